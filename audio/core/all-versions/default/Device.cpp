@@ -25,9 +25,12 @@
 
 //#define LOG_NDEBUG 0
 
+#include <inttypes.h>
 #include <memory.h>
+#include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <unordered_map>
 
 #include <android/log.h>
 
@@ -39,7 +42,7 @@ namespace implementation {
 
 using ::android::hardware::audio::common::CPP_VERSION::implementation::HidlUtils;
 
-Device::Device(audio_hw_device_t* device) : mDevice(device) {}
+Device::Device(audio_hw_device_t* device) : mDevice(device), mRoutingChangeCount(0) {}
 
 Device::~Device() {
     int status = audio_hw_device_close(mDevice);
@@ -305,6 +308,157 @@ Return<Result> Device::setAudioPortConfig(const AudioPortConfig& config) {
     return Result::NOT_SUPPORTED;
 }
 
+Result Device::validateRoutingChange(const RoutingChange& change) {
+    if ((!change.portConfigs.empty() || !change.patches.empty() ||
+         !change.releasedPatches.empty()) &&
+        version() < AUDIO_DEVICE_API_VERSION_3_0) {
+        return Result::NOT_SUPPORTED;
+    }
+    for (const auto& patch : change.patches) {
+        if (patch.sources.size() == 0 || patch.sources.size() > AUDIO_PATCH_PORTS_MAX ||
+            patch.sinks.size() == 0 || patch.sinks.size() > AUDIO_PATCH_PORTS_MAX) {
+            ALOGE("Invalid routing change: patch with %zu sources and %zu sinks",
+                  patch.sources.size(), patch.sinks.size());
+            return Result::INVALID_ARGUMENTS;
+        }
+        if (patch.handle != AUDIO_PATCH_HANDLE_NONE &&
+            std::find(change.releasedPatches.begin(), change.releasedPatches.end(),
+                      patch.handle) != change.releasedPatches.end()) {
+            ALOGE("Invalid routing change: patch %d is both updated and released", patch.handle);
+            return Result::INVALID_ARGUMENTS;
+        }
+    }
+    for (const auto& stream : change.streamParameters) {
+        if (stream.stream == nullptr) {
+            ALOGE("Invalid routing change: parameters for a null stream");
+            return Result::INVALID_ARGUMENTS;
+        }
+    }
+    return Result::OK;
+}
+
+Result Device::applyRoutingChange(const RoutingChange& change, hidl_vec<AudioPatchHandle>* patches,
+                                  RoutingChangeTimings* timings) {
+    std::lock_guard<std::mutex> lock(mRoutingLock);
+    RoutingChangeTimings phases;
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t phaseStart = start;
+    auto endPhase = [&phaseStart](nsecs_t* duration) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        *duration = now - phaseStart;
+        phaseStart = now;
+    };
+    auto finish = [&](Result retval) {
+        phases.totalNs = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        mLastRoutingChangeTimings = phases;
+        ++mRoutingChangeCount;
+        if (timings != nullptr) *timings = phases;
+        return retval;
+    };
+
+    Result retval = validateRoutingChange(change);
+    endPhase(&phases.validateNs);
+    if (retval != Result::OK) return finish(retval);
+
+    // Only the last config of a port matters, the previous ones would be
+    // overridden anyway.
+    std::unordered_map<AudioPortHandle, size_t> lastConfigOfPort;
+    for (size_t i = 0; i < change.portConfigs.size(); ++i) {
+        lastConfigOfPort[change.portConfigs[i].id] = i;
+    }
+    // Active configs of the ports before the change, to put them back if the
+    // port configs or the patches fail. A port which can not be queried, or
+    // which has no active config, is left as the change set it.
+    std::vector<audio_port_config> previousConfigs;
+    previousConfigs.reserve(lastConfigOfPort.size());
+    for (size_t i = 0; i < change.portConfigs.size(); ++i) {
+        if (lastConfigOfPort[change.portConfigs[i].id] != i) continue;
+        struct audio_port halPort = {};
+        halPort.id = static_cast<audio_port_handle_t>(change.portConfigs[i].id);
+        int status = mDevice->get_audio_port(mDevice, &halPort);
+        if (status != 0) {
+            ALOGW("Routing change can not be undone for port %d: %s", halPort.id,
+                  strerror(-status));
+            continue;
+        }
+        if (halPort.active_config.config_mask != 0) {
+            previousConfigs.push_back(halPort.active_config);
+        }
+    }
+    auto restorePortConfigs = [&]() {
+        for (auto config = previousConfigs.rbegin(); config != previousConfigs.rend(); ++config) {
+            analyzeStatus("set_audio_port_config",
+                          mDevice->set_audio_port_config(mDevice, &*config));
+        }
+    };
+
+    for (size_t i = 0; i < change.portConfigs.size(); ++i) {
+        if (lastConfigOfPort[change.portConfigs[i].id] != i) continue;
+        struct audio_port_config halPortConfig;
+        HidlUtils::audioPortConfigToHal(change.portConfigs[i], &halPortConfig);
+        retval = analyzeStatus("set_audio_port_config",
+                               mDevice->set_audio_port_config(mDevice, &halPortConfig));
+        if (retval != Result::OK) {
+            restorePortConfigs();
+            return finish(retval);
+        }
+    }
+    endPhase(&phases.portConfigsNs);
+
+    // Existing patches are updated in place, so that the HAL can reroute
+    // without going through an intermediate state with no patch.
+    std::vector<AudioPatchHandle> handles;
+    handles.reserve(change.patches.size());
+    for (const auto& patch : change.patches) {
+        std::unique_ptr<audio_port_config[]> halSources(
+            HidlUtils::audioPortConfigsToHal(patch.sources));
+        std::unique_ptr<audio_port_config[]> halSinks(HidlUtils::audioPortConfigsToHal(patch.sinks));
+        audio_patch_handle_t halPatch = static_cast<audio_patch_handle_t>(patch.handle);
+        retval = analyzeStatus(
+            "create_audio_patch",
+            mDevice->create_audio_patch(mDevice, patch.sources.size(), &halSources[0],
+                                        patch.sinks.size(), &halSinks[0], &halPatch));
+        if (retval != Result::OK) {
+            // Undo the patches created by this change, updated ones can not be
+            // reverted as the HAL does not report the previous sources and sinks.
+            for (size_t i = 0; i < handles.size(); ++i) {
+                if (change.patches[i].handle == AUDIO_PATCH_HANDLE_NONE) {
+                    mDevice->release_audio_patch(mDevice, handles[i]);
+                }
+            }
+            restorePortConfigs();
+            return finish(retval);
+        }
+        handles.push_back(static_cast<AudioPatchHandle>(halPatch));
+    }
+    endPhase(&phases.patchesNs);
+
+    for (AudioPatchHandle patch : change.releasedPatches) {
+        Result releaseRetval = analyzeStatus(
+            "release_audio_patch",
+            mDevice->release_audio_patch(mDevice, static_cast<audio_patch_handle_t>(patch)));
+        // The new routing is in place, a patch that can not be released is
+        // reported but does not undo it.
+        if (releaseRetval != Result::OK) retval = releaseRetval;
+    }
+    endPhase(&phases.releaseNs);
+
+    // Each of these is a single set_parameters call.
+    if (change.deviceParameters.size() != 0) {
+        Result paramsRetval = setParametersImpl({} /* context */, change.deviceParameters);
+        if (paramsRetval != Result::OK) retval = paramsRetval;
+    }
+    for (const auto& stream : change.streamParameters) {
+        if (stream.parameters.size() == 0) continue;
+        Result paramsRetval = stream.stream->setParametersImpl({} /* context */, stream.parameters);
+        if (paramsRetval != Result::OK) retval = paramsRetval;
+    }
+    endPhase(&phases.parametersNs);
+
+    if (patches != nullptr) *patches = handles;
+    return finish(retval);
+}
+
 #if MAJOR_VERSION == 2
 Return<AudioHwSync> Device::getHwAvSync() {
     int halHwAvSync;
@@ -354,6 +508,16 @@ Return<void> Device::debugDump(const hidl_handle& fd) {
 Return<void> Device::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /* options */) {
     if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
         analyzeStatus("dump", mDevice->dump(mDevice, fd->data[0]));
+        std::lock_guard<std::mutex> lock(mRoutingLock);
+        const RoutingChangeTimings& timings = mLastRoutingChangeTimings;
+        dprintf(fd->data[0],
+                "Routing changes: %zu\n"
+                "Last routing change (us): validate %" PRId64 ", port configs %" PRId64
+                ", patches %" PRId64 ", release %" PRId64 ", parameters %" PRId64
+                ", total %" PRId64 "\n",
+                mRoutingChangeCount, ns2us(timings.validateNs), ns2us(timings.portConfigsNs),
+                ns2us(timings.patchesNs), ns2us(timings.releaseNs), ns2us(timings.parametersNs),
+                ns2us(timings.totalNs));
     }
     return Void();
 }
@@ -18,6 +18,12 @@
 #include "core/default/Conversions.h"
 #include "core/default/Util.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
 #include <system/audio.h>
 
 namespace android {
@@ -45,61 +51,181 @@ static Result getHalStatusToResult(status_t status) {
     }
 }
 
+bool ParameterTokenizer::next(std::string_view* key, std::string_view* value) {
+    while (!mRemaining.empty()) {
+        size_t end = mRemaining.find(';');
+        std::string_view pair = mRemaining.substr(0, end);
+        mRemaining.remove_prefix(end == std::string_view::npos ? mRemaining.size() : end + 1);
+        if (pair.empty()) continue;
+        size_t separator = pair.find('=');
+        *key = pair.substr(0, separator);
+        *value = separator == std::string_view::npos ? std::string_view()
+                                                     : pair.substr(separator + 1);
+        return true;
+    }
+    return false;
+}
+
+ParameterBatch& ParameterBatch::add(const char* name, const char* value) {
+    if (!mKeysAndValues.empty()) mKeysAndValues += ';';
+    mKeysAndValues += name;
+    mKeysAndValues += '=';
+    mKeysAndValues += value;
+    return *this;
+}
+
+ParameterBatch& ParameterBatch::add(const char* name, bool value) {
+    return add(name, value ? AudioParameter::valueOn : AudioParameter::valueOff);
+}
+
+ParameterBatch& ParameterBatch::add(const char* name, int value) {
+    char str[16];
+    snprintf(str, sizeof(str), "%d", value);
+    return add(name, str);
+}
+
+ParameterBatch& ParameterBatch::add(const char* name, float value) {
+    // Same format as AudioParameter::addFloat.
+    char str[48];
+    snprintf(str, sizeof(str), "%.10f", value);
+    return add(name, str);
+}
+
+// static
+Result ParametersUtil::parseParam(std::string_view value, bool* result) {
+    *result = false;
+    if (value.empty()) return Result::NOT_SUPPORTED;
+    *result = value != AudioParameter::valueOff;
+    return Result::OK;
+}
+
+// static
+Result ParametersUtil::parseParam(std::string_view value, int* result) {
+    // Same rules as AudioParameter::getInt (sscanf "%d"), without making a String8:
+    // the value is 0 unless the string starts with a decimal integer, blanks before
+    // it and text after it are ignored.
+    *result = 0;
+    size_t start = value.find_first_not_of(" \t\n\v\f\r");
+    if (start == std::string_view::npos) return Result::INVALID_ARGUMENTS;
+    value.remove_prefix(start);
+    // Any integer fits in the first characters, what follows it is ignored anyway.
+    char str[32];
+    size_t size = std::min(value.size(), sizeof(str) - 1);
+    memcpy(str, value.data(), size);
+    str[size] = '\0';
+    char* end;
+    long parsed = strtol(str, &end, 10);
+    if (end == str) return Result::INVALID_ARGUMENTS;
+    *result = static_cast<int>(parsed);
+    return Result::OK;
+}
+
+// static
+bool ParametersUtil::isCacheable(const char* name) {
+    return strcmp(name, AudioParameter::keyStreamSupportedFormats) == 0 ||
+           strcmp(name, AudioParameter::keyStreamSupportedChannels) == 0 ||
+           strcmp(name, AudioParameter::keyStreamSupportedSamplingRates) == 0;
+}
+
+void ParametersUtil::invalidateCache() {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    mCache.clear();
+}
+
+Result ParametersUtil::getParams(const char* const* keys, size_t keyCount,
+                                 const GetParamsCallback& cb) {
+    std::string halKeys;
+    for (size_t i = 0; i < keyCount; ++i) {
+        if (i != 0) halKeys += ';';
+        halKeys += keys[i];
+    }
+    char* halValues = halGetParameters(halKeys.c_str());
+    if (halValues == NULL) return keyCount == 0 ? Result::OK : Result::NOT_SUPPORTED;
+    ParameterTokenizer tokenizer(halValues);
+    std::string_view key, value;
+    size_t pairCount = 0;
+    while (tokenizer.next(&key, &value)) {
+        cb(key, value);
+        ++pairCount;
+    }
+    free(halValues);
+    return keyCount == 0 || pairCount != 0 ? Result::OK : Result::NOT_SUPPORTED;
+}
+
 Result ParametersUtil::getParam(const char* name, bool* value) {
-    String8 halValue;
-    Result retval = getParam(name, &halValue);
+    Result retval = Result::NOT_SUPPORTED;
     *value = false;
-    if (retval == Result::OK) {
-        if (halValue.empty()) {
-            return Result::NOT_SUPPORTED;
-        }
-        *value = !(halValue == AudioParameter::valueOff);
-    }
+    getParams(&name, 1, [&](std::string_view key, std::string_view halValue) {
+        if (key == name) retval = parseParam(halValue, value);
+    });
     return retval;
 }
 
 Result ParametersUtil::getParam(const char* name, int* value) {
-    const String8 halName(name);
-    AudioParameter keys;
-    keys.addKey(halName);
-    std::unique_ptr<AudioParameter> params = getParams(keys);
-    return getHalStatusToResult(params->getInt(halName, *value));
+    Result retval = Result::NOT_SUPPORTED;
+    *value = 0;
+    getParams(&name, 1, [&](std::string_view key, std::string_view halValue) {
+        if (key == name) retval = parseParam(halValue, value);
+    });
+    return retval;
 }
 
 Result ParametersUtil::getParam(const char* name, String8* value, AudioParameter context) {
+    std::string cacheKey;
+    if (isCacheable(name)) {
+        cacheKey = context.toString().string();
+        cacheKey += '|';
+        cacheKey += name;
+        std::lock_guard<std::mutex> lock(mCacheLock);
+        auto it = mCache.find(cacheKey);
+        if (it != mCache.end()) {
+            value->setTo(it->second.c_str());
+            return Result::OK;
+        }
+    }
     const String8 halName(name);
     context.addKey(halName);
     std::unique_ptr<AudioParameter> params = getParams(context);
-    return getHalStatusToResult(params->get(halName, *value));
+    Result retval = getHalStatusToResult(params->get(halName, *value));
+    // An empty list may mean that the HAL is not ready to answer yet.
+    if (retval == Result::OK && !cacheKey.empty() && !value->isEmpty()) {
+        std::lock_guard<std::mutex> lock(mCacheLock);
+        mCache.emplace(std::move(cacheKey), value->string());
+    }
+    return retval;
 }
 
 void ParametersUtil::getParametersImpl(
     const hidl_vec<ParameterValue>& context, const hidl_vec<hidl_string>& keys,
     std::function<void(Result retval, const hidl_vec<ParameterValue>& parameters)> cb) {
-    AudioParameter halKeys;
+    // As with AudioParameter::keysToString, only the keys of the context are passed.
+    std::string halKeys;
     for (auto& pair : context) {
-        halKeys.add(String8(pair.key.c_str()), String8(pair.value.c_str()));
+        if (!halKeys.empty()) halKeys += ';';
+        halKeys += pair.key.c_str();
     }
     for (size_t i = 0; i < keys.size(); ++i) {
-        halKeys.addKey(String8(keys[i].c_str()));
+        if (!halKeys.empty()) halKeys += ';';
+        halKeys += keys[i].c_str();
     }
-    std::unique_ptr<AudioParameter> halValues = getParams(halKeys);
-    Result retval =
-        (keys.size() == 0 || halValues->size() != 0) ? Result::OK : Result::NOT_SUPPORTED;
+    char* halValues = halGetParameters(halKeys.c_str());
     hidl_vec<ParameterValue> result;
-    result.resize(halValues->size());
-    String8 halKey, halValue;
-    for (size_t i = 0; i < halValues->size(); ++i) {
-        status_t status = halValues->getAt(i, halKey, halValue);
-        if (status != OK) {
-            result.resize(0);
-            retval = getHalStatusToResult(status);
-            break;
+    if (halValues != NULL) {
+        std::string_view key, value;
+        size_t pairCount = 0;
+        for (ParameterTokenizer tokenizer(halValues); tokenizer.next(&key, &value);) {
+            ++pairCount;
+        }
+        result.resize(pairCount);
+        size_t i = 0;
+        for (ParameterTokenizer tokenizer(halValues); tokenizer.next(&key, &value); ++i) {
+            result[i].key = hidl_string(key.data(), key.size());
+            result[i].value = hidl_string(value.data(), value.size());
         }
-        result[i].key = halKey.string();
-        result[i].value = halValue.string();
     }
+    Result retval = (keys.size() == 0 || result.size() != 0) ? Result::OK : Result::NOT_SUPPORTED;
     cb(retval, result);
+    free(halValues);
 }
 
 std::unique_ptr<AudioParameter> ParametersUtil::getParams(const AudioParameter& keys) {
@@ -114,41 +240,40 @@ std::unique_ptr<AudioParameter> ParametersUtil::getParams(const AudioParameter&
     return std::unique_ptr<AudioParameter>(new AudioParameter(paramsAndValues));
 }
 
+Result ParametersUtil::setParams(const ParameterBatch& batch) {
+    if (batch.empty()) return Result::OK;
+    invalidateCache();
+    return util::analyzeStatus(halSetParameters(batch.c_str()));
+}
+
 Result ParametersUtil::setParam(const char* name, const char* value) {
-    AudioParameter param;
-    param.add(String8(name), String8(value));
-    return setParams(param);
+    return setParams(ParameterBatch().add(name, value));
 }
 
 Result ParametersUtil::setParam(const char* name, bool value) {
-    AudioParameter param;
-    param.add(String8(name), String8(value ? AudioParameter::valueOn : AudioParameter::valueOff));
-    return setParams(param);
+    return setParams(ParameterBatch().add(name, value));
 }
 
 Result ParametersUtil::setParam(const char* name, int value) {
-    AudioParameter param;
-    param.addInt(String8(name), value);
-    return setParams(param);
+    return setParams(ParameterBatch().add(name, value));
 }
 
 Result ParametersUtil::setParam(const char* name, float value) {
-    AudioParameter param;
-    param.addFloat(String8(name), value);
-    return setParams(param);
+    return setParams(ParameterBatch().add(name, value));
 }
 
 Result ParametersUtil::setParametersImpl(const hidl_vec<ParameterValue>& context,
                                          const hidl_vec<ParameterValue>& parameters) {
-    AudioParameter params;
+    ParameterBatch batch;
     for (auto& pair : context) {
-        params.add(String8(pair.key.c_str()), String8(pair.value.c_str()));
+        batch.add(pair.key.c_str(), pair.value.c_str());
     }
     for (size_t i = 0; i < parameters.size(); ++i) {
-        params.add(String8(parameters[i].key.c_str()), String8(parameters[i].value.c_str()));
+        batch.add(parameters[i].key.c_str(), parameters[i].value.c_str());
     }
-    return setParams(params);
+    return setParams(batch);
 }
+
 Result ParametersUtil::setParam(const char* name, const DeviceAddress& address) {
     AudioParameter params(String8(deviceAddressToHal(address).c_str()));
     params.addInt(String8(name), int(address.device));
@@ -156,6 +281,7 @@ Result ParametersUtil::setParam(const char* name, const DeviceAddress& address)
 }
 
 Result ParametersUtil::setParams(const AudioParameter& param) {
+    invalidateCache();
     int halStatus = halSetParameters(param.toString().string());
     return util::analyzeStatus(halStatus);
 }
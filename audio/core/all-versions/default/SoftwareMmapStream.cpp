@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SoftwareMmapStreamHAL"
+
+#include "core/default/SoftwareMmapStream.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <android/log.h>
+#include <cutils/ashmem.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+// The loopback "device" shared by all software MMAP streams of the process.
+// It is a byte FIFO: output bursts are appended, input bursts are taken from
+// it, and are filled with silence when it runs dry.
+class MmapLoopback {
+   public:
+    static MmapLoopback& getInstance() {
+        static MmapLoopback loopback;
+        return loopback;
+    }
+
+    void write(const uint8_t* data, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (bytes > kCapacity) {
+            data += bytes - kCapacity;
+            mWritePos += bytes - kCapacity;
+            bytes = kCapacity;
+        }
+        const size_t offset = mWritePos % kCapacity;
+        const size_t first = std::min(bytes, kCapacity - offset);
+        memcpy(&mFifo[offset], data, first);
+        memcpy(&mFifo[0], data + first, bytes - first);
+        mWritePos += bytes;
+        // On overflow the oldest data is dropped.
+        if (mWritePos - mReadPos > kCapacity) mReadPos = mWritePos - kCapacity;
+    }
+
+    void read(uint8_t* data, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mLock);
+        const size_t available = std::min<uint64_t>(bytes, mWritePos - mReadPos);
+        const size_t offset = mReadPos % kCapacity;
+        const size_t first = std::min(available, kCapacity - offset);
+        memcpy(data, &mFifo[offset], first);
+        memcpy(data + first, &mFifo[0], available - first);
+        memset(data + available, 0, bytes - available);
+        mReadPos += available;
+    }
+
+    // Called when capture starts, so that stale data doesn't add latency.
+    void flush() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mReadPos = mWritePos;
+    }
+
+   private:
+    static constexpr size_t kCapacity = 256 * 1024;
+
+    MmapLoopback() : mFifo(kCapacity), mWritePos(0), mReadPos(0) {}
+
+    std::mutex mLock;
+    std::vector<uint8_t> mFifo;
+    uint64_t mWritePos;
+    uint64_t mReadPos;
+};
+
+}  // namespace
+
+// Moves one burst between the ring buffer and the loopback at every burst
+// boundary of the position clock.
+class SoftwareMmapStream::DeviceThread : public Thread {
+   public:
+    // Input bursts are captured this much ahead of the clock, so that the
+    // frames are in the ring by the time the position reports them.
+    static constexpr nsecs_t kCaptureLeadNs = 100000;
+
+    DeviceThread(const SoftwareMmapStream* stream, nsecs_t startTime, int64_t startPosition)
+        : Thread(false /*canCallJava*/),
+          mStream(stream),
+          mStartTime(startTime),
+          mStartPosition(startPosition),
+          mBursts(0),
+          mScratch(stream->mBurstFrames * stream->mFrameSize) {}
+
+   private:
+    const SoftwareMmapStream* mStream;
+    const nsecs_t mStartTime;
+    const int64_t mStartPosition;
+    int64_t mBursts;
+    std::vector<uint8_t> mScratch;
+
+    bool threadLoop() override;
+    void transfer(int64_t position);
+};
+
+bool SoftwareMmapStream::DeviceThread::threadLoop() {
+    nsecs_t deadline = mStartTime + mStream->burstTime(mBursts + 1);
+    if (!mStream->mIsOutput) deadline -= kCaptureLeadNs;
+    struct timespec ts = {static_cast<time_t>(deadline / 1000000000),
+                          static_cast<long>(deadline % 1000000000)};
+    int error;
+    while ((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)) == EINTR) {
+    }
+    if (error != 0) {
+        ALOGE("clock_nanosleep failed: %s", strerror(error));
+        return false;
+    }
+    transfer(mStartPosition + mBursts * mStream->mBurstFrames);
+    ++mBursts;
+    return true;
+}
+
+void SoftwareMmapStream::DeviceThread::transfer(int64_t position) {
+    const size_t frameSize = mStream->mFrameSize;
+    const uint32_t bufferFrames = mStream->mBufferFrames;
+    const uint32_t offset = position % bufferFrames;
+    const uint32_t firstFrames = std::min(mStream->mBurstFrames, bufferFrames - offset);
+    const size_t firstBytes = firstFrames * frameSize;
+    const size_t secondBytes = (mStream->mBurstFrames - firstFrames) * frameSize;
+    uint8_t* first = mStream->mBuffer + offset * frameSize;
+    if (mStream->mIsOutput) {
+        memcpy(mScratch.data(), first, firstBytes);
+        memcpy(mScratch.data() + firstBytes, mStream->mBuffer, secondBytes);
+        MmapLoopback::getInstance().write(mScratch.data(), mScratch.size());
+    } else {
+        MmapLoopback::getInstance().read(mScratch.data(), mScratch.size());
+        memcpy(first, mScratch.data(), firstBytes);
+        memcpy(mStream->mBuffer, mScratch.data() + firstBytes, secondBytes);
+    }
+}
+
+bool SoftwareMmapStream::isEnabled() {
+    // Read once: a stream must not change of backend while the service runs.
+    static const bool enabled = property_get_bool("vendor.audio.mmap.software_loopback", false);
+    return enabled;
+}
+
+SoftwareMmapStream::SoftwareMmapStream(bool isOutput, uint32_t sampleRate, size_t frameSize)
+    : mIsOutput(isOutput),
+      mSampleRate(sampleRate),
+      mFrameSize(frameSize),
+      mBurstFrames(std::max<uint32_t>(1, sampleRate * kBurstDurationMs / 1000)),
+      mFd(-1),
+      mBuffer(nullptr),
+      mBufferFrames(0),
+      mStarted(false),
+      mStartTime(0),
+      mStartPosition(0) {}
+
+SoftwareMmapStream::~SoftwareMmapStream() {
+    stop();
+    if (mBuffer != nullptr) {
+        munmap(mBuffer, mBufferFrames * mFrameSize);
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+nsecs_t SoftwareMmapStream::burstTime(int64_t bursts) const {
+    // Computed from the start every time so that rounding does not accumulate,
+    // and split in seconds so that it does not overflow.
+    const int64_t frames = bursts * mBurstFrames;
+    return frames / mSampleRate * 1000000000LL + frames % mSampleRate * 1000000000LL / mSampleRate;
+}
+
+int SoftwareMmapStream::createMmapBuffer(int32_t minSizeFrames, audio_mmap_buffer_info* info) {
+    if (minSizeFrames <= 0 || mFrameSize == 0 || mSampleRate == 0) return -EINVAL;
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mBuffer != nullptr) {
+        ALOGE("the buffer of a software MMAP stream can only be created once");
+        return -ENODATA;
+    }
+    // At least two bursts, so that the client and the device never share one.
+    uint32_t bufferFrames = std::max<uint32_t>(minSizeFrames, 2 * mBurstFrames);
+    bufferFrames = (bufferFrames + mBurstFrames - 1) / mBurstFrames * mBurstFrames;
+    const size_t bufferSize = bufferFrames * mFrameSize;
+    int fd = ashmem_create_region("SoftwareMmapStream", bufferSize);
+    if (fd < 0) {
+        ALOGE("could not create the shared memory: %s", strerror(errno));
+        return -ENOMEM;
+    }
+    void* buffer = mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        ALOGE("could not map the shared memory: %s", strerror(errno));
+        close(fd);
+        return -ENOMEM;
+    }
+    memset(buffer, 0, bufferSize);
+    mFd = fd;
+    mBuffer = static_cast<uint8_t*>(buffer);
+    mBufferFrames = bufferFrames;
+
+    info->shared_memory_address = mBuffer;
+    info->shared_memory_fd = mFd;
+    info->buffer_size_frames = mBufferFrames;
+    info->burst_size_frames = mBurstFrames;
+    info->flags = AUDIO_MMAP_APPLICATION_SHAREABLE;
+    ALOGI("created software MMAP %s buffer: %u frames, burst %u frames",
+          mIsOutput ? "output" : "input", mBufferFrames, mBurstFrames);
+    return 0;
+}
+
+void SoftwareMmapStream::getPositionLocked(nsecs_t now, audio_mmap_position* position) const {
+    int64_t bursts = 0;
+    if (mStarted && now > mStartTime) {
+        const nsecs_t elapsed = now - mStartTime;
+        const int64_t frames = elapsed / 1000000000LL * mSampleRate +
+                               elapsed % 1000000000LL * mSampleRate / 1000000000LL;
+        bursts = frames / mBurstFrames;
+    }
+    position->position_frames = mStartPosition + bursts * mBurstFrames;
+    position->time_nanoseconds = mStartTime + burstTime(bursts);
+}
+
+int SoftwareMmapStream::getMmapPosition(audio_mmap_position* position) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mBuffer == nullptr) return -ENODATA;
+    getPositionLocked(systemTime(SYSTEM_TIME_MONOTONIC), position);
+    return 0;
+}
+
+int SoftwareMmapStream::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mBuffer == nullptr) return -ENODATA;
+    if (mStarted) return 0;
+    if (!mIsOutput) MmapLoopback::getInstance().flush();
+    mStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStarted = true;
+    mDeviceThread = new DeviceThread(this, mStartTime, mStartPosition);
+    status_t status = mDeviceThread->run(mIsOutput ? "sw_mmap_out" : "sw_mmap_in",
+                                         PRIORITY_URGENT_AUDIO);
+    if (status != OK) {
+        ALOGE("could not start the software MMAP device thread: %s", strerror(-status));
+        mDeviceThread.clear();
+        mStarted = false;
+        return status;
+    }
+    return 0;
+}
+
+int SoftwareMmapStream::stop() {
+    sp<DeviceThread> deviceThread;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mStarted) return 0;
+        // Freeze the clock where it is now, the next start resumes from there.
+        audio_mmap_position position;
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        getPositionLocked(now, &position);
+        mStartPosition = position.position_frames;
+        mStartTime = now;
+        mStarted = false;
+        deviceThread = std::move(mDeviceThread);
+    }
+    deviceThread->requestExitAndWait();
+    return 0;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
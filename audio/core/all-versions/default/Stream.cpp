@@ -314,6 +314,7 @@ Return<Result> Stream::close() {
 Return<void> Stream::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /* options */) {
     if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
         analyzeStatus("dump", mStream->dump(mStream, fd->data[0]));
+        mIoStats.dump(fd->data[0]);
     }
     return Void();
 }
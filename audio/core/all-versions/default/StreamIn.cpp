@@ -42,7 +42,8 @@ class ReadThread : public Thread {
    public:
     // ReadThread's lifespan never exceeds StreamIn's lifespan.
     ReadThread(std::atomic<bool>* stop, audio_stream_in_t* stream, StreamIn::CommandMQ* commandMQ,
-               StreamIn::DataMQ* dataMQ, StreamIn::StatusMQ* statusMQ, EventFlag* efGroup)
+               StreamIn::DataMQ* dataMQ, StreamIn::StatusMQ* statusMQ, EventFlag* efGroup,
+               StreamIoStats* stats, double nsPerByte)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mStream(stream),
@@ -50,11 +51,7 @@ class ReadThread : public Thread {
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
           mEfGroup(efGroup),
-          mBuffer(nullptr) {}
-    bool init() {
-        mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
-        return mBuffer != nullptr;
-    }
+          mTimer(stats, nsPerByte) {}
     virtual ~ReadThread() {}
 
    private:
@@ -64,7 +61,7 @@ class ReadThread : public Thread {
     StreamIn::DataMQ* mDataMQ;
     StreamIn::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
-    std::unique_ptr<uint8_t[]> mBuffer;
+    StreamIoTimer mTimer;
     IStreamIn::ReadParameters mParameters;
     IStreamIn::ReadStatus mStatus;
 
@@ -84,13 +81,12 @@ void ReadThread::doRead() {
             (int32_t)requestedToRead, (int32_t)availableToWrite);
         requestedToRead = availableToWrite;
     }
-    ssize_t readResult = mStream->read(mStream, &mBuffer[0], requestedToRead);
+    mTimer.onIoStart();
+    ssize_t readResult = StreamIn::readToDataMQImpl(mStream, mDataMQ, requestedToRead);
+    mTimer.onIoEnd(readResult);
     mStatus.retval = Result::OK;
     if (readResult >= 0) {
         mStatus.reply.read = readResult;
-        if (!mDataMQ->write(&mBuffer[0], readResult)) {
-            ALOGW("data message queue write failed");
-        }
     } else {
         mStatus.retval = Stream::analyzeStatus("read", readResult);
     }
@@ -107,7 +103,9 @@ bool ReadThread::threadLoop() {
     // as the Thread uses mutexes, and this can lead to priority inversion.
     while (!std::atomic_load_explicit(mStop, std::memory_order_acquire)) {
         uint32_t efState = 0;
+        mTimer.onWaitStart();
         mEfGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL), &efState);
+        mTimer.onWake();
         if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL))) {
             continue;  // Nothing to do.
         }
@@ -127,10 +125,12 @@ bool ReadThread::threadLoop() {
                 mStatus.retval = Result::NOT_SUPPORTED;
                 break;
         }
-        if (!mStatusMQ->write(&mStatus)) {
+        bool statusWritten = mStatusMQ->write(&mStatus);
+        if (!statusWritten) {
             ALOGW("status message queue write failed");
         }
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY));
+        mTimer.onReplied(statusWritten);
     }
 
     return false;
@@ -387,14 +387,11 @@ Return<void> StreamIn::prepareForReading(uint32_t frameSize, uint32_t framesCoun
     }
 
     // Create and launch the thread.
-    auto tempReadThread =
-        std::make_unique<ReadThread>(&mStopReadThread, mStream, tempCommandMQ.get(),
-                                     tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
-    if (!tempReadThread->init()) {
-        ALOGW("failed to start reader thread: %s", strerror(-status));
-        sendError(Result::INVALID_ARGUMENTS);
-        return Void();
-    }
+    uint32_t sampleRate = mStream->common.get_sample_rate(&mStream->common);
+    double nsPerByte = sampleRate != 0 ? 1e9 / (static_cast<double>(sampleRate) * frameSize) : 0;
+    auto tempReadThread = std::make_unique<ReadThread>(
+        &mStopReadThread, mStream, tempCommandMQ.get(), tempDataMQ.get(), tempStatusMQ.get(),
+        tempElfGroup.get(), mStreamCommon->getIoStats(), nsPerByte);
     status = tempReadThread->run("reader", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start reader thread: %s", strerror(-status));
@@ -419,6 +416,30 @@ Return<uint32_t> StreamIn::getInputFramesLost() {
 }
 
 // static
+ssize_t StreamIn::readToDataMQImpl(audio_stream_in_t* stream, DataMQ* dataMQ, size_t bytes) {
+    DataMQ::MemTransaction tx;
+    if (!dataMQ->beginWrite(bytes, &tx)) {
+        ALOGW("data message queue write failed");
+        return 0;
+    }
+    const DataMQ::MemRegion& first = tx.getFirstRegion();
+    const DataMQ::MemRegion& second = tx.getSecondRegion();
+    ssize_t readResult = stream->read(stream, first.getAddress(), first.getLength());
+    if (readResult == static_cast<ssize_t>(first.getLength()) && second.getLength() > 0) {
+        // The free space wraps around the end of the queue.
+        ssize_t secondResult = stream->read(stream, second.getAddress(), second.getLength());
+        if (secondResult >= 0) {
+            readResult += secondResult;
+        } else {
+            ALOGW("read into wrapped space failed: %s", strerror(-secondResult));
+        }
+    }
+    if (readResult > 0 && !dataMQ->commitWrite(readResult)) {
+        ALOGW("data message queue write commit failed");
+    }
+    return readResult;
+}
+
 Result StreamIn::getCapturePositionImpl(audio_stream_in_t* stream, uint64_t* frames,
                                         uint64_t* time) {
     // HAL may have a stub function, always returning ENOSYS, don't
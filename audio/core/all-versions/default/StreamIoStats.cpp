@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/default/StreamIoStats.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+IoHistogram::IoHistogram() : mCount(0), mSum(0), mMax(0) {
+    for (auto& bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void IoHistogram::record(uint64_t value) {
+    size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= kBucketCount) bucket = kBucketCount - 1;
+    increment(&mBuckets[bucket], 1);
+    increment(&mCount, 1);
+    increment(&mSum, value);
+    if (value > mMax.load(std::memory_order_relaxed)) {
+        mMax.store(value, std::memory_order_relaxed);
+    }
+}
+
+void IoHistogram::dump(int fd, const char* name, const char* unit) const {
+    uint64_t buckets[kBucketCount];
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += buckets[i];
+    }
+    if (total == 0) {
+        dprintf(fd, "  %s: no samples\n", name);
+        return;
+    }
+    // Percentiles are reported as the upper bound of the bucket they fall in.
+    auto percentile = [&](uint64_t pct) -> uint64_t {
+        uint64_t target = (total * pct + 99) / 100, seen = 0;
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            seen += buckets[i];
+            if (seen >= target) return i == 0 ? 0 : (1ULL << i) - 1;
+        }
+        return UINT64_MAX;
+    };
+    dprintf(fd,
+            "  %s: count %" PRIu64 ", mean %" PRIu64 " %s, p50 <= %" PRIu64 ", p99 <= %" PRIu64
+            ", max %" PRIu64 "\n",
+            name, total, mSum.load(std::memory_order_relaxed) / total, unit, percentile(50),
+            percentile(99), mMax.load(std::memory_order_relaxed));
+    dprintf(fd, "   ");
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        if (buckets[i] == 0) continue;
+        dprintf(fd, " [%" PRIu64 ",%" PRIu64 "):%" PRIu64, i == 0 ? 0 : 1ULL << (i - 1),
+                1ULL << i, buckets[i]);
+    }
+    dprintf(fd, "\n");
+}
+
+StreamIoStats::StreamIoStats() : missedDeadlines(0), statusWriteFailures(0) {}
+
+void StreamIoStats::dump(int fd) const {
+    if (bytesPerCall.count() == 0 && waitUs.count() == 0) return;
+    dprintf(fd, "Stream I/O thread:\n");
+    waitUs.dump(fd, "Event flag wait", "us");
+    wakeToIoUs.dump(fd, "Wake to HAL call", "us");
+    halIoUs.dump(fd, "HAL call duration", "us");
+    bytesPerCall.dump(fd, "Bytes per call", "bytes");
+    dprintf(fd, "  Missed deadlines: %" PRIu64 "\n",
+            missedDeadlines.load(std::memory_order_relaxed));
+    dprintf(fd, "  Status write failures: %" PRIu64 "\n",
+            statusWriteFailures.load(std::memory_order_relaxed));
+}
+
+void StreamIoTimer::onWake() {
+    mWake = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStats->waitUs.record(ns2us(mWake - mWaitStart));
+    mIoStart = 0;
+}
+
+void StreamIoTimer::onIoEnd(ssize_t bytes) {
+    nsecs_t ioEnd = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStats->wakeToIoUs.record(ns2us(mIoStart - mWake));
+    mStats->halIoUs.record(ns2us(ioEnd - mIoStart));
+    mBytes = bytes > 0 ? bytes : 0;
+    mStats->bytesPerCall.record(mBytes);
+}
+
+void StreamIoTimer::onReplied(bool statusWritten) {
+    if (!statusWritten) {
+        mStats->statusWriteFailures.store(
+            mStats->statusWriteFailures.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+    // Only data transfers have a deadline.
+    if (mIoStart == 0 || mBytes == 0 || mNsPerByte <= 0) return;
+    nsecs_t replied = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (replied - mWake > static_cast<nsecs_t>(mBytes * mNsPerByte)) {
+        mStats->missedDeadlines.store(
+            mStats->missedDeadlines.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+    mBytes = 0;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
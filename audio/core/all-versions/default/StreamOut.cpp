@@ -41,7 +41,8 @@ class WriteThread : public Thread {
     // WriteThread's lifespan never exceeds StreamOut's lifespan.
     WriteThread(std::atomic<bool>* stop, audio_stream_out_t* stream,
                 StreamOut::CommandMQ* commandMQ, StreamOut::DataMQ* dataMQ,
-                StreamOut::StatusMQ* statusMQ, EventFlag* efGroup)
+                StreamOut::StatusMQ* statusMQ, EventFlag* efGroup, StreamIoStats* stats,
+                double nsPerByte)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mStream(stream),
@@ -49,11 +50,7 @@ class WriteThread : public Thread {
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
           mEfGroup(efGroup),
-          mBuffer(nullptr) {}
-    bool init() {
-        mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
-        return mBuffer != nullptr;
-    }
+          mTimer(stats, nsPerByte) {}
     virtual ~WriteThread() {}
 
    private:
@@ -63,7 +60,7 @@ class WriteThread : public Thread {
     StreamOut::DataMQ* mDataMQ;
     StreamOut::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
-    std::unique_ptr<uint8_t[]> mBuffer;
+    StreamIoTimer mTimer;
     IStreamOut::WriteStatus mStatus;
 
     bool threadLoop() override;
@@ -74,16 +71,15 @@ class WriteThread : public Thread {
 };
 
 void WriteThread::doWrite() {
-    const size_t availToRead = mDataMQ->availableToRead();
     mStatus.retval = Result::OK;
     mStatus.reply.written = 0;
-    if (mDataMQ->read(&mBuffer[0], availToRead)) {
-        ssize_t writeResult = mStream->write(mStream, &mBuffer[0], availToRead);
-        if (writeResult >= 0) {
-            mStatus.reply.written = writeResult;
-        } else {
-            mStatus.retval = Stream::analyzeStatus("write", writeResult);
-        }
+    mTimer.onIoStart();
+    ssize_t writeResult = StreamOut::writeFromDataMQImpl(mStream, mDataMQ);
+    mTimer.onIoEnd(writeResult);
+    if (writeResult >= 0) {
+        mStatus.reply.written = writeResult;
+    } else {
+        mStatus.retval = Stream::analyzeStatus("write", writeResult);
     }
 }
 
@@ -104,7 +100,9 @@ bool WriteThread::threadLoop() {
     // as the Thread uses mutexes, and this can lead to priority inversion.
     while (!std::atomic_load_explicit(mStop, std::memory_order_acquire)) {
         uint32_t efState = 0;
+        mTimer.onWaitStart();
         mEfGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY), &efState);
+        mTimer.onWake();
         if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY))) {
             continue;  // Nothing to do.
         }
@@ -126,10 +124,12 @@ bool WriteThread::threadLoop() {
                 mStatus.retval = Result::NOT_SUPPORTED;
                 break;
         }
-        if (!mStatusMQ->write(&mStatus)) {
+        bool statusWritten = mStatusMQ->write(&mStatus);
+        if (!statusWritten) {
             ALOGE("status message queue write failed");
         }
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL));
+        mTimer.onReplied(statusWritten);
     }
 
     return false;
@@ -370,14 +370,11 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize, uint32_t framesCou
     }
 
     // Create and launch the thread.
-    auto tempWriteThread =
-        std::make_unique<WriteThread>(&mStopWriteThread, mStream, tempCommandMQ.get(),
-                                      tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
-    if (!tempWriteThread->init()) {
-        ALOGW("failed to start writer thread: %s", strerror(-status));
-        sendError(Result::INVALID_ARGUMENTS);
-        return Void();
-    }
+    uint32_t sampleRate = mStream->common.get_sample_rate(&mStream->common);
+    double nsPerByte = sampleRate != 0 ? 1e9 / (static_cast<double>(sampleRate) * frameSize) : 0;
+    auto tempWriteThread = std::make_unique<WriteThread>(
+        &mStopWriteThread, mStream, tempCommandMQ.get(), tempDataMQ.get(), tempStatusMQ.get(),
+        tempElfGroup.get(), mStreamCommon->getIoStats(), nsPerByte);
     status = tempWriteThread->run("writer", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start writer thread: %s", strerror(-status));
@@ -516,6 +513,31 @@ Result StreamOut::getPresentationPositionImpl(audio_stream_out_t* stream, uint64
     return retval;
 }
 
+ssize_t StreamOut::writeFromDataMQImpl(audio_stream_out_t* stream, DataMQ* dataMQ) {
+    const size_t availToRead = dataMQ->availableToRead();
+    DataMQ::MemTransaction tx;
+    if (!dataMQ->beginRead(availToRead, &tx)) {
+        return 0;
+    }
+    const DataMQ::MemRegion& first = tx.getFirstRegion();
+    const DataMQ::MemRegion& second = tx.getSecondRegion();
+    ssize_t writeResult = stream->write(stream, first.getAddress(), first.getLength());
+    if (writeResult == static_cast<ssize_t>(first.getLength()) && second.getLength() > 0) {
+        // The available data wraps around the end of the queue.
+        ssize_t secondResult = stream->write(stream, second.getAddress(), second.getLength());
+        if (secondResult >= 0) {
+            writeResult += secondResult;
+        } else {
+            ALOGW("write of wrapped data failed: %s", strerror(-secondResult));
+        }
+    }
+    // Consume everything, as the client never resends data the HAL didn't take.
+    if (!dataMQ->commitRead(availToRead)) {
+        ALOGW("data message queue read commit failed");
+    }
+    return writeResult;
+}
+
 Return<void> StreamOut::getPresentationPosition(getPresentationPosition_cb _hidl_cb) {
     uint64_t frames = 0;
     TimeSpec timeStamp = {0, 0};
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Round trip latency of an exclusive mode style client through a pair of
+// software MMAP streams connected by the loopback device: an impulse is
+// written just ahead of the output position and searched for in the frames
+// captured by the input stream.
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "core/default/SoftwareMmapStream.h"
+
+using namespace ::android::hardware::audio::CPP_VERSION::implementation;
+using ::android::sp;
+
+namespace {
+
+constexpr uint32_t kSampleRate = 48000;
+constexpr size_t kChannelCount = 2;
+constexpr size_t kFrameSize = kChannelCount * sizeof(int16_t);
+constexpr int32_t kMinBufferFrames = 4 * kSampleRate / 1000;
+constexpr int16_t kImpulse = 0x7fff;
+
+struct MmapClient {
+    explicit MmapClient(bool isOutput)
+        : stream(new SoftwareMmapStream(isOutput, kSampleRate, kFrameSize)) {
+        valid = stream->createMmapBuffer(kMinBufferFrames, &info) == 0;
+    }
+
+    int16_t* frame(int64_t position) {
+        uint8_t* buffer = static_cast<uint8_t*>(info.shared_memory_address);
+        return reinterpret_cast<int16_t*>(buffer +
+                                          (position % info.buffer_size_frames) * kFrameSize);
+    }
+
+    int64_t position() {
+        audio_mmap_position position;
+        stream->getMmapPosition(&position);
+        return position.position_frames;
+    }
+
+    sp<SoftwareMmapStream> stream;
+    audio_mmap_buffer_info info;
+    bool valid;
+};
+
+}  // namespace
+
+static void BM_SoftwareMmap_RoundTrip(benchmark::State& state) {
+    MmapClient output(true /*isOutput*/);
+    MmapClient input(false /*isOutput*/);
+    if (!output.valid || !input.valid) {
+        state.SkipWithError("could not create the MMAP buffers");
+        return;
+    }
+    input.stream->start();
+    output.stream->start();
+    const useconds_t pollUs = SoftwareMmapStream::kBurstDurationMs * 1000 / 4;
+    int64_t totalFrames = 0;
+    for (auto _ : state) {
+        // Leave one burst to the device, like a client writing ahead would.
+        int64_t writePosition = output.position() + output.info.burst_size_frames;
+        int16_t* impulse = output.frame(writePosition);
+        impulse[0] = kImpulse;
+        auto start = std::chrono::steady_clock::now();
+        int64_t readPosition = input.position();
+        bool found = false;
+        while (!found) {
+            usleep(pollUs);
+            int64_t captured = input.position();
+            for (; readPosition < captured && !found; ++readPosition) {
+                found = input.frame(readPosition)[0] == kImpulse;
+            }
+            if (std::chrono::steady_clock::now() - start > std::chrono::seconds(1)) break;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        impulse[0] = 0;
+        if (!found) {
+            state.SkipWithError("the impulse was not captured");
+            break;
+        }
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+        totalFrames += readPosition - writePosition;
+    }
+    state.counters["round_trip_frames"] =
+        benchmark::Counter(totalFrames, benchmark::Counter::kAvgIterations);
+    output.stream->stop();
+    input.stream->stop();
+}
+BENCHMARK(BM_SoftwareMmap_RoundTrip)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loopback benchmark of the stream data paths: a client fills the data queue,
+// the stream I/O path moves it through a fake legacy HAL stream whose "device"
+// is a plain memory buffer, and back for capture.
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#include "core/default/StreamIn.h"
+#include "core/default/StreamOut.h"
+
+using namespace ::android::hardware::audio::CPP_VERSION::implementation;
+
+namespace {
+
+constexpr size_t kSampleRate = 48000;
+constexpr size_t kChannelCount = 8;
+constexpr size_t kFrameSize = kChannelCount * sizeof(float);
+// Queue length used by the framework for a fast track, in periods.
+constexpr size_t kQueuePeriods = 2;
+
+// The fake device copies each write into (and each read out of) its own
+// memory, like a HAL filling a DMA buffer would.
+struct LoopbackDevice {
+    std::vector<uint8_t> memory;
+    size_t position = 0;
+
+    void transfer(void* out, const void* in, size_t bytes) {
+        if (in != nullptr) {
+            memcpy(&memory[position], in, bytes);
+        } else {
+            memcpy(out, &memory[position], bytes);
+        }
+        position = (position + bytes) % (memory.size() / 2);
+    }
+};
+
+struct FakeStreamOut {
+    audio_stream_out_t stream;  // Must be first.
+    LoopbackDevice* device;
+
+    static ssize_t write(audio_stream_out_t* stream, const void* buffer, size_t bytes) {
+        reinterpret_cast<FakeStreamOut*>(stream)->device->transfer(nullptr, buffer, bytes);
+        return bytes;
+    }
+};
+
+struct FakeStreamIn {
+    audio_stream_in_t stream;  // Must be first.
+    LoopbackDevice* device;
+
+    static ssize_t read(audio_stream_in_t* stream, void* buffer, size_t bytes) {
+        reinterpret_cast<FakeStreamIn*>(stream)->device->transfer(buffer, nullptr, bytes);
+        return bytes;
+    }
+};
+
+struct Loopback {
+    explicit Loopback(size_t periodFrames)
+        : periodBytes(periodFrames * kFrameSize),
+          // One extra frame so that the queue positions drift and regularly wrap
+          // in the middle of a period.
+          outMQ(periodBytes * kQueuePeriods + kFrameSize),
+          inMQ(periodBytes * kQueuePeriods + kFrameSize),
+          clientBuffer(periodBytes, 0x3f),
+          scratch(outMQ.getQuantumCount()) {
+        device.memory.resize(periodBytes * 8);
+        memset(&out, 0, sizeof(out));
+        out.stream.write = FakeStreamOut::write;
+        out.device = &device;
+        memset(&in, 0, sizeof(in));
+        in.stream.read = FakeStreamIn::read;
+        in.device = &device;
+    }
+
+    const size_t periodBytes;
+    StreamOut::DataMQ outMQ;
+    StreamIn::DataMQ inMQ;
+    std::vector<uint8_t> clientBuffer;
+    std::vector<uint8_t> scratch;
+    LoopbackDevice device;
+    FakeStreamOut out;
+    FakeStreamIn in;
+};
+
+void setCounters(benchmark::State& state, size_t periodFrames) {
+    // Audio seconds moved per second of benchmark CPU time; the CPU cost of one
+    // second of audio is the inverse.
+    state.counters["realtime_x"] = benchmark::Counter(
+            static_cast<double>(state.iterations()) * periodFrames / kSampleRate,
+            benchmark::Counter::kIsRate);
+    state.SetBytesProcessed(state.iterations() * periodFrames * kFrameSize * 2);
+}
+
+}  // namespace
+
+// The previous WriteThread/ReadThread behavior: stage data in a private buffer.
+static void BM_Loopback_CopyThroughBuffer(benchmark::State& state) {
+    const size_t periodFrames = state.range(0);
+    Loopback lb(periodFrames);
+    for (auto _ : state) {
+        lb.outMQ.write(lb.clientBuffer.data(), lb.periodBytes);
+        const size_t availToRead = lb.outMQ.availableToRead();
+        lb.outMQ.read(lb.scratch.data(), availToRead);
+        lb.out.stream.write(&lb.out.stream, lb.scratch.data(), availToRead);
+
+        ssize_t readResult = lb.in.stream.read(&lb.in.stream, lb.scratch.data(), lb.periodBytes);
+        lb.inMQ.write(lb.scratch.data(), readResult);
+        lb.inMQ.read(lb.clientBuffer.data(), readResult);
+    }
+    setCounters(state, periodFrames);
+}
+BENCHMARK(BM_Loopback_CopyThroughBuffer)->Arg(192)->Arg(480)->Arg(960);
+
+static void BM_Loopback_ZeroCopy(benchmark::State& state) {
+    const size_t periodFrames = state.range(0);
+    Loopback lb(periodFrames);
+    for (auto _ : state) {
+        lb.outMQ.write(lb.clientBuffer.data(), lb.periodBytes);
+        StreamOut::writeFromDataMQImpl(&lb.out.stream, &lb.outMQ);
+
+        ssize_t readResult = StreamIn::readToDataMQImpl(&lb.in.stream, &lb.inMQ, lb.periodBytes);
+        lb.inMQ.read(lb.clientBuffer.data(), readResult);
+    }
+    setCounters(state, periodFrames);
+}
+BENCHMARK(BM_Loopback_ZeroCopy)->Arg(192)->Arg(480)->Arg(960);
+
+BENCHMARK_MAIN();
@@ -22,9 +22,12 @@
 #include "ParametersUtil.h"
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <hardware/audio.h>
 #include <media/AudioParameter.h>
+#include <utils/Timers.h>
 
 #include <hidl/Status.h>
 
@@ -49,6 +52,36 @@ using namespace ::android::hardware::audio::common::CPP_VERSION;
 using namespace ::android::hardware::audio::CPP_VERSION;
 
 struct Device : public IDevice, public ParametersUtil {
+    // A whole routing change, validated up front and applied by applyRoutingChange
+    // with as few HAL calls as possible.
+    struct RoutingChange {
+        struct Patch {
+            // AUDIO_PATCH_HANDLE_NONE creates a new patch, otherwise the patch
+            // is updated in place instead of being released and recreated.
+            AudioPatchHandle handle = AUDIO_PATCH_HANDLE_NONE;
+            hidl_vec<AudioPortConfig> sources;
+            hidl_vec<AudioPortConfig> sinks;
+        };
+        struct StreamParameters {
+            ParametersUtil* stream;  // Owned by the caller.
+            hidl_vec<ParameterValue> parameters;
+        };
+        std::vector<AudioPortConfig> portConfigs;
+        std::vector<Patch> patches;
+        std::vector<AudioPatchHandle> releasedPatches;
+        hidl_vec<ParameterValue> deviceParameters;
+        std::vector<StreamParameters> streamParameters;
+    };
+    // Duration of each phase of a routing change.
+    struct RoutingChangeTimings {
+        nsecs_t validateNs = 0;
+        nsecs_t portConfigsNs = 0;
+        nsecs_t patchesNs = 0;
+        nsecs_t releaseNs = 0;
+        nsecs_t parametersNs = 0;
+        nsecs_t totalNs = 0;
+    };
+
     explicit Device(audio_hw_device_t* device);
 
     // Methods from ::android::hardware::audio::CPP_VERSION::IDevice follow.
@@ -124,8 +157,29 @@ struct Device : public IDevice, public ParametersUtil {
     void closeOutputStream(audio_stream_out_t* stream);
     audio_hw_device_t* device() const { return mDevice; }
 
+    // Applies the port configs, then the patches, releases the old patches
+    // and finally sets the device and stream parameters, each coalesced in a
+    // single HAL call. Nothing is applied if the change is invalid. If a port
+    // config or a patch fails, the patches created by this change are released,
+    // the active configs the ports had before the change are set back and the
+    // error returned. What can not be rolled back:
+    // - patches updated in place keep their new sources and sinks, the HAL has
+    //   no way to report the previous ones;
+    // - ports for which get_audio_port failed or which had no active config
+    //   keep the config of the change;
+    // - failures to release the old patches or to set the parameters happen
+    //   once the new routing is in place, they are returned but undo nothing.
+    // The handles of the patches are returned in the same order.
+    Result applyRoutingChange(const RoutingChange& change, hidl_vec<AudioPatchHandle>* patches,
+                              RoutingChangeTimings* timings);
+
    private:
     audio_hw_device_t* mDevice;
+    std::mutex mRoutingLock;
+    RoutingChangeTimings mLastRoutingChangeTimings;  // Protected by mRoutingLock.
+    size_t mRoutingChangeCount;                      // Protected by mRoutingLock.
+
+    Result validateRoutingChange(const RoutingChange& change);
 
     virtual ~Device();
 
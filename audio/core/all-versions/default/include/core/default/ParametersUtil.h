@@ -21,6 +21,10 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 
 #include <hidl/HidlSupport.h>
 #include <media/AudioParameter.h>
@@ -36,8 +40,46 @@ using ::android::hardware::hidl_vec;
 using namespace ::android::hardware::audio::common::CPP_VERSION;
 using namespace ::android::hardware::audio::CPP_VERSION;
 
+/** Iterates over the pairs of a "key1=value1;key2=value2" string in place,
+ * without copying nor allocating. A key without '=' has an empty value. */
+class ParameterTokenizer {
+   public:
+    explicit ParameterTokenizer(std::string_view keysAndValues) : mRemaining(keysAndValues) {}
+
+    /** @return false when there are no more pairs. */
+    bool next(std::string_view* key, std::string_view* value);
+
+   private:
+    std::string_view mRemaining;
+};
+
+/** Parameters to be set together with a single HAL call. */
+class ParameterBatch {
+   public:
+    ParameterBatch& add(const char* name, const char* value);
+    ParameterBatch& add(const char* name, bool value);
+    ParameterBatch& add(const char* name, int value);
+    ParameterBatch& add(const char* name, float value);
+
+    bool empty() const { return mKeysAndValues.empty(); }
+    const char* c_str() const { return mKeysAndValues.c_str(); }
+
+   private:
+    std::string mKeysAndValues;
+};
+
 class ParametersUtil {
    public:
+    using GetParamsCallback = std::function<void(std::string_view key, std::string_view value)>;
+
+    /** Queries all the keys with a single HAL call. The callback is invoked for
+     * every pair of the reply, the views are only valid during the call. */
+    Result getParams(const char* const* keys, size_t keyCount, const GetParamsCallback& cb);
+    Result setParams(const ParameterBatch& batch);
+    /** Typed conversions of values reported by getParams. */
+    static Result parseParam(std::string_view value, bool* result);
+    static Result parseParam(std::string_view value, int* result);
+
     Result setParam(const char* name, const char* value);
     Result getParam(const char* name, bool* value);
     Result getParam(const char* name, int* value);
@@ -59,6 +101,16 @@ class ParametersUtil {
 
     virtual char* halGetParameters(const char* keys) = 0;
     virtual int halSetParameters(const char* keysAndValues) = 0;
+
+   private:
+    /** Capabilities which do not change during the life of a stream (supported
+     * formats, sampling rates and channels) are only queried once per context.
+     * The cache is cleared on any set, in case it affects them (e.g. routing). */
+    static bool isCacheable(const char* name);
+    void invalidateCache();
+
+    std::mutex mCacheLock;
+    std::unordered_map<std::string, std::string> mCache;
 };
 
 }  // namespace implementation
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_SOFTWAREMMAPSTREAM_H
+#define ANDROID_HARDWARE_AUDIO_SOFTWAREMMAPSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+#include <system/audio.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+/**
+ * Software emulation of an MMAP (NOIRQ) stream, used when the legacy HAL stream
+ * does not implement create_mmap_buffer and the emulation is enabled by the
+ * vendor.audio.mmap.software_loopback property. Otherwise such streams keep
+ * returning NOT_SUPPORTED and the framework falls back to the normal path.
+ *
+ * The client and a "device" thread share a ring buffer in ashmem. The position
+ * clock is driven by a timer: it advances by one burst every burst duration
+ * while the stream is started. Every burst the device thread consumes (output)
+ * or produces (input) the corresponding frames of the ring. The device is a
+ * process wide loopback, what output streams consume is captured by input
+ * streams, so that exclusive mode clients can be measured for round trip
+ * latency without audio hardware.
+ *
+ * Methods follow the conventions of the legacy HAL MMAP functions and return
+ * 0 or a negative errno.
+ */
+class SoftwareMmapStream : public RefBase {
+   public:
+    static constexpr uint32_t kBurstDurationMs = 2;
+
+    // Whether streams without create_mmap_buffer are emulated, off by default.
+    static bool isEnabled();
+
+    SoftwareMmapStream(bool isOutput, uint32_t sampleRate, size_t frameSize);
+
+    int createMmapBuffer(int32_t minSizeFrames, audio_mmap_buffer_info* info);
+    int getMmapPosition(audio_mmap_position* position);
+    int start();
+    int stop();
+
+   private:
+    class DeviceThread;
+
+    const bool mIsOutput;
+    const uint32_t mSampleRate;
+    const size_t mFrameSize;
+    const uint32_t mBurstFrames;
+
+    std::mutex mLock;
+    int mFd;
+    uint8_t* mBuffer;
+    uint32_t mBufferFrames;
+    bool mStarted;
+    // The clock is at mStartPosition frames at mStartTime, and advances from
+    // there while started.
+    nsecs_t mStartTime;
+    int64_t mStartPosition;
+    sp<DeviceThread> mDeviceThread;
+
+    virtual ~SoftwareMmapStream();
+
+    nsecs_t burstTime(int64_t bursts) const;
+    void getPositionLocked(nsecs_t now, audio_mmap_position* position) const;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_SOFTWAREMMAPSTREAM_H
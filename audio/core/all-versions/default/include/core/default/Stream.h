@@ -20,7 +20,10 @@
 #include PATH(android/hardware/audio/FILE_VERSION/IStream.h)
 
 #include "ParametersUtil.h"
+#include "SoftwareMmapStream.h"
+#include "StreamIoStats.h"
 
+#include <type_traits>
 #include <vector>
 
 #include <hardware/audio.h>
@@ -109,8 +112,12 @@ struct Stream : public IStream, public ParametersUtil {
     static Result analyzeStatus(const char* funcName, int status,
                                 const std::vector<int>& ignoreErrors);
 
+    // Filled by the stream's I/O thread, dumped by debug().
+    StreamIoStats* getIoStats() { return &mIoStats; }
+
    private:
     audio_stream_t* mStream;
+    StreamIoStats mIoStats;
 
     virtual ~Stream();
 
@@ -133,10 +140,15 @@ struct StreamMmap : public RefBase {
     StreamMmap() {}
 
     T* mStream;
+    // Emulates MMAP when the legacy stream doesn't support it, if enabled.
+    sp<SoftwareMmapStream> mSoftwareStream;
 };
 
 template <typename T>
 Return<Result> StreamMmap<T>::start() {
+    if (mSoftwareStream != nullptr) {
+        return Stream::analyzeStatus("start", mSoftwareStream->start());
+    }
     if (mStream->start == NULL) return Result::NOT_SUPPORTED;
     int result = mStream->start(mStream);
     return Stream::analyzeStatus("start", result);
@@ -144,6 +156,9 @@ Return<Result> StreamMmap<T>::start() {
 
 template <typename T>
 Return<Result> StreamMmap<T>::stop() {
+    if (mSoftwareStream != nullptr) {
+        return Stream::analyzeStatus("stop", mSoftwareStream->stop());
+    }
     if (mStream->stop == NULL) return Result::NOT_SUPPORTED;
     int result = mStream->stop(mStream);
     return Stream::analyzeStatus("stop", result);
@@ -156,33 +171,41 @@ Return<void> StreamMmap<T>::createMmapBuffer(int32_t minSizeFrames, size_t frame
     MmapBufferInfo info;
     native_handle_t* hidlHandle = nullptr;
 
+    struct audio_mmap_buffer_info halInfo;
     if (mStream->create_mmap_buffer != NULL) {
-        struct audio_mmap_buffer_info halInfo;
         retval = Stream::analyzeStatus(
             "create_mmap_buffer", mStream->create_mmap_buffer(mStream, minSizeFrames, &halInfo));
-        if (retval == Result::OK) {
-            hidlHandle = native_handle_create(1, 0);
-            hidlHandle->data[0] = halInfo.shared_memory_fd;
-
-            // Negative buffer size frame is a legacy hack to indicate that the buffer
-            // is shareable to applications before the relevant flag was introduced
-            bool applicationShareable =
-                halInfo.flags & AUDIO_MMAP_APPLICATION_SHAREABLE || halInfo.buffer_size_frames < 0;
-            halInfo.buffer_size_frames = abs(halInfo.buffer_size_frames);
-            info.sharedMemory =  // hidl_memory size must always be positive
-                hidl_memory("audio_buffer", hidlHandle, frameSize * halInfo.buffer_size_frames);
+    } else if (SoftwareMmapStream::isEnabled()) {
+        if (mSoftwareStream == nullptr) {
+            mSoftwareStream = new SoftwareMmapStream(
+                std::is_same<T, audio_stream_out_t>::value,
+                mStream->common.get_sample_rate(&mStream->common), frameSize);
+        }
+        retval = Stream::analyzeStatus("create_mmap_buffer",
+                                       mSoftwareStream->createMmapBuffer(minSizeFrames, &halInfo));
+    }
+    if (retval == Result::OK) {
+        hidlHandle = native_handle_create(1, 0);
+        hidlHandle->data[0] = halInfo.shared_memory_fd;
+
+        // Negative buffer size frame is a legacy hack to indicate that the buffer
+        // is shareable to applications before the relevant flag was introduced
+        bool applicationShareable =
+            halInfo.flags & AUDIO_MMAP_APPLICATION_SHAREABLE || halInfo.buffer_size_frames < 0;
+        halInfo.buffer_size_frames = abs(halInfo.buffer_size_frames);
+        info.sharedMemory =  // hidl_memory size must always be positive
+            hidl_memory("audio_buffer", hidlHandle, frameSize * halInfo.buffer_size_frames);
 #if MAJOR_VERSION == 2
-            if (applicationShareable) {
-                halInfo.buffer_size_frames *= -1;
-            }
+        if (applicationShareable) {
+            halInfo.buffer_size_frames *= -1;
+        }
 #else
-            info.flags =
-                halInfo.flags | (applicationShareable ? MmapBufferFlag::APPLICATION_SHAREABLE
-                                                      : MmapBufferFlag::NONE);
+        info.flags =
+            halInfo.flags | (applicationShareable ? MmapBufferFlag::APPLICATION_SHAREABLE
+                                                  : MmapBufferFlag::NONE);
 #endif
-            info.bufferSizeFrames = halInfo.buffer_size_frames;
-            info.burstSizeFrames = halInfo.burst_size_frames;
-        }
+        info.bufferSizeFrames = halInfo.buffer_size_frames;
+        info.burstSizeFrames = halInfo.burst_size_frames;
     }
     _hidl_cb(retval, info);
     if (hidlHandle != nullptr) {
@@ -196,14 +219,17 @@ Return<void> StreamMmap<T>::getMmapPosition(IStream::getMmapPosition_cb _hidl_cb
     Result retval(Result::NOT_SUPPORTED);
     MmapPosition position;
 
-    if (mStream->get_mmap_position != NULL) {
-        struct audio_mmap_position halPosition;
+    struct audio_mmap_position halPosition;
+    if (mSoftwareStream != nullptr) {
+        retval = Stream::analyzeStatus("get_mmap_position",
+                                       mSoftwareStream->getMmapPosition(&halPosition));
+    } else if (mStream->get_mmap_position != NULL) {
         retval = Stream::analyzeStatus("get_mmap_position",
                                        mStream->get_mmap_position(mStream, &halPosition));
-        if (retval == Result::OK) {
-            position.timeNanoseconds = halPosition.time_nanoseconds;
-            position.positionFrames = halPosition.position_frames;
-        }
+    }
+    if (retval == Result::OK) {
+        position.timeNanoseconds = halPosition.time_nanoseconds;
+        position.positionFrames = halPosition.position_frames;
     }
     _hidl_cb(retval, position);
     return Void();
@@ -116,6 +116,9 @@ struct StreamIn : public IStreamIn {
     Return<Result> setMicrophoneDirection(MicrophoneDirection direction) override;
     Return<Result> setMicrophoneFieldDimension(float zoom) override;
 #endif
+    // Lets the HAL read up to 'bytes' straight into the queue's shared memory,
+    // and publishes what was read. Returns the HAL read result.
+    static ssize_t readToDataMQImpl(audio_stream_in_t* stream, DataMQ* dataMQ, size_t bytes);
     static Result getCapturePositionImpl(audio_stream_in_t* stream, uint64_t* frames,
                                          uint64_t* time);
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_STREAMIOSTATS_H
+#define ANDROID_HARDWARE_AUDIO_STREAMIOSTATS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+/**
+ * Histogram with power of two buckets. Meant to be updated by a single thread
+ * (the stream I/O thread) and read concurrently by debug(), so it uses relaxed
+ * atomics and no locks. Bucket i counts values in [2^(i-1), 2^i).
+ */
+class IoHistogram {
+   public:
+    IoHistogram();
+
+    void record(uint64_t value);
+    void dump(int fd, const char* name, const char* unit) const;
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+
+   private:
+    static constexpr size_t kBucketCount = 40;
+
+    static void increment(std::atomic<uint64_t>* counter, uint64_t delta) {
+        counter->store(counter->load(std::memory_order_relaxed) + delta,
+                       std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> mBuckets[kBucketCount];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMax;
+};
+
+/**
+ * Timing of the data path of a stream, as seen by its WriteThread or ReadThread.
+ */
+struct StreamIoStats {
+    StreamIoStats();
+
+    // Time blocked on the event flag waiting for a command.
+    IoHistogram waitUs;
+    // From the event flag wake-up to the start of the HAL read or write.
+    IoHistogram wakeToIoUs;
+    // Duration of the HAL read or write call.
+    IoHistogram halIoUs;
+    IoHistogram bytesPerCall;
+    // Status replies sent later after the wake-up than the duration of the
+    // audio transferred by the call.
+    std::atomic<uint64_t> missedDeadlines;
+    std::atomic<uint64_t> statusWriteFailures;
+
+    void dump(int fd) const;
+};
+
+/**
+ * Collects the timestamps of one command of a stream I/O thread and records
+ * them into StreamIoStats.
+ */
+class StreamIoTimer {
+   public:
+    // nsPerByte converts transferred bytes to audio duration, 0 disables
+    // deadline tracking.
+    StreamIoTimer(StreamIoStats* stats, double nsPerByte)
+        : mStats(stats), mNsPerByte(nsPerByte) {}
+
+    void onWaitStart() { mWaitStart = systemTime(SYSTEM_TIME_MONOTONIC); }
+    void onWake();
+    void onIoStart() { mIoStart = systemTime(SYSTEM_TIME_MONOTONIC); }
+    void onIoEnd(ssize_t bytes);
+    void onReplied(bool statusWritten);
+
+   private:
+    StreamIoStats* const mStats;
+    const double mNsPerByte;
+    nsecs_t mWaitStart = 0;
+    nsecs_t mWake = 0;
+    nsecs_t mIoStart = 0;
+    size_t mBytes = 0;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_STREAMIOSTATS_H
@@ -124,6 +124,9 @@ struct StreamOut : public IStreamOut {
 
     static Result getPresentationPositionImpl(audio_stream_out_t* stream, uint64_t* frames,
                                               TimeSpec* timeStamp);
+    // Hands all data available in the queue to the HAL straight from the queue's
+    // shared memory, and consumes it. Returns the HAL write result.
+    static ssize_t writeFromDataMQImpl(audio_stream_out_t* stream, DataMQ* dataMQ);
 
    private:
     bool mIsClosed;
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives Device::applyRoutingChange against a fake audio_hw_device: checks
+// what is applied when the change succeeds, that nothing is applied when it is
+// invalid, and what is rolled back when a patch fails half way.
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include <hardware/audio.h>
+
+#include "core/default/Device.h"
+
+using ::android::sp;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::audio::common::CPP_VERSION::AudioPatchHandle;
+using ::android::hardware::audio::common::CPP_VERSION::AudioPortConfig;
+using ::android::hardware::audio::common::CPP_VERSION::AudioPortConfigMask;
+using ::android::hardware::audio::CPP_VERSION::Result;
+using ::android::hardware::audio::CPP_VERSION::implementation::Device;
+
+namespace {
+
+constexpr audio_port_handle_t kSourcePort = 1;
+constexpr audio_port_handle_t kSinkPort = 2;
+constexpr audio_port_handle_t kOtherSinkPort = 3;
+constexpr uint32_t kPreviousSampleRate = 44100;
+constexpr uint32_t kNewSampleRate = 48000;
+
+// Keeps the active config of the ports and the sinks of the patches, as a
+// HAL would. create_audio_patch can be made to fail after a number of calls.
+struct FakeHwDevice {
+    audio_hw_device_t device;  // Must be first, the callbacks cast it back.
+    std::map<audio_port_handle_t, audio_port_config> portConfigs;
+    std::map<audio_patch_handle_t, std::vector<audio_port_handle_t>> patches;
+    audio_patch_handle_t nextPatch = 100;
+    int createPatchCalls = 0;
+    int failCreatePatchAt = -1;  // Index of the create_audio_patch call to fail.
+    int halCalls = 0;
+
+    FakeHwDevice() {
+        memset(&device, 0, sizeof(device));
+        device.common.version = AUDIO_DEVICE_API_VERSION_3_0;
+        device.common.close = close;
+        device.get_audio_port = getAudioPort;
+        device.set_audio_port_config = setAudioPortConfig;
+        device.create_audio_patch = createAudioPatch;
+        device.release_audio_patch = releaseAudioPatch;
+    }
+
+    static FakeHwDevice* from(const struct audio_hw_device* dev) {
+        return reinterpret_cast<FakeHwDevice*>(const_cast<struct audio_hw_device*>(dev));
+    }
+
+    static int close(hw_device_t*) { return 0; }
+
+    static int getAudioPort(struct audio_hw_device* dev, struct audio_port* port) {
+        FakeHwDevice* self = from(dev);
+        self->halCalls++;
+        auto config = self->portConfigs.find(port->id);
+        if (config != self->portConfigs.end()) port->active_config = config->second;
+        return 0;
+    }
+
+    static int setAudioPortConfig(struct audio_hw_device* dev,
+                                  const struct audio_port_config* config) {
+        FakeHwDevice* self = from(dev);
+        self->halCalls++;
+        self->portConfigs[config->id] = *config;
+        return 0;
+    }
+
+    static int createAudioPatch(struct audio_hw_device* dev, unsigned int, const audio_port_config*,
+                                unsigned int numSinks, const audio_port_config* sinks,
+                                audio_patch_handle_t* handle) {
+        FakeHwDevice* self = from(dev);
+        self->halCalls++;
+        if (self->createPatchCalls++ == self->failCreatePatchAt) return -ENOSYS;
+        if (*handle == AUDIO_PATCH_HANDLE_NONE) *handle = self->nextPatch++;
+        std::vector<audio_port_handle_t>& patchSinks = self->patches[*handle];
+        patchSinks.clear();
+        for (unsigned int i = 0; i < numSinks; ++i) patchSinks.push_back(sinks[i].id);
+        return 0;
+    }
+
+    static int releaseAudioPatch(struct audio_hw_device* dev, audio_patch_handle_t handle) {
+        FakeHwDevice* self = from(dev);
+        self->halCalls++;
+        return self->patches.erase(handle) == 1 ? 0 : -EINVAL;
+    }
+
+    uint32_t sampleRate(audio_port_handle_t port) const {
+        auto config = portConfigs.find(port);
+        return config == portConfigs.end() ? 0 : config->second.sample_rate;
+    }
+};
+
+AudioPortConfig portConfig(audio_port_handle_t port, uint32_t sampleRate) {
+    AudioPortConfig config = {};
+    config.id = port;
+    config.configMask = static_cast<uint32_t>(AudioPortConfigMask::SAMPLE_RATE);
+    config.sampleRateHz = sampleRate;
+    return config;
+}
+
+Device::RoutingChange::Patch patch(AudioPatchHandle handle, audio_port_handle_t sink) {
+    Device::RoutingChange::Patch result;
+    result.handle = handle;
+    result.sources = hidl_vec<AudioPortConfig>{portConfig(kSourcePort, 0)};
+    result.sinks = hidl_vec<AudioPortConfig>{portConfig(sink, 0)};
+    return result;
+}
+
+class DeviceRoutingTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        audio_port_config previous = {};
+        previous.id = kSinkPort;
+        previous.config_mask = AUDIO_PORT_CONFIG_SAMPLE_RATE;
+        previous.sample_rate = kPreviousSampleRate;
+        mHal.portConfigs[kSinkPort] = previous;
+        mDevice = new Device(&mHal.device);
+    }
+
+    FakeHwDevice mHal;
+    sp<Device> mDevice;
+};
+
+}  // namespace
+
+TEST_F(DeviceRoutingTest, AppliesAValidChange) {
+    Device::RoutingChange change;
+    change.portConfigs.push_back(portConfig(kSinkPort, kNewSampleRate));
+    change.patches.push_back(patch(AUDIO_PATCH_HANDLE_NONE, kSinkPort));
+
+    hidl_vec<AudioPatchHandle> handles;
+    ASSERT_EQ(Result::OK, mDevice->applyRoutingChange(change, &handles, nullptr));
+
+    EXPECT_EQ(kNewSampleRate, mHal.sampleRate(kSinkPort));
+    ASSERT_EQ(1u, handles.size());
+    ASSERT_EQ(1u, mHal.patches.count(handles[0]));
+    EXPECT_EQ(std::vector<audio_port_handle_t>{kSinkPort}, mHal.patches[handles[0]]);
+}
+
+TEST_F(DeviceRoutingTest, InvalidChangeAppliesNothing) {
+    Device::RoutingChange change;
+    change.portConfigs.push_back(portConfig(kSinkPort, kNewSampleRate));
+    Device::RoutingChange::Patch noSinks = patch(AUDIO_PATCH_HANDLE_NONE, kSinkPort);
+    noSinks.sinks.resize(0);
+    change.patches.push_back(noSinks);
+
+    EXPECT_EQ(Result::INVALID_ARGUMENTS, mDevice->applyRoutingChange(change, nullptr, nullptr));
+
+    EXPECT_EQ(0, mHal.halCalls);
+    EXPECT_EQ(kPreviousSampleRate, mHal.sampleRate(kSinkPort));
+    EXPECT_TRUE(mHal.patches.empty());
+}
+
+TEST_F(DeviceRoutingTest, FailedPatchRollsBackWhatItCan) {
+    mHal.patches[10] = {kSinkPort};
+    mHal.patches[11] = {kOtherSinkPort};
+
+    Device::RoutingChange change;
+    change.portConfigs.push_back(portConfig(kSinkPort, kNewSampleRate));
+    // Updated in place, then a new patch, then the failing one.
+    change.patches.push_back(patch(10, kOtherSinkPort));
+    change.patches.push_back(patch(AUDIO_PATCH_HANDLE_NONE, kSinkPort));
+    change.patches.push_back(patch(AUDIO_PATCH_HANDLE_NONE, kOtherSinkPort));
+    change.releasedPatches.push_back(11);
+    mHal.failCreatePatchAt = 2;
+
+    EXPECT_NE(Result::OK, mDevice->applyRoutingChange(change, nullptr, nullptr));
+
+    // The port config is put back and the patch created by the change released.
+    EXPECT_EQ(kPreviousSampleRate, mHal.sampleRate(kSinkPort));
+    EXPECT_EQ(2u, mHal.patches.size());
+    // The old patches are not released.
+    ASSERT_EQ(1u, mHal.patches.count(11));
+    // A patch updated in place can not be rolled back.
+    ASSERT_EQ(1u, mHal.patches.count(10));
+    EXPECT_EQ(std::vector<audio_port_handle_t>{kOtherSinkPort}, mHal.patches[10]);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the typed parameter getters of ParametersUtil, which parse the
+// HAL reply in place, give the same results as AudioParameter did.
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "core/default/ParametersUtil.h"
+
+using ::android::AudioParameter;
+using ::android::String8;
+using ::android::hardware::audio::CPP_VERSION::Result;
+using ::android::hardware::audio::CPP_VERSION::implementation::ParametersUtil;
+
+namespace {
+
+constexpr char kKey[] = "key";
+
+// Replies to any query with a fixed string.
+class FakeParametersUtil : public ParametersUtil {
+   public:
+    explicit FakeParametersUtil(const std::string& reply) : mReply(reply) {}
+
+   protected:
+    char* halGetParameters(const char*) override { return strdup(mReply.c_str()); }
+    int halSetParameters(const char*) override { return 0; }
+
+   private:
+    const std::string mReply;
+};
+
+// The result AudioParameter::getInt gave, as ParametersUtil used to convert it.
+Result getIntResult(const std::string& reply, int* value) {
+    *value = -1;
+    switch (AudioParameter(String8(reply.c_str())).getInt(String8(kKey), *value)) {
+        case android::OK:
+            return Result::OK;
+        case android::BAD_VALUE:
+            return Result::NOT_SUPPORTED;
+        default:
+            return Result::INVALID_ARGUMENTS;
+    }
+}
+
+}  // namespace
+
+TEST(ParametersUtilTest, GetIntParamMatchesAudioParameterGetInt) {
+    const char* const values[] = {"48000", "48000 ", "-7",  "+5",  " 12", "010",
+                                  "0x10",  "12abc",  "abc", "- 3", ""};
+    for (const char* value : values) {
+        const std::string reply = std::string(kKey) + "=" + value;
+        int expected;
+        const Result expectedResult = getIntResult(reply, &expected);
+        FakeParametersUtil util(reply);
+        int actual = -1;
+        EXPECT_EQ(expectedResult, util.getParam(kKey, &actual)) << '"' << value << '"';
+        EXPECT_EQ(expected, actual) << '"' << value << '"';
+    }
+}
+
+TEST(ParametersUtilTest, GetIntParamIsDecimal) {
+    FakeParametersUtil util(std::string(kKey) + "=010");
+    int value;
+    ASSERT_EQ(Result::OK, util.getParam(kKey, &value));
+    EXPECT_EQ(10, value);
+}
+
+TEST(ParametersUtilTest, MissingIntParamIsZero) {
+    const std::string reply = "other=1";
+    int expected;
+    EXPECT_EQ(Result::NOT_SUPPORTED, getIntResult(reply, &expected));
+    EXPECT_EQ(0, expected);
+
+    FakeParametersUtil util(reply);
+    int value = -1;
+    EXPECT_EQ(Result::NOT_SUPPORTED, util.getParam(kKey, &value));
+    EXPECT_EQ(0, value);
+}
@@ -16,8 +16,11 @@
 
 #include "AudioBufferManager.h"
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <atomic>
 
+#include <android/log.h>
 #include <hidlmemory/mapping.h>
 
 namespace android {
@@ -25,29 +28,63 @@ namespace android {
 ANDROID_SINGLETON_STATIC_INSTANCE(AudioBufferManager);
 
 bool AudioBufferManager::wrap(const AudioBuffer& buffer, sp<AudioBufferWrapper>* wrapper) {
+    Shard& shard = shardFor(buffer.id);
     // Check if we have this buffer already
-    std::lock_guard<std::mutex> lock(mLock);
-    ssize_t idx = mBuffers.indexOfKey(buffer.id);
-    if (idx >= 0) {
-        *wrapper = mBuffers[idx].promote();
-        if (*wrapper != nullptr) {
-            (*wrapper)->getHalBuffer()->frameCount = buffer.frameCount;
-            return true;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.buffers.find(buffer.id);
+        if (it != shard.buffers.end()) {
+            *wrapper = it->second.promote();
+            if (*wrapper != nullptr) {
+                (*wrapper)->getHalBuffer()->frameCount = buffer.frameCount;
+                return true;
+            }
         }
-        mBuffers.removeItemsAt(idx);
     }
-    // Need to create and init a new AudioBufferWrapper.
+    // Need to create and init a new AudioBufferWrapper. This is done without
+    // holding the shard lock as a failed wrapper removes itself on destruction.
     sp<AudioBufferWrapper> tempBuffer(new AudioBufferWrapper(buffer));
     if (!tempBuffer->init()) return false;
+    std::lock_guard<std::mutex> lock(shard.lock);
+    wp<AudioBufferWrapper>& entry = shard.buffers[buffer.id];
+    *wrapper = entry.promote();
+    if (*wrapper != nullptr) {
+        // Another thread has wrapped the same buffer meanwhile.
+        (*wrapper)->getHalBuffer()->frameCount = buffer.frameCount;
+        return true;
+    }
+    entry = tempBuffer;
     *wrapper = tempBuffer;
-    mBuffers.add(buffer.id, *wrapper);
     return true;
 }
 
-void AudioBufferManager::removeEntry(uint64_t id) {
-    std::lock_guard<std::mutex> lock(mLock);
-    ssize_t idx = mBuffers.indexOfKey(id);
-    if (idx >= 0) mBuffers.removeItemsAt(idx);
+void AudioBufferManager::dump(int fd) {
+    dprintf(fd, "Effect buffer mappings: %zu live (%zu bytes), %" PRIu64 " created\n",
+            mLiveMappings.load(std::memory_order_relaxed),
+            mLiveBytes.load(std::memory_order_relaxed),
+            mMappingsCreated.load(std::memory_order_relaxed));
+}
+
+sp<IMemory> AudioBufferManager::acquireMapping(const hidl_memory& memory) {
+    sp<IMemory> mapping = hardware::mapMemory(memory);
+    if (mapping == nullptr) return nullptr;
+    mMappingsCreated.fetch_add(1, std::memory_order_relaxed);
+    mLiveMappings.fetch_add(1, std::memory_order_relaxed);
+    mLiveBytes.fetch_add(memory.size(), std::memory_order_relaxed);
+    return mapping;
+}
+
+void AudioBufferManager::releaseMapping(const hidl_memory& memory) {
+    mLiveMappings.fetch_sub(1, std::memory_order_relaxed);
+    mLiveBytes.fetch_sub(memory.size(), std::memory_order_relaxed);
+}
+
+void AudioBufferManager::removeEntry(uint64_t id, const AudioBufferWrapper* wrapper) {
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    auto it = shard.buffers.find(id);
+    // The entry may already refer to a new wrapper of the same buffer.
+    if (it != shard.buffers.end() && it->second == wrapper) shard.buffers.erase(it);
 }
 
 namespace hardware {
@@ -60,7 +97,11 @@ AudioBufferWrapper::AudioBufferWrapper(const AudioBuffer& buffer)
     : mHidlBuffer(buffer), mHalBuffer{0, {nullptr}} {}
 
 AudioBufferWrapper::~AudioBufferWrapper() {
-    AudioBufferManager::getInstance().removeEntry(mHidlBuffer.id);
+    AudioBufferManager& manager = AudioBufferManager::getInstance();
+    manager.removeEntry(mHidlBuffer.id, this);
+    if (mHidlMemory != nullptr) {
+        manager.releaseMapping(mHidlBuffer.data);
+    }
 }
 
 bool AudioBufferWrapper::init() {
@@ -68,7 +109,7 @@ bool AudioBufferWrapper::init() {
         ALOGE("An attempt to init AudioBufferWrapper twice");
         return false;
     }
-    mHidlMemory = mapMemory(mHidlBuffer.data);
+    mHidlMemory = AudioBufferManager::getInstance().acquireMapping(mHidlBuffer.data);
     if (mHidlMemory == nullptr) {
         ALOGE("Could not map HIDL memory to IMemory");
         return false;
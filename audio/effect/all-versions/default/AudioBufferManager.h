@@ -19,14 +19,16 @@
 
 #include PATH(android/hardware/audio/effect/FILE_VERSION/types.h)
 
+#include <atomic>
 #include <mutex>
+#include <unordered_map>
 
 #include <android/hidl/memory/1.0/IMemory.h>
 #include <system/audio_effect.h>
-#include <utils/KeyedVector.h>
 #include <utils/RefBase.h>
 #include <utils/Singleton.h>
 
+using ::android::hardware::hidl_memory;
 using ::android::hardware::audio::effect::CPP_VERSION::AudioBuffer;
 using ::android::hidl::memory::V1_0::IMemory;
 
@@ -68,15 +70,36 @@ namespace android {
 class AudioBufferManager : public Singleton<AudioBufferManager> {
    public:
     bool wrap(const AudioBuffer& buffer, sp<AudioBufferWrapper>* wrapper);
+    void dump(int fd);
 
    private:
     friend class hardware::audio::effect::CPP_VERSION::implementation::AudioBufferWrapper;
 
-    // Called by AudioBufferWrapper.
-    void removeEntry(uint64_t id);
-
-    std::mutex mLock;
-    KeyedVector<uint64_t, wp<AudioBufferWrapper>> mBuffers;
+    // Wrappers are looked up in one of several independently locked shards,
+    // so that effects wrapping unrelated buffers do not contend.
+    static constexpr size_t kShardBits = 3;
+    static constexpr size_t kShardCount = 1 << kShardBits;
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<uint64_t, wp<AudioBufferWrapper>> buffers;
+    };
+    Shard& shardFor(uint64_t id) {
+        return mShards[(id * 0x9E3779B97F4A7C15ull) >> (64 - kShardBits)];
+    }
+
+    // Called by AudioBufferWrapper. Mappings are not reused once released:
+    // nothing received from the client identifies the memory region behind a
+    // buffer reliably, and buffer ids may repeat after a client restarts.
+    sp<IMemory> acquireMapping(const hidl_memory& memory);
+    void releaseMapping(const hidl_memory& memory);
+    void removeEntry(uint64_t id, const AudioBufferWrapper* wrapper);
+
+    Shard mShards[kShardCount];
+
+    std::atomic<uint64_t> mMappingsCreated{0};
+    std::atomic<size_t> mLiveMappings{0};
+    std::atomic<size_t> mLiveBytes{0};
 };
 
 }  // namespace android
@@ -49,7 +49,7 @@ class ProcessThread : public Thread {
     // ProcessThread's lifespan never exceeds Effect's lifespan.
     ProcessThread(std::atomic<bool>* stop, effect_handle_t effect,
                   std::atomic<audio_buffer_t*>* inBuffer, std::atomic<audio_buffer_t*>* outBuffer,
-                  Effect::StatusMQ* statusMQ, EventFlag* efGroup)
+                  Effect::StatusMQ* statusMQ, EventFlag* efGroup, Effect::ProcessTap* tap)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mEffect(effect),
@@ -57,7 +57,8 @@ class ProcessThread : public Thread {
           mInBuffer(inBuffer),
           mOutBuffer(outBuffer),
           mStatusMQ(statusMQ),
-          mEfGroup(efGroup) {}
+          mEfGroup(efGroup),
+          mTap(tap) {}
     virtual ~ProcessThread() {}
 
    private:
@@ -68,6 +69,7 @@ class ProcessThread : public Thread {
     std::atomic<audio_buffer_t*>* mOutBuffer;
     Effect::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
+    Effect::ProcessTap* mTap;
 
     bool threadLoop() override;
 };
@@ -99,6 +101,9 @@ bool ProcessThread::threadLoop() {
             if (inBuffer != nullptr && outBuffer != nullptr) {
                 if (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS)) {
                     processResult = (*mEffect)->process(mEffect, inBuffer, outBuffer);
+                    if (processResult == 0 && mTap != nullptr) {
+                        mTap->onProcessed(inBuffer, outBuffer);
+                    }
                 } else {
                     processResult = (*mEffect)->process_reverse(mEffect, inBuffer, outBuffer);
                 }
@@ -168,14 +173,14 @@ size_t Effect::alignedSizeIn(size_t s) {
 
 // static
 template <typename T>
-std::unique_ptr<uint8_t[]> Effect::hidlVecToHal(const hidl_vec<T>& vec, uint32_t* halDataSize) {
+void Effect::hidlVecToHal(const hidl_vec<T>& vec, ParamBuffer* halData) {
     // Due to bugs in HAL, they may attempt to write into the provided
     // input buffer. The original binder buffer is r/o, thus it is needed
     // to create a r/w version.
-    *halDataSize = vec.size() * sizeof(T);
-    std::unique_ptr<uint8_t[]> halData(new uint8_t[*halDataSize]);
-    memcpy(&halData[0], &vec[0], *halDataSize);
-    return halData;
+    halData->resize(vec.size() * sizeof(T));
+    if (halData->size() > 0) {
+        memcpy(halData->data(), &vec[0], halData->size());
+    }
 }
 
 // static
@@ -241,12 +246,12 @@ void Effect::effectOffloadParamToHal(const EffectOffloadParameter& offload,
 }
 
 // static
-std::vector<uint8_t> Effect::parameterToHal(uint32_t paramSize, const void* paramData,
-                                            uint32_t valueSize, const void** valueData) {
+void Effect::parameterToHal(uint32_t paramSize, const void* paramData, uint32_t valueSize,
+                            const void** valueData, ParamBuffer* halParamBuffer) {
     size_t valueOffsetFromData = alignedSizeIn<uint32_t>(paramSize) * sizeof(uint32_t);
     size_t halParamBufferSize = sizeof(effect_param_t) + valueOffsetFromData + valueSize;
-    std::vector<uint8_t> halParamBuffer(halParamBufferSize, 0);
-    effect_param_t* halParam = reinterpret_cast<effect_param_t*>(&halParamBuffer[0]);
+    halParamBuffer->resize(halParamBufferSize);
+    effect_param_t* halParam = reinterpret_cast<effect_param_t*>(halParamBuffer->data());
     halParam->psize = paramSize;
     halParam->vsize = valueSize;
     memcpy(halParam->data, paramData, paramSize);
@@ -259,7 +264,6 @@ std::vector<uint8_t> Effect::parameterToHal(uint32_t paramSize, const void* para
             *valueData = halParam->data + valueOffsetFromData;
         }
     }
-    return halParamBuffer;
 }
 
 Result Effect::analyzeCommandStatus(const char* commandName, const char* context, status_t status) {
@@ -316,23 +320,46 @@ Result Effect::getCurrentConfigImpl(uint32_t featureId, uint32_t configSize,
 Result Effect::getParameterImpl(uint32_t paramSize, const void* paramData,
                                 uint32_t requestValueSize, uint32_t replyValueSize,
                                 GetParameterSuccessCallback onSuccess) {
+    ParamBuffer halCmdBuffer;
+    ParamBuffer halParamBuffer;
+    return getParameterImpl(paramSize, paramData, requestValueSize, replyValueSize, &halCmdBuffer,
+                            &halParamBuffer, onSuccess);
+}
+
+Result Effect::getParameterImpl(uint32_t paramSize, const void* paramData,
+                                uint32_t requestValueSize, uint32_t replyValueSize,
+                                ParamBuffer* halCmdBuffer, ParamBuffer* halParamBuffer,
+                                GetParameterSuccessCallback onSuccess) {
     // As it is unknown what method HAL uses for copying the provided parameter data,
     // it is safer to make sure that input and output buffers do not overlap.
-    std::vector<uint8_t> halCmdBuffer =
-        parameterToHal(paramSize, paramData, requestValueSize, nullptr);
+    parameterToHal(paramSize, paramData, requestValueSize, nullptr, halCmdBuffer);
     const void* valueData = nullptr;
-    std::vector<uint8_t> halParamBuffer =
-        parameterToHal(paramSize, paramData, replyValueSize, &valueData);
-    uint32_t halParamBufferSize = halParamBuffer.size();
+    parameterToHal(paramSize, paramData, replyValueSize, &valueData, halParamBuffer);
+    uint32_t halParamBufferSize = halParamBuffer->size();
 
     return sendCommandReturningStatusAndData(
-        EFFECT_CMD_GET_PARAM, "GET_PARAM", halCmdBuffer.size(), &halCmdBuffer[0],
-        &halParamBufferSize, &halParamBuffer[0], sizeof(effect_param_t), [&] {
-            effect_param_t* halParam = reinterpret_cast<effect_param_t*>(&halParamBuffer[0]);
+        EFFECT_CMD_GET_PARAM, "GET_PARAM", halCmdBuffer->size(), halCmdBuffer->data(),
+        &halParamBufferSize, halParamBuffer->data(), sizeof(effect_param_t), [&] {
+            effect_param_t* halParam = reinterpret_cast<effect_param_t*>(halParamBuffer->data());
             onSuccess(halParam->vsize, valueData);
         });
 }
 
+Result Effect::getParametersImpl(const ParameterRef* params, size_t count,
+                                 GetParametersSuccessCallback onSuccess) {
+    ParamBuffer halCmdBuffer;
+    ParamBuffer halParamBuffer;
+    for (size_t i = 0; i < count; ++i) {
+        const ParameterRef& param = params[i];
+        Result retval = getParameterImpl(
+            param.paramSize, param.paramData, param.valueSize, param.valueSize, &halCmdBuffer,
+            &halParamBuffer,
+            [&](uint32_t valueSize, const void* valueData) { onSuccess(i, valueSize, valueData); });
+        if (retval != Result::OK) return retval;
+    }
+    return Result::OK;
+}
+
 Result Effect::getSupportedConfigsImpl(uint32_t featureId, uint32_t maxConfigs, uint32_t configSize,
                                        GetSupportedConfigsSuccessCallback onSuccess) {
     uint32_t halCmd[2] = {featureId, maxConfigs};
@@ -372,7 +399,8 @@ Return<void> Effect::prepareForProcessing(prepareForProcessing_cb _hidl_cb) {
 
     // Create and launch the thread.
     mProcessThread = new ProcessThread(&mStopProcessThread, mHandle, &mHalInBufferPtr,
-                                       &mHalOutBufferPtr, tempStatusMQ.get(), mEfGroup);
+                                       &mHalOutBufferPtr, tempStatusMQ.get(), mEfGroup,
+                                       mProcessTap.get());
     status = mProcessThread->run("effect", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start effect processing thread: %s", strerror(-status));
@@ -406,6 +434,15 @@ Return<Result> Effect::setProcessBuffers(const AudioBuffer& inBuffer,
     return Result::OK;
 }
 
+Result Effect::setProcessTap(std::unique_ptr<ProcessTap> tap) {
+    if (mProcessThread.get()) {
+        ALOGE("the process tap must be set before preparing for processing");
+        return Result::INVALID_STATE;
+    }
+    mProcessTap = std::move(tap);
+    return Result::OK;
+}
+
 Result Effect::sendCommand(int commandCode, const char* commandName) {
     return sendCommand(commandCode, commandName, 0, NULL);
 }
@@ -477,10 +514,26 @@ Result Effect::setConfigImpl(int commandCode, const char* commandName, const Eff
 
 Result Effect::setParameterImpl(uint32_t paramSize, const void* paramData, uint32_t valueSize,
                                 const void* valueData) {
-    std::vector<uint8_t> halParamBuffer =
-        parameterToHal(paramSize, paramData, valueSize, &valueData);
-    return sendCommandReturningStatus(EFFECT_CMD_SET_PARAM, "SET_PARAM", halParamBuffer.size(),
-                                      &halParamBuffer[0]);
+    ParamBuffer halParamBuffer;
+    return setParameterImpl(paramSize, paramData, valueSize, valueData, &halParamBuffer);
+}
+
+Result Effect::setParameterImpl(uint32_t paramSize, const void* paramData, uint32_t valueSize,
+                                const void* valueData, ParamBuffer* halParamBuffer) {
+    parameterToHal(paramSize, paramData, valueSize, &valueData, halParamBuffer);
+    return sendCommandReturningStatus(EFFECT_CMD_SET_PARAM, "SET_PARAM", halParamBuffer->size(),
+                                      halParamBuffer->data());
+}
+
+Result Effect::setParametersImpl(const ParameterRef* params, size_t count) {
+    ParamBuffer halParamBuffer;
+    for (size_t i = 0; i < count; ++i) {
+        const ParameterRef& param = params[i];
+        Result retval = setParameterImpl(param.paramSize, param.paramData, param.valueSize,
+                                         param.valueData, &halParamBuffer);
+        if (retval != Result::OK) return retval;
+    }
+    return Result::OK;
 }
 
 // Methods from ::android::hardware::audio::effect::CPP_VERSION::IEffect follow.
@@ -514,12 +567,12 @@ Return<Result> Effect::setDevice(AudioDeviceBitfield device) {
 
 Return<void> Effect::setAndGetVolume(const hidl_vec<uint32_t>& volumes,
                                      setAndGetVolume_cb _hidl_cb) {
-    uint32_t halDataSize;
-    std::unique_ptr<uint8_t[]> halData = hidlVecToHal(volumes, &halDataSize);
-    uint32_t halResultSize = halDataSize;
+    ParamBuffer halData;
+    hidlVecToHal(volumes, &halData);
+    uint32_t halResultSize = halData.size();
     uint32_t halResult[volumes.size()];
-    Result retval = sendCommandReturningData(EFFECT_CMD_SET_VOLUME, "SET_VOLUME", halDataSize,
-                                             &halData[0], &halResultSize, halResult);
+    Result retval = sendCommandReturningData(EFFECT_CMD_SET_VOLUME, "SET_VOLUME", halData.size(),
+                                             halData.data(), &halResultSize, halResult);
     hidl_vec<uint32_t> result;
     if (retval == Result::OK) {
         result.setToExternal(&halResult[0], halResultSize);
@@ -529,9 +582,9 @@ Return<void> Effect::setAndGetVolume(const hidl_vec<uint32_t>& volumes,
 }
 
 Return<Result> Effect::volumeChangeNotification(const hidl_vec<uint32_t>& volumes) {
-    uint32_t halDataSize;
-    std::unique_ptr<uint8_t[]> halData = hidlVecToHal(volumes, &halDataSize);
-    return sendCommand(EFFECT_CMD_SET_VOLUME, "SET_VOLUME", halDataSize, &halData[0]);
+    ParamBuffer halData;
+    hidlVecToHal(volumes, &halData);
+    return sendCommand(EFFECT_CMD_SET_VOLUME, "SET_VOLUME", halData.size(), halData.data());
 }
 
 Return<Result> Effect::setAudioMode(AudioMode mode) {
@@ -626,19 +679,18 @@ Return<void> Effect::getDescriptor(getDescriptor_cb _hidl_cb) {
 
 Return<void> Effect::command(uint32_t commandId, const hidl_vec<uint8_t>& data,
                              uint32_t resultMaxSize, command_cb _hidl_cb) {
-    uint32_t halDataSize;
-    std::unique_ptr<uint8_t[]> halData = hidlVecToHal(data, &halDataSize);
+    ParamBuffer halData;
+    hidlVecToHal(data, &halData);
     uint32_t halResultSize = resultMaxSize;
-    std::unique_ptr<uint8_t[]> halResult(new uint8_t[halResultSize]);
-    memset(&halResult[0], 0, halResultSize);
+    ParamBuffer halResult(halResultSize);
 
-    void* dataPtr = halDataSize > 0 ? &halData[0] : NULL;
-    void* resultPtr = halResultSize > 0 ? &halResult[0] : NULL;
-    status_t status =
-        (*mHandle)->command(mHandle, commandId, halDataSize, dataPtr, &halResultSize, resultPtr);
+    void* dataPtr = halData.data();
+    void* resultPtr = halResult.data();
+    status_t status = (*mHandle)->command(mHandle, commandId, halData.size(), dataPtr,
+                                          &halResultSize, resultPtr);
     hidl_vec<uint8_t> result;
     if (status == OK && resultPtr != NULL) {
-        result.setToExternal(&halResult[0], halResultSize);
+        result.setToExternal(halResult.data(), halResultSize);
     }
     _hidl_cb(status, result);
     return Void();
@@ -652,12 +704,15 @@ Return<Result> Effect::setParameter(const hidl_vec<uint8_t>& parameter,
 Return<void> Effect::getParameter(const hidl_vec<uint8_t>& parameter, uint32_t valueMaxSize,
                                   getParameter_cb _hidl_cb) {
     hidl_vec<uint8_t> value;
-    Result retval = getParameterImpl(
-        parameter.size(), &parameter[0], valueMaxSize,
-        [&](uint32_t valueSize, const void* valueData) {
-            value.setToExternal(reinterpret_cast<uint8_t*>(const_cast<void*>(valueData)),
-                                valueSize);
-        });
+    // The marshalling buffers are gone once getParameterImpl returns, so the
+    // value has to be copied out rather than referenced.
+    Result retval = getParameterImpl(parameter.size(), &parameter[0], valueMaxSize,
+                                     [&](uint32_t valueSize, const void* valueData) {
+                                         value.resize(valueSize);
+                                         if (valueSize > 0) {
+                                             memcpy(&value[0], valueData, valueSize);
+                                         }
+                                     });
     _hidl_cb(retval, value);
     return Void();
 }
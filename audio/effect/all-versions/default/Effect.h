@@ -20,6 +20,7 @@
 #include PATH(android/hardware/audio/effect/FILE_VERSION/IEffect.h)
 
 #include "AudioBufferManager.h"
+#include "InlineBuffer.h"
 
 #include <atomic>
 #include <memory>
@@ -55,6 +56,22 @@ struct Effect : public IEffect {
     typedef MessageQueue<Result, kSynchronizedReadWrite> StatusMQ;
     using GetParameterSuccessCallback =
         std::function<void(uint32_t valueSize, const void* valueData)>;
+    // One parameter of a batched get or set. The data is owned by the caller.
+    struct ParameterRef {
+        uint32_t paramSize;
+        const void* paramData;
+        uint32_t valueSize;
+        const void* valueData;  // Unused for gets.
+    };
+    using GetParametersSuccessCallback =
+        std::function<void(size_t index, uint32_t valueSize, const void* valueData)>;
+    // Observes the buffers of every successful forward process call, on the
+    // processing thread.
+    struct ProcessTap {
+        virtual ~ProcessTap() {}
+        virtual void onProcessed(const audio_buffer_t* inBuffer,
+                                 const audio_buffer_t* outBuffer) = 0;
+    };
 
     explicit Effect(effect_handle_t handle);
 
@@ -155,11 +172,23 @@ struct Effect : public IEffect {
                             uint32_t replyValueSize, GetParameterSuccessCallback onSuccess);
     Result setParameterImpl(uint32_t paramSize, const void* paramData, uint32_t valueSize,
                             const void* valueData);
+    // Batched versions of the above. Parameters are sent in order, reusing the
+    // same marshalling buffers; the first failure stops the batch and is returned.
+    Result getParametersImpl(const ParameterRef* params, size_t count,
+                             GetParametersSuccessCallback onSuccess);
+    Result setParametersImpl(const ParameterRef* params, size_t count);
+    // The tap is owned by the Effect and can only be set before prepareForProcessing.
+    Result setProcessTap(std::unique_ptr<ProcessTap> tap);
 
    private:
+    friend struct EffectChain;        // to process the effect handle
     friend struct VirtualizerEffect;  // for getParameterImpl
     friend struct VisualizerEffect;   // to allow executing commands
 
+    // Parameters and commands bigger than this are marshalled on the heap.
+    static constexpr size_t kInlineParamBufferSize = 256;
+    using ParamBuffer = InlineBuffer<kInlineParamBufferSize>;
+
     using CommandSuccessCallback = std::function<void()>;
     using GetConfigCallback = std::function<void(Result retval, const EffectConfig& config)>;
     using GetCurrentConfigSuccessCallback = std::function<void(void* configData)>;
@@ -180,13 +209,14 @@ struct Effect : public IEffect {
     EventFlag* mEfGroup;
     std::atomic<bool> mStopProcessThread;
     sp<Thread> mProcessThread;
+    std::unique_ptr<ProcessTap> mProcessTap;
 
     virtual ~Effect();
 
     template <typename T>
     static size_t alignedSizeIn(size_t s);
     template <typename T>
-    std::unique_ptr<uint8_t[]> hidlVecToHal(const hidl_vec<T>& vec, uint32_t* halDataSize);
+    static void hidlVecToHal(const hidl_vec<T>& vec, ParamBuffer* halData);
     static void effectAuxChannelsConfigFromHal(const channel_config_t& halConfig,
                                                EffectAuxChannelsConfig* config);
     static void effectAuxChannelsConfigToHal(const EffectAuxChannelsConfig& config,
@@ -199,8 +229,8 @@ struct Effect : public IEffect {
     static void effectConfigToHal(const EffectConfig& config, effect_config_t* halConfig);
     static void effectOffloadParamToHal(const EffectOffloadParameter& offload,
                                         effect_offload_param_t* halOffload);
-    static std::vector<uint8_t> parameterToHal(uint32_t paramSize, const void* paramData,
-                                               uint32_t valueSize, const void** valueData);
+    static void parameterToHal(uint32_t paramSize, const void* paramData, uint32_t valueSize,
+                               const void** valueData, ParamBuffer* halParamBuffer);
 
     Result analyzeCommandStatus(const char* commandName, const char* context, status_t status);
     Result analyzeStatus(const char* funcName, const char* subFuncName,
@@ -210,6 +240,11 @@ struct Effect : public IEffect {
                                 GetCurrentConfigSuccessCallback onSuccess);
     Result getSupportedConfigsImpl(uint32_t featureId, uint32_t maxConfigs, uint32_t configSize,
                                    GetSupportedConfigsSuccessCallback onSuccess);
+    Result getParameterImpl(uint32_t paramSize, const void* paramData, uint32_t requestValueSize,
+                            uint32_t replyValueSize, ParamBuffer* halCmdBuffer,
+                            ParamBuffer* halParamBuffer, GetParameterSuccessCallback onSuccess);
+    Result setParameterImpl(uint32_t paramSize, const void* paramData, uint32_t valueSize,
+                            const void* valueData, ParamBuffer* halParamBuffer);
     Result sendCommand(int commandCode, const char* commandName);
     Result sendCommand(int commandCode, const char* commandName, uint32_t size, void* data);
     Result sendCommandReturningData(int commandCode, const char* commandName, uint32_t* replySize,
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EffectChainHAL"
+#define ATRACE_TAG ATRACE_TAG_AUDIO
+
+#include "EffectChain.h"
+
+#include <android/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+class ChainProcessThread : public Thread {
+   public:
+    // ChainProcessThread's lifespan never exceeds EffectChain's lifespan.
+    ChainProcessThread(std::atomic<bool>* stop, EffectChain* chain,
+                       EffectChain::StatusMQ* statusMQ, EventFlag* efGroup)
+        : Thread(false /*canCallJava*/),
+          mStop(stop),
+          mChain(chain),
+          mStatusMQ(statusMQ),
+          mEfGroup(efGroup) {}
+    virtual ~ChainProcessThread() {}
+
+   private:
+    std::atomic<bool>* mStop;
+    EffectChain* mChain;
+    EffectChain::StatusMQ* mStatusMQ;
+    EventFlag* mEfGroup;
+
+    bool threadLoop() override;
+};
+
+bool ChainProcessThread::threadLoop() {
+    // As for a single effect, control is not returned back to the Thread
+    // until it decides to stop, to avoid priority inversion on its mutexes.
+    while (!std::atomic_load_explicit(mStop, std::memory_order_acquire)) {
+        uint32_t efState = 0;
+        mEfGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS_ALL), &efState);
+        if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS_ALL)) ||
+            (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_QUIT))) {
+            continue;  // Nothing to do or time to quit.
+        }
+        Result retval = Result::NOT_SUPPORTED;
+        if (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS)) {
+            // A chain only supports forward processing.
+            retval = mChain->process();
+        }
+        if (!mStatusMQ->write(&retval)) {
+            ALOGW("status message queue write failed");
+        }
+        mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING));
+    }
+
+    return false;
+}
+
+Result analyzeProcessResult(int32_t processResult) {
+    switch (processResult) {
+        case 0:
+            return Result::OK;
+        case -ENODATA:
+            return Result::INVALID_STATE;
+        case -EINVAL:
+            return Result::INVALID_ARGUMENTS;
+        default:
+            return Result::NOT_INITIALIZED;
+    }
+}
+
+}  // namespace
+
+EffectChain::EffectChain(const std::vector<sp<Effect>>& effects)
+    : mEffects(effects),
+      mHandles(handlesOf(effects)),
+      mIsClosed(false),
+      mHalInBufferPtr(nullptr),
+      mHalOutBufferPtr(nullptr),
+      mEfGroup(nullptr),
+      mStopProcessThread(false) {}
+
+EffectChain::~EffectChain() {
+    ATRACE_CALL();
+    close();
+    if (mProcessThread.get()) {
+        ATRACE_NAME("mProcessThread->join");
+        status_t status = mProcessThread->join();
+        ALOGE_IF(status, "processing thread exit error: %s", strerror(-status));
+    }
+    if (mEfGroup) {
+        status_t status = EventFlag::deleteEventFlag(&mEfGroup);
+        ALOGE_IF(status, "processing MQ event flag deletion error: %s", strerror(-status));
+    }
+    mInBuffer.clear();
+    mOutBuffer.clear();
+}
+
+// static
+std::vector<effect_handle_t> EffectChain::handlesOf(const std::vector<sp<Effect>>& effects) {
+    std::vector<effect_handle_t> handles;
+    handles.reserve(effects.size());
+    for (const auto& effect : effects) {
+        handles.push_back(effect->mHandle);
+    }
+    return handles;
+}
+
+Result EffectChain::prepareForProcessing(StatusMQ::Descriptor* statusMQDesc) {
+    status_t status;
+    // Create message queue.
+    if (mStatusMQ) {
+        ALOGE("the client attempts to call prepareForProcessing twice");
+        return Result::INVALID_STATE;
+    }
+    std::unique_ptr<StatusMQ> tempStatusMQ(new StatusMQ(1, true /*EventFlag*/));
+    if (!tempStatusMQ->isValid()) {
+        ALOGE("status MQ is invalid");
+        return Result::INVALID_ARGUMENTS;
+    }
+    status = EventFlag::createEventFlag(tempStatusMQ->getEventFlagWord(), &mEfGroup);
+    if (status != OK || !mEfGroup) {
+        ALOGE("failed creating event flag for status MQ: %s", strerror(-status));
+        return Result::INVALID_ARGUMENTS;
+    }
+
+    // Create and launch the thread.
+    mProcessThread =
+        new ChainProcessThread(&mStopProcessThread, this, tempStatusMQ.get(), mEfGroup);
+    status = mProcessThread->run("effect_chain", PRIORITY_URGENT_AUDIO);
+    if (status != OK) {
+        ALOGW("failed to start effect chain processing thread: %s", strerror(-status));
+        return Result::INVALID_ARGUMENTS;
+    }
+
+    mStatusMQ = std::move(tempStatusMQ);
+    *statusMQDesc = *mStatusMQ->getDesc();
+    return Result::OK;
+}
+
+Result EffectChain::setProcessBuffers(const AudioBuffer& inBuffer, const AudioBuffer& outBuffer) {
+    AudioBufferManager& manager = AudioBufferManager::getInstance();
+    sp<AudioBufferWrapper> tempInBuffer, tempOutBuffer;
+    if (!manager.wrap(inBuffer, &tempInBuffer)) {
+        ALOGE("Could not map memory of the input buffer");
+        return Result::INVALID_ARGUMENTS;
+    }
+    if (!manager.wrap(outBuffer, &tempOutBuffer)) {
+        ALOGE("Could not map memory of the output buffer");
+        return Result::INVALID_ARGUMENTS;
+    }
+    mInBuffer = tempInBuffer;
+    mOutBuffer = tempOutBuffer;
+    // The processing thread only reads these pointers after waking up by an event flag,
+    // so it's OK to update the pair non-atomically.
+    mHalInBufferPtr.store(mInBuffer->getHalBuffer(), std::memory_order_release);
+    mHalOutBufferPtr.store(mOutBuffer->getHalBuffer(), std::memory_order_release);
+    return Result::OK;
+}
+
+Result EffectChain::process() {
+    // affects both buffer pointers and their contents.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    audio_buffer_t* inBuffer = mHalInBufferPtr.load(std::memory_order_relaxed);
+    audio_buffer_t* outBuffer = mHalOutBufferPtr.load(std::memory_order_relaxed);
+    if (inBuffer == nullptr || outBuffer == nullptr) {
+        ALOGE("processing buffers were not set before calling 'process'");
+        return analyzeProcessResult(-ENODEV);
+    }
+    Result retval = processChain(inBuffer, outBuffer);
+    std::atomic_thread_fence(std::memory_order_release);
+    return retval;
+}
+
+Result EffectChain::processChain(audio_buffer_t* inBuffer, audio_buffer_t* outBuffer) const {
+    audio_buffer_t* source = inBuffer;
+    bool active = false;
+    for (effect_handle_t handle : mHandles) {
+        int32_t processResult = (*handle)->process(handle, source, outBuffer);
+        if (processResult == -ENODATA) continue;  // Inactive, pass the signal through.
+        if (processResult != 0) return analyzeProcessResult(processResult);
+        source = outBuffer;
+        active = true;
+    }
+    return active ? Result::OK : analyzeProcessResult(-ENODATA);
+}
+
+Result EffectChain::close() {
+    if (mIsClosed) return Result::INVALID_STATE;
+    mIsClosed = true;
+    if (mProcessThread.get()) {
+        mStopProcessThread.store(true, std::memory_order_release);
+    }
+    if (mEfGroup) {
+        mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_QUIT));
+    }
+    return Result::OK;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+#define ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+
+#include "Effect.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <fmq/EventFlag.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+// An ordered list of effects sharing one pair of processing buffers and one
+// processing thread. The chain is driven with the same status queue and
+// event flag protocol as a single effect: one REQUEST_PROCESS wakes the
+// thread up, all effects process the buffer in order, and a single status
+// is reported with DONE_PROCESSING.
+//
+// The first active effect reads the input buffer and writes the output
+// buffer, the following effects process the output buffer in place. Inactive
+// effects (-ENODATA) are skipped. If no effect was active the status is
+// INVALID_STATE, as for a single inactive effect. Any other error stops the
+// chain and is reported.
+//
+// The composition of a chain is fixed, to change it create a new chain.
+// Effects of a chain must not be processed through their own queues.
+struct EffectChain : public RefBase {
+    typedef Effect::StatusMQ StatusMQ;
+
+    explicit EffectChain(const std::vector<sp<Effect>>& effects);
+
+    size_t size() const { return mHandles.size(); }
+
+    // Same semantics as IEffect::prepareForProcessing.
+    Result prepareForProcessing(StatusMQ::Descriptor* statusMQDesc);
+    // Same semantics as IEffect::setProcessBuffers.
+    Result setProcessBuffers(const AudioBuffer& inBuffer, const AudioBuffer& outBuffer);
+    // Processes the current buffers once on the calling thread.
+    Result process();
+    Result close();
+
+   private:
+    // Effects are held to keep the handles alive.
+    const std::vector<sp<Effect>> mEffects;
+    const std::vector<effect_handle_t> mHandles;
+    bool mIsClosed;
+    sp<AudioBufferWrapper> mInBuffer;
+    sp<AudioBufferWrapper> mOutBuffer;
+    std::atomic<audio_buffer_t*> mHalInBufferPtr;
+    std::atomic<audio_buffer_t*> mHalOutBufferPtr;
+    std::unique_ptr<StatusMQ> mStatusMQ;
+    EventFlag* mEfGroup;
+    std::atomic<bool> mStopProcessThread;
+    sp<Thread> mProcessThread;
+
+    virtual ~EffectChain();
+
+    static std::vector<effect_handle_t> handlesOf(const std::vector<sp<Effect>>& effects);
+
+    Result processChain(audio_buffer_t* inBuffer, audio_buffer_t* outBuffer) const;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
@@ -32,6 +32,8 @@
 #include "VisualizerEffect.h"
 #include "common/all-versions/default/EffectMap.h"
 
+#include <stdio.h>
+
 #include <android/log.h>
 #include <media/EffectsFactoryApi.h>
 #include <system/audio_effects/effect_aec.h>
@@ -85,10 +87,15 @@ sp<IEffect> EffectsFactory::dispatchEffectInstanceCreation(const effect_descript
     return new Effect(handle);
 }
 
-// Methods from ::android::hardware::audio::effect::CPP_VERSION::IEffectsFactory follow.
-Return<void> EffectsFactory::getAllDescriptors(getAllDescriptors_cb _hidl_cb) {
+const effect_descriptor_t* EffectsFactory::DescriptorCache::find(
+    const effect_uuid_t& uuid) const {
+    auto it = index.find(uuid);
+    return it != index.end() ? &halDescriptors[it->second] : nullptr;
+}
+
+// static
+Result EffectsFactory::queryAllDescriptors(std::vector<effect_descriptor_t>* halDescriptors) {
     Result retval(Result::OK);
-    hidl_vec<EffectDescriptor> result;
     uint32_t numEffects;
     status_t status;
 
@@ -96,17 +103,14 @@ restart:
     numEffects = 0;
     status = EffectQueryNumberEffects(&numEffects);
     if (status != OK) {
-        retval = Result::NOT_INITIALIZED;
         ALOGE("Error querying number of effects: %s", strerror(-status));
-        goto exit;
+        halDescriptors->clear();
+        return Result::NOT_INITIALIZED;
     }
-    result.resize(numEffects);
+    halDescriptors->resize(numEffects);
     for (uint32_t i = 0; i < numEffects; ++i) {
-        effect_descriptor_t halDescriptor;
-        status = EffectQueryEffect(i, &halDescriptor);
-        if (status == OK) {
-            effectDescriptorFromHal(halDescriptor, &result[i]);
-        } else {
+        status = EffectQueryEffect(i, &(*halDescriptors)[i]);
+        if (status != OK) {
             ALOGE("Error querying effect at position %d / %d: %s", i, numEffects,
                   strerror(-status));
             switch (status) {
@@ -116,26 +120,72 @@ restart:
                 }
                 case -ENOENT: {
                     // No more effects available.
-                    result.resize(i);
+                    halDescriptors->resize(i);
                     break;
                 }
                 default: {
-                    result.resize(0);
+                    halDescriptors->clear();
                     retval = Result::NOT_INITIALIZED;
                 }
             }
             break;
         }
     }
+    return retval;
+}
+
+std::shared_ptr<const EffectsFactory::DescriptorCache> EffectsFactory::getDescriptorCache(
+    Result* retval) {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    *retval = Result::OK;
+    if (mCache) return mCache;
 
-exit:
-    _hidl_cb(retval, result);
+    auto cache = std::make_shared<DescriptorCache>();
+    *retval = queryAllDescriptors(&cache->halDescriptors);
+    if (*retval != Result::OK) {
+        // Not cached, the next call retries.
+        return nullptr;
+    }
+    cache->descriptors.resize(cache->halDescriptors.size());
+    cache->index.reserve(cache->halDescriptors.size());
+    for (size_t i = 0; i < cache->halDescriptors.size(); ++i) {
+        effectDescriptorFromHal(cache->halDescriptors[i], &cache->descriptors[i]);
+        cache->index.emplace(cache->halDescriptors[i].uuid, i);
+    }
+    mCache = cache;
+    return mCache;
+}
+
+void EffectsFactory::invalidateDescriptorCache() {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    mCache.reset();
+}
+
+// Methods from ::android::hardware::audio::effect::CPP_VERSION::IEffectsFactory follow.
+Return<void> EffectsFactory::getAllDescriptors(getAllDescriptors_cb _hidl_cb) {
+    Result retval;
+    std::shared_ptr<const DescriptorCache> cache = getDescriptorCache(&retval);
+    if (cache) {
+        _hidl_cb(retval, cache->descriptors);
+    } else {
+        _hidl_cb(retval, hidl_vec<EffectDescriptor>());
+    }
     return Void();
 }
 
 Return<void> EffectsFactory::getDescriptor(const Uuid& uid, getDescriptor_cb _hidl_cb) {
     effect_uuid_t halUuid;
     HidlUtils::uuidToHal(uid, &halUuid);
+    Result cacheRetval;
+    std::shared_ptr<const DescriptorCache> cache = getDescriptorCache(&cacheRetval);
+    if (cache) {
+        const effect_descriptor_t* cached = cache->find(halUuid);
+        if (cached != nullptr) {
+            _hidl_cb(Result::OK, cache->descriptors[cached - &cache->halDescriptors[0]]);
+            return Void();
+        }
+    }
+
     effect_descriptor_t halDescriptor;
     status_t status = EffectGetDescriptor(&halUuid, &halDescriptor);
     EffectDescriptor descriptor;
@@ -164,9 +214,16 @@ Return<void> EffectsFactory::createEffect(const Uuid& uid, int32_t session, int3
     sp<IEffect> effect;
     uint64_t effectId = EffectMap::INVALID_ID;
     if (status == OK) {
+        Result cacheRetval;
+        std::shared_ptr<const DescriptorCache> cache = getDescriptorCache(&cacheRetval);
+        const effect_descriptor_t* cached = cache ? cache->find(halUuid) : nullptr;
         effect_descriptor_t halDescriptor;
-        memset(&halDescriptor, 0, sizeof(effect_descriptor_t));
-        status = (*handle)->get_descriptor(handle, &halDescriptor);
+        if (cached != nullptr) {
+            halDescriptor = *cached;
+        } else {
+            memset(&halDescriptor, 0, sizeof(effect_descriptor_t));
+            status = (*handle)->get_descriptor(handle, &halDescriptor);
+        }
         if (status == OK) {
             effect = dispatchEffectInstanceCreation(halDescriptor, handle);
             effectId = EffectMap::getInstance().add(handle);
@@ -179,6 +236,8 @@ Return<void> EffectsFactory::createEffect(const Uuid& uid, int32_t session, int3
     if (status != OK) {
         ALOGE("Error creating effect %s: %s", uuidToString(halUuid).c_str(), strerror(-status));
         if (status == -ENOENT) {
+            // The effect may have disappeared from a cached table.
+            invalidateDescriptorCache();
             retval = Result::INVALID_ARGUMENTS;
         } else {
             retval = Result::NOT_INITIALIZED;
@@ -196,6 +255,14 @@ Return<void> EffectsFactory::debug(const hidl_handle& fd,
                                    const hidl_vec<hidl_string>& /* options */) {
     if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
         EffectDumpEffects(fd->data[0]);
+        std::lock_guard<std::mutex> lock(mCacheLock);
+        if (mCache) {
+            dprintf(fd->data[0], "Cached effect descriptors: %zu\n",
+                    mCache->descriptors.size());
+        } else {
+            dprintf(fd->data[0], "Effect descriptors not cached\n");
+        }
+        AudioBufferManager::getInstance().dump(fd->data[0]);
     }
     return Void();
 }
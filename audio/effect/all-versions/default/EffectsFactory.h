@@ -29,6 +29,13 @@
 #include <hidl/Status.h>
 
 #include <hidl/MQDescriptor.h>
+
+#include <string.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 namespace android {
 namespace hardware {
 namespace audio {
@@ -55,8 +62,43 @@ struct EffectsFactory : public IEffectsFactory {
     Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
 
    private:
+    struct UuidHash {
+        size_t operator()(const effect_uuid_t& uuid) const {
+            // FNV-1a over the raw bytes
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&uuid);
+            size_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof(effect_uuid_t); ++i) {
+                hash = (hash ^ bytes[i]) * 16777619u;
+            }
+            return hash;
+        }
+    };
+    struct UuidEqual {
+        bool operator()(const effect_uuid_t& a, const effect_uuid_t& b) const {
+            return memcmp(&a, &b, sizeof(effect_uuid_t)) == 0;
+        }
+    };
+    // Descriptors of all effects known to libeffects. The set of effect
+    // libraries is fixed once libeffects has loaded its configuration, so the
+    // table is built on first use and only dropped if an effect from the table
+    // can no longer be created.
+    struct DescriptorCache {
+        std::vector<effect_descriptor_t> halDescriptors;
+        hidl_vec<EffectDescriptor> descriptors;
+        // Implementation UUID to position in the vectors above.
+        std::unordered_map<effect_uuid_t, size_t, UuidHash, UuidEqual> index;
+
+        const effect_descriptor_t* find(const effect_uuid_t& uuid) const;
+    };
+
+    std::mutex mCacheLock;
+    std::shared_ptr<const DescriptorCache> mCache;  // Guarded by mCacheLock.
+
     static sp<IEffect> dispatchEffectInstanceCreation(const effect_descriptor_t& halDescriptor,
                                                       effect_handle_t handle);
+    static Result queryAllDescriptors(std::vector<effect_descriptor_t>* halDescriptors);
+    std::shared_ptr<const DescriptorCache> getDescriptorCache(Result* retval);
+    void invalidateDescriptorCache();
 };
 
 extern "C" IEffectsFactory* HIDL_FETCH_IEffectsFactory(const char* name);
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_EFFECT_INLINEBUFFER_H
+#define ANDROID_HARDWARE_AUDIO_EFFECT_INLINEBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+/**
+ * Zero-initialized byte buffer which is stored inline (usually on the stack)
+ * when it fits in InlineSize bytes, and only uses the heap for larger sizes.
+ * A heap allocation is kept and reused by later resize() calls, so a buffer
+ * reused across a batch allocates at most once.
+ */
+template <size_t InlineSize>
+class InlineBuffer {
+   public:
+    InlineBuffer() : mData(mInline), mSize(0), mHeapSize(0) {}
+    explicit InlineBuffer(size_t size) : InlineBuffer() { resize(size); }
+    InlineBuffer(const InlineBuffer&) = delete;
+    InlineBuffer& operator=(const InlineBuffer&) = delete;
+
+    // Contents are not preserved.
+    void resize(size_t size) {
+        if (size > InlineSize) {
+            if (size > mHeapSize) {
+                mHeap.reset(new uint8_t[size]);
+                mHeapSize = size;
+            }
+            mData = mHeap.get();
+        } else {
+            mData = mInline;
+        }
+        mSize = size;
+        memset(mData, 0, mSize);
+    }
+
+    uint8_t* data() { return mSize > 0 ? mData : nullptr; }
+    const uint8_t* data() const { return mSize > 0 ? mData : nullptr; }
+    size_t size() const { return mSize; }
+
+   private:
+    alignas(max_align_t) uint8_t mInline[InlineSize];
+    uint8_t* mData;
+    size_t mSize;
+    std::unique_ptr<uint8_t[]> mHeap;
+    size_t mHeapSize;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_EFFECT_INLINEBUFFER_H
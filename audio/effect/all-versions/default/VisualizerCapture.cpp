@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Visualizer_HAL"
+
+#include "VisualizerCapture.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+// Level reported for silence by the visualizer library.
+constexpr int32_t kMinLevelMb = -9600;
+
+static_assert((VisualizerCapture::kRingFrames & (VisualizerCapture::kRingFrames - 1)) == 0,
+              "the ring size must be a power of two");
+
+}  // namespace
+
+void computePeakAndRmsScalar(const float* samples, size_t count, float* peak, float* rms) {
+    float maxAbs = 0;
+    double sumSquares = 0;
+    for (size_t i = 0; i < count; ++i) {
+        maxAbs = std::max(maxAbs, fabsf(samples[i]));
+        sumSquares += samples[i] * samples[i];
+    }
+    *peak = maxAbs;
+    *rms = count != 0 ? sqrtf(sumSquares / count) : 0;
+}
+
+void computePeakAndRms(const float* samples, size_t count, float* peak, float* rms) {
+    size_t i = 0;
+    float maxAbs = 0;
+    float sumSquares = 0;
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+    float32x4_t maxAbs4 = vdupq_n_f32(0);
+    float32x4_t sum4 = vdupq_n_f32(0);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t x = vld1q_f32(samples + i);
+        maxAbs4 = vmaxq_f32(maxAbs4, vabsq_f32(x));
+        sum4 = vmlaq_f32(sum4, x, x);
+    }
+    float lanes[4];
+    vst1q_f32(lanes, maxAbs4);
+    maxAbs = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    vst1q_f32(lanes, sum4);
+    sumSquares = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 maxAbs4 = _mm_setzero_ps();
+    __m128 sum4 = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(samples + i);
+        maxAbs4 = _mm_max_ps(maxAbs4, _mm_and_ps(x, absMask));
+        sum4 = _mm_add_ps(sum4, _mm_mul_ps(x, x));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, maxAbs4);
+    maxAbs = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, sum4);
+    sumSquares = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < count; ++i) {
+        maxAbs = std::max(maxAbs, fabsf(samples[i]));
+        sumSquares += samples[i] * samples[i];
+    }
+    *peak = maxAbs;
+    *rms = count != 0 ? sqrtf(sumSquares / count) : 0;
+}
+
+int32_t levelToMillibels(float level) {
+    if (level <= 0) return kMinLevelMb;
+    return std::max(kMinLevelMb, static_cast<int32_t>(2000 * log10f(level)));
+}
+
+VisualizerCapture::VisualizerCapture()
+    : mFormat(AUDIO_FORMAT_PCM_FLOAT),
+      mChannelCount(2),
+      mSampleRate(48000),
+      mWritten(0),
+      mLastWriteTime(0),
+      mRing(new float[kRingFrames]()) {}
+
+void VisualizerCapture::setInputConfig(audio_format_t format, uint32_t channelCount,
+                                       uint32_t sampleRate) {
+    if (format != AUDIO_FORMAT_DEFAULT) mFormat.store(format, std::memory_order_relaxed);
+    if (channelCount != 0) mChannelCount.store(channelCount, std::memory_order_relaxed);
+    if (sampleRate != 0) mSampleRate.store(sampleRate, std::memory_order_relaxed);
+}
+
+void VisualizerCapture::onProcessed(const audio_buffer_t* inBuffer,
+                                    const audio_buffer_t* /*outBuffer*/) {
+    const audio_format_t format = mFormat.load(std::memory_order_relaxed);
+    const uint32_t channelCount = mChannelCount.load(std::memory_order_relaxed);
+    if (format != AUDIO_FORMAT_PCM_FLOAT && format != AUDIO_FORMAT_PCM_16_BIT) return;
+    const float scale = 1.0f / channelCount / (format == AUDIO_FORMAT_PCM_16_BIT ? 32768 : 1);
+    uint64_t written = mWritten.load(std::memory_order_relaxed);
+    for (size_t frame = 0; frame < inBuffer->frameCount; ++frame) {
+        // Channels are mixed down to mono.
+        float sum = 0;
+        for (uint32_t channel = 0; channel < channelCount; ++channel) {
+            size_t sample = frame * channelCount + channel;
+            sum += format == AUDIO_FORMAT_PCM_FLOAT ? inBuffer->f32[sample]
+                                                    : inBuffer->s16[sample];
+        }
+        mRing[written++ & (kRingFrames - 1)] = sum * scale;
+    }
+    mWritten.store(written, std::memory_order_release);
+    mLastWriteTime.store(systemTime(SYSTEM_TIME_MONOTONIC), std::memory_order_relaxed);
+}
+
+bool VisualizerCapture::readLatest(float* samples, size_t count, nsecs_t maxAgeNs) const {
+    if (count > kRingFrames) return false;
+    if (systemTime(SYSTEM_TIME_MONOTONIC) - mLastWriteTime.load(std::memory_order_relaxed) >
+        maxAgeNs) {
+        return false;
+    }
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        const uint64_t end = mWritten.load(std::memory_order_acquire);
+        if (end < count) return false;
+        const size_t offset = (end - count) & (kRingFrames - 1);
+        const size_t first = std::min(count, kRingFrames - offset);
+        memcpy(samples, &mRing[offset], first * sizeof(float));
+        memcpy(samples + first, &mRing[0], (count - first) * sizeof(float));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The copy is valid if the writer has not wrapped over it meanwhile.
+        if (mWritten.load(std::memory_order_relaxed) - (end - count) <= kRingFrames) return true;
+    }
+    return false;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
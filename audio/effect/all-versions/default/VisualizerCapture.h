@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_EFFECT_VISUALIZERCAPTURE_H
+#define ANDROID_HARDWARE_AUDIO_EFFECT_VISUALIZERCAPTURE_H
+
+#include "Effect.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include <system/audio.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+// Peak and RMS of the samples, as linear levels.
+void computePeakAndRms(const float* samples, size_t count, float* peak, float* rms);
+// Reference implementation of the above, without vector instructions.
+void computePeakAndRmsScalar(const float* samples, size_t count, float* peak, float* rms);
+// Level in millibels, as reported by the visualizer measurements.
+int32_t levelToMillibels(float level);
+
+// Ring of the last mono samples seen by the processing thread of a visualizer
+// effect. The processing thread is the only writer and never blocks; readers
+// copy the most recent samples and retry if they were overwritten meanwhile.
+class VisualizerCapture : public Effect::ProcessTap {
+   public:
+    // Must hold the largest capture size and measurement window.
+    static constexpr size_t kRingFrames = 32768;
+
+    VisualizerCapture();
+
+    void setInputConfig(audio_format_t format, uint32_t channelCount, uint32_t sampleRate);
+    uint32_t getSampleRate() const { return mSampleRate.load(std::memory_order_relaxed); }
+
+    // Copies the latest count samples. Fails if not enough samples have been
+    // captured, or if the last ones are older than maxAgeNs.
+    bool readLatest(float* samples, size_t count, nsecs_t maxAgeNs) const;
+
+    void onProcessed(const audio_buffer_t* inBuffer, const audio_buffer_t* outBuffer) override;
+
+   private:
+    std::atomic<audio_format_t> mFormat;
+    std::atomic<uint32_t> mChannelCount;
+    std::atomic<uint32_t> mSampleRate;
+    std::atomic<uint64_t> mWritten;
+    std::atomic<nsecs_t> mLastWriteTime;
+    std::unique_ptr<float[]> mRing;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_EFFECT_VISUALIZERCAPTURE_H
@@ -18,6 +18,9 @@
 
 #include "VisualizerEffect.h"
 
+#include <math.h>
+#include <algorithm>
+
 #include <android/log.h>
 #include <system/audio_effects/effect_visualizer.h>
 
@@ -31,7 +34,14 @@ namespace CPP_VERSION {
 namespace implementation {
 
 VisualizerEffect::VisualizerEffect(effect_handle_t handle)
-    : mEffect(new Effect(handle)), mCaptureSize(0), mMeasurementMode(MeasurementMode::NONE) {}
+    : mEffect(new Effect(handle)),
+      mCapture(new VisualizerCapture()),
+      mCaptureSize(0),
+      mScalingMode(ScalingMode::NORMALIZED),
+      mMeasurementMode(MeasurementMode::NONE),
+      mScratch(new float[VisualizerCapture::kRingFrames]) {
+    mEffect->setProcessTap(std::unique_ptr<Effect::ProcessTap>(mCapture));
+}
 
 VisualizerEffect::~VisualizerEffect() {}
 
@@ -43,7 +53,19 @@ Return<Result> VisualizerEffect::init() {
 Return<Result> VisualizerEffect::setConfig(
     const EffectConfig& config, const sp<IEffectBufferProviderCallback>& inputBufferProvider,
     const sp<IEffectBufferProviderCallback>& outputBufferProvider) {
-    return mEffect->setConfig(config, inputBufferProvider, outputBufferProvider);
+    Result retval = mEffect->setConfig(config, inputBufferProvider, outputBufferProvider);
+    if (retval == Result::OK) {
+        const EffectBufferConfig& input = config.inputCfg;
+        mCapture->setInputConfig(
+            input.mask & EffectConfigParameters::FORMAT ? static_cast<audio_format_t>(input.format)
+                                                        : AUDIO_FORMAT_DEFAULT,
+            input.mask & EffectConfigParameters::CHANNELS
+                ? audio_channel_count_from_out_mask(
+                      static_cast<audio_channel_mask_t>(input.channels))
+                : 0,
+            input.mask & EffectConfigParameters::SMP_RATE ? input.samplingRateHz : 0);
+    }
+    return retval;
 }
 
 Return<Result> VisualizerEffect::reset() {
@@ -180,7 +202,12 @@ Return<void> VisualizerEffect::getCaptureSize(getCaptureSize_cb _hidl_cb) {
 }
 
 Return<Result> VisualizerEffect::setScalingMode(IVisualizerEffect::ScalingMode scalingMode) {
-    return mEffect->setParam(VISUALIZER_PARAM_SCALING_MODE, static_cast<int32_t>(scalingMode));
+    Result retval =
+        mEffect->setParam(VISUALIZER_PARAM_SCALING_MODE, static_cast<int32_t>(scalingMode));
+    if (retval == Result::OK) {
+        mScalingMode = scalingMode;
+    }
+    return retval;
 }
 
 Return<void> VisualizerEffect::getScalingMode(getScalingMode_cb _hidl_cb) {
@@ -220,11 +247,15 @@ Return<void> VisualizerEffect::capture(capture_cb _hidl_cb) {
         _hidl_cb(Result::NOT_INITIALIZED, hidl_vec<uint8_t>());
         return Void();
     }
+    hidl_vec<uint8_t> capture;
+    if (captureFromRing(&capture)) {
+        _hidl_cb(Result::OK, capture);
+        return Void();
+    }
     uint32_t halCaptureSize = mCaptureSize;
     uint8_t halCapture[mCaptureSize];
     Result retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_CAPTURE, "VISUALIZER_CAPTURE",
                                                       &halCaptureSize, halCapture);
-    hidl_vec<uint8_t> capture;
     if (retval == Result::OK) {
         capture.setToExternal(&halCapture[0], halCaptureSize);
     }
@@ -237,11 +268,16 @@ Return<void> VisualizerEffect::measure(measure_cb _hidl_cb) {
         _hidl_cb(Result::NOT_INITIALIZED, Measurement());
         return Void();
     }
+    Measurement measurement = {.mode = MeasurementMode::PEAK_RMS};
+    if (measureFromRing(&measurement.value.peakAndRms.peakMb,
+                        &measurement.value.peakAndRms.rmsMb)) {
+        _hidl_cb(Result::OK, measurement);
+        return Void();
+    }
     int32_t halMeasurement[MEASUREMENT_COUNT];
     uint32_t halMeasurementSize = sizeof(halMeasurement);
     Result retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_MEASURE, "VISUALIZER_MEASURE",
                                                       &halMeasurementSize, halMeasurement);
-    Measurement measurement = {.mode = MeasurementMode::PEAK_RMS};
     measurement.value.peakAndRms.peakMb = 0;
     measurement.value.peakAndRms.rmsMb = 0;
     if (retval == Result::OK) {
@@ -252,6 +288,40 @@ Return<void> VisualizerEffect::measure(measure_cb _hidl_cb) {
     return Void();
 }
 
+bool VisualizerEffect::captureFromRing(hidl_vec<uint8_t>* capture) {
+    std::lock_guard<std::mutex> lock(mScratchLock);
+    float* samples = mScratch.get();
+    if (!mCapture->readLatest(samples, mCaptureSize, kMaxCaptureAgeNs)) return false;
+    float gain = 1;
+    if (mScalingMode == ScalingMode::NORMALIZED) {
+        // Scale the loudest sample to full scale, as the library does.
+        float peak, rms;
+        computePeakAndRms(samples, mCaptureSize, &peak, &rms);
+        if (peak > 0) gain = 1 / peak;
+    }
+    capture->resize(mCaptureSize);
+    for (size_t i = 0; i < mCaptureSize; ++i) {
+        // 8 bit unsigned samples, centered on 0x80.
+        long sample = lrintf(samples[i] * gain * 128) + 128;
+        (*capture)[i] = static_cast<uint8_t>(std::min(255L, std::max(0L, sample)));
+    }
+    return true;
+}
+
+bool VisualizerEffect::measureFromRing(int32_t* peakMb, int32_t* rmsMb) {
+    const size_t windowFrames =
+        std::min<size_t>(VisualizerCapture::kRingFrames,
+                         mCapture->getSampleRate() * kMeasurementWindowMs / 1000);
+    std::lock_guard<std::mutex> lock(mScratchLock);
+    float* samples = mScratch.get();
+    if (!mCapture->readLatest(samples, windowFrames, kMaxCaptureAgeNs)) return false;
+    float peak, rms;
+    computePeakAndRms(samples, windowFrames, &peak, &rms);
+    *peakMb = levelToMillibels(peak);
+    *rmsMb = levelToMillibels(rms);
+    return true;
+}
+
 }  // namespace implementation
 }  // namespace CPP_VERSION
 }  // namespace effect
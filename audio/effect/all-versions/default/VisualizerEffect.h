@@ -20,6 +20,10 @@
 #include PATH(android/hardware/audio/effect/FILE_VERSION/IVisualizerEffect.h)
 
 #include "Effect.h"
+#include "VisualizerCapture.h"
+
+#include <memory>
+#include <mutex>
 
 #include <hidl/Status.h>
 
@@ -103,11 +107,25 @@ struct VisualizerEffect : public IVisualizerEffect {
     Return<void> measure(measure_cb _hidl_cb) override;
 
    private:
+    // Captured samples older than this are not used, the library is queried instead.
+    static constexpr nsecs_t kMaxCaptureAgeNs = 1000000000;
+    // Duration over which peak and RMS are measured.
+    static constexpr uint32_t kMeasurementWindowMs = 500;
+
     sp<Effect> mEffect;
+    // Owned by mEffect, fed by its processing thread.
+    VisualizerCapture* mCapture;
     uint16_t mCaptureSize;
+    ScalingMode mScalingMode;
     MeasurementMode mMeasurementMode;
+    std::mutex mScratchLock;
+    std::unique_ptr<float[]> mScratch;
 
     virtual ~VisualizerEffect();
+
+    // Capture and measurement from the samples seen by the processing thread.
+    bool captureFromRing(hidl_vec<uint8_t>* capture);
+    bool measureFromRing(int32_t* peakMb, int32_t* rmsMb);
 };
 
 }  // namespace implementation
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Processing of a buffer by a chain of stub effects: one processing thread
+// handshake per effect versus a single handshake for an EffectChain.
+
+#include <benchmark/benchmark.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+
+#include "EffectChain.h"
+
+using namespace ::android::hardware::audio::effect::CPP_VERSION::implementation;
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_memory;
+
+namespace {
+
+constexpr size_t kChainLength = 5;
+constexpr uint32_t kFrameCount = 192;  // 4 ms at 48 kHz.
+constexpr uint32_t kChannelCount = 2;
+
+// A stub effect applying a gain to a stereo float buffer.
+struct StubEffect {
+    const effect_interface_s* itfe;
+    float gain;
+};
+
+int32_t stubProcess(effect_handle_t self, audio_buffer_t* inBuffer, audio_buffer_t* outBuffer) {
+    const StubEffect* effect = reinterpret_cast<StubEffect*>(self);
+    const size_t samples = inBuffer->frameCount * kChannelCount;
+    for (size_t i = 0; i < samples; ++i) {
+        outBuffer->f32[i] = inBuffer->f32[i] * effect->gain;
+    }
+    return 0;
+}
+
+int32_t stubCommand(effect_handle_t, uint32_t, uint32_t, void*, uint32_t*, void*) {
+    return -EINVAL;
+}
+
+const effect_interface_s kStubInterface = {
+    .process = stubProcess,
+    .command = stubCommand,
+    .get_descriptor = nullptr,
+    .process_reverse = nullptr,
+};
+
+AudioBuffer makeBuffer(uint64_t id) {
+    const size_t size = kFrameCount * kChannelCount * sizeof(float);
+    native_handle_t* handle = native_handle_create(1, 0);
+    handle->data[0] = ashmem_create_region("EffectChainBenchmark", size);
+    AudioBuffer buffer;
+    buffer.id = id;
+    buffer.frameCount = kFrameCount;
+    buffer.data = hidl_memory("ashmem", handle, size);
+    return buffer;
+}
+
+// A client side of a status queue and its event flag.
+struct ProcessingClient {
+    explicit ProcessingClient(const Effect::StatusMQ::Descriptor& desc)
+        : statusMQ(new Effect::StatusMQ(desc)), efGroup(nullptr) {
+        EventFlag::createEventFlag(statusMQ->getEventFlagWord(), &efGroup);
+    }
+    ~ProcessingClient() { EventFlag::deleteEventFlag(&efGroup); }
+
+    Result process() {
+        efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS));
+        uint32_t efState = 0;
+        do {
+            efGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING), &efState);
+        } while (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING)));
+        Result retval = Result::NOT_INITIALIZED;
+        statusMQ->read(&retval);
+        return retval;
+    }
+
+    std::unique_ptr<Effect::StatusMQ> statusMQ;
+    EventFlag* efGroup;
+};
+
+struct ChainFixture {
+    ChainFixture() : inBuffer(makeBuffer(1)), outBuffer(makeBuffer(2)) {
+        for (size_t i = 0; i < kChainLength; ++i) {
+            stubs[i] = {&kStubInterface, 0.9f};
+            effects.push_back(new Effect(reinterpret_cast<effect_handle_t>(&stubs[i])));
+        }
+    }
+
+    StubEffect stubs[kChainLength];
+    std::vector<sp<Effect>> effects;
+    AudioBuffer inBuffer;
+    AudioBuffer outBuffer;
+};
+
+// CPU time of all threads, including the processing ones.
+double processCpuUs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+}  // namespace
+
+// Every effect runs its own processing thread, the client wakes them up one by one.
+static void BM_Process_PerEffect(benchmark::State& state) {
+    ChainFixture f;
+    std::vector<std::unique_ptr<ProcessingClient>> clients;
+    for (size_t i = 0; i < kChainLength; ++i) {
+        const sp<Effect>& effect = f.effects[i];
+        effect->setProcessBuffers(i == 0 ? f.inBuffer : f.outBuffer, f.outBuffer);
+        effect->prepareForProcessing([&](Result retval, const Effect::StatusMQ::Descriptor& desc) {
+            if (retval == Result::OK) clients.emplace_back(new ProcessingClient(desc));
+        });
+    }
+    if (clients.size() != kChainLength) {
+        state.SkipWithError("could not prepare effects for processing");
+        return;
+    }
+    double cpuStartUs = processCpuUs();
+    for (auto _ : state) {
+        for (auto& client : clients) {
+            benchmark::DoNotOptimize(client->process());
+        }
+    }
+    state.counters["wakeups_per_buffer"] = kChainLength;
+    state.counters["cpu_us_per_buffer"] = benchmark::Counter(
+        processCpuUs() - cpuStartUs, benchmark::Counter::kAvgIterations);
+    for (const auto& effect : f.effects) effect->close();
+}
+BENCHMARK(BM_Process_PerEffect);
+
+// All effects run on the chain's processing thread after a single wake up.
+static void BM_Process_Chain(benchmark::State& state) {
+    ChainFixture f;
+    sp<EffectChain> chain = new EffectChain(f.effects);
+    chain->setProcessBuffers(f.inBuffer, f.outBuffer);
+    Effect::StatusMQ::Descriptor desc;
+    if (chain->prepareForProcessing(&desc) != Result::OK) {
+        state.SkipWithError("could not prepare the chain for processing");
+        return;
+    }
+    ProcessingClient client(desc);
+    double cpuStartUs = processCpuUs();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client.process());
+    }
+    state.counters["wakeups_per_buffer"] = 1;
+    state.counters["cpu_us_per_buffer"] = benchmark::Counter(
+        processCpuUs() - cpuStartUs, benchmark::Counter::kAvgIterations);
+    chain->close();
+}
+BENCHMARK(BM_Process_Chain);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Parameter get/set round trips through Effect against a stub effect_handle_t.
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <vector>
+
+#include "Effect.h"
+
+using namespace ::android::hardware::audio::effect::CPP_VERSION::implementation;
+using ::android::sp;
+
+namespace {
+
+constexpr size_t kRoundTrips = 10000;
+constexpr size_t kBatchSize = 10;
+constexpr uint32_t kParamCount = 16;
+
+// A stub effect holding int32_t parameters indexed by parameter id.
+struct StubEffect {
+    const effect_interface_s* itfe;
+    int32_t values[kParamCount];
+};
+
+size_t valueOffset(const effect_param_t* param) {
+    return (param->psize + sizeof(int32_t) - 1) / sizeof(int32_t) * sizeof(int32_t);
+}
+
+int32_t stubCommand(effect_handle_t self, uint32_t cmdCode, uint32_t /*cmdSize*/, void* pCmdData,
+                    uint32_t* replySize, void* pReplyData) {
+    StubEffect* effect = reinterpret_cast<StubEffect*>(self);
+    const effect_param_t* cmd = static_cast<const effect_param_t*>(pCmdData);
+    uint32_t paramId = *reinterpret_cast<const uint32_t*>(cmd->data) % kParamCount;
+    switch (cmdCode) {
+        case EFFECT_CMD_SET_PARAM:
+            memcpy(&effect->values[paramId], cmd->data + valueOffset(cmd), sizeof(int32_t));
+            *static_cast<int32_t*>(pReplyData) = 0;
+            return 0;
+        case EFFECT_CMD_GET_PARAM: {
+            effect_param_t* reply = static_cast<effect_param_t*>(pReplyData);
+            size_t offset = valueOffset(cmd);
+            memcpy(reply, cmd, sizeof(effect_param_t) + cmd->psize);
+            reply->status = 0;
+            reply->vsize = sizeof(int32_t);
+            memcpy(reply->data + offset, &effect->values[paramId], sizeof(int32_t));
+            *replySize = sizeof(effect_param_t) + offset + sizeof(int32_t);
+            return 0;
+        }
+        default:
+            return -EINVAL;
+    }
+}
+
+const effect_interface_s kStubInterface = {
+    .process = nullptr,
+    .command = stubCommand,
+    .get_descriptor = nullptr,
+    .process_reverse = nullptr,
+};
+
+struct StubEffectFixture {
+    StubEffectFixture() : stub{&kStubInterface, {}} {
+        effect = new Effect(reinterpret_cast<effect_handle_t>(&stub));
+    }
+    StubEffect stub;
+    sp<Effect> effect;
+};
+
+// The previous marshalling: a heap allocated buffer for every command.
+std::vector<uint8_t> legacyParameterToHal(uint32_t paramId, const int32_t* value) {
+    std::vector<uint8_t> buffer(sizeof(effect_param_t) + 2 * sizeof(int32_t), 0);
+    effect_param_t* param = reinterpret_cast<effect_param_t*>(&buffer[0]);
+    param->psize = sizeof(uint32_t);
+    param->vsize = sizeof(int32_t);
+    memcpy(param->data, &paramId, sizeof(uint32_t));
+    if (value) memcpy(param->data + sizeof(uint32_t), value, sizeof(int32_t));
+    return buffer;
+}
+
+}  // namespace
+
+static void BM_ParameterRoundTrip_Legacy(benchmark::State& state) {
+    StubEffectFixture f;
+    effect_handle_t handle = reinterpret_cast<effect_handle_t>(&f.stub);
+    for (auto _ : state) {
+        for (size_t i = 0; i < kRoundTrips; ++i) {
+            uint32_t paramId = i % kParamCount;
+            int32_t value = i;
+            std::vector<uint8_t> setCmd = legacyParameterToHal(paramId, &value);
+            int32_t status;
+            uint32_t replySize = sizeof(status);
+            (*handle)->command(handle, EFFECT_CMD_SET_PARAM, setCmd.size(), &setCmd[0], &replySize,
+                               &status);
+            std::vector<uint8_t> getCmd = legacyParameterToHal(paramId, nullptr);
+            std::vector<uint8_t> getReply = legacyParameterToHal(paramId, nullptr);
+            replySize = getReply.size();
+            (*handle)->command(handle, EFFECT_CMD_GET_PARAM, getCmd.size(), &getCmd[0], &replySize,
+                               &getReply[0]);
+            benchmark::DoNotOptimize(getReply.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kRoundTrips);
+}
+BENCHMARK(BM_ParameterRoundTrip_Legacy);
+
+static void BM_ParameterRoundTrip(benchmark::State& state) {
+    StubEffectFixture f;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kRoundTrips; ++i) {
+            uint32_t paramId = i % kParamCount;
+            int32_t value = i;
+            f.effect->setParam(paramId, value);
+            f.effect->getParam(paramId, value);
+            benchmark::DoNotOptimize(value);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kRoundTrips);
+}
+BENCHMARK(BM_ParameterRoundTrip);
+
+static void BM_ParameterRoundTrip_Batched(benchmark::State& state) {
+    StubEffectFixture f;
+    uint32_t paramIds[kBatchSize];
+    int32_t values[kBatchSize];
+    Effect::ParameterRef params[kBatchSize];
+    for (size_t i = 0; i < kBatchSize; ++i) {
+        paramIds[i] = i;
+        values[i] = i;
+        params[i] = {sizeof(uint32_t), &paramIds[i], sizeof(int32_t), &values[i]};
+    }
+    for (auto _ : state) {
+        for (size_t i = 0; i < kRoundTrips; i += kBatchSize) {
+            f.effect->setParametersImpl(params, kBatchSize);
+            f.effect->getParametersImpl(params, kBatchSize,
+                                        [&](size_t index, uint32_t, const void* valueData) {
+                                            memcpy(&values[index], valueData, sizeof(int32_t));
+                                        });
+        }
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * kRoundTrips);
+}
+BENCHMARK(BM_ParameterRoundTrip_Batched);
+
+BENCHMARK_MAIN();
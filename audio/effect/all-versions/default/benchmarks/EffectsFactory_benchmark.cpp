@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Cold (first call on a new factory) and warm (cached) descriptor query
+// latency of EffectsFactory, using the effect libraries configured on the device.
+
+#include <benchmark/benchmark.h>
+
+#include "EffectsFactory.h"
+
+using namespace ::android::hardware::audio::effect::CPP_VERSION::implementation;
+using ::android::sp;
+
+namespace {
+
+hidl_vec<EffectDescriptor> getAll(const sp<EffectsFactory>& factory) {
+    hidl_vec<EffectDescriptor> descriptors;
+    factory->getAllDescriptors([&](Result, const hidl_vec<EffectDescriptor>& result) {
+        descriptors = result;
+    });
+    return descriptors;
+}
+
+}  // namespace
+
+static void BM_GetAllDescriptors_Cold(benchmark::State& state) {
+    for (auto _ : state) {
+        sp<EffectsFactory> factory = new EffectsFactory();
+        benchmark::DoNotOptimize(getAll(factory));
+    }
+}
+BENCHMARK(BM_GetAllDescriptors_Cold);
+
+static void BM_GetAllDescriptors_Warm(benchmark::State& state) {
+    sp<EffectsFactory> factory = new EffectsFactory();
+    getAll(factory);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(getAll(factory));
+    }
+}
+BENCHMARK(BM_GetAllDescriptors_Warm);
+
+// Looks up every effect by UUID.
+static void BM_GetDescriptor(benchmark::State& state) {
+    const bool warm = state.range(0);
+    sp<EffectsFactory> factory = new EffectsFactory();
+    hidl_vec<EffectDescriptor> all = getAll(factory);
+    for (auto _ : state) {
+        if (!warm) {
+            state.PauseTiming();
+            factory = new EffectsFactory();
+            state.ResumeTiming();
+        }
+        for (const auto& descriptor : all) {
+            factory->getDescriptor(descriptor.uuid, [](Result, const EffectDescriptor& d) {
+                benchmark::DoNotOptimize(d);
+            });
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * all.size());
+}
+BENCHMARK(BM_GetDescriptor)->Arg(false)->Arg(true);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Visualizer capture ring reads and peak/RMS measurement, from the capture
+// sizes allowed by IVisualizerEffect up to a 500 ms measurement window.
+
+#include <benchmark/benchmark.h>
+
+#include <math.h>
+#include <memory>
+#include <vector>
+
+#include "VisualizerCapture.h"
+
+using namespace ::android::hardware::audio::effect::CPP_VERSION::implementation;
+
+namespace {
+
+constexpr size_t kChannelCount = 2;
+constexpr size_t kFramesPerBuffer = 960;  // 20 ms at 48 kHz.
+constexpr nsecs_t kMaxAgeNs = 1000000000;
+
+std::vector<float> makeSine(size_t count) {
+    std::vector<float> samples(count);
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = 0.5f * sinf(i * 0.05f);
+    }
+    return samples;
+}
+
+void fillCapture(VisualizerCapture* capture) {
+    std::vector<float> interleaved = makeSine(kFramesPerBuffer * kChannelCount);
+    audio_buffer_t buffer = {kFramesPerBuffer, {interleaved.data()}};
+    capture->setInputConfig(AUDIO_FORMAT_PCM_FLOAT, kChannelCount, 48000);
+    for (size_t written = 0; written < VisualizerCapture::kRingFrames;
+         written += kFramesPerBuffer) {
+        capture->onProcessed(&buffer, &buffer);
+    }
+}
+
+}  // namespace
+
+static void BM_Measure_Scalar(benchmark::State& state) {
+    std::vector<float> samples = makeSine(state.range(0));
+    float peak, rms;
+    for (auto _ : state) {
+        computePeakAndRmsScalar(samples.data(), samples.size(), &peak, &rms);
+        benchmark::DoNotOptimize(peak);
+        benchmark::DoNotOptimize(rms);
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(BM_Measure_Scalar)->RangeMultiplier(2)->Range(128, 1024)->Arg(24000);
+
+static void BM_Measure_Vectorized(benchmark::State& state) {
+    std::vector<float> samples = makeSine(state.range(0));
+    float peak, rms;
+    for (auto _ : state) {
+        computePeakAndRms(samples.data(), samples.size(), &peak, &rms);
+        benchmark::DoNotOptimize(peak);
+        benchmark::DoNotOptimize(rms);
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(BM_Measure_Vectorized)->RangeMultiplier(2)->Range(128, 1024)->Arg(24000);
+
+static void BM_CaptureRing_Read(benchmark::State& state) {
+    std::unique_ptr<VisualizerCapture> capture(new VisualizerCapture());
+    fillCapture(capture.get());
+    std::vector<float> samples(state.range(0));
+    for (auto _ : state) {
+        if (!capture->readLatest(samples.data(), samples.size(), kMaxAgeNs)) {
+            state.SkipWithError("the capture ring is empty");
+            break;
+        }
+        benchmark::DoNotOptimize(samples.data());
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(BM_CaptureRing_Read)->RangeMultiplier(2)->Range(128, 1024)->Arg(24000);
+
+static void BM_CaptureRing_Write(benchmark::State& state) {
+    std::unique_ptr<VisualizerCapture> capture(new VisualizerCapture());
+    capture->setInputConfig(AUDIO_FORMAT_PCM_FLOAT, kChannelCount, 48000);
+    std::vector<float> interleaved = makeSine(kFramesPerBuffer * kChannelCount);
+    audio_buffer_t buffer = {kFramesPerBuffer, {interleaved.data()}};
+    for (auto _ : state) {
+        capture->onProcessed(&buffer, &buffer);
+    }
+    state.SetItemsProcessed(state.iterations() * kFramesPerBuffer);
+}
+BENCHMARK(BM_CaptureRing_Write);
+
+BENCHMARK_MAIN();
@@ -18,7 +18,9 @@
 
 #define LOG_TAG "CamComm1.0-MD"
 #include <log/log.h>
+#include <stdint.h>
 #include <utils/Errors.h>
+#include <utility>
 
 #include "CameraMetadata.h"
 #include "VendorTagDescriptor.h"
@@ -33,28 +35,45 @@ namespace helper {
 #define ALIGN_TO(val, alignment) \
     (((uintptr_t)(val) + ((alignment) - 1)) & ~((alignment) - 1))
 
+namespace {
+const uint32_t kEmptyTagIndexSlot = UINT32_MAX;
+const size_t kMinTagIndexSize = 16;
+
+inline size_t tagIndexHash(uint32_t tag) {
+    // Tags are (section << 16 | index); mix both halves into the low bits
+    uint32_t h = (tag ^ (tag >> 16)) * 0x9E3779B1u;
+    return h ^ (h >> 15);
+}
+} // anonymous namespace
+
 CameraMetadata::CameraMetadata() :
-        mBuffer(NULL), mLocked(false) {
+        mBuffer(NULL), mLocked(false), mTagIndexEnabled(false), mTagIndexDirty(true) {
 }
 
 CameraMetadata::CameraMetadata(size_t entryCapacity, size_t dataCapacity) :
-        mLocked(false)
+        mLocked(false), mTagIndexEnabled(false), mTagIndexDirty(true)
 {
     mBuffer = allocate_camera_metadata(entryCapacity, dataCapacity);
 }
 
 CameraMetadata::CameraMetadata(const CameraMetadata &other) :
-        mLocked(false) {
+        mLocked(false), mTagIndexEnabled(other.mTagIndexEnabled),
+        mTagIndexDirty(other.mTagIndexDirty) {
+    // Cloning preserves entry order, so the source index stays valid
     mBuffer = clone_camera_metadata(other.mBuffer);
+    if (!mTagIndexDirty) {
+        mTagIndex = other.mTagIndex;
+    }
 }
 
 CameraMetadata::CameraMetadata(camera_metadata_t *buffer) :
-        mBuffer(NULL), mLocked(false) {
+        mBuffer(NULL), mLocked(false), mTagIndexEnabled(false), mTagIndexDirty(true) {
     acquire(buffer);
 }
 
 CameraMetadata &CameraMetadata::operator=(const CameraMetadata &other) {
-    return operator=(other.mBuffer);
+    operator=(other.mBuffer);
+    return *this;
 }
 
 CameraMetadata &CameraMetadata::operator=(const camera_metadata_t *buffer) {
@@ -67,6 +86,7 @@ CameraMetadata &CameraMetadata::operator=(const camera_metadata_t *buffer) {
         camera_metadata_t *newBuffer = clone_camera_metadata(buffer);
         clear();
         mBuffer = newBuffer;
+        refreshTagIndex();
     }
     return *this;
 }
@@ -102,6 +122,7 @@ camera_metadata_t* CameraMetadata::release() {
     }
     camera_metadata_t *released = mBuffer;
     mBuffer = NULL;
+    refreshTagIndex();
     return released;
 }
 
@@ -114,6 +135,7 @@ void CameraMetadata::clear() {
         free_camera_metadata(mBuffer);
         mBuffer = NULL;
     }
+    refreshTagIndex();
 }
 
 void CameraMetadata::acquire(camera_metadata_t *buffer) {
@@ -123,6 +145,7 @@ void CameraMetadata::acquire(camera_metadata_t *buffer) {
     }
     clear();
     mBuffer = buffer;
+    refreshTagIndex();
 
     ALOGE_IF(validate_camera_metadata_structure(mBuffer, /*size*/NULL) != OK,
              "%s: Failed to validate metadata structure %p",
@@ -150,7 +173,11 @@ status_t CameraMetadata::append(const camera_metadata_t* other) {
     size_t extraData = get_camera_metadata_data_count(other);
     resizeIfNeeded(extraEntries, extraData);
 
-    return append_camera_metadata(mBuffer, other);
+    status_t res = append_camera_metadata(mBuffer, other);
+    // Appended tags may duplicate existing ones; let a rebuild sort out
+    // which entry lookups should return.
+    refreshTagIndex();
+    return res;
 }
 
 size_t CameraMetadata::entryCount() const {
@@ -167,7 +194,9 @@ status_t CameraMetadata::sort() {
         ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
         return INVALID_OPERATION;
     }
-    return sort_camera_metadata(mBuffer);
+    status_t res = sort_camera_metadata(mBuffer);
+    refreshTagIndex();
+    return res;
 }
 
 status_t CameraMetadata::checkType(uint32_t tag, uint8_t expectedType) {
@@ -290,6 +319,78 @@ status_t CameraMetadata::update(const camera_metadata_ro_entry &entry) {
     return updateImpl(entry.tag, (const void*)entry.data.u8, entry.count);
 }
 
+status_t CameraMetadata::update(const camera_metadata_ro_entry *entries,
+        size_t entryCount) {
+    status_t res;
+    if (mLocked) {
+        ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
+        return INVALID_OPERATION;
+    }
+    if (entryCount == 0) {
+        return OK;
+    }
+    if (entries == NULL) {
+        return BAD_VALUE;
+    }
+
+    // Validate everything and size the buffer for all entries up front, so
+    // applying them below never has to reallocate.
+    size_t extraEntries = 0;
+    size_t extraData = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        const camera_metadata_ro_entry &entry = entries[i];
+        if ( (res = checkType(entry.tag, entry.type)) != OK) {
+            return res;
+        }
+        if (isInBuffer(entry.data.u8)) {
+            ALOGE("%s: Update attempted with data from the same metadata buffer!",
+                    __FUNCTION__);
+            return INVALID_OPERATION;
+        }
+        size_t data_size = calculate_camera_metadata_entry_data_size(entry.type,
+                entry.count);
+        size_t index;
+        camera_metadata_ro_entry existing;
+        if (findEntryIndex(entry.tag, &index) == OK &&
+                get_camera_metadata_ro_entry(mBuffer, index, &existing) == OK) {
+            size_t old_size = calculate_camera_metadata_entry_data_size(existing.type,
+                    existing.count);
+            extraData += (data_size > old_size) ? data_size - old_size : 0;
+        } else {
+            extraEntries++;
+            extraData += data_size;
+        }
+    }
+    res = resizeIfNeeded(extraEntries, extraData);
+    if (res != OK) {
+        return res;
+    }
+
+    for (size_t i = 0; i < entryCount; i++) {
+        const camera_metadata_ro_entry &entry = entries[i];
+        size_t data_size = calculate_camera_metadata_entry_data_size(entry.type,
+                entry.count);
+        res = updateEntry(entry.tag, entry.data.u8, entry.count, data_size);
+        if (res != OK) {
+            ALOGE("%s: Unable to update metadata entry %s.%s (%x): %s (%d)", __FUNCTION__,
+                  get_local_camera_metadata_section_name(entry.tag, mBuffer),
+                  get_local_camera_metadata_tag_name(entry.tag, mBuffer), entry.tag,
+                  strerror(-res), res);
+            return res;
+        }
+    }
+
+    IF_ALOGV() {
+        ALOGE_IF(validate_camera_metadata_structure(mBuffer, /*size*/NULL) !=
+                 OK,
+
+                 "%s: Failed to validate metadata structure after update %p",
+                 __FUNCTION__, mBuffer);
+    }
+
+    return OK;
+}
+
 status_t CameraMetadata::updateImpl(uint32_t tag, const void *data,
         size_t data_count) {
     status_t res;
@@ -304,10 +405,7 @@ status_t CameraMetadata::updateImpl(uint32_t tag, const void *data,
     }
     // Safety check - ensure that data isn't pointing to this metadata, since
     // that would get invalidated if a resize is needed
-    size_t bufferSize = get_camera_metadata_size(mBuffer);
-    uintptr_t bufAddr = reinterpret_cast<uintptr_t>(mBuffer);
-    uintptr_t dataAddr = reinterpret_cast<uintptr_t>(data);
-    if (dataAddr > bufAddr && dataAddr < (bufAddr + bufferSize)) {
+    if (isInBuffer(data)) {
         ALOGE("%s: Update attempted with data from the same metadata buffer!",
                 __FUNCTION__);
         return INVALID_OPERATION;
@@ -316,19 +414,7 @@ status_t CameraMetadata::updateImpl(uint32_t tag, const void *data,
     size_t data_size = calculate_camera_metadata_entry_data_size(type,
             data_count);
 
-    res = resizeIfNeeded(1, data_size);
-
-    if (res == OK) {
-        camera_metadata_entry_t entry;
-        res = find_camera_metadata_entry(mBuffer, tag, &entry);
-        if (res == NAME_NOT_FOUND) {
-            res = add_camera_metadata_entry(mBuffer,
-                    tag, data, data_count);
-        } else if (res == OK) {
-            res = update_camera_metadata_entry(mBuffer,
-                    entry.index, data, data_count, NULL);
-        }
-    }
+    res = updateEntry(tag, data, data_count, data_size);
 
     if (res != OK) {
         ALOGE("%s: Unable to update metadata entry %s.%s (%x): %s (%d)", __FUNCTION__,
@@ -347,9 +433,46 @@ status_t CameraMetadata::updateImpl(uint32_t tag, const void *data,
     return res;
 }
 
+status_t CameraMetadata::updateEntry(uint32_t tag, const void *data,
+        size_t data_count, size_t data_size) {
+    status_t res;
+    size_t index;
+    camera_metadata_ro_entry existing;
+    if (findEntryIndex(tag, &index) == OK &&
+            get_camera_metadata_ro_entry(mBuffer, index, &existing) == OK) {
+        // Updates that fit in the entry's current data storage don't need
+        // the capacity check. Resizing preserves entry order, so index stays
+        // valid either way.
+        size_t old_size = calculate_camera_metadata_entry_data_size(existing.type,
+                existing.count);
+        res = (data_size > old_size) ? resizeIfNeeded(0, data_size - old_size) : OK;
+        if (res == OK) {
+            res = update_camera_metadata_entry(mBuffer, index, data, data_count, NULL);
+        }
+        return res;
+    }
+
+    res = resizeIfNeeded(1, data_size);
+    if (res == OK) {
+        size_t newIndex = get_camera_metadata_entry_count(mBuffer);
+        res = add_camera_metadata_entry(mBuffer, tag, data, data_count);
+        if (res == OK) {
+            onEntryAdded(tag, newIndex);
+        }
+    }
+    return res;
+}
+
+bool CameraMetadata::isInBuffer(const void *data) const {
+    size_t bufferSize = get_camera_metadata_size(mBuffer);
+    uintptr_t bufAddr = reinterpret_cast<uintptr_t>(mBuffer);
+    uintptr_t dataAddr = reinterpret_cast<uintptr_t>(data);
+    return dataAddr > bufAddr && dataAddr < (bufAddr + bufferSize);
+}
+
 bool CameraMetadata::exists(uint32_t tag) const {
-    camera_metadata_ro_entry entry;
-    return find_camera_metadata_ro_entry(mBuffer, tag, &entry) == 0;
+    size_t index;
+    return findEntryIndex(tag, &index) == OK;
 }
 
 camera_metadata_entry_t CameraMetadata::find(uint32_t tag) {
@@ -360,7 +483,11 @@ camera_metadata_entry_t CameraMetadata::find(uint32_t tag) {
         entry.count = 0;
         return entry;
     }
-    res = find_camera_metadata_entry(mBuffer, tag, &entry);
+    size_t index;
+    res = findEntryIndex(tag, &index);
+    if (res == OK) {
+        res = get_camera_metadata_entry(mBuffer, index, &entry);
+    }
     if (CC_UNLIKELY( res != OK )) {
         entry.count = 0;
         entry.data.u8 = NULL;
@@ -371,7 +498,11 @@ camera_metadata_entry_t CameraMetadata::find(uint32_t tag) {
 camera_metadata_ro_entry_t CameraMetadata::find(uint32_t tag) const {
     status_t res;
     camera_metadata_ro_entry entry;
-    res = find_camera_metadata_ro_entry(mBuffer, tag, &entry);
+    size_t index;
+    res = findEntryIndex(tag, &index);
+    if (res == OK) {
+        res = get_camera_metadata_ro_entry(mBuffer, index, &entry);
+    }
     if (CC_UNLIKELY( res != OK )) {
         entry.count = 0;
         entry.data.u8 = NULL;
@@ -396,6 +527,8 @@ status_t CameraMetadata::erase(uint32_t tag) {
         return res;
     }
     res = delete_camera_metadata_entry(mBuffer, entry.index);
+    // Entries after the deleted one have shifted down
+    refreshTagIndex();
     if (res != OK) {
         ALOGE("%s: Error deleting entry %s.%s (%x): %s %d", __FUNCTION__,
               get_local_camera_metadata_section_name(tag, mBuffer),
@@ -460,6 +593,110 @@ void CameraMetadata::swap(CameraMetadata& other) {
 
     other.mBuffer = thisBuf;
     mBuffer = otherBuf;
+
+    // The indexes follow their buffers; one coming from a metadata object
+    // without index is dirty and needs a rebuild.
+    std::swap(mTagIndexDirty, other.mTagIndexDirty);
+    mTagIndex.swap(other.mTagIndex);
+    if (!mTagIndexEnabled || mTagIndexDirty) {
+        refreshTagIndex();
+    }
+    if (!other.mTagIndexEnabled || other.mTagIndexDirty) {
+        other.refreshTagIndex();
+    }
+}
+
+void CameraMetadata::setTagIndexEnabled(bool enabled) {
+    mTagIndexEnabled = enabled;
+    refreshTagIndex();
+    if (!enabled) {
+        std::vector<TagIndexSlot>().swap(mTagIndex);
+    }
+}
+
+void CameraMetadata::refreshTagIndex() {
+    // Rebuilt right away rather than on the next lookup, so that lookups
+    // only read the index and const ones can run concurrently. Operations
+    // that change the entries are linear in the entry count already. There
+    // is nothing to look up without a buffer; the first entry added to a new
+    // one rebuilds it.
+    mTagIndexDirty = true;
+    if (mTagIndexEnabled && mBuffer != NULL) {
+        rebuildTagIndex();
+    }
+}
+
+void CameraMetadata::rebuildTagIndex() {
+    size_t count = entryCount();
+    size_t tableSize = kMinTagIndexSize;
+    while (tableSize < count * 2) {
+        tableSize <<= 1;
+    }
+    mTagIndex.assign(tableSize, TagIndexSlot{0, kEmptyTagIndexSlot});
+    for (size_t i = 0; i < count; i++) {
+        camera_metadata_ro_entry entry;
+        if (get_camera_metadata_ro_entry(mBuffer, i, &entry) == OK) {
+            insertTagIndex(entry.tag, i);
+        }
+    }
+    mTagIndexDirty = false;
+}
+
+bool CameraMetadata::insertTagIndex(uint32_t tag, uint32_t entryIndex) {
+    size_t mask = mTagIndex.size() - 1;
+    for (size_t slot = tagIndexHash(tag) & mask;; slot = (slot + 1) & mask) {
+        TagIndexSlot &s = mTagIndex[slot];
+        if (s.entryIndex == kEmptyTagIndexSlot) {
+            s.tag = tag;
+            s.entryIndex = entryIndex;
+            return true;
+        }
+        if (s.tag == tag) {
+            // Duplicate tag (from append()): lookups keep returning the first
+            // entry, like a linear search of the buffer would.
+            return false;
+        }
+    }
+}
+
+void CameraMetadata::onEntryAdded(uint32_t tag, size_t entryIndex) {
+    if (!mTagIndexEnabled) {
+        return;
+    }
+    // Keep the load factor at or below 1/2; past that, rebuild into a table
+    // twice the size.
+    if (mTagIndexDirty || (entryIndex + 1) * 2 > mTagIndex.size()) {
+        rebuildTagIndex();
+        return;
+    }
+    insertTagIndex(tag, entryIndex);
+}
+
+status_t CameraMetadata::findEntryIndex(uint32_t tag, size_t *index) const {
+    if (mBuffer == NULL) {
+        return NAME_NOT_FOUND;
+    }
+    // Enabled, the index is only dirty before the buffer has entries.
+    if (!mTagIndexEnabled || mTagIndexDirty) {
+        camera_metadata_ro_entry entry;
+        status_t res = find_camera_metadata_ro_entry(mBuffer, tag, &entry);
+        if (res == OK) {
+            *index = entry.index;
+        }
+        return res;
+    }
+
+    size_t mask = mTagIndex.size() - 1;
+    for (size_t slot = tagIndexHash(tag) & mask;; slot = (slot + 1) & mask) {
+        const TagIndexSlot &s = mTagIndex[slot];
+        if (s.entryIndex == kEmptyTagIndexSlot) {
+            return NAME_NOT_FOUND;
+        }
+        if (s.tag == tag) {
+            *index = s.entryIndex;
+            return OK;
+        }
+    }
 }
 
 status_t CameraMetadata::getTagFromName(const char *name,
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+#include "CameraMetadata.h"
+
+using ::android::OK;
+using ::android::hardware::camera::common::V1_0::helper::CameraMetadata;
+
+namespace {
+
+constexpr size_t kRequestTagCount = 200;
+
+// Backing storage large enough for any single-value entry
+union Value {
+    uint8_t u8;
+    int32_t i32;
+    float f;
+    int64_t i64;
+    double d;
+    camera_metadata_rational_t r;
+};
+
+struct SyntheticRequest {
+    std::vector<camera_metadata_ro_entry> entries;
+    std::vector<Value> values;
+};
+
+// Collects the first kRequestTagCount framework tags, each with one value
+const SyntheticRequest& getRequest() {
+    static SyntheticRequest request = [] {
+        SyntheticRequest req;
+        req.values.resize(kRequestTagCount);
+        for (uint32_t section = 0; section < ANDROID_SECTION_COUNT &&
+                req.entries.size() < kRequestTagCount; section++) {
+            for (uint32_t tag = camera_metadata_section_bounds[section][0];
+                    tag < camera_metadata_section_bounds[section][1] &&
+                    req.entries.size() < kRequestTagCount; tag++) {
+                int type = get_camera_metadata_tag_type(tag);
+                if (type < 0) {
+                    continue;
+                }
+                camera_metadata_ro_entry entry = {};
+                entry.tag = tag;
+                entry.type = type;
+                entry.count = 1;
+                entry.data.u8 = &req.values[req.entries.size()].u8;
+                req.entries.push_back(entry);
+            }
+        }
+        return req;
+    }();
+    return request;
+}
+
+CameraMetadata buildRequest(bool indexed) {
+    CameraMetadata md;
+    md.setTagIndexEnabled(indexed);
+    for (const auto& entry : getRequest().entries) {
+        md.update(entry);
+    }
+    return md;
+}
+
+} // anonymous namespace
+
+static void BM_Find(benchmark::State& state) {
+    const CameraMetadata md = buildRequest(state.range(0));
+    const auto& entries = getRequest().entries;
+    for (auto _ : state) {
+        for (const auto& entry : entries) {
+            benchmark::DoNotOptimize(md.find(entry.tag));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_Find)->Arg(false)->Arg(true);
+
+// Per-frame result filling: overwrite every tag of an existing request
+static void BM_UpdateExisting(benchmark::State& state) {
+    CameraMetadata md = buildRequest(state.range(0));
+    const auto& entries = getRequest().entries;
+    for (auto _ : state) {
+        for (const auto& entry : entries) {
+            md.update(entry);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_UpdateExisting)->Arg(false)->Arg(true);
+
+// Building a request from scratch, one tag at a time
+static void BM_BuildOneByOne(benchmark::State& state) {
+    const auto& entries = getRequest().entries;
+    for (auto _ : state) {
+        CameraMetadata md;
+        md.setTagIndexEnabled(state.range(0));
+        for (const auto& entry : entries) {
+            md.update(entry);
+        }
+        benchmark::DoNotOptimize(md.entryCount());
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_BuildOneByOne)->Arg(false)->Arg(true);
+
+// Building a request from scratch with the bulk update
+static void BM_BuildBulk(benchmark::State& state) {
+    const auto& entries = getRequest().entries;
+    for (auto _ : state) {
+        CameraMetadata md;
+        md.setTagIndexEnabled(state.range(0));
+        if (md.update(entries.data(), entries.size()) != OK) {
+            state.SkipWithError("bulk update failed");
+            break;
+        }
+        benchmark::DoNotOptimize(md.entryCount());
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_BuildBulk)->Arg(false)->Arg(true);
+
+// Copying the per-frame settings and then querying them, as the external
+// camera does for every request
+static void BM_CopyThenFind(benchmark::State& state) {
+    CameraMetadata md = buildRequest(state.range(0));
+    const auto& entries = getRequest().entries;
+    for (auto _ : state) {
+        CameraMetadata copy(md);
+        for (const auto& entry : entries) {
+            benchmark::DoNotOptimize(copy.find(entry.tag));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+BENCHMARK(BM_CopyThenFind)->Arg(false)->Arg(true);
+
+BENCHMARK_MAIN();
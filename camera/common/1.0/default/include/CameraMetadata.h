@@ -21,6 +21,7 @@
 
 #include <utils/String8.h>
 #include <utils/Vector.h>
+#include <vector>
 
 namespace android {
 namespace hardware {
@@ -146,6 +147,12 @@ class CameraMetadata {
             const String8 &string);
     status_t update(const camera_metadata_ro_entry &entry);
 
+    /**
+     * Update several metadata entries in one pass. The buffer is reallocated
+     * at most once to make room for all new and enlarged entries. Entry data
+     * must not point into this metadata buffer.
+     */
+    status_t update(const camera_metadata_ro_entry *entries, size_t entryCount);
 
     template<typename T>
     status_t update(uint32_t tag, Vector<T> data) {
@@ -173,6 +180,16 @@ class CameraMetadata {
      */
     status_t erase(uint32_t tag);
 
+    /**
+     * Enable or disable the tag index. When enabled, find(), exists() and
+     * update() locate entries through a tag to entry index table instead of
+     * searching the metadata buffer. Worth enabling for metadata that is
+     * queried or updated many times, such as per-frame request settings.
+     * The index is maintained by the non-const methods, so const lookups
+     * stay safe to run concurrently.
+     */
+    void setTagIndexEnabled(bool enabled);
+
     /**
      * Swap the underlying camera metadata between this and the other
      * metadata object.
@@ -203,6 +220,20 @@ class CameraMetadata {
     camera_metadata_t *mBuffer;
     mutable bool       mLocked;
 
+    /**
+     * Open addressing tag index. update() appends new entries to the end of
+     * the buffer, so the index is extended in place there; operations that
+     * remove or reorder entries rebuild it. Lookups never write to it.
+     * Always dirty while the index is disabled or there is no buffer.
+     */
+    struct TagIndexSlot {
+        uint32_t tag;
+        uint32_t entryIndex;
+    };
+    bool               mTagIndexEnabled;
+    bool               mTagIndexDirty;
+    std::vector<TagIndexSlot> mTagIndex;
+
     /**
      * Check if tag has a given type
      */
@@ -213,6 +244,27 @@ class CameraMetadata {
      */
     status_t updateImpl(uint32_t tag, const void *data, size_t data_count);
 
+    /**
+     * Update or add an entry whose type and data size have been checked
+     */
+    status_t updateEntry(uint32_t tag, const void *data, size_t data_count,
+            size_t data_size);
+
+    /**
+     * Check whether data points into this metadata buffer
+     */
+    bool isInBuffer(const void *data) const;
+
+    /**
+     * Look up the index of the entry for tag, using the tag index if enabled
+     */
+    status_t findEntryIndex(uint32_t tag, size_t *index) const;
+
+    void refreshTagIndex();
+    void rebuildTagIndex();
+    bool insertTagIndex(uint32_t tag, uint32_t entryIndex);
+    void onEntryAdded(uint32_t tag, size_t entryIndex);
+
     /**
      * Resize metadata buffer if needed by reallocating it and copying it over.
      */
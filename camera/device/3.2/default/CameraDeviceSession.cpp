@@ -139,6 +139,9 @@ bool CameraDeviceSession::initialize() {
                 resFMQSize);
     }
 
+    mMetadataBufferPool = std::make_shared<MetadataBufferPool>();
+    mResultBatcher.setMetadataBufferPool(mMetadataBufferPool);
+
     mResultMetadataQueue = std::make_shared<RequestMetadataQueue>(
             static_cast<size_t>(resFMQSize),
             false /* non blocking */);
@@ -413,6 +416,16 @@ void CameraDeviceSession::ResultBatcher::setResultMetadataQueue(
     mResultMetadataQueue = q;
 }
 
+void CameraDeviceSession::ResultBatcher::setMetadataBufferPool(
+        std::shared_ptr<MetadataBufferPool> pool) {
+    Mutex::Autolock _l(mLock);
+    mMetadataBufferPool = pool;
+}
+
+bool CameraDeviceSession::ResultBatcher::isBatched(uint32_t frameNumber) {
+    return getBatch(frameNumber).first != NOT_BATCHED;
+}
+
 void CameraDeviceSession::ResultBatcher::registerBatch(uint32_t frameNumber, uint32_t batchSize) {
     auto batch = std::make_shared<InflightBatch>();
     batch->mFirstFrame = frameNumber;
@@ -726,20 +739,30 @@ void CameraDeviceSession::ResultBatcher::invokeProcessCaptureResultCallback(
             return;
         }
     }
-    if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
-        for (CaptureResult &result : results) {
-            if (result.result.size() > 0) {
-                if (mResultMetadataQueue->write(result.result.data(), result.result.size())) {
-                    result.fmqResultSize = result.result.size();
-                    result.result.resize(0);
-                } else {
-                    ALOGW("%s: couldn't utilize fmq, fall back to hwbinder, result size: %zu,"
-                    "shared message queue available size: %zu",
-                        __FUNCTION__, result.result.size(),
-                        mResultMetadataQueue->availableToWrite());
-                    result.fmqResultSize = 0;
-                }
+    MetadataBufferPool::Holder compactMds(mMetadataBufferPool.get());
+    bool useFmq = tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0;
+    for (CaptureResult &result : results) {
+        if (result.result.size() == 0) {
+            continue;
+        }
+        const camera_metadata_t* md =
+                reinterpret_cast<const camera_metadata_t*>(result.result.data());
+        if (useFmq) {
+            size_t written = mMetadataBufferPool->writeCompact(mResultMetadataQueue.get(), md);
+            if (written > 0) {
+                result.fmqResultSize = written;
+                result.result.resize(0);
+                continue;
             }
+            ALOGW("%s: couldn't utilize fmq, fall back to hwbinder, result size: %zu,"
+            "shared message queue available size: %zu",
+                __FUNCTION__, result.result.size(),
+                mResultMetadataQueue->availableToWrite());
+            result.fmqResultSize = 0;
+        }
+        // Shrinking may have been left to the FMQ write, do it now for hwbinder
+        if (sShouldShrink(md)) {
+            convertToHidl(compactMds.compactCopy(md), &result.result);
         }
     }
     auto ret = mCallback->processCaptureResult(results);
@@ -1502,15 +1525,15 @@ status_t CameraDeviceSession::constructCaptureResult(CaptureResult& result,
 // Static helper method to copy/shrink capture result metadata sent by HAL
 void CameraDeviceSession::sShrinkCaptureResult(
         camera3_capture_result* dst, const camera3_capture_result* src,
-        std::vector<::android::hardware::camera::common::V1_0::helper::CameraMetadata>* mds,
+        MetadataBufferPool::Holder* mds,
         std::vector<const camera_metadata_t*>* physCamMdArray,
-        bool handlePhysCam) {
+        bool handlePhysCam, bool shrinkResult) {
     *dst = *src;
-    // Reserve maximum number of entries to avoid metadata re-allocation.
-    mds->reserve(1 + (handlePhysCam ? src->num_physcam_metadata : 0));
-    if (sShouldShrink(src->result)) {
-        mds->emplace_back(sCreateCompactCopy(src->result));
-        dst->result = mds->back().getAndLock();
+    if (shrinkResult && src->result != nullptr && sShouldShrink(src->result)) {
+        const camera_metadata_t* compact = mds->compactCopy(src->result);
+        if (compact != nullptr) {
+            dst->result = compact;
+        }
     }
 
     if (handlePhysCam) {
@@ -1527,9 +1550,12 @@ void CameraDeviceSession::sShrinkCaptureResult(
         physCamMdArray->reserve(src->num_physcam_metadata);
         dst->physcam_metadata = physCamMdArray->data();
         for (uint32_t i = 0; i < src->num_physcam_metadata; i++) {
+            const camera_metadata_t* compact = nullptr;
             if (sShouldShrink(src->physcam_metadata[i])) {
-                mds->emplace_back(sCreateCompactCopy(src->physcam_metadata[i]));
-                dst->physcam_metadata[i] = mds->back().getAndLock();
+                compact = mds->compactCopy(src->physcam_metadata[i]);
+            }
+            if (compact != nullptr) {
+                dst->physcam_metadata[i] = compact;
             } else {
                 dst->physcam_metadata[i] = src->physcam_metadata[i];
             }
@@ -1548,15 +1574,6 @@ bool CameraDeviceSession::sShouldShrink(const camera_metadata_t* md) {
     return false;
 }
 
-camera_metadata_t* CameraDeviceSession::sCreateCompactCopy(const camera_metadata_t* src) {
-    size_t compactSize = get_camera_metadata_compact_size(src);
-    void* buffer = calloc(1, compactSize);
-    if (buffer == nullptr) {
-        ALOGE("%s: Allocating %zu bytes failed", __FUNCTION__, compactSize);
-    }
-    return copy_camera_metadata(buffer, compactSize, src);
-}
-
 /**
  * Static callback forwarding methods from HAL to instance
  */
@@ -1569,9 +1586,12 @@ void CameraDeviceSession::sProcessCaptureResult(
     CaptureResult result = {};
     camera3_capture_result shadowResult;
     bool handlePhysCam = (d->mDeviceVersion >= CAMERA_DEVICE_API_VERSION_3_5);
-    std::vector<::android::hardware::camera::common::V1_0::helper::CameraMetadata> compactMds;
+    MetadataBufferPool::Holder compactMds(d->mMetadataBufferPool.get());
     std::vector<const camera_metadata_t*> physCamMdArray;
-    sShrinkCaptureResult(&shadowResult, hal_result, &compactMds, &physCamMdArray, handlePhysCam);
+    // Results delivered right away are compacted directly into the result FMQ
+    bool shrinkResult = d->mResultBatcher.isBatched(hal_result->frame_number);
+    sShrinkCaptureResult(&shadowResult, hal_result, &compactMds, &physCamMdArray, handlePhysCam,
+            shrinkResult);
 
     status_t ret = d->constructCaptureResult(result, &shadowResult);
     if (ret == OK) {
@@ -28,6 +28,7 @@
 #include <unordered_map>
 #include "CameraMetadata.h"
 #include "HandleImporter.h"
+#include "MetadataBufferPool.h"
 #include "hardware/camera3.h"
 #include "hardware/camera_common.h"
 #include "utils/Mutex.h"
@@ -183,6 +184,8 @@ protected:
     std::unique_ptr<RequestMetadataQueue> mRequestMetadataQueue;
     using ResultMetadataQueue = MessageQueue<uint8_t, kSynchronizedReadWrite>;
     std::shared_ptr<ResultMetadataQueue> mResultMetadataQueue;
+    // Reusable buffers for compacted result metadata, shared with the result batchers
+    std::shared_ptr<MetadataBufferPool> mMetadataBufferPool;
 
     class ResultBatcher {
     public:
@@ -190,6 +193,11 @@ protected:
         void setNumPartialResults(uint32_t n);
         void setBatchedStreams(const std::vector<int>& streamsToBatch);
         void setResultMetadataQueue(std::shared_ptr<ResultMetadataQueue> q);
+        void setMetadataBufferPool(std::shared_ptr<MetadataBufferPool> pool);
+
+        // Whether the result of frameNumber will be held back for batched delivery
+        // This method will hold ResultBatcher::mLock briefly
+        bool isBatched(uint32_t frameNumber);
 
         void registerBatch(uint32_t frameNumber, uint32_t batchSize);
         void notify(NotifyMsg& msg);
@@ -288,6 +296,7 @@ protected:
         std::vector<int> mStreamsToBatch;
         const sp<ICameraDeviceCallback> mCallback;
         std::shared_ptr<ResultMetadataQueue> mResultMetadataQueue;
+        std::shared_ptr<MetadataBufferPool> mMetadataBufferPool;
 
         // Protect against invokeProcessCaptureResultCallback()
         Mutex mProcessCaptureResultLock;
@@ -355,14 +364,15 @@ protected:
                                 const camera3_capture_result *hal_result);
 
     // Static helper method to copy/shrink capture result metadata sent by HAL
-    // Temporarily allocated metadata copy will be hold in mds
+    // Compact metadata copies are held in pooled buffers owned by mds.
+    // shrinkResult = false leaves src->result as is, for results that will be compacted
+    // straight into the result FMQ.
     static void sShrinkCaptureResult(
             camera3_capture_result* dst, const camera3_capture_result* src,
-            std::vector<::android::hardware::camera::common::V1_0::helper::CameraMetadata>* mds,
+            MetadataBufferPool::Holder* mds,
             std::vector<const camera_metadata_t*>* physCamMdArray,
-            bool handlePhysCam);
+            bool handlePhysCam, bool shrinkResult = true);
     static bool sShouldShrink(const camera_metadata_t* md);
-    static camera_metadata_t* sCreateCompactCopy(const camera_metadata_t* src);
 
 private:
 
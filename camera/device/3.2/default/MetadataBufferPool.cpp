@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CamDevSession@3.2-impl"
+#include <log/log.h>
+
+#include "MetadataBufferPool.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace V3_2 {
+namespace implementation {
+
+namespace {
+// camera_metadata_t entries hold up to 64-bit values
+constexpr uintptr_t kMetadataAlignment = alignof(uint64_t);
+} // anonymous namespace
+
+MetadataBufferPool::Holder::~Holder() {
+    for (auto& buffer : mBuffers) {
+        mPool->release(std::move(buffer));
+    }
+}
+
+const camera_metadata_t* MetadataBufferPool::Holder::compactCopy(const camera_metadata_t* src) {
+    if (src == nullptr) {
+        return nullptr;
+    }
+    size_t compactSize = get_camera_metadata_compact_size(src);
+    std::vector<uint8_t> buffer = mPool->acquire(compactSize);
+    camera_metadata_t* copy = copy_camera_metadata(buffer.data(), compactSize, src);
+    if (copy == nullptr) {
+        ALOGE("%s: Copying %zu bytes of metadata failed", __FUNCTION__, compactSize);
+        mPool->release(std::move(buffer));
+        return nullptr;
+    }
+    mBuffers.push_back(std::move(buffer));
+    return copy;
+}
+
+std::vector<uint8_t> MetadataBufferPool::acquire(size_t size) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        // Buffers are few, a linear scan for the first one that fits is good enough
+        for (auto it = mFreeBuffers.begin(); it != mFreeBuffers.end(); it++) {
+            if (it->size() >= size) {
+                std::vector<uint8_t> buffer = std::move(*it);
+                mFreeBuffers.erase(it);
+                return buffer;
+            }
+        }
+    }
+    return std::vector<uint8_t>(size);
+}
+
+void MetadataBufferPool::release(std::vector<uint8_t>&& buffer) {
+    if (buffer.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFreeBuffers.size() < kMaxPooledBuffers) {
+        mFreeBuffers.push_back(std::move(buffer));
+        return;
+    }
+    // Pool is full: keep the larger buffer so big results stay allocation free
+    auto smallest = mFreeBuffers.begin();
+    for (auto it = mFreeBuffers.begin(); it != mFreeBuffers.end(); it++) {
+        if (it->size() < smallest->size()) {
+            smallest = it;
+        }
+    }
+    if (smallest->size() < buffer.size()) {
+        *smallest = std::move(buffer);
+    }
+}
+
+size_t MetadataBufferPool::writeCompact(ResultMetadataQueue* q, const camera_metadata_t* md) {
+    size_t compactSize = get_camera_metadata_compact_size(md);
+    if (compactSize == 0 || q->availableToWrite() < compactSize) {
+        return 0;
+    }
+
+    ResultMetadataQueue::MemTransaction tx;
+    if (q->beginWrite(compactSize, &tx)) {
+        auto region = tx.getFirstRegion();
+        uint8_t* address = region.getAddress();
+        if (region.getLength() >= compactSize &&
+                (reinterpret_cast<uintptr_t>(address) % kMetadataAlignment) == 0) {
+            if (copy_camera_metadata(address, compactSize, md) != nullptr &&
+                    q->commitWrite(compactSize)) {
+                return compactSize;
+            }
+            return 0;
+        }
+    }
+
+    // Write region wraps around or is misaligned, stage the compact copy in a pooled buffer
+    std::vector<uint8_t> buffer = acquire(compactSize);
+    size_t written = 0;
+    if (copy_camera_metadata(buffer.data(), compactSize, md) != nullptr &&
+            q->write(buffer.data(), compactSize)) {
+        written = compactSize;
+    }
+    release(std::move(buffer));
+    return written;
+}
+
+size_t MetadataBufferPool::size() const {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mFreeBuffers.size();
+}
+
+}  // namespace implementation
+}  // namespace V3_2
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_CAMERA_DEVICE_V3_2_METADATABUFFERPOOL_H
+#define ANDROID_HARDWARE_CAMERA_DEVICE_V3_2_METADATABUFFERPOOL_H
+
+#include <fmq/MessageQueue.h>
+#include <system/camera_metadata.h>
+#include <mutex>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace V3_2 {
+namespace implementation {
+
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+
+/**
+ * Thread-safe pool of byte buffers used to hold compacted capture result metadata, so that
+ * shrinking HAL results stops hitting the heap once the pool is warmed up.
+ */
+class MetadataBufferPool {
+public:
+    using ResultMetadataQueue = MessageQueue<uint8_t, kSynchronizedReadWrite>;
+
+    // Holds pooled buffers for the duration of one capture result and gives them back to the
+    // pool on destruction.
+    class Holder {
+    public:
+        explicit Holder(MetadataBufferPool* pool) : mPool(pool) {}
+        ~Holder();
+
+        // Returns a compact copy of src backed by a pooled buffer, or nullptr on failure.
+        // The copy is valid until this Holder is destroyed.
+        const camera_metadata_t* compactCopy(const camera_metadata_t* src);
+
+    private:
+        MetadataBufferPool* mPool;
+        std::vector<std::vector<uint8_t>> mBuffers;
+    };
+
+    // Returns a buffer of at least size bytes
+    std::vector<uint8_t> acquire(size_t size);
+    void release(std::vector<uint8_t>&& buffer);
+
+    // Write a compact copy of md into q. The copy is made straight into the queue's shared
+    // memory when the next write region is contiguous and aligned, otherwise it goes through
+    // a pooled buffer. Returns the number of bytes written, or 0 if md did not fit.
+    size_t writeCompact(ResultMetadataQueue* q, const camera_metadata_t* md);
+
+    // Number of buffers currently pooled
+    size_t size() const;
+
+private:
+    // Enough for one logical camera result plus a handful of physical camera results
+    static const size_t kMaxPooledBuffers = 8;
+
+    mutable std::mutex mLock;
+    std::vector<std::vector<uint8_t>> mFreeBuffers;
+};
+
+}  // namespace implementation
+}  // namespace V3_2
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_CAMERA_DEVICE_V3_2_METADATABUFFERPOOL_H
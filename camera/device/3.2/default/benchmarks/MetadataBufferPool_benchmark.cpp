@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <stdlib.h>
+#include <vector>
+#include "CameraDeviceSession.h"
+#include "MetadataBufferPool.h"
+
+using ::android::hardware::camera::device::V3_2::implementation::CameraDeviceSession;
+using ::android::hardware::camera::device::V3_2::implementation::MetadataBufferPool;
+
+namespace {
+
+// Vendor section used for the synthetic payloads
+constexpr uint32_t kVendorTagStart = 0x80000000u;
+constexpr size_t kNumVendorTags = 16;
+constexpr size_t kVendorPayloadSize = 8 * 1024;
+// HALs commonly hand out results from buffers sized for the worst case
+constexpr size_t kResultEntryCapacity = 512;
+constexpr size_t kResultDataCapacity = 1 << 20;
+
+int getTagCount(const vendor_tag_ops_t*) { return kNumVendorTags; }
+void getAllTags(const vendor_tag_ops_t*, uint32_t* tags) {
+    for (size_t i = 0; i < kNumVendorTags; i++) {
+        tags[i] = kVendorTagStart + i;
+    }
+}
+const char* getSectionName(const vendor_tag_ops_t*, uint32_t) { return "com.benchmark"; }
+const char* getTagName(const vendor_tag_ops_t*, uint32_t) { return "payload"; }
+int getTagType(const vendor_tag_ops_t*, uint32_t) { return TYPE_BYTE; }
+
+const vendor_tag_ops_t kVendorOps = {
+    .get_tag_count = getTagCount,
+    .get_all_tags = getAllTags,
+    .get_section_name = getSectionName,
+    .get_tag_name = getTagName,
+    .get_tag_type = getTagType,
+};
+
+camera_metadata_t* createSyntheticResult() {
+    set_camera_metadata_vendor_ops(&kVendorOps);
+    camera_metadata_t* md = allocate_camera_metadata(kResultEntryCapacity, kResultDataCapacity);
+    std::vector<uint8_t> payload(kVendorPayloadSize, 0x5a);
+    for (size_t i = 0; i < kNumVendorTags; i++) {
+        add_camera_metadata_entry(md, kVendorTagStart + i, payload.data(), payload.size());
+    }
+    int64_t timestamp = 1;
+    add_camera_metadata_entry(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+    return md;
+}
+
+// Exposes the protected result shrinking helper
+struct ShrinkAccess : public CameraDeviceSession {
+    using CameraDeviceSession::sShrinkCaptureResult;
+};
+
+using ResultMetadataQueue = MetadataBufferPool::ResultMetadataQueue;
+
+} // anonymous namespace
+
+// Previous behavior: calloc a compact copy per result and per physical camera
+static void BM_ShrinkResult_Calloc(benchmark::State& state) {
+    size_t numMds = 1 + state.range(0);
+    camera_metadata_t* md = createSyntheticResult();
+    for (auto _ : state) {
+        for (size_t i = 0; i < numMds; i++) {
+            size_t compactSize = get_camera_metadata_compact_size(md);
+            void* buffer = calloc(1, compactSize);
+            camera_metadata_t* copy = copy_camera_metadata(buffer, compactSize, md);
+            benchmark::DoNotOptimize(copy);
+            free(buffer);
+        }
+    }
+    free_camera_metadata(md);
+}
+BENCHMARK(BM_ShrinkResult_Calloc)->Arg(0)->Arg(2)->Arg(4);
+
+static void BM_ShrinkResult_Pooled(benchmark::State& state) {
+    uint32_t numPhysCams = state.range(0);
+    camera_metadata_t* md = createSyntheticResult();
+    std::vector<const camera_metadata_t*> physMds(numPhysCams, md);
+    std::vector<const char*> physIds(numPhysCams, "1");
+
+    camera3_capture_result_t halResult = {};
+    halResult.frame_number = 1;
+    halResult.result = md;
+    halResult.partial_result = 1;
+    halResult.num_physcam_metadata = numPhysCams;
+    halResult.physcam_ids = physIds.data();
+    halResult.physcam_metadata = physMds.data();
+
+    MetadataBufferPool pool;
+    for (auto _ : state) {
+        camera3_capture_result_t shadowResult;
+        MetadataBufferPool::Holder compactMds(&pool);
+        std::vector<const camera_metadata_t*> physCamMdArray;
+        ShrinkAccess::sShrinkCaptureResult(&shadowResult, &halResult, &compactMds,
+                &physCamMdArray, /*handlePhysCam*/numPhysCams > 0);
+        benchmark::DoNotOptimize(shadowResult.result);
+    }
+    free_camera_metadata(md);
+}
+BENCHMARK(BM_ShrinkResult_Pooled)->Arg(0)->Arg(2)->Arg(4);
+
+// Previous behavior: shrink into a temporary buffer, then copy it into the FMQ
+static void BM_ResultFmq_CompactThenWrite(benchmark::State& state) {
+    camera_metadata_t* md = createSyntheticResult();
+    ResultMetadataQueue queue(1 << 20, /*configureEventFlagWord*/false);
+    std::vector<uint8_t> readBack(1 << 20);
+    for (auto _ : state) {
+        size_t compactSize = get_camera_metadata_compact_size(md);
+        void* buffer = calloc(1, compactSize);
+        copy_camera_metadata(buffer, compactSize, md);
+        queue.write(static_cast<uint8_t*>(buffer), compactSize);
+        free(buffer);
+        queue.read(readBack.data(), compactSize);
+    }
+    free_camera_metadata(md);
+}
+BENCHMARK(BM_ResultFmq_CompactThenWrite);
+
+static void BM_ResultFmq_CompactInPlace(benchmark::State& state) {
+    camera_metadata_t* md = createSyntheticResult();
+    ResultMetadataQueue queue(1 << 20, /*configureEventFlagWord*/false);
+    std::vector<uint8_t> readBack(1 << 20);
+    MetadataBufferPool pool;
+    for (auto _ : state) {
+        size_t written = pool.writeCompact(&queue, md);
+        queue.read(readBack.data(), written);
+    }
+    free_camera_metadata(md);
+}
+BENCHMARK(BM_ResultFmq_CompactInPlace);
+
+BENCHMARK_MAIN();
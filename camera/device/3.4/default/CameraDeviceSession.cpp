@@ -51,6 +51,7 @@ CameraDeviceSession::CameraDeviceSession(
             mHasCallback_3_4 = true;
             if (!mInitFail) {
                 mResultBatcher_3_4.setResultMetadataQueue(mResultMetadataQueue);
+                mResultBatcher_3_4.setMetadataBufferPool(mMetadataBufferPool);
             }
         }
     }
@@ -531,9 +532,12 @@ void CameraDeviceSession::sProcessCaptureResult_3_4(
     CaptureResult result = {};
     camera3_capture_result shadowResult;
     bool handlePhysCam = (d->mDeviceVersion >= CAMERA_DEVICE_API_VERSION_3_5);
-    std::vector<::android::hardware::camera::common::V1_0::helper::CameraMetadata> compactMds;
+    V3_2::implementation::MetadataBufferPool::Holder compactMds(d->mMetadataBufferPool.get());
     std::vector<const camera_metadata_t*> physCamMdArray;
-    sShrinkCaptureResult(&shadowResult, hal_result, &compactMds, &physCamMdArray, handlePhysCam);
+    // Results delivered right away are compacted directly into the result FMQ
+    bool shrinkResult = d->mResultBatcher_3_4.isBatched(hal_result->frame_number);
+    sShrinkCaptureResult(&shadowResult, hal_result, &compactMds, &physCamMdArray, handlePhysCam,
+            shrinkResult);
 
     status_t ret = d->constructCaptureResult(result.v3_2, &shadowResult);
     if (ret != OK) {
@@ -715,28 +719,45 @@ void CameraDeviceSession::ResultBatcher_3_4::invokeProcessCaptureResultCallback_
             return;
         }
     }
-    if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
-        for (CaptureResult &result : results) {
-            if (result.v3_2.result.size() > 0) {
-                if (mResultMetadataQueue->write(result.v3_2.result.data(),
-                        result.v3_2.result.size())) {
-                    result.v3_2.fmqResultSize = result.v3_2.result.size();
-                    result.v3_2.result.resize(0);
-                } else {
+    V3_2::implementation::MetadataBufferPool::Holder compactMds(mMetadataBufferPool.get());
+    bool useFmq = tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0;
+    for (CaptureResult &result : results) {
+        if (result.v3_2.result.size() > 0) {
+            const camera_metadata_t* md =
+                    reinterpret_cast<const camera_metadata_t*>(result.v3_2.result.data());
+            size_t written = useFmq ?
+                    mMetadataBufferPool->writeCompact(mResultMetadataQueue.get(), md) : 0;
+            if (written > 0) {
+                result.v3_2.fmqResultSize = written;
+                result.v3_2.result.resize(0);
+            } else {
+                if (useFmq) {
                     ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
-                    result.v3_2.fmqResultSize = 0;
+                }
+                result.v3_2.fmqResultSize = 0;
+                // Shrinking may have been left to the FMQ write, do it now for hwbinder
+                if (sShouldShrink(md)) {
+                    V3_2::implementation::convertToHidl(
+                            compactMds.compactCopy(md), &result.v3_2.result);
                 }
             }
+        }
 
-            for (auto& onePhysMetadata : result.physicalCameraMetadata) {
-                if (mResultMetadataQueue->write(onePhysMetadata.metadata.data(),
-                        onePhysMetadata.metadata.size())) {
-                    onePhysMetadata.fmqMetadataSize = onePhysMetadata.metadata.size();
-                    onePhysMetadata.metadata.resize(0);
-                } else {
-                    ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
-                    onePhysMetadata.fmqMetadataSize = 0;
-                }
+        if (!useFmq) {
+            continue;
+        }
+        for (auto& onePhysMetadata : result.physicalCameraMetadata) {
+            if (onePhysMetadata.metadata.size() == 0) {
+                continue;
+            }
+            size_t written = mMetadataBufferPool->writeCompact(mResultMetadataQueue.get(),
+                    reinterpret_cast<const camera_metadata_t*>(onePhysMetadata.metadata.data()));
+            if (written > 0) {
+                onePhysMetadata.fmqMetadataSize = written;
+                onePhysMetadata.metadata.resize(0);
+            } else {
+                ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
+                onePhysMetadata.fmqMetadataSize = 0;
             }
         }
     }
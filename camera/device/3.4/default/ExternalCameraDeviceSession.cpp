@@ -25,6 +25,7 @@
 #include <utils/Timers.h>
 #include <utils/Trace.h>
 #include <linux/videodev2.h>
+#include <poll.h>
 #include <sync/sync.h>
 
 #define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
@@ -106,7 +107,10 @@ ExternalCameraDeviceSession::ExternalCameraDeviceSession(
         mCameraId(cameraId),
         mV4l2Fd(std::move(v4l2Fd)),
         mMaxThumbResolution(getMaxThumbResolution()),
-        mMaxJpegResolution(getMaxJpegResolution()) {}
+        mMaxJpegResolution(getMaxJpegResolution()) {
+    // Request settings are looked up and updated many times per frame
+    mLatestReqSetting.setTagIndexEnabled(true);
+}
 
 bool ExternalCameraDeviceSession::initialize() {
     if (mV4l2Fd.get() < 0) {
@@ -280,12 +284,28 @@ void ExternalCameraDeviceSession::dumpState(const native_handle_t* handle) {
                 mV4l2StreamingFps);
 
         size_t numDequeuedV4l2Buffers = 0;
+        V4L2BufferStats stats;
         {
             std::lock_guard<std::mutex> lk(mV4l2BufferLock);
             numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
-        }
-        dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n",
-                v4L2BufferCount, numDequeuedV4l2Buffers);
+            stats = mV4l2BufferStats;
+        }
+        dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu, memory %s\n",
+                v4L2BufferCount, numDequeuedV4l2Buffers,
+                (mV4l2MemoryType == V4L2_MEMORY_DMABUF) ? "dmabuf" : "mmap");
+        dprintf(fd, "V4L2 buffer count %s (target %d, bounds [%d, %d], %" PRIu64 " resizes),"
+                " low latency mode %s\n",
+                !mCfg.adaptiveBufferCount ? "fixed" :
+                        (stats.resizeFailed ? "pinned" : "adaptive"),
+                stats.targetBufferCount,
+                mCfg.minNumBuffers, mCfg.maxNumBuffers, stats.numResizes,
+                mCfg.lowLatencyMode ? "on" : "off");
+        dprintf(fd, "V4L2 frames dequeued %" PRIu64 ", waited for buffer return %" PRIu64
+                ", stale frames dropped %" PRIu64 "\n",
+                stats.numFrames, stats.numBufferWaits, stats.numDroppedFrames);
+        dprintf(fd, "Dequeue to result latency: avg %.2fms, max %.2fms over %" PRIu64 " results\n",
+                stats.numResults == 0 ? 0.0 : stats.totalLatencyNs / 1e6 / stats.numResults,
+                stats.maxLatencyNs / 1e6, stats.numResults);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -726,7 +746,37 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
                     }
                 }
             }
-            configureV4l2StreamLocked(mV4l2StreamingFmt, requestFpsMax);
+            if (configureV4l2StreamLocked(mV4l2StreamingFmt, requestFpsMax) != 0) {
+                ALOGE("%s: V4L2 stream reconfiguration failed!", __FUNCTION__);
+                notifyError(request.frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
+                return Status::INTERNAL_ERROR;
+            }
+        }
+    }
+
+    if (mCfg.adaptiveBufferCount && mV4l2Streaming) {
+        uint32_t targetBufferCount;
+        {
+            std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+            targetBufferCount = mV4l2BufferStats.targetBufferCount;
+        }
+        if (targetBufferCount != 0 && targetBufferCount != mV4l2RequestedBufferCount) {
+            {
+                std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+                while (mNumDequeuedV4l2Buffers != 0) {
+                    // Wait until pipeline is idle before resizing V4L2 buffer queue
+                    int waitRet = waitForV4L2BufferReturnLocked(lk);
+                    if (waitRet != 0) {
+                        ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+                        return Status::INTERNAL_ERROR;
+                    }
+                }
+            }
+            if (resizeV4l2BuffersLocked(targetBufferCount) != 0) {
+                ALOGE("%s: V4L2 buffer queue resize failed!", __FUNCTION__);
+                notifyError(request.frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
+                return Status::INTERNAL_ERROR;
+            }
         }
     }
 
@@ -744,9 +794,11 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
 
     std::shared_ptr<HalRequest> halReq = std::make_shared<HalRequest>();
     halReq->frameNumber = request.frameNumber;
+    halReq->setting.setTagIndexEnabled(true);
     halReq->setting = mLatestReqSetting;
     halReq->frameIn = frameIn;
     halReq->shutterTs = shutterTs;
+    halReq->dequeueTs = systemTime(SYSTEM_TIME_MONOTONIC);
     halReq->buffers.resize(numOutputBufs);
     for (size_t i = 0; i < numOutputBufs; i++) {
         HalStreamBuffer& halBuf = halReq->buffers[i];
@@ -837,6 +889,14 @@ Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequ
     // Return V4L2 buffer to V4L2 buffer queue
     enqueueV4l2Frame(req->frameIn);
 
+    {
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - req->dequeueTs;
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mV4l2BufferStats.numResults++;
+        mV4l2BufferStats.totalLatencyNs += latency;
+        mV4l2BufferStats.maxLatencyNs = std::max(mV4l2BufferStats.maxLatencyNs, latency);
+    }
+
     // NotifyShutter
     notifyShutter(req->frameNumber, req->shutterTs);
 
@@ -1075,24 +1135,36 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return 0;
     }
 
-    auto it = mScaledYu12Frames.find(outSz);
-    sp<AllocatedFrame> scaledYu12Buf;
+    // Another output buffer of this request might already need the same transform
+    ScaleKey key {inputCrop, outSz, V4L2_PIX_FMT_YUV420};
+    auto it = mScaledYu12Frames.find(key);
     if (it != mScaledYu12Frames.end()) {
-        scaledYu12Buf = it->second;
-    } else {
-        it = mIntermediateBuffers.find(outSz);
-        if (it == mIntermediateBuffers.end()) {
-            ALOGE("%s: failed to find intermediate buffer size %dx%d",
-                    __FUNCTION__, outSz.width, outSz.height);
-            return -1;
+        mScaleCacheHits++;
+        ret = it->second->getLayout(out);
+        if (ret != 0) {
+            ALOGE("%s: failed to get scaled buffer layout", __FUNCTION__);
         }
-        scaledYu12Buf = it->second;
+        return ret;
+    }
+    mScaleCacheMisses++;
+
+    sp<AllocatedFrame> scaledYu12Buf = acquireIntermediateBufferLocked(outSz);
+    if (scaledYu12Buf == nullptr) {
+        ALOGE("%s: failed to get intermediate buffer size %dx%d",
+                __FUNCTION__, outSz.width, outSz.height);
+        return -1;
     }
+    // Hand the buffer to the per-frame map right away so it goes back to the pool
+    // even if scaling fails below
+    mScaledYu12Frames.insert({key, scaledYu12Buf});
+
     // Scale
     YCbCrLayout outLayout;
     ret = scaledYu12Buf->getLayout(&outLayout);
     if (ret != 0) {
         ALOGE("%s: failed to get output buffer layout", __FUNCTION__);
+        mScaledYu12Frames.erase(key);
+        mIntermediateBuffers[outSz].push_back(scaledYu12Buf);
         return ret;
     }
 
@@ -1120,14 +1192,45 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         ALOGE("%s: failed to scale buffer from %dx%d to %dx%d. Ret %d",
                 __FUNCTION__, inputCrop.width, inputCrop.height,
                 outSz.width, outSz.height, ret);
+        mScaledYu12Frames.erase(key);
+        mIntermediateBuffers[outSz].push_back(scaledYu12Buf);
         return ret;
     }
 
     *out = outLayout;
-    mScaledYu12Frames.insert({outSz, scaledYu12Buf});
     return 0;
 }
 
+sp<AllocatedFrame> ExternalCameraDeviceSession::OutputThread::acquireIntermediateBufferLocked(
+        const Size& sz) {
+    auto it = mIntermediateBuffers.find(sz);
+    if (it != mIntermediateBuffers.end() && !it->second.empty()) {
+        sp<AllocatedFrame> buf = it->second.back();
+        it->second.pop_back();
+        mIntermediateBufferReuses++;
+        return buf;
+    }
+
+    // Only happens when several crops of the same output size are needed for one frame
+    ALOGV("%s: allocating extra intermediate buffer %dx%d", __FUNCTION__, sz.width, sz.height);
+    sp<AllocatedFrame> buf = new AllocatedFrame(sz.width, sz.height);
+    int ret = buf->allocate();
+    if (ret != 0) {
+        ALOGE("%s: allocating intermediate YU12 frame %dx%d failed!",
+                __FUNCTION__, sz.width, sz.height);
+        return nullptr;
+    }
+    mIntermediateBufferAllocs++;
+    return buf;
+}
+
+void ExternalCameraDeviceSession::OutputThread::releaseScaledFramesLocked() {
+    for (auto& pair : mScaledYu12Frames) {
+        mIntermediateBuffers[pair.first.size].push_back(pair.second);
+    }
+    mScaledYu12Frames.clear();
+}
+
 
 int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
         sp<AllocatedFrame>& in, const Size &outSz, YCbCrLayout* out) {
@@ -1966,7 +2069,7 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                 return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
         }
     } // for each buffer
-    mScaledYu12Frames.clear();
+    releaseScaledFramesLocked();
 
     // Don't hold the lock while calling back to parent
     lk.unlock();
@@ -2014,13 +2117,14 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         }
     }
 
-    // Allocating scaled buffers
+    // Allocating scaled buffers, reusing pooled ones from previous stream configurations
     for (const auto& stream : streams) {
         Size sz = {stream.width, stream.height};
         if (sz == v4lSize) {
             continue; // Don't need an intermediate buffer same size as v4lBuffer
         }
-        if (mIntermediateBuffers.count(sz) == 0) {
+        auto& pool = mIntermediateBuffers[sz];
+        if (pool.empty()) {
             // Create new intermediate buffer
             sp<AllocatedFrame> buf = new AllocatedFrame(stream.width, stream.height);
             int ret = buf->allocate();
@@ -2029,11 +2133,15 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
                             __FUNCTION__, stream.width, stream.height);
                 return Status::INTERNAL_ERROR;
             }
-            mIntermediateBuffers[sz] = buf;
+            pool.push_back(buf);
+            mIntermediateBufferAllocs++;
+        } else {
+            mIntermediateBufferReuses++;
         }
     }
 
-    // Remove unconfigured buffers
+    // Keep a few unconfigured buffers around in case the next configuration uses them again
+    size_t numSpare = 0;
     auto it = mIntermediateBuffers.begin();
     while (it != mIntermediateBuffers.end()) {
         bool configured = false;
@@ -2046,6 +2154,9 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         }
         if (configured) {
             it++;
+        } else if (numSpare + it->second.size() <= kMaxSpareIntermediateBuffers) {
+            numSpare += it->second.size();
+            it++;
         } else {
             it = mIntermediateBuffers.erase(it);
         }
@@ -2140,6 +2251,15 @@ void ExternalCameraDeviceSession::OutputThread::dump(int fd) {
         dprintf(fd, "%d, ", req->frameNumber);
     }
     dprintf(fd, "\n");
+
+    uint64_t hits = mScaleCacheHits;
+    uint64_t misses = mScaleCacheMisses;
+    uint64_t lookups = hits + misses;
+    dprintf(fd, "OutputThread scale cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)\n",
+            hits, misses, lookups == 0 ? 0.0 : 100.0 * hits / lookups);
+    dprintf(fd, "OutputThread intermediate buffers: %" PRIu64 " allocated, %" PRIu64 " reused\n",
+            static_cast<uint64_t>(mIntermediateBufferAllocs),
+            static_cast<uint64_t>(mIntermediateBufferReuses));
 }
 
 void ExternalCameraDeviceSession::cleanupBuffersLocked(int id) {
@@ -2242,7 +2362,6 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
             return -1;
         }
     }
-    mV4L2BufferCount = 0;
 
     // VIDIOC_STREAMOFF
     v4l2_buf_type capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -2251,20 +2370,122 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
         return -errno;
     }
 
+    int ret = releaseV4l2BuffersLocked();
+    if (ret != OK) {
+        return ret;
+    }
+
+    mV4l2Streaming = false;
+    return OK;
+}
+
+int ExternalCameraDeviceSession::releaseV4l2BuffersLocked() {
+    mV4L2BufferCount = 0;
+
     // VIDIOC_REQBUFS: clear buffers
     v4l2_requestbuffers req_buffers{};
     req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req_buffers.memory = V4L2_MEMORY_MMAP;
+    req_buffers.memory = mV4l2MemoryType;
     req_buffers.count = 0;
     if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
         ALOGE("%s: REQBUFS failed: %s", __FUNCTION__, strerror(errno));
         return -errno;
     }
+    mV4l2DmaBufs.clear();
+    return OK;
+}
 
-    mV4l2Streaming = false;
+int ExternalCameraDeviceSession::v4l2StreamOnLocked() {
+    // VIDIOC_STREAMON: start streaming
+    v4l2_buf_type capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMON, &capture_type));
+    if (ret < 0) {
+        int numAttempt = 0;
+        while (ret < 0) {
+            ALOGW("%s: VIDIOC_STREAMON failed, wait 33ms and try again", __FUNCTION__);
+            usleep(IOCTL_RETRY_SLEEP_US); // sleep 100 ms and try again
+            ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMON, &capture_type));
+            if (numAttempt == MAX_RETRY) {
+                break;
+            }
+            numAttempt++;
+        }
+        if (ret < 0) {
+            ALOGE("%s: VIDIOC_STREAMON ioctl failed: %s", __FUNCTION__, strerror(errno));
+            return -errno;
+        }
+    }
+    // The device is streaming from here on, so a later stream off has to undo it
+    mV4l2Streaming = true;
+
+    // Swallow first few frames after streamOn to account for bad frames from some devices
+    for (int i = 0; i < kBadFramesAfterStreamOn; i++) {
+        v4l2_buffer buffer{};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = mV4l2MemoryType;
+        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
+            ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
+            return -errno;
+        }
+
+        if (mV4l2MemoryType == V4L2_MEMORY_DMABUF && buffer.index < mV4l2DmaBufs.size()) {
+            buffer.m.fd = mV4l2DmaBufs[buffer.index].get();
+            buffer.length = mMaxV4L2BufferSize;
+        }
+
+        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+            ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer.index, strerror(errno));
+            return -errno;
+        }
+    }
     return OK;
 }
 
+int ExternalCameraDeviceSession::resizeV4l2BuffersLocked(uint32_t count) {
+    ATRACE_CALL();
+    const uint32_t previousCount = mV4l2RequestedBufferCount;
+    // Format and fps are kept: only the buffer queue is torn down and requested again
+    int ret = v4l2StreamOffLocked();
+    if (ret != OK) {
+        ALOGE("%s: stop v4l2 streaming failed: ret %d", __FUNCTION__, ret);
+        return ret;
+    }
+
+    ret = requestV4l2BuffersLocked(count);
+    if (ret == OK) {
+        ret = v4l2StreamOnLocked();
+    }
+    if (ret == OK) {
+        ALOGI("%s: resized V4L2 buffer queue %d -> %d", __FUNCTION__, previousCount, count);
+        mV4l2RequestedBufferCount = count;
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mV4l2BufferStats.numResizes++;
+        return OK;
+    }
+
+    ALOGW("%s: resizing V4L2 buffer queue %d -> %d failed (%d), restoring %d buffers",
+            __FUNCTION__, previousCount, count, ret, previousCount);
+    {
+        // Settle on the count that is known to work rather than retrying every window
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mV4l2BufferStats.targetBufferCount = previousCount;
+        mV4l2BufferStats.resizeFailed = true;
+    }
+
+    // Drop whatever the failed attempt left in the queue
+    ret = mV4l2Streaming ? v4l2StreamOffLocked() : releaseV4l2BuffersLocked();
+    if (ret == OK) {
+        ret = requestV4l2BuffersLocked(previousCount);
+    }
+    if (ret == OK) {
+        ret = v4l2StreamOnLocked();
+    }
+    if (ret != OK) {
+        ALOGE("%s: restoring %d V4L2 buffers failed: ret %d", __FUNCTION__, previousCount, ret);
+    }
+    return ret;
+}
+
 int ExternalCameraDeviceSession::setV4l2FpsLocked(double fps) {
     // VIDIOC_G_PARM/VIDIOC_S_PARM: set fps
     v4l2_streamparm streamparm = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
@@ -2390,6 +2611,58 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
 
     uint32_t v4lBufferCount = (fps >= kDefaultFps) ?
             mCfg.numVideoBuffers : mCfg.numStillBuffers;
+    if (mCfg.adaptiveBufferCount) {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        uint32_t& target = mV4l2BufferStats.targetBufferCount;
+        if (target == 0) {
+            target = v4lBufferCount;
+        }
+        target = std::min(std::max(target, mCfg.minNumBuffers), mCfg.maxNumBuffers);
+        if (mV4l2RequestedBufferCount != 0 && target != mV4l2RequestedBufferCount) {
+            ALOGI("%s: resizing V4L2 buffer queue %d -> %d", __FUNCTION__,
+                    mV4l2RequestedBufferCount, target);
+            mV4l2BufferStats.numResizes++;
+        }
+        v4lBufferCount = target;
+    }
+    mV4l2RequestedBufferCount = v4lBufferCount;
+    ret = requestV4l2BuffersLocked(v4lBufferCount);
+    if (ret != OK) {
+        return ret;
+    }
+
+    ret = v4l2StreamOnLocked();
+    if (ret != OK) {
+        return ret;
+    }
+
+    ALOGI("%s: start V4L2 streaming %dx%d@%ffps",
+                __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, fps);
+    mV4l2StreamingFmt = v4l2Fmt;
+    return OK;
+}
+
+int ExternalCameraDeviceSession::requestV4l2BuffersLocked(uint32_t v4lBufferCount) {
+    if (mCfg.dmaBufEnabled && !mV4l2DmaBufUnsupported) {
+        int ret = requestV4l2DmaBuffersLocked(v4lBufferCount);
+        if (ret == OK) {
+            return OK;
+        }
+        ALOGW("%s: V4L2 dma-buf import failed (%d), falling back to mmap buffers",
+                __FUNCTION__, ret);
+        mV4l2DmaBufUnsupported = true;
+
+        // Drop whatever the failed attempt left in the queue
+        v4l2_requestbuffers req_buffers{};
+        req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req_buffers.memory = V4L2_MEMORY_DMABUF;
+        req_buffers.count = 0;
+        TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers));
+        mV4l2DmaBufs.clear();
+        mV4L2BufferCount = 0;
+    }
+
+    mV4l2MemoryType = V4L2_MEMORY_MMAP;
     // VIDIOC_REQBUFS: create buffers
     v4l2_requestbuffers req_buffers{};
     req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -2427,46 +2700,51 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
         }
     }
 
-    // VIDIOC_STREAMON: start streaming
-    v4l2_buf_type capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMON, &capture_type));
-    if (ret < 0) {
-        int numAttempt = 0;
-        while (ret < 0) {
-            ALOGW("%s: VIDIOC_STREAMON failed, wait 33ms and try again", __FUNCTION__);
-            usleep(IOCTL_RETRY_SLEEP_US); // sleep 100 ms and try again
-            ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMON, &capture_type));
-            if (numAttempt == MAX_RETRY) {
-                break;
-            }
-            numAttempt++;
-        }
-        if (ret < 0) {
-            ALOGE("%s: VIDIOC_STREAMON ioctl failed: %s", __FUNCTION__, strerror(errno));
-            return -errno;
-        }
+    return OK;
+}
+
+int ExternalCameraDeviceSession::requestV4l2DmaBuffersLocked(uint32_t v4lBufferCount) {
+    mV4l2MemoryType = V4L2_MEMORY_DMABUF;
+
+    // VIDIOC_REQBUFS: setup queue for imported buffers
+    v4l2_requestbuffers req_buffers{};
+    req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req_buffers.memory = V4L2_MEMORY_DMABUF;
+    req_buffers.count = v4lBufferCount;
+    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
+        ALOGW("%s: VIDIOC_REQBUFS (DMABUF) failed: %s", __FUNCTION__, strerror(errno));
+        return -errno;
     }
 
-    // Swallow first few frames after streamOn to account for bad frames from some devices
-    for (int i = 0; i < kBadFramesAfterStreamOn; i++) {
-        v4l2_buffer buffer{};
-        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V4L2_MEMORY_MMAP;
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
-            ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
-            return -errno;
+    if (req_buffers.count < v4lBufferCount) {
+        ALOGE("%s: VIDIOC_REQBUFS expected %d buffers, got %d instead",
+                __FUNCTION__, v4lBufferCount, req_buffers.count);
+        return NO_MEMORY;
+    }
+
+    // Allocate dma-bufs and send them to driver
+    mV4l2DmaBufs.clear();
+    mV4L2BufferCount = req_buffers.count;
+    for (uint32_t i = 0; i < req_buffers.count; i++) {
+        unique_fd dmaBuf = allocateDmaHeapBuffer(mCfg.dmaHeapPath, mMaxV4L2BufferSize);
+        if (dmaBuf.get() < 0) {
+            return NO_MEMORY;
         }
 
+        v4l2_buffer buffer{};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.index = i;
+        buffer.memory = V4L2_MEMORY_DMABUF;
+        buffer.m.fd = dmaBuf.get();
+        buffer.length = mMaxV4L2BufferSize;
         if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
-            ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer.index, strerror(errno));
+            ALOGW("%s: QBUF (DMABUF) %d failed: %s", __FUNCTION__, i,  strerror(errno));
             return -errno;
         }
+        mV4l2DmaBufs.push_back(std::move(dmaBuf));
     }
-
-    ALOGI("%s: start V4L2 streaming %dx%d@%ffps",
-                __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, fps);
-    mV4l2StreamingFmt = v4l2Fmt;
-    mV4l2Streaming = true;
+    ALOGI("%s: using %zu dma-buf V4L2 buffers from %s",
+            __FUNCTION__, mV4l2DmaBufs.size(), mCfg.dmaHeapPath.c_str());
     return OK;
 }
 
@@ -2479,9 +2757,11 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
         return ret;
     }
 
+    bool waited = false;
     {
         std::unique_lock<std::mutex> lk(mV4l2BufferLock);
         if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
+            waited = true;
             int waitRet = waitForV4L2BufferReturnLocked(lk);
             if (waitRet != 0) {
                 return ret;
@@ -2492,13 +2772,36 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
     ATRACE_BEGIN("VIDIOC_DQBUF");
     v4l2_buffer buffer{};
     buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.memory = mV4l2MemoryType;
     if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
         ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
         return ret;
     }
     ATRACE_END();
 
+    uint64_t numDropped = 0;
+    if (mCfg.lowLatencyMode) {
+        // Skip to the newest frame the driver has ready and give the stale ones back
+        ATRACE_BEGIN("dropStaleV4l2Frames");
+        struct pollfd pfd = { .fd = mV4l2Fd.get(), .events = POLLIN, .revents = 0 };
+        while (TEMP_FAILURE_RETRY(poll(&pfd, 1, /*timeoutMs*/0)) > 0 && (pfd.revents & POLLIN)) {
+            v4l2_buffer newer{};
+            newer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            newer.memory = mV4l2MemoryType;
+            if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &newer)) < 0) {
+                break;
+            }
+            if (requeueV4l2BufferLocked(&buffer) != 0) {
+                // Stale buffer is lost to the driver, account for it like a failed enqueue
+                std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+                mNumDequeuedV4l2Buffers++;
+            }
+            buffer = newer;
+            numDropped++;
+        }
+        ATRACE_END();
+    }
+
     if (buffer.index >= mV4L2BufferCount) {
         ALOGE("%s: Invalid buffer id: %d", __FUNCTION__, buffer.index);
         return ret;
@@ -2527,20 +2830,93 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         mNumDequeuedV4l2Buffers++;
+        mV4l2BufferStats.numDroppedFrames += numDropped;
+        updateV4l2BufferTargetLocked(waited);
+    }
+    if (mV4l2MemoryType == V4L2_MEMORY_DMABUF) {
+        return new V4L2Frame(
+                mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
+                buffer.index, mV4l2DmaBufs[buffer.index].get(), buffer.bytesused,
+                /*offset*/0, /*isDmaBuf*/true);
     }
     return new V4L2Frame(
             mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
             buffer.index, mV4l2Fd.get(), buffer.bytesused, buffer.m.offset);
 }
 
+int ExternalCameraDeviceSession::requeueV4l2BufferLocked(v4l2_buffer* buffer) {
+    if (mV4l2MemoryType == V4L2_MEMORY_DMABUF) {
+        if (buffer->index >= mV4l2DmaBufs.size()) {
+            ALOGE("%s: Invalid buffer id: %d", __FUNCTION__, buffer->index);
+            return -EINVAL;
+        }
+        buffer->m.fd = mV4l2DmaBufs[buffer->index].get();
+        buffer->length = mMaxV4L2BufferSize;
+    }
+    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, buffer)) < 0) {
+        ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer->index, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+void ExternalCameraDeviceSession::updateV4l2BufferTargetLocked(bool waited) {
+    V4L2BufferStats& stats = mV4l2BufferStats;
+    stats.numFrames++;
+    if (waited) {
+        stats.numBufferWaits++;
+    }
+    if (!mCfg.adaptiveBufferCount || stats.resizeFailed) {
+        return;
+    }
+
+    stats.windowFrames++;
+    if (waited) {
+        stats.windowWaits++;
+    }
+    if (stats.windowFrames < kBufferAdaptWindowFrames) {
+        return;
+    }
+
+    uint32_t target = stats.targetBufferCount;
+    if (stats.windowWaits * kBufferWaitRatioDenom > stats.windowFrames) {
+        // Output pipeline keeps running out of buffers: add one
+        stats.idleWindows = 0;
+        if (target < mCfg.maxNumBuffers) {
+            target++;
+        }
+    } else if (stats.windowWaits == 0) {
+        // Buffers are sitting in the queue aging: remove one once this has been stable a while
+        stats.idleWindows++;
+        if (stats.idleWindows >= kIdleWindowsToShrink && target > mCfg.minNumBuffers) {
+            target--;
+            stats.idleWindows = 0;
+        }
+    } else {
+        stats.idleWindows = 0;
+    }
+
+    if (target != stats.targetBufferCount) {
+        ALOGV("%s: V4L2 buffer count target %d -> %d (%d waits in %d frames)", __FUNCTION__,
+                stats.targetBufferCount, target, stats.windowWaits, stats.windowFrames);
+        stats.targetBufferCount = target;
+    }
+    stats.windowFrames = 0;
+    stats.windowWaits = 0;
+}
+
 void ExternalCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
     ATRACE_CALL();
     frame->unmap();
     ATRACE_BEGIN("VIDIOC_QBUF");
     v4l2_buffer buffer{};
     buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.memory = mV4l2MemoryType;
     buffer.index = frame->mBufferIndex;
+    if (mV4l2MemoryType == V4L2_MEMORY_DMABUF) {
+        buffer.m.fd = mV4l2DmaBufs[frame->mBufferIndex].get();
+        buffer.length = mMaxV4L2BufferSize;
+    }
     if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
         ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__,
                 frame->mBufferIndex, strerror(errno));
@@ -2918,16 +3294,6 @@ status_t ExternalCameraDeviceSession::initDefaultRequests() {
 
 status_t ExternalCameraDeviceSession::fillCaptureResult(
         common::V1_0::helper::CameraMetadata &md, nsecs_t timestamp) {
-    // android.control
-    // For USB camera, we don't know the AE state. Set the state to converged to
-    // indicate the frame should be good to use. Then apps don't have to wait the
-    // AE state.
-    const uint8_t aeState = ANDROID_CONTROL_AE_STATE_CONVERGED;
-    UPDATE(md, ANDROID_CONTROL_AE_STATE, &aeState, 1);
-
-    const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
-    UPDATE(md, ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
-
     bool afTrigger = false;
     {
         std::lock_guard<std::mutex> lk(mAfTriggerLock);
@@ -2942,6 +3308,21 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(
         }
     }
 
+    camera_metadata_ro_entry active_array_size =
+        mCameraCharacteristics.find(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE);
+
+    if (active_array_size.count == 0) {
+        ALOGE("%s: cannot find active array size!", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    // android.control
+    // For USB camera, we don't know the AE state. Set the state to converged to
+    // indicate the frame should be good to use. Then apps don't have to wait the
+    // AE state.
+    const uint8_t aeState = ANDROID_CONTROL_AE_STATE_CONVERGED;
+    const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
+
     // For USB camera, the USB camera handles everything and we don't have control
     // over AF. We only simply fake the AF metadata based on the request
     // received here.
@@ -2951,46 +3332,50 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(
     } else {
         afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
     }
-    UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
 
     // Set AWB state to converged to indicate the frame should be good to use.
     const uint8_t awbState = ANDROID_CONTROL_AWB_STATE_CONVERGED;
-    UPDATE(md, ANDROID_CONTROL_AWB_STATE, &awbState, 1);
-
     const uint8_t awbLock = ANDROID_CONTROL_AWB_LOCK_OFF;
-    UPDATE(md, ANDROID_CONTROL_AWB_LOCK, &awbLock, 1);
-
-    camera_metadata_ro_entry active_array_size =
-        mCameraCharacteristics.find(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE);
-
-    if (active_array_size.count == 0) {
-        ALOGE("%s: cannot find active array size!", __FUNCTION__);
-        return -EINVAL;
-    }
 
     const uint8_t flashState = ANDROID_FLASH_STATE_UNAVAILABLE;
-    UPDATE(md, ANDROID_FLASH_STATE, &flashState, 1);
 
     // This means pipeline latency of X frame intervals. The maximum number is 4.
     const uint8_t requestPipelineMaxDepth = 4;
-    UPDATE(md, ANDROID_REQUEST_PIPELINE_DEPTH, &requestPipelineMaxDepth, 1);
 
     // android.scaler
     const int32_t crop_region[] = {
           active_array_size.data.i32[0], active_array_size.data.i32[1],
           active_array_size.data.i32[2], active_array_size.data.i32[3],
     };
-    UPDATE(md, ANDROID_SCALER_CROP_REGION, crop_region, ARRAY_SIZE(crop_region));
-
-    // android.sensor
-    UPDATE(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
 
     // android.statistics
     const uint8_t lensShadingMapMode = ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
-    UPDATE(md, ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &lensShadingMapMode, 1);
-
     const uint8_t sceneFlicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
-    UPDATE(md, ANDROID_STATISTICS_SCENE_FLICKER, &sceneFlicker, 1);
+
+#define RESULT_ENTRY(tag, type, field, data, size) \
+    { .tag = (tag), .type = (type), .count = (size), .data = { .field = (data) } }
+    // Applied in one pass so the result buffer is grown at most once
+    const camera_metadata_ro_entry resultEntries[] = {
+        RESULT_ENTRY(ANDROID_CONTROL_AE_STATE, TYPE_BYTE, u8, &aeState, 1),
+        RESULT_ENTRY(ANDROID_CONTROL_AE_LOCK, TYPE_BYTE, u8, &ae_lock, 1),
+        RESULT_ENTRY(ANDROID_CONTROL_AF_STATE, TYPE_BYTE, u8, &afState, 1),
+        RESULT_ENTRY(ANDROID_CONTROL_AWB_STATE, TYPE_BYTE, u8, &awbState, 1),
+        RESULT_ENTRY(ANDROID_CONTROL_AWB_LOCK, TYPE_BYTE, u8, &awbLock, 1),
+        RESULT_ENTRY(ANDROID_FLASH_STATE, TYPE_BYTE, u8, &flashState, 1),
+        RESULT_ENTRY(ANDROID_REQUEST_PIPELINE_DEPTH, TYPE_BYTE, u8,
+                &requestPipelineMaxDepth, 1),
+        RESULT_ENTRY(ANDROID_SCALER_CROP_REGION, TYPE_INT32, i32, crop_region,
+                ARRAY_SIZE(crop_region)),
+        RESULT_ENTRY(ANDROID_SENSOR_TIMESTAMP, TYPE_INT64, i64, &timestamp, 1),
+        RESULT_ENTRY(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, TYPE_BYTE, u8,
+                &lensShadingMapMode, 1),
+        RESULT_ENTRY(ANDROID_STATISTICS_SCENE_FLICKER, TYPE_BYTE, u8, &sceneFlicker, 1),
+    };
+#undef RESULT_ENTRY
+    if (md.update(resultEntries, ARRAY_SIZE(resultEntries)) != OK) {
+        ALOGE("%s: update capture result metadata failed!", __FUNCTION__);
+        return BAD_VALUE;
+    }
 
     return OK;
 }
@@ -18,10 +18,28 @@
 #include <log/log.h>
 
 #include <cmath>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
 #include <linux/videodev2.h>
 #include "ExternalCameraUtils.h"
 
+#if __has_include(<linux/dma-heap.h>)
+#include <linux/dma-heap.h>
+#else
+// Older kernel headers predate the dma-heap uapi
+struct dma_heap_allocation_data {
+    __u64 len;
+    __u32 fd;
+    __u32 fd_flags;
+    __u64 heap_flags;
+};
+#define DMA_HEAP_IOC_MAGIC 'H'
+#define DMA_HEAP_IOCTL_ALLOC _IOWR(DMA_HEAP_IOC_MAGIC, 0x0, struct dma_heap_allocation_data)
+#endif
+
 namespace android {
 namespace hardware {
 namespace camera {
@@ -31,9 +49,10 @@ namespace implementation {
 
 V4L2Frame::V4L2Frame(
         uint32_t w, uint32_t h, uint32_t fourcc,
-        int bufIdx, int fd, uint32_t dataSize, uint64_t offset) :
+        int bufIdx, int fd, uint32_t dataSize, uint64_t offset, bool isDmaBuf) :
         mWidth(w), mHeight(h), mFourcc(fourcc),
-        mBufferIndex(bufIdx), mFd(fd), mDataSize(dataSize), mOffset(offset) {}
+        mBufferIndex(bufIdx), mIsDmaBuf(isDmaBuf),
+        mFd(fd), mDataSize(dataSize), mOffset(offset) {}
 
 int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
     if (data == nullptr || dataSize == nullptr) {
@@ -51,6 +70,12 @@ int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
         }
         mData = static_cast<uint8_t*>(addr);
         mMapped = true;
+        if (mIsDmaBuf) {
+            struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+            if (TEMP_FAILURE_RETRY(ioctl(mFd, DMA_BUF_IOCTL_SYNC, &sync)) < 0) {
+                ALOGW("%s: dma-buf sync start failed: %s", __FUNCTION__, strerror(errno));
+            }
+        }
     }
     *data = mData;
     *dataSize = mDataSize;
@@ -62,6 +87,12 @@ int V4L2Frame::unmap() {
     std::lock_guard<std::mutex> lk(mLock);
     if (mMapped) {
         ALOGV("%s: V4L unmap data %p size %zu", __FUNCTION__, mData, mDataSize);
+        if (mIsDmaBuf) {
+            struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ };
+            if (TEMP_FAILURE_RETRY(ioctl(mFd, DMA_BUF_IOCTL_SYNC, &sync)) < 0) {
+                ALOGW("%s: dma-buf sync end failed: %s", __FUNCTION__, strerror(errno));
+            }
+        }
         if (munmap(mData, mDataSize) != 0) {
             ALOGE("%s: V4L2 buffer unmap failed: %s", __FUNCTION__, strerror(errno));
             return -EINVAL;
@@ -75,6 +106,28 @@ V4L2Frame::~V4L2Frame() {
     unmap();
 }
 
+android::base::unique_fd allocateDmaHeapBuffer(const std::string& heapPath, size_t size) {
+    android::base::unique_fd heapFd(TEMP_FAILURE_RETRY(
+            open(heapPath.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (heapFd.get() < 0) {
+        ALOGE("%s: open dma-heap %s failed: %s", __FUNCTION__, heapPath.c_str(), strerror(errno));
+        return android::base::unique_fd();
+    }
+
+    struct dma_heap_allocation_data data = {
+        .len = size,
+        .fd = 0,
+        .fd_flags = O_RDWR | O_CLOEXEC,
+        .heap_flags = 0,
+    };
+    if (TEMP_FAILURE_RETRY(ioctl(heapFd.get(), DMA_HEAP_IOCTL_ALLOC, &data)) < 0) {
+        ALOGE("%s: allocating %zu bytes from %s failed: %s", __FUNCTION__,
+                size, heapPath.c_str(), strerror(errno));
+        return android::base::unique_fd();
+    }
+    return android::base::unique_fd(static_cast<int>(data.fd));
+}
+
 AllocatedFrame::AllocatedFrame(
         uint32_t w, uint32_t h) :
         mWidth(w), mHeight(h), mFourcc(V4L2_PIX_FMT_YUV420) {};
@@ -162,8 +215,11 @@ namespace {
     const int kDefaultJpegBufSize = 5 << 20; // 5MB
     const int kDefaultNumVideoBuffer = 4;
     const int kDefaultNumStillBuffer = 2;
+    const int kDefaultMinNumBuffer = 2;
+    const int kDefaultMaxNumBuffer = 8;
     const int kDefaultOrientation = 0; // suitable for natural landscape displays like tablet/TV
                                        // For phone devices 270 is better
+    const char* kDefaultDmaHeapPath = "/dev/dma_heap/system";
 } // anonymous namespace
 
 const char* ExternalCameraConfig::kDefaultCfgPath = "/vendor/etc/external_camera_config.xml";
@@ -240,6 +296,29 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
                 numStillBuf->UnsignedAttribute("count", /*Default*/kDefaultNumStillBuffer);
     }
 
+    XMLElement *adaptiveBuf = deviceCfg->FirstChildElement("AdaptiveBufferCount");
+    if (adaptiveBuf == nullptr) {
+        ALOGI("%s: adaptive buffer count is not enabled", __FUNCTION__);
+    } else {
+        ret.adaptiveBufferCount = adaptiveBuf->BoolAttribute("enabled", false);
+        ret.minNumBuffers = adaptiveBuf->UnsignedAttribute("min", /*Default*/kDefaultMinNumBuffer);
+        ret.maxNumBuffers = adaptiveBuf->UnsignedAttribute("max", /*Default*/kDefaultMaxNumBuffer);
+        if (ret.minNumBuffers == 0 || ret.minNumBuffers > ret.maxNumBuffers) {
+            ALOGE("%s: invalid adaptive buffer count bounds [%d, %d], disabling",
+                    __FUNCTION__, ret.minNumBuffers, ret.maxNumBuffers);
+            ret.adaptiveBufferCount = false;
+            ret.minNumBuffers = kDefaultMinNumBuffer;
+            ret.maxNumBuffers = kDefaultMaxNumBuffer;
+        }
+    }
+
+    XMLElement *lowLatency = deviceCfg->FirstChildElement("LowLatencyMode");
+    if (lowLatency == nullptr) {
+        ALOGI("%s: low latency mode is not enabled", __FUNCTION__);
+    } else {
+        ret.lowLatencyMode = lowLatency->BoolAttribute("enabled", false);
+    }
+
     XMLElement *fpsList = deviceCfg->FirstChildElement("FpsList");
     if (fpsList == nullptr) {
         ALOGI("%s: no fps list specified", __FUNCTION__);
@@ -284,6 +363,17 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
         ret.orientation = orientation->IntAttribute("degree", /*Default*/kDefaultOrientation);
     }
 
+    XMLElement *dmaBuf = deviceCfg->FirstChildElement("DmaBufCapture");
+    if (dmaBuf == nullptr) {
+        ALOGI("%s: dma-buf V4L2 capture is not enabled", __FUNCTION__);
+    } else {
+        ret.dmaBufEnabled = dmaBuf->BoolAttribute("enabled", false);
+        const char* heap = dmaBuf->Attribute("heap");
+        if (heap != nullptr) {
+            ret.dmaHeapPath = heap;
+        }
+    }
+
     ALOGI("%s: external camera cfg loaded: maxJpgBufSize %d,"
             " num video buffers %d, num still buffers %d, orientation %d",
             __FUNCTION__, ret.maxJpegBufSize,
@@ -298,6 +388,12 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
     }
     ALOGI("%s: minStreamSize: %dx%d" , __FUNCTION__,
          ret.minStreamSize.width, ret.minStreamSize.height);
+    ALOGI("%s: adaptive buffer count %s [%d, %d], low latency mode %s", __FUNCTION__,
+            ret.adaptiveBufferCount ? "enabled" : "disabled",
+            ret.minNumBuffers, ret.maxNumBuffers,
+            ret.lowLatencyMode ? "enabled" : "disabled");
+    ALOGI("%s: dma-buf capture %s, heap %s", __FUNCTION__,
+            ret.dmaBufEnabled ? "enabled" : "disabled", ret.dmaHeapPath.c_str());
     return ret;
 }
 
@@ -333,8 +429,14 @@ ExternalCameraConfig::ExternalCameraConfig() :
         maxJpegBufSize(kDefaultJpegBufSize),
         numVideoBuffers(kDefaultNumVideoBuffer),
         numStillBuffers(kDefaultNumStillBuffer),
+        adaptiveBufferCount(false),
+        minNumBuffers(kDefaultMinNumBuffer),
+        maxNumBuffers(kDefaultMaxNumBuffer),
+        lowLatencyMode(false),
         depthEnabled(false),
-        orientation(kDefaultOrientation) {
+        orientation(kDefaultOrientation),
+        dmaBufEnabled(false),
+        dmaHeapPath(kDefaultDmaHeapPath) {
     fpsLimits.push_back({/*Size*/{ 640,  480}, /*FPS upper bound*/30.0});
     fpsLimits.push_back({/*Size*/{1280,  720}, /*FPS upper bound*/7.5});
     fpsLimits.push_back({/*Size*/{1920, 1080}, /*FPS upper bound*/5.0});
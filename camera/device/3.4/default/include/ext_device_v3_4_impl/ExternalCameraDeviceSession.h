@@ -23,6 +23,8 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <include/convert.h>
+#include <linux/videodev2.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <list>
@@ -167,6 +169,7 @@ protected:
         common::V1_0::helper::CameraMetadata setting;
         sp<V4L2Frame> frameIn;
         nsecs_t shutterTs;
+        nsecs_t dequeueTs; // when frameIn was dequeued from V4L2, for latency statistics
         std::vector<HalStreamBuffer> buffers;
     };
 
@@ -191,7 +194,18 @@ protected:
     // fps = 0.0 means default, which is
     // slowest fps that is at least 30, or fastest fps if 30 is not supported
     int configureV4l2StreamLocked(const SupportedV4L2Format& fmt, double fps = 0.0);
+    // Request and queue V4L2 buffers, trying dma-buf import first if enabled in config
+    int requestV4l2BuffersLocked(uint32_t count);
+    int requestV4l2DmaBuffersLocked(uint32_t count);
     int v4l2StreamOffLocked();
+    // VIDIOC_STREAMON, then swallow the first frames. Buffers must already be queued.
+    int v4l2StreamOnLocked();
+    // Return all V4L2 buffers to the driver, which must not be streaming
+    int releaseV4l2BuffersLocked();
+    // Restart a running stream with a different number of buffers, keeping format and fps.
+    // No buffer may be dequeued. On failure the previous count is restored; an error is only
+    // returned if that failed too and the stream is down.
+    int resizeV4l2BuffersLocked(uint32_t count);
     int setV4l2FpsLocked(double fps);
     static Status isStreamCombinationSupported(const V3_2::StreamConfiguration& config,
             const std::vector<SupportedV4L2Format>& supportedFormats,
@@ -251,6 +265,12 @@ protected:
 
     int waitForV4L2BufferReturnLocked(std::unique_lock<std::mutex>& lk);
 
+    // Called with mV4l2BufferLock held after each dequeue. Updates the adaptive V4L2 buffer
+    // count target once per kBufferAdaptWindowFrames frames.
+    void updateV4l2BufferTargetLocked(bool waited);
+    // Requeue a dequeued V4L2 buffer directly without going through V4L2Frame
+    int requeueV4l2BufferLocked(v4l2_buffer* buffer);
+
     class OutputThread : public android::Thread {
     public:
         OutputThread(wp<ExternalCameraDeviceSession> parent, CroppingType);
@@ -282,6 +302,34 @@ protected:
         static int getCropRect(
                 CroppingType ct, const Size& inSize, const Size& outSize, IMapper::Rect* out);
 
+        // Identifies one crop+scale transform of the current input frame
+        struct ScaleKey {
+            IMapper::Rect crop;
+            Size size;
+            uint32_t fourcc;
+
+            bool operator==(const ScaleKey& other) const {
+                return (crop.left == other.crop.left && crop.top == other.crop.top &&
+                        crop.width == other.crop.width && crop.height == other.crop.height &&
+                        size == other.size && fourcc == other.fourcc);
+            }
+        };
+
+        struct ScaleKeyHasher {
+            size_t operator()(const ScaleKey& key) const {
+                size_t result = SizeHasher()(key.size);
+                result = 31 * result + key.crop.left;
+                result = 31 * result + key.crop.top;
+                result = 31 * result + key.crop.width;
+                result = 31 * result + key.crop.height;
+                result = 31 * result + key.fourcc;
+                return result;
+            }
+        };
+
+        // Max number of intermediate buffers of unconfigured sizes kept for later reuse
+        static const size_t kMaxSpareIntermediateBuffers = 2;
+
         static const int kFlushWaitTimeoutSec = 3; // 3 sec
         static const int kReqWaitTimeoutMs = 33;   // 33ms
         static const int kReqWaitTimesMax = 90;    // 33ms * 90 ~= 3 sec
@@ -293,6 +341,11 @@ protected:
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
 
+        // Get a free intermediate buffer of given size from the pool, allocating one if needed
+        sp<AllocatedFrame> acquireIntermediateBufferLocked(const Size& sz);
+        // Return all scaled frames of the current input frame back to the intermediate pool
+        void releaseScaledFramesLocked();
+
         int cropAndScaleThumbLocked(
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
@@ -326,8 +379,16 @@ protected:
         mutable std::mutex mBufferLock; // Protect access to intermediate buffers
         sp<AllocatedFrame> mYu12Frame;
         sp<AllocatedFrame> mYu12ThumbFrame;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mIntermediateBuffers;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mScaledYu12Frames;
+        // Free intermediate buffers, grouped by size
+        std::unordered_map<Size, std::vector<sp<AllocatedFrame>>, SizeHasher> mIntermediateBuffers;
+        // Crop+scale results of the current input frame. Buffers here are taken out of
+        // mIntermediateBuffers and returned to it once the request is done.
+        std::unordered_map<ScaleKey, sp<AllocatedFrame>, ScaleKeyHasher> mScaledYu12Frames;
+        // Statistics for dumpState, only updated with mBufferLock held
+        std::atomic<uint64_t> mScaleCacheHits {0};
+        std::atomic<uint64_t> mScaleCacheMisses {0};
+        std::atomic<uint64_t> mIntermediateBufferAllocs {0};
+        std::atomic<uint64_t> mIntermediateBufferReuses {0};
         YCbCrLayout mYu12FrameLayout;
         YCbCrLayout mYu12ThumbFrameLayout;
         uint32_t mBlobBufferSize = 0; // 0 -> HAL derive buffer size, else: use given size
@@ -365,6 +426,13 @@ protected:
     SupportedV4L2Format mV4l2StreamingFmt;
     double mV4l2StreamingFps = 0.0;
     size_t mV4L2BufferCount = 0;
+    // V4L2_MEMORY_MMAP or V4L2_MEMORY_DMABUF
+    uint32_t mV4l2MemoryType = V4L2_MEMORY_MMAP;
+    // dma-bufs owned by the HAL and imported to V4L2, indexed by V4L2 buffer index.
+    // Only used in V4L2_MEMORY_DMABUF mode.
+    std::vector<unique_fd> mV4l2DmaBufs;
+    // Driver refused dma-buf import once; stick to mmap for the rest of the session
+    bool mV4l2DmaBufUnsupported = false;
 
     static const int kBufferWaitTimeoutSec = 3; // TODO: handle long exposure (or not allowing)
     std::mutex mV4l2BufferLock; // protect the buffer count and condition below
@@ -372,6 +440,33 @@ protected:
     size_t mNumDequeuedV4l2Buffers = 0;
     uint32_t mMaxV4L2BufferSize = 0;
 
+    // Adaptive V4L2 buffer count. The controller looks at windows of kBufferAdaptWindowFrames
+    // frames: if dequeue waited for a buffer return in more than 1/kBufferWaitRatioDenom of
+    // them the queue grows by one buffer; after kIdleWindowsToShrink windows without any wait
+    // it shrinks by one to cut latency. A new target is applied by processCaptureRequest once the
+    // dequeued buffers are all returned, by restarting the stream with the new count.
+    static const uint32_t kBufferAdaptWindowFrames = 30;
+    static const uint32_t kBufferWaitRatioDenom = 10;
+    static const uint32_t kIdleWindowsToShrink = 4;
+    // Number of buffers last requested from V4L2 (the driver may allocate more)
+    uint32_t mV4l2RequestedBufferCount = 0;
+
+    // Protected by mV4l2BufferLock
+    struct V4L2BufferStats {
+        uint32_t targetBufferCount = 0; // 0: not decided yet, use config
+        uint32_t windowFrames = 0;
+        uint32_t windowWaits = 0;
+        uint32_t idleWindows = 0;
+        uint64_t numFrames = 0;         // frames dequeued
+        uint64_t numBufferWaits = 0;    // dequeues that had to wait for a buffer return
+        uint64_t numDroppedFrames = 0;  // stale frames dropped in low latency mode
+        uint64_t numResizes = 0;        // V4L2 queue resizes by the controller
+        bool resizeFailed = false;      // the driver refused a resize: keep the current count
+        uint64_t numResults = 0;
+        nsecs_t totalLatencyNs = 0;     // dequeue-to-result latency
+        nsecs_t maxLatencyNs = 0;
+    } mV4l2BufferStats;
+
     // Not protected by mLock (but might be used when mLock is locked)
     sp<OutputThread> mOutputThread;
 
@@ -20,9 +20,11 @@
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <inttypes.h>
 #include <mutex>
+#include <string>
 #include <unordered_set>
 #include <vector>
 #include "tinyxml2.h"  // XML parsing
+#include "android-base/unique_fd.h"
 #include "utils/LightRefBase.h"
 
 using android::hardware::graphics::mapper::V2_0::IMapper;
@@ -72,6 +74,15 @@ struct ExternalCameraConfig {
     // Size of v4l2 buffer queue when streaming > kMaxVideoSize
     uint32_t numStillBuffers;
 
+    // Adjust the v4l2 buffer queue size at runtime within [minNumBuffers, maxNumBuffers]
+    // based on how often the HAL has to wait for buffer returns
+    bool adaptiveBufferCount;
+    uint32_t minNumBuffers;
+    uint32_t maxNumBuffers;
+
+    // Always deliver the newest V4L2 frame, dropping stale queued frames
+    bool lowLatencyMode;
+
     // Indication that the device connected supports depth output
     bool depthEnabled;
 
@@ -88,6 +99,13 @@ struct ExternalCameraConfig {
     // The value of android.sensor.orientation
     int32_t orientation;
 
+    // Queue dma-buf backed buffers to V4L2 (V4L2_MEMORY_DMABUF) instead of driver
+    // allocated mmap buffers. Falls back to mmap if the driver does not support it.
+    bool dmaBufEnabled;
+
+    // dma-heap device used to allocate V4L2 dma-buf buffers
+    std::string dmaHeapPath;
+
 private:
     ExternalCameraConfig();
     static bool updateFpsList(tinyxml2::XMLElement* fpsList, std::vector<FpsLimitation>& fpsLimits);
@@ -117,13 +135,16 @@ struct SupportedV4L2Format {
 // Also contains necessary information to enqueue the buffer back to V4L2 buffer queue
 class V4L2Frame : public virtual VirtualLightRefBase {
 public:
+    // isDmaBuf: fd is a dma-buf imported to V4L2 (V4L2_MEMORY_DMABUF) rather than the V4L2
+    // device fd, so CPU access must be bracketed by DMA_BUF_IOCTL_SYNC
     V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int fd,
-              uint32_t dataSize, uint64_t offset);
+              uint32_t dataSize, uint64_t offset, bool isDmaBuf = false);
     ~V4L2Frame() override;
     const uint32_t mWidth;
     const uint32_t mHeight;
     const uint32_t mFourcc;
     const int mBufferIndex; // for later enqueue
+    const bool mIsDmaBuf;
     int map(uint8_t** data, size_t* dataSize);
     int unmap();
 private:
@@ -135,6 +156,10 @@ private:
     bool  mMapped = false;
 };
 
+// Allocate a dma-buf of given size from the dma-heap device at heapPath.
+// Returns an invalid fd on failure.
+android::base::unique_fd allocateDmaHeapBuffer(const std::string& heapPath, size_t size);
+
 // A RAII class representing a CPU allocated YUV frame used as intermeidate buffers
 // when generating output images.
 class AllocatedFrame : public virtual VirtualLightRefBase {
@@ -18,9 +18,20 @@
 
 #include "Gnss.h"
 
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <utils/SystemClock.h>
 
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
 #include "AGnss.h"
 #include "AGnssRil.h"
 #include "GnssBatching.h"
@@ -44,6 +55,13 @@ namespace implementation {
 
 using GnssSvFlags = IGnssCallback::GnssSvFlags;
 
+// GNSS trace replayed instead of the mock location, and its speed.
+constexpr const char* kTraceProperty = "vendor.gnss.mock.trace";
+constexpr const char* kTraceSpeedProperty = "vendor.gnss.mock.trace_speed";
+// Satellites of the mock measurements, and mock epochs delivered on each report.
+constexpr const char* kMeasurementSatellitesProperty = "vendor.gnss.mock.measurement_satellites";
+constexpr const char* kMeasurementBatchProperty = "vendor.gnss.mock.measurement_batch";
+
 sp<V2_0::IGnssCallback> Gnss::sGnssCallback_2_0 = nullptr;
 sp<V1_1::IGnssCallback> Gnss::sGnssCallback_1_1 = nullptr;
 
@@ -63,9 +81,96 @@ V2_0::GnssLocation getMockLocationV2_0() {
     return location;
 }
 
+hidl_vec<V2_0::IGnssCallback::GnssSvInfo> getMockSvInfoListV2_0() {
+    const GnssSvInfo mockGnssSvInfoList[] = {
+            Utils::getSvInfo(3, GnssConstellationType::GPS, 32.5, 59.1, 166.5),
+            Utils::getSvInfo(5, GnssConstellationType::GPS, 27.0, 29.0, 56.5),
+            Utils::getSvInfo(17, GnssConstellationType::GPS, 30.5, 71.0, 77.0),
+            Utils::getSvInfo(26, GnssConstellationType::GPS, 24.1, 28.0, 253.0),
+            Utils::getSvInfo(5, GnssConstellationType::GLONASS, 20.5, 11.5, 116.0),
+            Utils::getSvInfo(17, GnssConstellationType::GLONASS, 21.5, 28.5, 186.0),
+            Utils::getSvInfo(18, GnssConstellationType::GLONASS, 28.3, 38.8, 69.0),
+            Utils::getSvInfo(10, GnssConstellationType::GLONASS, 25.0, 66.0, 247.0)};
+
+    hidl_vec<V2_0::IGnssCallback::GnssSvInfo> svInfoList(sizeof(mockGnssSvInfoList) /
+                                                         sizeof(GnssSvInfo));
+    for (size_t i = 0; i < svInfoList.size(); i++) {
+        svInfoList[i] = {.v1_0 = mockGnssSvInfoList[i],
+                         .constellation = static_cast<V2_0::GnssConstellationType>(
+                                 mockGnssSvInfoList[i].constellation)};
+    }
+    return svInfoList;
+}
+
+// Formats the fix as a GGA sentence.
+std::string getMockNmea(const V2_0::GnssLocation& location,
+                        const hidl_vec<V2_0::IGnssCallback::GnssSvInfo>& svInfoList) {
+    const V1_0::GnssLocation& fix = location.v1_0;
+    size_t numSvsUsed = 0;
+    for (const auto& svInfo : svInfoList) {
+        if (svInfo.v1_0.svFlag & static_cast<uint8_t>(GnssSvFlags::USED_IN_FIX)) {
+            numSvsUsed++;
+        }
+    }
+    const time_t seconds = static_cast<time_t>(fix.timestamp / 1000);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    const double latitude = std::abs(fix.latitudeDegrees);
+    const double longitude = std::abs(fix.longitudeDegrees);
+
+    char body[128];
+    snprintf(body, sizeof(body),
+             "GPGGA,%02d%02d%02d.%02d,%02d%07.4f,%c,%03d%07.4f,%c,1,%02zu,1.0,%.1f,M,0.0,M,,",
+             utc.tm_hour, utc.tm_min, utc.tm_sec, static_cast<int>(fix.timestamp % 1000) / 10,
+             static_cast<int>(latitude), std::fmod(latitude, 1.0) * 60,
+             fix.latitudeDegrees < 0 ? 'S' : 'N', static_cast<int>(longitude),
+             std::fmod(longitude, 1.0) * 60, fix.longitudeDegrees < 0 ? 'W' : 'E', numSvsUsed,
+             fix.altitudeMeters);
+    uint8_t checksum = 0;
+    for (const char* c = body; *c != '\0'; c++) {
+        checksum ^= static_cast<uint8_t>(*c);
+    }
+    char sentence[sizeof(body) + 8];
+    snprintf(sentence, sizeof(sentence), "$%s*%02X", body, checksum);
+    return sentence;
+}
+
+std::shared_ptr<GnssTraceProvider> createTraceProvider() {
+    char tracePath[PROPERTY_VALUE_MAX];
+    if (property_get(kTraceProperty, tracePath, nullptr) <= 0) {
+        return nullptr;
+    }
+    char speed[PROPERTY_VALUE_MAX];
+    property_get(kTraceSpeedProperty, speed, "1");
+    return GnssTraceProvider::create(tracePath, strtof(speed, nullptr));
+}
+
+// Returns the value of the property, 1 by default, within [1, max].
+size_t getSizeProperty(const char* name, size_t max) {
+    const int64_t value = property_get_int64(name, 1);
+    const int64_t clamped = std::min(std::max<int64_t>(value, 1), static_cast<int64_t>(max));
+    if (clamped != value) {
+        ALOGW("%s: %s=%" PRId64 " is out of [1, %zu], using %" PRId64, __func__, name, value, max,
+              clamped);
+    }
+    return static_cast<size_t>(clamped);
+}
+
 }  // namespace
 
-Gnss::Gnss() : mMinIntervalMs(1000) {}
+Gnss::Gnss() : Gnss(createTraceProvider()) {}
+
+Gnss::Gnss(std::shared_ptr<GnssTraceProvider> traceProvider)
+    : mMinIntervalMs(1000),
+      mIsActive(false),
+      mReportScheduler(std::make_shared<GnssReportScheduler>()),
+      mReportId(-1),
+      mTraceProvider(std::move(traceProvider)),
+      mMockMeasurementSource(std::make_shared<GnssMockMeasurementSource>(
+              getSizeProperty(kMeasurementSatellitesProperty,
+                              GnssMockMeasurementSource::kMaxSatelliteCount))),
+      mMeasurementEpochsPerReport(
+              getSizeProperty(kMeasurementBatchProperty, GnssMeasurement::kMaxEpochsPerReport)) {}
 
 Gnss::~Gnss() {
     stop();
@@ -84,21 +189,18 @@ Return<bool> Gnss::start() {
     }
 
     mIsActive = true;
-    mThread = std::thread([this]() {
-        while (mIsActive == true) {
-            const auto location = getMockLocationV2_0();
-            this->reportLocation(location);
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(mMinIntervalMs));
-        }
-    });
+    mReportId = mReportScheduler->addReport(
+            getReportPeriod(),
+            [this](GnssReportScheduler::Clock::time_point epoch) { this->reportEpoch(epoch); });
     return true;
 }
 
 Return<bool> Gnss::stop() {
     mIsActive = false;
-    if (mThread.joinable()) {
-        mThread.join();
+    const int reportId = mReportId.exchange(-1);
+    if (reportId >= 0) {
+        // Returns promptly: the reports are not running or are finishing the current epoch.
+        mReportScheduler->removeReport(reportId);
     }
     return true;
 }
@@ -224,7 +326,8 @@ Return<sp<V1_1::IGnssConfiguration>> Gnss::getExtensionGnssConfiguration_1_1() {
 
 Return<sp<V1_1::IGnssMeasurement>> Gnss::getExtensionGnssMeasurement_1_1() {
     ALOGD("Gnss::getExtensionGnssMeasurement_1_1");
-    return new GnssMeasurement();
+    return new GnssMeasurement(mReportScheduler, mTraceProvider, mMockMeasurementSource,
+                               mMeasurementEpochsPerReport);
 }
 
 Return<bool> Gnss::injectBestLocation(const V1_0::GnssLocation&) {
@@ -252,7 +355,8 @@ Return<sp<V2_0::IAGnssRil>> Gnss::getExtensionAGnssRil_2_0() {
 
 Return<sp<V2_0::IGnssMeasurement>> Gnss::getExtensionGnssMeasurement_2_0() {
     ALOGD("Gnss::getExtensionGnssMeasurement_2_0");
-    return new GnssMeasurement();
+    return new GnssMeasurement(mReportScheduler, mTraceProvider, mMockMeasurementSource,
+                               mMeasurementEpochsPerReport);
 }
 
 Return<sp<measurement_corrections::V1_0::IMeasurementCorrections>>
@@ -267,7 +371,14 @@ Return<sp<visibility_control::V1_0::IGnssVisibilityControl>> Gnss::getExtensionV
 }
 
 Return<sp<V2_0::IGnssBatching>> Gnss::getExtensionGnssBatching_2_0() {
-    return new GnssBatching();
+    if (mTraceProvider != nullptr) {
+        return new GnssBatching([traceProvider = mTraceProvider]() {
+            const GnssTraceEpoch epoch =
+                    traceProvider->getEpoch(GnssReportScheduler::Clock::now());
+            return epoch.hasLocation ? epoch.location : getMockLocationV2_0();
+        });
+    }
+    return new GnssBatching(getMockLocationV2_0);
 }
 
 Return<bool> Gnss::setCallback_2_0(const sp<V2_0::IGnssCallback>& callback) {
@@ -303,6 +414,37 @@ Return<bool> Gnss::setCallback_2_0(const sp<V2_0::IGnssCallback>& callback) {
     return true;
 }
 
+std::chrono::nanoseconds Gnss::getReportPeriod() const {
+    const std::chrono::milliseconds interval(mMinIntervalMs);
+    return mTraceProvider != nullptr ? mTraceProvider->getReportPeriod(interval) : interval;
+}
+
+void Gnss::reportEpoch(GnssReportScheduler::Clock::time_point epoch) {
+    if (mTraceProvider != nullptr) {
+        const GnssTraceEpoch traceEpoch = mTraceProvider->getEpoch(epoch);
+        if (traceEpoch.hasLocation) {
+            reportLocation(traceEpoch.location);
+        }
+        if (traceEpoch.svInfoList.size() > 0) {
+            reportSvStatus(traceEpoch.svInfoList);
+        }
+        for (std::string_view sentence : traceEpoch.nmeaSentences) {
+            reportNmea(traceEpoch.location.v1_0.timestamp, sentence);
+        }
+        if (traceEpoch.nmeaSentences.empty() && traceEpoch.hasLocation) {
+            reportNmea(traceEpoch.location.v1_0.timestamp,
+                       getMockNmea(traceEpoch.location, traceEpoch.svInfoList));
+        }
+        return;
+    }
+
+    const auto location = getMockLocationV2_0();
+    const auto svInfoList = getMockSvInfoListV2_0();
+    reportLocation(location);
+    reportSvStatus(svInfoList);
+    reportNmea(location.v1_0.timestamp, getMockNmea(location, svInfoList));
+}
+
 Return<void> Gnss::reportLocation(const V2_0::GnssLocation& location) const {
     std::unique_lock<std::mutex> lock(mMutex);
     if (sGnssCallback_2_0 == nullptr) {
@@ -313,11 +455,48 @@ Return<void> Gnss::reportLocation(const V2_0::GnssLocation& location) const {
     return Void();
 }
 
+Return<void> Gnss::reportSvStatus(
+        const hidl_vec<V2_0::IGnssCallback::GnssSvInfo>& svInfoList) const {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (sGnssCallback_2_0 == nullptr) {
+        ALOGE("%s: sGnssCallback 2.0 is null.", __func__);
+        return Void();
+    }
+    sGnssCallback_2_0->gnssSvStatusCb_2_0(svInfoList);
+    return Void();
+}
+
+Return<void> Gnss::reportNmea(int64_t timestampMs, std::string_view nmea) const {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (sGnssCallback_2_0 == nullptr) {
+        ALOGE("%s: sGnssCallback 2.0 is null.", __func__);
+        return Void();
+    }
+    sGnssCallback_2_0->gnssNmeaCb(timestampMs, hidl_string(nmea.data(), nmea.size()));
+    return Void();
+}
+
 Return<bool> Gnss::injectBestLocation_2_0(const V2_0::GnssLocation&) {
     // TODO(b/124012850): Implement function.
     return bool{};
 }
 
+// Methods from ::android::hidl::base::V1_0::IBase follow.
+Return<void> Gnss::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        ALOGE("%s: missing fd", __func__);
+        return Void();
+    }
+    const int dumpFd = fd->data[0];
+    dprintf(dumpFd, "Gnss: %s, interval %ld ms\n", mIsActive ? "active" : "inactive",
+            static_cast<long>(mMinIntervalMs));
+    mReportScheduler->dump(dumpFd);
+    if (mTraceProvider != nullptr) {
+        mTraceProvider->dump(dumpFd);
+    }
+    return Void();
+}
+
 }  // namespace implementation
 }  // namespace V2_0
 }  // namespace gnss
@@ -21,8 +21,13 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <atomic>
+#include <memory>
 #include <mutex>
-#include <thread>
+#include <string_view>
+
+#include "GnssMockMeasurementSource.h"
+#include "GnssReportScheduler.h"
+#include "GnssTraceProvider.h"
 
 namespace android {
 namespace hardware {
@@ -32,6 +37,7 @@ namespace implementation {
 
 using ::android::sp;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_memory;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
@@ -44,7 +50,11 @@ using GnssSvInfo = V1_0::IGnssCallback::GnssSvInfo;
 using GnssSvStatus = V1_0::IGnssCallback::GnssSvStatus;
 
 struct Gnss : public IGnss {
+    // Replays the trace of the vendor.gnss.mock.trace property, if set, at the speed of the
+    // vendor.gnss.mock.trace_speed property.
     Gnss();
+    // Replays the trace, if not null, instead of reporting the mock location.
+    explicit Gnss(std::shared_ptr<GnssTraceProvider> traceProvider);
     ~Gnss();
     // Methods from V1_0::IGnss follow.
     Return<bool> setCallback(const sp<V1_0::IGnssCallback>& callback) override;
@@ -95,13 +105,28 @@ struct Gnss : public IGnss {
     Return<sp<V2_0::IGnssBatching>> getExtensionGnssBatching_2_0() override;
     Return<bool> injectBestLocation_2_0(const V2_0::GnssLocation& location) override;
 
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
   private:
+    // Reports the location, the SV status and the NMEA of one epoch.
+    void reportEpoch(GnssReportScheduler::Clock::time_point epoch);
+    std::chrono::nanoseconds getReportPeriod() const;
     Return<void> reportLocation(const V2_0::GnssLocation&) const;
+    Return<void> reportSvStatus(const hidl_vec<V2_0::IGnssCallback::GnssSvInfo>&) const;
+    Return<void> reportNmea(int64_t timestampMs, std::string_view nmea) const;
     static sp<V2_0::IGnssCallback> sGnssCallback_2_0;
     static sp<V1_1::IGnssCallback> sGnssCallback_1_1;
     std::atomic<long> mMinIntervalMs;
     std::atomic<bool> mIsActive;
-    std::thread mThread;
+    // Shared with the measurement extensions, so that all the reports have the same epochs.
+    const std::shared_ptr<GnssReportScheduler> mReportScheduler;
+    std::atomic<int> mReportId;
+    const std::shared_ptr<GnssTraceProvider> mTraceProvider;
+    // Sizes of the mock measurements, from the vendor.gnss.mock.measurement_satellites and
+    // vendor.gnss.mock.measurement_batch properties.
+    const std::shared_ptr<const GnssMockMeasurementSource> mMockMeasurementSource;
+    const size_t mMeasurementEpochsPerReport;
     mutable std::mutex mMutex;
 };
 
@@ -18,51 +18,187 @@
 
 #include "GnssBatching.h"
 
+#include <log/log.h>
+
+#include <chrono>
+#include <utility>
+
 namespace android {
 namespace hardware {
 namespace gnss {
 namespace V2_0 {
 namespace implementation {
 
-sp<V2_0::IGnssBatchingCallback> GnssBatching::sCallback = nullptr;
+using BatchingFlag = V1_0::IGnssBatching::Flag;
+
+constexpr uint16_t GnssBatching::kBatchSize;
+
+GnssBatching::GnssBatching(LocationSource locationSource)
+    : mLocationSource(std::move(locationSource)),
+      mIsActive(false),
+      mOptions(),
+      mRing(kBatchSize),
+      mBatchStart(0),
+      mBatchCount(0) {}
+
+GnssBatching::~GnssBatching() {
+    stopThread();
+}
 
 // Methods from ::android::hardware::gnss::V1_0::IGnssBatching follow.
-Return<bool> GnssBatching::init(const sp<V1_0::IGnssBatchingCallback>&) {
-    // TODO implement
-    return bool{};
+Return<bool> GnssBatching::init(const sp<V1_0::IGnssBatchingCallback>& callback) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCallback_1_0 = callback;
+    mCallback_2_0 = nullptr;
+    return true;
 }
 
 Return<uint16_t> GnssBatching::getBatchSize() {
-    // TODO implement
-    return uint16_t{};
+    return kBatchSize;
 }
 
-Return<bool> GnssBatching::start(const V1_0::IGnssBatching::Options&) {
-    // TODO implement
-    return bool{};
+Return<bool> GnssBatching::start(const V1_0::IGnssBatching::Options& options) {
+    if (options.periodNanos <= 0) {
+        ALOGE("%s: invalid period %lld ns", __func__, static_cast<long long>(options.periodNanos));
+        return false;
+    }
+    // Restarting only changes the options, the batched locations are kept. Concurrent starts are
+    // serialized, each one stopping the thread of the previous one.
+    std::unique_lock<std::mutex> threadLock(mThreadMutex);
+    stopThreadLocked();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mOptions = options;
+    mIsActive = true;
+    mThread = std::thread([this]() { batchLocations(); });
+    return true;
 }
 
 Return<void> GnssBatching::flush() {
-    // TODO implement
+    hidl_vec<V2_0::GnssLocation> locations;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        locations = takeBatchLocked();
+    }
+    reportBatch(locations);
     return Void();
 }
 
 Return<bool> GnssBatching::stop() {
-    // TODO implement
-    return bool{};
+    // The batched locations stay available to flush().
+    stopThread();
+    return true;
 }
 
 Return<void> GnssBatching::cleanup() {
-    // TODO implement
+    stopThread();
+    std::unique_lock<std::mutex> lock(mMutex);
+    mBatchCount = 0;
+    mCallback_1_0 = nullptr;
+    mCallback_2_0 = nullptr;
     return Void();
 }
 
 // Methods from V2_0::IGnssBatching follow.
 Return<bool> GnssBatching::init_2_0(const sp<V2_0::IGnssBatchingCallback>& callback) {
-    sCallback = callback;
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCallback_1_0 = nullptr;
+    mCallback_2_0 = callback;
     return true;
 }
 
+void GnssBatching::batchLocations() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto nextFix = std::chrono::steady_clock::now();
+    while (mIsActive) {
+        nextFix += std::chrono::nanoseconds(mOptions.periodNanos);
+        if (mStopCondition.wait_until(lock, nextFix, [this]() { return !mIsActive; })) {
+            break;
+        }
+        lock.unlock();
+        addLocation(mLocationSource());
+        lock.lock();
+    }
+}
+
+void GnssBatching::addLocation(const V2_0::GnssLocation& location) {
+    hidl_vec<V2_0::GnssLocation> fullBatch;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mBatchCount == kBatchSize) {
+            if (mOptions.flags & static_cast<uint8_t>(BatchingFlag::WAKEUP_ON_FIFO_FULL)) {
+                fullBatch = takeBatchLocked();
+            } else {
+                // Without a wakeup, the oldest location is lost.
+                mBatchStart = (mBatchStart + 1) % kBatchSize;
+                mBatchCount--;
+            }
+        }
+        mRing[(mBatchStart + mBatchCount) % kBatchSize] = location;
+        mBatchCount++;
+    }
+    if (fullBatch.size() > 0) {
+        reportBatch(fullBatch);
+    }
+}
+
+hidl_vec<V2_0::GnssLocation> GnssBatching::takeBatchLocked() {
+    hidl_vec<V2_0::GnssLocation> locations;
+    locations.resize(mBatchCount);
+    for (size_t i = 0; i < mBatchCount; i++) {
+        locations[i] = mRing[(mBatchStart + i) % kBatchSize];
+    }
+    mBatchStart = 0;
+    mBatchCount = 0;
+    return locations;
+}
+
+void GnssBatching::reportBatch(const hidl_vec<V2_0::GnssLocation>& locations) {
+    sp<V1_0::IGnssBatchingCallback> callback_1_0;
+    sp<V2_0::IGnssBatchingCallback> callback_2_0;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        callback_1_0 = mCallback_1_0;
+        callback_2_0 = mCallback_2_0;
+    }
+
+    if (callback_2_0 != nullptr) {
+        auto ret = callback_2_0->gnssLocationBatchCb(locations);
+        if (!ret.isOk()) {
+            ALOGE("%s: Unable to invoke callback", __func__);
+        }
+    } else if (callback_1_0 != nullptr) {
+        hidl_vec<V1_0::GnssLocation> locations_1_0;
+        locations_1_0.resize(locations.size());
+        for (size_t i = 0; i < locations.size(); i++) {
+            locations_1_0[i] = locations[i].v1_0;
+        }
+        auto ret = callback_1_0->gnssLocationBatchCb(locations_1_0);
+        if (!ret.isOk()) {
+            ALOGE("%s: Unable to invoke callback", __func__);
+        }
+    } else {
+        ALOGE("%s: batching callback is null, dropping %zu locations", __func__,
+              locations.size());
+    }
+}
+
+void GnssBatching::stopThread() {
+    std::unique_lock<std::mutex> threadLock(mThreadMutex);
+    stopThreadLocked();
+}
+
+void GnssBatching::stopThreadLocked() {
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mIsActive = false;
+        mStopCondition.notify_all();
+    }
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
 }  // namespace implementation
 }  // namespace V2_0
 }  // namespace gnss
@@ -19,6 +19,11 @@
 #include <android/hardware/gnss/2.0/IGnssBatching.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace android {
 namespace hardware {
@@ -34,7 +39,21 @@ using ::android::hardware::hidl_vec;
 using ::android::hardware::Return;
 using ::android::hardware::Void;
 
+/**
+ * Batches the locations of a location source in a fixed size ring, and delivers them with a single
+ * gnssLocationBatchCb on flush(), or when the ring is full if WAKEUP_ON_FIFO_FULL is set. Without
+ * that flag, the oldest locations are overwritten once the ring is full.
+ */
 struct GnssBatching : public IGnssBatching {
+    // Computes a location fix, called every Options::periodNanos while batching.
+    using LocationSource = std::function<V2_0::GnssLocation()>;
+
+    // Number of locations the ring holds.
+    static constexpr uint16_t kBatchSize = 128;
+
+    explicit GnssBatching(LocationSource locationSource);
+    ~GnssBatching();
+
     // Methods from ::android::hardware::gnss::V1_0::IGnssBatching follow.
     Return<bool> init(const sp<V1_0::IGnssBatchingCallback>& callback) override;
     Return<uint16_t> getBatchSize() override;
@@ -47,7 +66,31 @@ struct GnssBatching : public IGnssBatching {
     Return<bool> init_2_0(const sp<V2_0::IGnssBatchingCallback>& callback) override;
 
   private:
-    static sp<IGnssBatchingCallback> sCallback;
+    void batchLocations();
+    void addLocation(const V2_0::GnssLocation& location);
+    // Moves the batched locations out of the ring, oldest first. Must be called with mMutex held.
+    hidl_vec<V2_0::GnssLocation> takeBatchLocked();
+    void reportBatch(const hidl_vec<V2_0::GnssLocation>& locations);
+    void stopThread();
+    // Must be called with mThreadMutex held.
+    void stopThreadLocked();
+
+    const LocationSource mLocationSource;
+
+    // Serializes starting and stopping mThread, which mMutex cannot do as the thread takes it.
+    std::mutex mThreadMutex;
+
+    std::mutex mMutex;
+    std::condition_variable mStopCondition;
+    sp<V1_0::IGnssBatchingCallback> mCallback_1_0;
+    sp<V2_0::IGnssBatchingCallback> mCallback_2_0;
+    bool mIsActive;
+    V1_0::IGnssBatching::Options mOptions;
+    // Ring of kBatchSize locations, mBatchCount of which are batched starting at mBatchStart.
+    std::vector<V2_0::GnssLocation> mRing;
+    size_t mBatchStart;
+    size_t mBatchCount;
+    std::thread mThread;
 };
 
 }  // namespace implementation
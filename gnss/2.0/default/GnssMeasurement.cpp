@@ -18,7 +18,10 @@
 #include "GnssMeasurement.h"
 
 #include <log/log.h>
-#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
 
 namespace android {
 namespace hardware {
@@ -26,13 +29,20 @@ namespace gnss {
 namespace V2_0 {
 namespace implementation {
 
-using GnssConstellationType = V2_0::GnssConstellationType;
-using GnssMeasurementFlags = V1_0::IGnssMeasurementCallback::GnssMeasurementFlags;
-using GnssMeasurementState = V2_0::IGnssMeasurementCallback::GnssMeasurementState;
-
 sp<V2_0::IGnssMeasurementCallback> GnssMeasurement::sCallback = nullptr;
 
-GnssMeasurement::GnssMeasurement() : mMinIntervalMillis(1000) {}
+GnssMeasurement::GnssMeasurement(std::shared_ptr<GnssReportScheduler> reportScheduler,
+                                 std::shared_ptr<GnssTraceProvider> traceProvider,
+                                 std::shared_ptr<const GnssMockMeasurementSource> mockSource,
+                                 size_t epochsPerReport)
+    : mMinIntervalMillis(1000),
+      mIsActive(false),
+      mReportScheduler(std::move(reportScheduler)),
+      mReportId(-1),
+      mTraceProvider(std::move(traceProvider)),
+      mMockSource(std::move(mockSource)),
+      mEpochsPerReport(std::min(std::max<size_t>(epochsPerReport, 1), kMaxEpochsPerReport)),
+      mMockEpochs(mEpochsPerReport) {}
 
 GnssMeasurement::~GnssMeasurement() {
     stop();
@@ -47,8 +57,9 @@ Return<V1_0::IGnssMeasurement::GnssMeasurementStatus> GnssMeasurement::setCallba
 
 Return<void> GnssMeasurement::close() {
     ALOGD("close");
-    std::unique_lock<std::mutex> lock(mMutex);
+    // Not under mMutex, the report being stopped may be waiting for it.
     stop();
+    std::unique_lock<std::mutex> lock(mMutex);
     sCallback = nullptr;
     return Void();
 }
@@ -64,8 +75,10 @@ Return<V1_0::IGnssMeasurement::GnssMeasurementStatus> GnssMeasurement::setCallba
 Return<V1_0::IGnssMeasurement::GnssMeasurementStatus> GnssMeasurement::setCallback_2_0(
     const sp<V2_0::IGnssMeasurementCallback>& callback, bool) {
     ALOGD("setCallback_2_0");
-    std::unique_lock<std::mutex> lock(mMutex);
-    sCallback = callback;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        sCallback = callback;
+    }
 
     if (mIsActive) {
         ALOGW("GnssMeasurement callback already set. Resetting the callback...");
@@ -79,85 +92,61 @@ Return<V1_0::IGnssMeasurement::GnssMeasurementStatus> GnssMeasurement::setCallba
 void GnssMeasurement::start() {
     ALOGD("start");
     mIsActive = true;
-    mThread = std::thread([this]() {
-        while (mIsActive == true) {
-            auto measurement = this->getMockMeasurement();
-            this->reportMeasurement(measurement);
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(mMinIntervalMillis));
-        }
-    });
+    const std::chrono::nanoseconds period = getEpochPeriod();
+    if (mTraceProvider != nullptr &&
+        mTraceProvider->getFormat() == GnssTraceProvider::Format::RINEX) {
+        // Same epoch as the locations of the trace, reported on the same tick: the trace is
+        // replayed one epoch at a time.
+        mReportId = mReportScheduler->addReport(
+                period, [this](GnssReportScheduler::Clock::time_point epoch) {
+                    const GnssTraceEpoch traceEpoch = mTraceProvider->getEpoch(epoch);
+                    if (traceEpoch.hasMeasurement) {
+                        this->reportMeasurements(&traceEpoch.measurement, 1);
+                    }
+                });
+        return;
+    }
+    // The mock epochs of a report are all filled on its tick, only the last one being current.
+    mReportId = mReportScheduler->addReport(
+            period * static_cast<int64_t>(mEpochsPerReport),
+            [this](GnssReportScheduler::Clock::time_point epoch) {
+                this->fillMockEpochs(epoch);
+                this->reportMeasurements(mMockEpochs.data(), mMockEpochs.size());
+            });
 }
 
 void GnssMeasurement::stop() {
     ALOGD("stop");
     mIsActive = false;
-    if (mThread.joinable()) {
-        mThread.join();
+    const int reportId = mReportId.exchange(-1);
+    if (reportId >= 0) {
+        mReportScheduler->removeReport(reportId);
     }
 }
 
-GnssData GnssMeasurement::getMockMeasurement() {
-    V1_0::IGnssMeasurementCallback::GnssMeasurement measurement_1_0 = {
-            .flags = (uint32_t)GnssMeasurementFlags::HAS_CARRIER_FREQUENCY,
-            .svid = (int16_t)6,
-            .constellation = V1_0::GnssConstellationType::UNKNOWN,
-            .timeOffsetNs = 0.0,
-            .receivedSvTimeInNs = 8195997131077,
-            .receivedSvTimeUncertaintyInNs = 15,
-            .cN0DbHz = 30.0,
-            .pseudorangeRateMps = -484.13739013671875,
-            .pseudorangeRateUncertaintyMps = 1.0379999876022339,
-            .accumulatedDeltaRangeState = (uint32_t)V1_0::IGnssMeasurementCallback::
-                    GnssAccumulatedDeltaRangeState::ADR_STATE_UNKNOWN,
-            .accumulatedDeltaRangeM = 0.0,
-            .accumulatedDeltaRangeUncertaintyM = 0.0,
-            .carrierFrequencyHz = 1.59975e+09,
-            .multipathIndicator =
-                    V1_0::IGnssMeasurementCallback::GnssMultipathIndicator::INDICATOR_UNKNOWN};
-    V1_1::IGnssMeasurementCallback::GnssMeasurement measurement_1_1 = {.v1_0 = measurement_1_0};
-    V2_0::IGnssMeasurementCallback::GnssMeasurement measurement_2_0 = {
-            .v1_1 = measurement_1_1,
-            .codeType = "C",
-            .constellation = GnssConstellationType::GLONASS,
-            .state = GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
-                     GnssMeasurementState::STATE_SUBFRAME_SYNC |
-                     GnssMeasurementState::STATE_TOW_DECODED |
-                     GnssMeasurementState::STATE_GLO_STRING_SYNC |
-                     GnssMeasurementState::STATE_GLO_TOD_DECODED};
-
-    hidl_vec<IGnssMeasurementCallback::GnssMeasurement> measurements(1);
-    measurements[0] = measurement_2_0;
-    V1_0::IGnssMeasurementCallback::GnssClock clock = {.timeNs = 2713545000000,
-                                                       .fullBiasNs = -1226701900521857520,
-                                                       .biasNs = 0.59689998626708984,
-                                                       .biasUncertaintyNs = 47514.989972114563,
-                                                       .driftNsps = -51.757811607455452,
-                                                       .driftUncertaintyNsps = 310.64968328491528,
-                                                       .hwClockDiscontinuityCount = 1};
-
-    ElapsedRealtime timestamp = {
-            .flags = ElapsedRealtimeFlags::HAS_TIMESTAMP_NS |
-                     ElapsedRealtimeFlags::HAS_TIME_UNCERTAINTY_NS,
-            .timestampNs = static_cast<uint64_t>(::android::elapsedRealtimeNano()),
-            // This is an hardcoded value indicating a 1ms of uncertainty between the two clocks.
-            // In an actual implementation provide an estimate of the synchronization uncertainty
-            // or don't set the field.
-            .timeUncertaintyNs = 1000000};
-
-    GnssData gnssData = {
-            .measurements = measurements, .clock = clock, .elapsedRealtime = timestamp};
-    return gnssData;
+std::chrono::nanoseconds GnssMeasurement::getEpochPeriod() const {
+    const std::chrono::milliseconds interval(mMinIntervalMillis);
+    return mTraceProvider != nullptr ? mTraceProvider->getReportPeriod(interval) : interval;
+}
+
+void GnssMeasurement::fillMockEpochs(GnssReportScheduler::Clock::time_point epoch) {
+    const std::chrono::nanoseconds period = getEpochPeriod();
+    for (size_t i = 0; i < mMockEpochs.size(); i++) {
+        const auto age = period * static_cast<int64_t>(mMockEpochs.size() - 1 - i);
+        mMockSource->fill(epoch - age, &mMockEpochs[i]);
+    }
 }
 
-void GnssMeasurement::reportMeasurement(const GnssData& data) {
-    ALOGD("reportMeasurement()");
+void GnssMeasurement::reportMeasurements(const GnssData* data, size_t count) {
+    ALOGD("reportMeasurements(%zu)", count);
     std::unique_lock<std::mutex> lock(mMutex);
     if (sCallback == nullptr) {
         ALOGE("%s: GnssMeasurement::sCallback is null.", __func__);
         return;
     }
-    sCallback->gnssMeasurementCb_2_0(data);
+    for (size_t i = 0; i < count; i++) {
+        sCallback->gnssMeasurementCb_2_0(data[i]);
+    }
 }
 
 }  // namespace implementation
@@ -21,8 +21,13 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <atomic>
+#include <memory>
 #include <mutex>
-#include <thread>
+#include <vector>
+
+#include "GnssMockMeasurementSource.h"
+#include "GnssReportScheduler.h"
+#include "GnssTraceProvider.h"
 
 namespace android {
 namespace hardware {
@@ -41,7 +46,16 @@ using ::android::hardware::Void;
 using GnssData = V2_0::IGnssMeasurementCallback::GnssData;
 
 struct GnssMeasurement : public IGnssMeasurement {
-    GnssMeasurement();
+    static constexpr size_t kMaxEpochsPerReport = 64;
+
+    // The measurements are reported on the epochs of the scheduler. They are replayed from the
+    // trace, if not null and it has measurements, and generated by the mock source otherwise.
+    // Mock epochs are delivered epochsPerReport at a time, on one scheduler tick, clamped to
+    // [1, kMaxEpochsPerReport].
+    GnssMeasurement(std::shared_ptr<GnssReportScheduler> reportScheduler,
+                    std::shared_ptr<GnssTraceProvider> traceProvider,
+                    std::shared_ptr<const GnssMockMeasurementSource> mockSource,
+                    size_t epochsPerReport);
     ~GnssMeasurement();
     // Methods from V1_0::IGnssMeasurement follow.
     Return<V1_0::IGnssMeasurement::GnssMeasurementStatus> setCallback(
@@ -59,13 +73,22 @@ struct GnssMeasurement : public IGnssMeasurement {
    private:
     void start();
     void stop();
-    GnssData getMockMeasurement();
-    void reportMeasurement(const GnssData&);
+    // Time between two epochs, shorter when a trace is replayed faster than it was recorded.
+    std::chrono::nanoseconds getEpochPeriod() const;
+    // Fills mMockEpochs with the epochs of one report, the last one being the epoch of the tick.
+    void fillMockEpochs(GnssReportScheduler::Clock::time_point epoch);
+    void reportMeasurements(const GnssData* data, size_t count);
 
     static sp<IGnssMeasurementCallback> sCallback;
     std::atomic<long> mMinIntervalMillis;
     std::atomic<bool> mIsActive;
-    std::thread mThread;
+    const std::shared_ptr<GnssReportScheduler> mReportScheduler;
+    std::atomic<int> mReportId;
+    const std::shared_ptr<GnssTraceProvider> mTraceProvider;
+    const std::shared_ptr<const GnssMockMeasurementSource> mMockSource;
+    const size_t mEpochsPerReport;
+    // Only used by the scheduler thread, reused from one report to the next to avoid allocations.
+    std::vector<GnssData> mMockEpochs;
     mutable std::mutex mMutex;
 };
 
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GnssMockMeasurementSource"
+
+#include "GnssMockMeasurementSource.h"
+
+#include <log/log.h>
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+namespace {
+
+using GnssConstellationType = V2_0::GnssConstellationType;
+using GnssMeasurementFlags = V1_0::IGnssMeasurementCallback::GnssMeasurementFlags;
+using GnssMeasurementState = V2_0::IGnssMeasurementCallback::GnssMeasurementState;
+
+constexpr int64_t kNsPerSecond = 1000 * 1000 * 1000;
+constexpr int64_t kNsPerDay = 86400 * kNsPerSecond;
+constexpr int64_t kNsPerWeek = 7 * kNsPerDay;
+constexpr int16_t kGpsLeapSeconds = 18;
+constexpr int64_t kBeidouOffsetNs = 14 * kNsPerSecond;
+constexpr int64_t kGlonassOffsetNs = 3 * 3600 * kNsPerSecond;
+constexpr double kSpeedOfLight = 299792458.0;
+
+// The clock of the measurement the HAL always reported, at the start of the source.
+constexpr int64_t kMockTimeNs = 2713545000000;
+constexpr int64_t kMockFullBiasNs = -1226701900521857520;
+
+// Satellites are given to the constellations in turn, GLONASS first so that a single satellite
+// is the GLONASS satellite 6 the HAL always reported.
+struct Constellation {
+    GnssConstellationType type;
+    int16_t firstSvid;
+    int16_t svidCount;
+    float carrierFrequencyHz;
+    const char* codeType;
+    uint32_t state;
+};
+
+const Constellation kConstellations[] = {
+        {GnssConstellationType::GLONASS, 6, 24, 1602e6f, "C",
+         GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
+                 GnssMeasurementState::STATE_SUBFRAME_SYNC |
+                 GnssMeasurementState::STATE_TOW_DECODED |
+                 GnssMeasurementState::STATE_GLO_STRING_SYNC |
+                 GnssMeasurementState::STATE_GLO_TOD_DECODED},
+        {GnssConstellationType::GPS, 1, 32, 1575.42e6f, "C",
+         GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
+                 GnssMeasurementState::STATE_SUBFRAME_SYNC |
+                 GnssMeasurementState::STATE_TOW_DECODED},
+        {GnssConstellationType::GALILEO, 1, 36, 1575.42e6f, "C",
+         GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
+                 GnssMeasurementState::STATE_SUBFRAME_SYNC |
+                 GnssMeasurementState::STATE_TOW_DECODED},
+        {GnssConstellationType::BEIDOU, 1, 63, 1561.098e6f, "I",
+         GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
+                 GnssMeasurementState::STATE_SUBFRAME_SYNC |
+                 GnssMeasurementState::STATE_TOW_DECODED},
+};
+constexpr size_t kConstellationCount = sizeof(kConstellations) / sizeof(kConstellations[0]);
+
+// Between 20000 and 25000 km, different for neighbouring satellites.
+double getPseudorangeMeters(size_t index) {
+    return 20000e3 + static_cast<double>(index * 1733 % 5000) * 1e3;
+}
+
+// Time of the satellite clock, in the time scale of its constellation, at which the signal
+// received at the GPS time was sent.
+int64_t getReceivedSvTimeNs(GnssConstellationType constellation, int64_t gpsTimeNs,
+                            size_t index) {
+    int64_t timeNs = gpsTimeNs;
+    int64_t periodNs = kNsPerWeek;
+    if (constellation == GnssConstellationType::GLONASS) {
+        timeNs = gpsTimeNs - kGpsLeapSeconds * kNsPerSecond + kGlonassOffsetNs;
+        periodNs = kNsPerDay;
+    } else if (constellation == GnssConstellationType::BEIDOU) {
+        timeNs = gpsTimeNs - kBeidouOffsetNs;
+    }
+    timeNs -= static_cast<int64_t>(getPseudorangeMeters(index) / kSpeedOfLight * kNsPerSecond);
+    return timeNs % periodNs;
+}
+
+}  // namespace
+
+GnssMockMeasurementSource::GnssMockMeasurementSource(size_t satelliteCount)
+    : mSatelliteCount(std::min(std::max<size_t>(satelliteCount, 1), kMaxSatelliteCount)),
+      mStart(Clock::now()) {
+    if (mSatelliteCount != satelliteCount) {
+        ALOGW("%s: %zu satellites is out of [1, %zu], using %zu", __func__, satelliteCount,
+              kMaxSatelliteCount, mSatelliteCount);
+    }
+}
+
+void GnssMockMeasurementSource::fill(Clock::time_point epoch, GnssData* data) const {
+    if (data->measurements.size() != mSatelliteCount) {
+        data->measurements.resize(mSatelliteCount);
+        for (size_t i = 0; i < mSatelliteCount; i++) {
+            fillSatellite(i, &data->measurements[i]);
+        }
+        V1_0::IGnssMeasurementCallback::GnssClock& clock = data->clock;
+        clock = {};
+        clock.fullBiasNs = kMockFullBiasNs;
+        clock.biasNs = 0.59689998626708984;
+        clock.biasUncertaintyNs = 47514.989972114563;
+        clock.driftNsps = -51.757811607455452;
+        clock.driftUncertaintyNsps = 310.64968328491528;
+        clock.hwClockDiscontinuityCount = 1;
+        data->elapsedRealtime.flags = ElapsedRealtimeFlags::HAS_TIMESTAMP_NS |
+                                      ElapsedRealtimeFlags::HAS_TIME_UNCERTAINTY_NS;
+        // This is an hardcoded value indicating a 1ms of uncertainty between the two clocks.
+        // In an actual implementation provide an estimate of the synchronization uncertainty
+        // or don't set the field.
+        data->elapsedRealtime.timeUncertaintyNs = 1000000;
+    }
+
+    const int64_t sinceStartNs = std::chrono::nanoseconds(epoch - mStart).count();
+    data->clock.timeNs = kMockTimeNs + sinceStartNs;
+    const int64_t gpsTimeNs = data->clock.timeNs - data->clock.fullBiasNs;
+    for (size_t i = 0; i < mSatelliteCount; i++) {
+        V2_0::IGnssMeasurementCallback::GnssMeasurement& measurement = data->measurements[i];
+        measurement.v1_1.v1_0.receivedSvTimeInNs =
+                getReceivedSvTimeNs(measurement.constellation, gpsTimeNs, i);
+    }
+
+    // Epochs delivered in a batch are older than the report.
+    const int64_t ageNs = std::chrono::nanoseconds(Clock::now() - epoch).count();
+    data->elapsedRealtime.timestampNs =
+            static_cast<uint64_t>(::android::elapsedRealtimeNano() - std::max<int64_t>(ageNs, 0));
+}
+
+void GnssMockMeasurementSource::fillSatellite(
+        size_t index, V2_0::IGnssMeasurementCallback::GnssMeasurement* measurement) const {
+    const Constellation& constellation = kConstellations[index % kConstellationCount];
+    const size_t rank = index / kConstellationCount;
+
+    V1_0::IGnssMeasurementCallback::GnssMeasurement& measurement_1_0 = measurement->v1_1.v1_0;
+    measurement_1_0 = {};
+    measurement_1_0.flags = (uint32_t)GnssMeasurementFlags::HAS_CARRIER_FREQUENCY;
+    measurement_1_0.svid = static_cast<int16_t>(
+            1 + (constellation.firstSvid - 1 + rank) % constellation.svidCount);
+    measurement_1_0.constellation = V1_0::GnssConstellationType::UNKNOWN;
+    measurement_1_0.receivedSvTimeUncertaintyInNs = 15;
+    measurement_1_0.cN0DbHz = 30.0 - static_cast<double>(index * 7 % 15);
+    measurement_1_0.pseudorangeRateMps =
+            -484.13739013671875 + static_cast<double>(index * 311 % 1000);
+    measurement_1_0.pseudorangeRateUncertaintyMps = 1.0379999876022339;
+    measurement_1_0.accumulatedDeltaRangeState = (uint32_t)V1_0::IGnssMeasurementCallback::
+            GnssAccumulatedDeltaRangeState::ADR_STATE_UNKNOWN;
+    measurement_1_0.carrierFrequencyHz = constellation.carrierFrequencyHz;
+    if (constellation.type == GnssConstellationType::GLONASS) {
+        // Frequency channels from -7 to 6, the first satellite is on channel -4.
+        const int channel = static_cast<int>((rank + 3) % 14) - 7;
+        measurement_1_0.carrierFrequencyHz += channel * 0.5625e6f;
+    }
+    measurement_1_0.multipathIndicator =
+            V1_0::IGnssMeasurementCallback::GnssMultipathIndicator::INDICATOR_UNKNOWN;
+
+    measurement->codeType = constellation.codeType;
+    measurement->constellation = constellation.type;
+    measurement->state = constellation.state;
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_GNSS_V2_0_GNSSMOCKMEASUREMENTSOURCE_H
+#define ANDROID_HARDWARE_GNSS_V2_0_GNSSMOCKMEASUREMENTSOURCE_H
+
+#include <android/hardware/gnss/2.0/IGnssMeasurementCallback.h>
+
+#include <stddef.h>
+
+#include "GnssReportScheduler.h"
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * Generates the mock measurements of a configurable number of satellites, spread over GPS,
+ * GLONASS, Galileo and BeiDou, so that the measurement path can be exercised at the sizes of real
+ * receivers. With a single satellite, the measurement is the GLONASS one the HAL always reported.
+ *
+ * The measurements are written into buffers kept by the caller: the fields which do not change
+ * from one epoch to the next are only written the first time, and no allocation is made after it.
+ */
+class GnssMockMeasurementSource {
+  public:
+    using Clock = GnssReportScheduler::Clock;
+    using GnssData = V2_0::IGnssMeasurementCallback::GnssData;
+
+    static constexpr size_t kMaxSatelliteCount = 256;
+
+    // The satellite count is clamped to [1, kMaxSatelliteCount].
+    explicit GnssMockMeasurementSource(size_t satelliteCount);
+
+    size_t getSatelliteCount() const { return mSatelliteCount; }
+
+    /**
+     * Writes the measurements of the epoch into the data. Data last filled by this source is
+     * reused as is: only the clock, the elapsed realtime and the received satellite times are
+     * written again.
+     */
+    void fill(Clock::time_point epoch, GnssData* data) const;
+
+  private:
+    void fillSatellite(size_t index, V2_0::IGnssMeasurementCallback::GnssMeasurement* measurement)
+            const;
+
+    const size_t mSatelliteCount;
+    // The clock of the measurements starts with the source.
+    const Clock::time_point mStart;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_GNSS_V2_0_GNSSMOCKMEASUREMENTSOURCE_H
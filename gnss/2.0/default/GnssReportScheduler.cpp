@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GnssReportScheduler"
+
+#include "GnssReportScheduler.h"
+
+#include <log/log.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+GnssReportScheduler::GnssReportScheduler()
+    : mOrigin(Clock::now()), mStopThread(false), mNextId(1), mIsReporting(false) {
+    mThread = std::thread([this]() { run(); });
+}
+
+GnssReportScheduler::~GnssReportScheduler() {
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mStopThread = true;
+        mCondition.notify_all();
+    }
+    mThread.join();
+}
+
+int GnssReportScheduler::addReport(std::chrono::nanoseconds period, Report report) {
+    if (period <= std::chrono::nanoseconds::zero()) {
+        ALOGE("%s: invalid period %" PRId64 " ns", __func__,
+              static_cast<int64_t>(period.count()));
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    const int id = mNextId++;
+    mEntries[id] = {period, nextEpochLocked(period, Clock::now()), std::move(report)};
+    // The new report may be due before the deadline the thread is waiting for.
+    mCondition.notify_all();
+    return id;
+}
+
+void GnssReportScheduler::removeReport(int id) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mEntries.erase(id);
+    if (std::this_thread::get_id() == mThread.get_id()) {
+        // Removed by a report, waiting would never return.
+        return;
+    }
+    mCondition.wait(lock, [this]() { return !mIsReporting; });
+}
+
+GnssReportScheduler::Stats GnssReportScheduler::getStats() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void GnssReportScheduler::resetStats() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mStats = Stats();
+}
+
+void GnssReportScheduler::dump(int fd) {
+    const Stats stats = getStats();
+    const int64_t meanJitterNs =
+            stats.epochs > 0 ? stats.totalJitterNs / static_cast<int64_t>(stats.epochs) : 0;
+    dprintf(fd, "Report scheduler:\n");
+    dprintf(fd, "  epochs: %" PRIu64 ", reports: %" PRIu64 ", missed epochs: %" PRIu64 "\n",
+            stats.epochs, stats.reports, stats.missedEpochs);
+    dprintf(fd, "  jitter: mean %" PRId64 " us, max %" PRId64 " us\n", meanJitterNs / 1000,
+            stats.maxJitterNs / 1000);
+    dprintf(fd, "  max report duration: %" PRId64 " us\n", stats.maxReportDurationNs / 1000);
+}
+
+GnssReportScheduler::Clock::time_point GnssReportScheduler::nextEpochLocked(
+        std::chrono::nanoseconds period, Clock::time_point time) const {
+    return mOrigin + (((time - mOrigin) / period) + 1) * period;
+}
+
+void GnssReportScheduler::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStopThread) {
+        if (mEntries.empty()) {
+            mCondition.wait(lock);
+            continue;
+        }
+        Clock::time_point deadline = Clock::time_point::max();
+        for (const auto& entry : mEntries) {
+            deadline = std::min(deadline, entry.second.deadline);
+        }
+        // The wait is interrupted by new reports and by the destructor.
+        if (mCondition.wait_until(lock, deadline) != std::cv_status::timeout &&
+            Clock::now() < deadline) {
+            continue;
+        }
+
+        const Clock::time_point now = Clock::now();
+        // Reports may have been removed while waiting, the epoch is the earliest due deadline.
+        Clock::time_point epoch = now;
+        mDueReports.clear();
+        for (auto& entry : mEntries) {
+            Entry& report = entry.second;
+            if (report.deadline > now) {
+                continue;
+            }
+            epoch = std::min(epoch, report.deadline);
+            mDueReports.push_back(report.report);
+            Clock::time_point next = report.deadline + report.period;
+            if (next <= now) {
+                // Reporting late epochs back to back would only add to the drift.
+                next = nextEpochLocked(report.period, now);
+                mStats.missedEpochs += (next - report.deadline) / report.period - 1;
+            }
+            report.deadline = next;
+        }
+        if (mDueReports.empty()) {
+            continue;
+        }
+        const int64_t jitterNs =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - epoch).count();
+        ++mStats.epochs;
+        mStats.reports += mDueReports.size();
+        mStats.totalJitterNs += jitterNs;
+        mStats.maxJitterNs = std::max(mStats.maxJitterNs, jitterNs);
+        mIsReporting = true;
+        lock.unlock();
+
+        // The reports due together receive the same epoch time.
+        for (const Report& report : mDueReports) {
+            report(epoch);
+        }
+        const int64_t durationNs =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - now).count();
+
+        lock.lock();
+        mIsReporting = false;
+        mStats.maxReportDurationNs = std::max(mStats.maxReportDurationNs, durationNs);
+        // Wakes up removeReport().
+        mCondition.notify_all();
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_GNSS_V2_0_GNSSREPORTSCHEDULER_H
+#define ANDROID_HARDWARE_GNSS_V2_0_GNSSREPORTSCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * Runs the periodic GNSS reports (locations, SV status, NMEA, measurements) from a single thread.
+ *
+ * Reports are due on multiples of their period counted from a common origin, so reports with the
+ * same period run on the same epoch tick, one after the other, and receive the same epoch time.
+ * Deadlines are absolute: the time spent in the callbacks does not delay the next epoch, and an
+ * epoch which is missed entirely is skipped rather than reported late.
+ */
+class GnssReportScheduler {
+  public:
+    using Clock = std::chrono::steady_clock;
+    // Called on each epoch tick of the report, with the time of the epoch.
+    using Report = std::function<void(Clock::time_point epoch)>;
+
+    struct Stats {
+        uint64_t epochs = 0;
+        uint64_t reports = 0;
+        // Epochs skipped because the previous ones were still being reported.
+        uint64_t missedEpochs = 0;
+        // Lateness of the epoch ticks relative to their deadline.
+        int64_t totalJitterNs = 0;
+        int64_t maxJitterNs = 0;
+        // Longest time spent running the reports of one epoch.
+        int64_t maxReportDurationNs = 0;
+    };
+
+    GnssReportScheduler();
+    ~GnssReportScheduler();
+
+    /**
+     * Runs the report every period, starting on the next multiple of the period. Returns an id for
+     * removeReport().
+     */
+    int addReport(std::chrono::nanoseconds period, Report report);
+
+    /**
+     * Stops running the report. When called from another thread, returns once the report is no
+     * longer running, so that whatever it references may be destroyed.
+     */
+    void removeReport(int id);
+
+    Stats getStats();
+    void resetStats();
+
+    // Writes the stats in human readable form.
+    void dump(int fd);
+
+  private:
+    struct Entry {
+        std::chrono::nanoseconds period;
+        Clock::time_point deadline;
+        Report report;
+    };
+
+    void run();
+    // Returns the first multiple of the period after the time. Must be called with mMutex held.
+    Clock::time_point nextEpochLocked(std::chrono::nanoseconds period,
+                                      Clock::time_point time) const;
+
+    const Clock::time_point mOrigin;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopThread;               // Protected by mMutex.
+    int mNextId;                    // Protected by mMutex.
+    std::map<int, Entry> mEntries;  // Protected by mMutex.
+    // Set while the thread runs the due reports, which it does without holding mMutex.
+    bool mIsReporting;              // Protected by mMutex.
+    Stats mStats;                   // Protected by mMutex.
+
+    // Only used by the scheduler thread, kept to avoid allocations.
+    std::vector<Report> mDueReports;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_GNSS_V2_0_GNSSREPORTSCHEDULER_H
@@ -0,0 +1,993 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GnssTraceProvider"
+
+#include "GnssTraceProvider.h"
+
+#include <log/log.h>
+#include <utils/SystemClock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "Constants.h"
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+using GnssAccumulatedDeltaRangeState =
+        V1_0::IGnssMeasurementCallback::GnssAccumulatedDeltaRangeState;
+using GnssClockFlags = V1_0::IGnssMeasurementCallback::GnssClockFlags;
+using GnssLocationFlags = V1_0::GnssLocationFlags;
+using GnssMeasurementFlags = V1_0::IGnssMeasurementCallback::GnssMeasurementFlags;
+using GnssMeasurementState = V2_0::IGnssMeasurementCallback::GnssMeasurementState;
+using GnssMultipathIndicator = V1_0::IGnssMeasurementCallback::GnssMultipathIndicator;
+using GnssSvFlags = V1_0::IGnssCallback::GnssSvFlags;
+using GnssSvInfo = V2_0::IGnssCallback::GnssSvInfo;
+using GnssConstellationType = V2_0::GnssConstellationType;
+
+namespace {
+
+constexpr int64_t kNsPerMs = 1000000;
+constexpr int64_t kNsPerSecond = 1000 * kNsPerMs;
+constexpr int64_t kNsPerDay = 86400 * kNsPerSecond;
+constexpr int64_t kNsPerWeek = 7 * kNsPerDay;
+constexpr int64_t kMsPerDay = kNsPerDay / kNsPerMs;
+constexpr int64_t kUnknownTimeNs = std::numeric_limits<int64_t>::min();
+constexpr double kSpeedOfLight = 299792458.0;
+// The GPS epoch in Unix time, and the offset of GPS time from UTC since 2017.
+constexpr int64_t kGpsEpochUnixSeconds = 315964800;
+constexpr int16_t kGpsLeapSeconds = 18;
+// Offset of BeiDou time from GPS time, and of GLONASS time from UTC.
+constexpr int64_t kBeidouOffsetNs = 14 * kNsPerSecond;
+constexpr int64_t kGlonassOffsetNs = 3 * 3600 * kNsPerSecond;
+constexpr double kMetersPerSecondPerKnot = 0.514444;
+// User equivalent range error assumed to derive an accuracy from the HDOP.
+constexpr double kUereMeters = 5.0;
+// Replay times are compared with this tolerance, so that rounding the speed scaling never delays
+// an epoch to the next report.
+constexpr int64_t kReplayToleranceNs = kNsPerMs;
+// Interval between the loops over a trace which has a single epoch, or whose first two epochs are
+// not in order.
+constexpr int64_t kDefaultIntervalNs = kNsPerSecond;
+// Longer integers may not fit in an int64_t, and are not found in traces.
+constexpr size_t kMaxIntDigits = 18;
+// NMEA 0183 sentences have at most 82 characters, and therefore 20 fields or so.
+constexpr size_t kMaxNmeaFields = 32;
+// Width of a RINEX 3 observation, which are after the 3 characters of the satellite.
+constexpr size_t kRinexObservationWidth = 16;
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Returns the text before the separator, and removes it from the text with the separator.
+std::string_view nextField(std::string_view* text, char separator) {
+    const size_t end = text->find(separator);
+    const std::string_view field = text->substr(0, end);
+    text->remove_prefix(end == std::string_view::npos ? text->size() : end + 1);
+    return field;
+}
+
+// Returns the columns [start, start + length) of a fixed width record, which may be shorter.
+std::string_view columns(std::string_view line, size_t start, size_t length) {
+    return start < line.size() ? line.substr(start, length) : std::string_view();
+}
+
+// The numbers are parsed from the views, which are not null terminated. Surrounding blanks are
+// ignored, empty fields and integers too long for an int64_t are rejected.
+bool parseInt(std::string_view text, int64_t* value) {
+    text = trim(text);
+    const bool negative = !text.empty() && text.front() == '-';
+    if (!text.empty() && (text.front() == '-' || text.front() == '+')) {
+        text.remove_prefix(1);
+    }
+    if (text.empty() || text.size() > kMaxIntDigits) {
+        return false;
+    }
+    int64_t result = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    *value = negative ? -result : result;
+    return true;
+}
+
+bool parseDouble(std::string_view text, double* value) {
+    text = trim(text);
+    const bool negative = !text.empty() && text.front() == '-';
+    if (!text.empty() && (text.front() == '-' || text.front() == '+')) {
+        text.remove_prefix(1);
+    }
+    double result = 0;
+    double divisor = 1;
+    bool hasDigits = false;
+    bool inFraction = false;
+    for (char c : text) {
+        if (c == '.' && !inFraction) {
+            inFraction = true;
+            continue;
+        }
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        hasDigits = true;
+        result = result * 10 + (c - '0');
+        if (inFraction) {
+            divisor *= 10;
+        }
+    }
+    if (!hasDigits) {
+        return false;
+    }
+    *value = (negative ? -result : result) / divisor;
+    return true;
+}
+
+// Days from 1970-01-01 to the date of the proleptic Gregorian calendar.
+int64_t daysFromCivil(int64_t year, int64_t month, int64_t day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t yearOfEra = year - era * 400;
+    const int64_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Converts WGS84 earth-centered coordinates to a latitude and longitude in degrees, and an
+// altitude above the ellipsoid.
+void ecefToGeodetic(const double xyz[3], V1_0::GnssLocation* location) {
+    constexpr double kSemiMajorAxis = 6378137.0;
+    constexpr double kFlattening = 1 / 298.257223563;
+    constexpr double kSemiMinorAxis = kSemiMajorAxis * (1 - kFlattening);
+    constexpr double kEccentricity2 = kFlattening * (2 - kFlattening);
+    constexpr double kSecondEccentricity2 = kEccentricity2 / (1 - kEccentricity2);
+    constexpr double kDegreesPerRadian = 180 / M_PI;
+
+    // Bowring's formula, accurate to well under a millimeter on earth.
+    const double p = std::hypot(xyz[0], xyz[1]);
+    const double theta = std::atan2(xyz[2] * kSemiMajorAxis, p * kSemiMinorAxis);
+    const double sinTheta = std::sin(theta);
+    const double cosTheta = std::cos(theta);
+    const double latitude = std::atan2(
+            xyz[2] + kSecondEccentricity2 * kSemiMinorAxis * sinTheta * sinTheta * sinTheta,
+            p - kEccentricity2 * kSemiMajorAxis * cosTheta * cosTheta * cosTheta);
+    const double radius =
+            kSemiMajorAxis / std::sqrt(1 - kEccentricity2 * std::pow(std::sin(latitude), 2));
+    location->latitudeDegrees = latitude * kDegreesPerRadian;
+    location->longitudeDegrees = std::atan2(xyz[1], xyz[0]) * kDegreesPerRadian;
+    location->altitudeMeters = p / std::cos(latitude) - radius;
+}
+
+// Checks the checksum of the sentence, if it has one, and returns the sentence without the
+// leading '$' and the checksum.
+bool checkNmeaSentence(std::string_view line, std::string_view* sentence) {
+    if (line.empty() || (line.front() != '$' && line.front() != '!')) {
+        return false;
+    }
+    line.remove_prefix(1);
+    const size_t star = line.rfind('*');
+    if (star != std::string_view::npos) {
+        uint8_t checksum = 0;
+        for (char c : line.substr(0, star)) {
+            checksum ^= static_cast<uint8_t>(c);
+        }
+        const std::string_view hex = trim(line.substr(star + 1));
+        unsigned expected = 0;
+        for (char c : hex) {
+            if (c >= '0' && c <= '9') {
+                expected = expected * 16 + (c - '0');
+            } else if (c >= 'A' && c <= 'F') {
+                expected = expected * 16 + (c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        if (hex.size() != 2 || expected != checksum) {
+            return false;
+        }
+        line = line.substr(0, star);
+    }
+    *sentence = line;
+    return true;
+}
+
+// Parses "hhmmss.ss" into nanoseconds since midnight.
+bool parseNmeaTime(std::string_view text, int64_t* timeOfDayNs) {
+    int64_t hours;
+    int64_t minutes;
+    double seconds;
+    if (text.size() < 6 || !parseInt(text.substr(0, 2), &hours) ||
+        !parseInt(text.substr(2, 2), &minutes) || !parseDouble(text.substr(4), &seconds)) {
+        return false;
+    }
+    *timeOfDayNs = (hours * 3600 + minutes * 60) * kNsPerSecond +
+                   std::llround(seconds * kNsPerSecond);
+    return true;
+}
+
+// Parses "ddmm.mmmm" or "dddmm.mmmm" and its hemisphere into degrees.
+bool parseNmeaCoordinate(std::string_view text, std::string_view hemisphere, double* degrees) {
+    const size_t integerLength = std::min(text.find('.'), text.size());
+    int64_t wholeDegrees;
+    double minutes;
+    if (integerLength < 3 || !parseInt(text.substr(0, integerLength - 2), &wholeDegrees) ||
+        !parseDouble(text.substr(integerLength - 2), &minutes)) {
+        return false;
+    }
+    *degrees = wholeDegrees + minutes / 60;
+    if (hemisphere == "S" || hemisphere == "W") {
+        *degrees = -*degrees;
+    } else if (hemisphere != "N" && hemisphere != "E") {
+        return false;
+    }
+    return true;
+}
+
+// Maps the NMEA satellite ID to its constellation and its svid as defined in GnssSvInfo.
+bool getNmeaSatellite(std::string_view talker, int64_t id, GnssConstellationType* constellation,
+                      int16_t* svid) {
+    if (talker == "GN" || talker == "GP") {
+        // Multi constellation talkers use the ID ranges of NMEA 0183.
+        if (id >= 1 && id <= 32) {
+            *constellation = GnssConstellationType::GPS;
+            *svid = static_cast<int16_t>(id);
+        } else if (id >= 33 && id <= 64) {
+            *constellation = GnssConstellationType::SBAS;
+            *svid = static_cast<int16_t>(id + 87);
+        } else if (id >= 65 && id <= 96 && talker == "GN") {
+            *constellation = GnssConstellationType::GLONASS;
+            *svid = static_cast<int16_t>(id - 64);
+        } else if (id >= 193 && id <= 200) {
+            *constellation = GnssConstellationType::QZSS;
+            *svid = static_cast<int16_t>(id);
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (talker == "GL" && id >= 65 && id <= 96) {
+        *constellation = GnssConstellationType::GLONASS;
+        *svid = static_cast<int16_t>(id - 64);
+    } else if (talker == "GA" && id >= 1 && id <= 36) {
+        *constellation = GnssConstellationType::GALILEO;
+        *svid = static_cast<int16_t>(id);
+    } else if ((talker == "GB" || talker == "BD") && id >= 1 && id <= 63) {
+        *constellation = GnssConstellationType::BEIDOU;
+        *svid = static_cast<int16_t>(id);
+    } else if (talker == "GQ" && id >= 1 && id <= 10) {
+        *constellation = GnssConstellationType::QZSS;
+        *svid = static_cast<int16_t>(id + 192);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseGga(std::string_view fields, GnssTraceEpoch* epoch) {
+    const std::string_view latitude = nextField(&fields, ',');
+    const std::string_view northSouth = nextField(&fields, ',');
+    const std::string_view longitude = nextField(&fields, ',');
+    const std::string_view eastWest = nextField(&fields, ',');
+    const std::string_view quality = nextField(&fields, ',');
+    nextField(&fields, ',');  // Satellites used
+    const std::string_view hdop = nextField(&fields, ',');
+    const std::string_view altitude = nextField(&fields, ',');
+
+    int64_t fixQuality;
+    if (!parseInt(quality, &fixQuality)) {
+        return false;
+    }
+    if (fixQuality == 0) {
+        // No fix.
+        return true;
+    }
+    V1_0::GnssLocation& location = epoch->location.v1_0;
+    if (!parseNmeaCoordinate(latitude, northSouth, &location.latitudeDegrees) ||
+        !parseNmeaCoordinate(longitude, eastWest, &location.longitudeDegrees)) {
+        return false;
+    }
+    epoch->hasLocation = true;
+    location.gnssLocationFlags |= GnssLocationFlags::HAS_LAT_LONG;
+    if (parseDouble(altitude, &location.altitudeMeters)) {
+        location.gnssLocationFlags |= GnssLocationFlags::HAS_ALTITUDE;
+    }
+    double horizontalDilution;
+    if (parseDouble(hdop, &horizontalDilution)) {
+        location.horizontalAccuracyMeters = horizontalDilution * kUereMeters;
+        location.gnssLocationFlags |= GnssLocationFlags::HAS_HORIZONTAL_ACCURACY;
+    }
+    return true;
+}
+
+bool parseRmc(std::string_view fields, GnssTraceEpoch* epoch, int64_t* dateDays) {
+    const std::string_view status = nextField(&fields, ',');
+    const std::string_view latitude = nextField(&fields, ',');
+    const std::string_view northSouth = nextField(&fields, ',');
+    const std::string_view longitude = nextField(&fields, ',');
+    const std::string_view eastWest = nextField(&fields, ',');
+    const std::string_view speed = nextField(&fields, ',');
+    const std::string_view course = nextField(&fields, ',');
+    const std::string_view date = nextField(&fields, ',');
+
+    int64_t day;
+    int64_t month;
+    int64_t year;
+    if (date.size() == 6 && parseInt(date.substr(0, 2), &day) &&
+        parseInt(date.substr(2, 2), &month) && parseInt(date.substr(4, 2), &year)) {
+        *dateDays = daysFromCivil(year + (year < 80 ? 2000 : 1900), month, day);
+    }
+    if (status != "A") {
+        // No fix.
+        return status == "V";
+    }
+    V1_0::GnssLocation& location = epoch->location.v1_0;
+    if (!parseNmeaCoordinate(latitude, northSouth, &location.latitudeDegrees) ||
+        !parseNmeaCoordinate(longitude, eastWest, &location.longitudeDegrees)) {
+        return false;
+    }
+    epoch->hasLocation = true;
+    location.gnssLocationFlags |= GnssLocationFlags::HAS_LAT_LONG;
+    double value;
+    if (parseDouble(speed, &value)) {
+        location.speedMetersPerSec = value * kMetersPerSecondPerKnot;
+        location.gnssLocationFlags |= GnssLocationFlags::HAS_SPEED;
+    }
+    if (parseDouble(course, &value)) {
+        location.bearingDegrees = value;
+        location.gnssLocationFlags |= GnssLocationFlags::HAS_BEARING;
+    }
+    return true;
+}
+
+// GSV sentences list up to 4 satellites, which are appended.
+bool parseGsv(std::string_view talker, std::string_view fields,
+              std::vector<GnssSvInfo>* svInfoList) {
+    std::string_view values[kMaxNmeaFields];
+    size_t count = 0;
+    // The last field may be empty, the C/N0 of a satellite which is not tracked.
+    bool isLastField = false;
+    while (!isLastField && count < kMaxNmeaFields) {
+        isLastField = fields.find(',') == std::string_view::npos;
+        values[count++] = nextField(&fields, ',');
+    }
+    int64_t messageCount;
+    if (count < 3 || !parseInt(values[0], &messageCount)) {
+        return false;
+    }
+    // Each satellite has 4 fields, NMEA 4.10 adds a signal ID at the end.
+    for (size_t i = 3; i + 4 <= count; i += 4) {
+        int64_t id;
+        if (!parseInt(values[i], &id)) {
+            continue;
+        }
+        GnssSvInfo svInfo = {};
+        if (!getNmeaSatellite(talker, id, &svInfo.constellation, &svInfo.v1_0.svid)) {
+            continue;
+        }
+        double value;
+        if (parseDouble(values[i + 1], &value)) {
+            svInfo.v1_0.elevationDegrees = value;
+        }
+        if (parseDouble(values[i + 2], &value)) {
+            svInfo.v1_0.azimuthDegrees = value;
+        }
+        if (parseDouble(values[i + 3], &value)) {
+            svInfo.v1_0.cN0Dbhz = value;
+            // GSA sentences are not parsed, the tracked satellites are assumed to be used.
+            svInfo.v1_0.svFlag = static_cast<uint8_t>(GnssSvFlags::USED_IN_FIX);
+        }
+        svInfoList->push_back(svInfo);
+    }
+    return true;
+}
+
+GnssConstellationType getRinexConstellation(char system) {
+    switch (system) {
+        case 'G':
+            return GnssConstellationType::GPS;
+        case 'R':
+            return GnssConstellationType::GLONASS;
+        case 'E':
+            return GnssConstellationType::GALILEO;
+        case 'C':
+            return GnssConstellationType::BEIDOU;
+        case 'J':
+            return GnssConstellationType::QZSS;
+        case 'S':
+            return GnssConstellationType::SBAS;
+        default:
+            return GnssConstellationType::UNKNOWN;
+    }
+}
+
+// Frequency of a RINEX band, 0 if unknown. The channel of GLONASS satellites is not in the
+// observations, the center frequency of the band is used.
+double getCarrierFrequencyHz(GnssConstellationType constellation, char band) {
+    switch (band) {
+        case '1':
+            return constellation == GnssConstellationType::GLONASS ? 1602.0e6 : 1575.42e6;
+        case '2':
+            if (constellation == GnssConstellationType::GLONASS) {
+                return 1246.0e6;
+            }
+            return constellation == GnssConstellationType::BEIDOU ? 1561.098e6 : 1227.60e6;
+        case '5':
+            return 1176.45e6;
+        case '7':
+            return 1207.14e6;
+        default:
+            return 0;
+    }
+}
+
+// Time of the satellite clock, in the time scale of the constellation, at which a signal
+// received at the GPS time was sent.
+int64_t getReceivedSvTimeNs(GnssConstellationType constellation, int64_t gpsTimeNs,
+                            double pseudorangeMeters) {
+    int64_t timeNs;
+    int64_t periodNs;
+    switch (constellation) {
+        case GnssConstellationType::GLONASS:
+            // Time of day, in Moscow time.
+            timeNs = gpsTimeNs - kGpsLeapSeconds * kNsPerSecond + kGlonassOffsetNs;
+            periodNs = kNsPerDay;
+            break;
+        case GnssConstellationType::BEIDOU:
+            timeNs = gpsTimeNs - kBeidouOffsetNs;
+            periodNs = kNsPerWeek;
+            break;
+        default:
+            // Time of week, Galileo and QZSS time being aligned with GPS time.
+            timeNs = gpsTimeNs;
+            periodNs = kNsPerWeek;
+            break;
+    }
+    timeNs -= std::llround(pseudorangeMeters / kSpeedOfLight * kNsPerSecond);
+    return ((timeNs % periodNs) + periodNs) % periodNs;
+}
+
+// Parses the observations of a satellite, in the order of the types of its system. Only the
+// observations on the band of the first pseudorange are used.
+bool parseRinexObservations(std::string_view line, const std::vector<std::string>& types,
+                            int64_t gpsTimeNs, V2_0::IGnssMeasurementCallback::GnssMeasurement* m,
+                            GnssSvInfo* svInfo) {
+    const GnssConstellationType constellation = getRinexConstellation(line.empty() ? ' ' : line[0]);
+    int64_t prn;
+    if (constellation == GnssConstellationType::UNKNOWN || !parseInt(columns(line, 1, 2), &prn)) {
+        return false;
+    }
+    int16_t svid = static_cast<int16_t>(prn);
+    if (constellation == GnssConstellationType::SBAS) {
+        svid += 100;
+    } else if (constellation == GnssConstellationType::QZSS) {
+        svid += 192;
+    }
+
+    // The band of the first pseudorange, then the other observations on that band.
+    char band = '\0';
+    char attribute = '\0';
+    double pseudorange = 0;
+    for (size_t i = 0; i < types.size() && band == '\0'; i++) {
+        if (types[i].size() == 3 && types[i][0] == 'C' &&
+            parseDouble(columns(line, 3 + i * kRinexObservationWidth, 14), &pseudorange)) {
+            band = types[i][1];
+            attribute = types[i][2];
+        }
+    }
+    if (band == '\0') {
+        return false;
+    }
+    double phase = 0;
+    double doppler = 0;
+    double cn0 = 0;
+    bool hasPhase = false;
+    bool hasDoppler = false;
+    bool hasCn0 = false;
+    for (size_t i = 0; i < types.size(); i++) {
+        const std::string& type = types[i];
+        double value;
+        if (type.size() != 3 || type[1] != band ||
+            !parseDouble(columns(line, 3 + i * kRinexObservationWidth, 14), &value)) {
+            continue;
+        }
+        if (type[0] == 'L' && !hasPhase) {
+            phase = value;
+            hasPhase = true;
+        } else if (type[0] == 'D' && !hasDoppler) {
+            doppler = value;
+            hasDoppler = true;
+        } else if (type[0] == 'S' && !hasCn0) {
+            cn0 = value;
+            hasCn0 = true;
+        }
+    }
+
+    const double frequencyHz = getCarrierFrequencyHz(constellation, band);
+    V1_0::IGnssMeasurementCallback::GnssMeasurement& measurement = m->v1_1.v1_0;
+    measurement = {};
+    measurement.svid = svid;
+    measurement.constellation = V1_0::GnssConstellationType::UNKNOWN;
+    measurement.receivedSvTimeInNs = getReceivedSvTimeNs(constellation, gpsTimeNs, pseudorange);
+    measurement.receivedSvTimeUncertaintyInNs = 10;
+    measurement.cN0DbHz = cn0;
+    measurement.multipathIndicator = GnssMultipathIndicator::INDICATOR_UNKNOWN;
+    if (frequencyHz > 0) {
+        const double wavelengthMeters = kSpeedOfLight / frequencyHz;
+        measurement.flags |= GnssMeasurementFlags::HAS_CARRIER_FREQUENCY;
+        measurement.carrierFrequencyHz = frequencyHz;
+        if (hasDoppler) {
+            measurement.pseudorangeRateMps = -doppler * wavelengthMeters;
+            measurement.pseudorangeRateUncertaintyMps = 0.1;
+        }
+        if (hasPhase) {
+            measurement.accumulatedDeltaRangeM = phase * wavelengthMeters;
+            measurement.accumulatedDeltaRangeUncertaintyM = 0.01;
+            measurement.accumulatedDeltaRangeState =
+                    static_cast<uint16_t>(GnssAccumulatedDeltaRangeState::ADR_STATE_VALID);
+        }
+    }
+    m->codeType = std::string(1, attribute);
+    m->constellation = constellation;
+    if (constellation == GnssConstellationType::GLONASS) {
+        m->state = GnssMeasurementState::STATE_CODE_LOCK |
+                   GnssMeasurementState::STATE_GLO_STRING_SYNC |
+                   GnssMeasurementState::STATE_GLO_TOD_DECODED;
+    } else {
+        m->state = GnssMeasurementState::STATE_CODE_LOCK | GnssMeasurementState::STATE_BIT_SYNC |
+                   GnssMeasurementState::STATE_SUBFRAME_SYNC |
+                   GnssMeasurementState::STATE_TOW_DECODED;
+    }
+
+    *svInfo = {};
+    svInfo->v1_0.svid = svid;
+    svInfo->v1_0.constellation = static_cast<V1_0::GnssConstellationType>(constellation);
+    svInfo->v1_0.cN0Dbhz = cn0;
+    svInfo->v1_0.svFlag = static_cast<uint8_t>(GnssSvFlags::USED_IN_FIX);
+    if (frequencyHz > 0) {
+        svInfo->v1_0.carrierFrequencyHz = frequencyHz;
+        svInfo->v1_0.svFlag |= static_cast<uint8_t>(GnssSvFlags::HAS_CARRIER_FREQUENCY);
+    }
+    svInfo->constellation = constellation;
+    return true;
+}
+
+}  // namespace
+
+std::shared_ptr<GnssTraceProvider> GnssTraceProvider::create(const std::string& path,
+                                                             float speed) {
+    if (!(speed > 0)) {
+        ALOGE("%s: invalid speed %f", __func__, speed);
+        return nullptr;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Failed to open the GNSS trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ALOGE("The GNSS trace %s is empty", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 /* offset */);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        ALOGE("Failed to map the GNSS trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    // The trace is read once per loop, from the start to the end.
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const char* text = static_cast<const char*>(mapping);
+    const void* firstNewline = memchr(text, '\n', size);
+    const std::string_view firstLine(
+            text, firstNewline ? static_cast<const char*>(firstNewline) - text : size);
+    const Format format = firstLine.find("RINEX VERSION / TYPE") != std::string_view::npos
+                                  ? Format::RINEX
+                                  : Format::NMEA;
+
+    std::shared_ptr<GnssTraceProvider> provider(
+            new GnssTraceProvider(path, text, size, format, speed));
+    std::unique_lock<std::mutex> lock(provider->mMutex);
+    if (format == Format::RINEX && !provider->parseRinexHeader()) {
+        ALOGE("The GNSS trace %s has a malformed or unsupported RINEX header", path.c_str());
+        return nullptr;
+    }
+    provider->mOffset = provider->mBodyOffset;
+    provider->advanceLocked();
+    if (provider->mFirstTimeNs == kUnknownTimeNs) {
+        ALOGE("The GNSS trace %s has no epoch", path.c_str());
+        return nullptr;
+    }
+    return provider;
+}
+
+GnssTraceProvider::GnssTraceProvider(const std::string& path, const char* mapping, size_t size,
+                                     Format format, float speed)
+    : mPath(path),
+      mMapping(mapping),
+      mSize(size),
+      mFormat(format),
+      mSpeed(speed),
+      mBodyOffset(0),
+      mApproximatePosition{0, 0, 0},
+      mHasApproximatePosition(false),
+      mOffset(0),
+      mNmeaDateDays(-1),
+      mNmeaDateOffsetNs(0),
+      mDayOffsetNs(0),
+      mLastNmeaTimeNs(kUnknownTimeNs),
+      mFirstTimeNs(kUnknownTimeNs),
+      mFirstIntervalNs(0),
+      mLoopOffsetNs(0),
+      mLatestTimeNs(0),
+      mLoopCount(0),
+      mIsReplaying(false),
+      mNextTimeNs(std::numeric_limits<int64_t>::max()) {}
+
+GnssTraceProvider::~GnssTraceProvider() {
+    munmap(const_cast<char*>(mMapping), mSize);
+}
+
+std::chrono::nanoseconds GnssTraceProvider::getReportPeriod(
+        std::chrono::nanoseconds interval) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(interval /
+                                                                static_cast<double>(mSpeed));
+}
+
+GnssTraceEpoch GnssTraceProvider::getEpoch(GnssReportScheduler::Clock::time_point time) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mIsReplaying) {
+        mIsReplaying = true;
+        mReplayStart = time;
+    }
+    const int64_t elapsedNs =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time - mReplayStart).count();
+    const int64_t traceTimeNs = mFirstTimeNs +
+                                static_cast<int64_t>(elapsedNs * static_cast<double>(mSpeed)) +
+                                kReplayToleranceNs;
+    bool hasAdvanced = false;
+    while (mNextTimeNs <= traceTimeNs) {
+        if (hasAdvanced) {
+            mStats.skippedEpochs++;
+        }
+        mCurrent = std::move(mNext);
+        hasAdvanced = true;
+        advanceLocked();
+    }
+    if (hasAdvanced) {
+        mStats.epochs++;
+    }
+    GnssTraceEpoch epoch = mCurrent;
+    lock.unlock();
+
+    const ElapsedRealtime elapsedRealtime = {
+            .flags = ElapsedRealtimeFlags::HAS_TIMESTAMP_NS |
+                     ElapsedRealtimeFlags::HAS_TIME_UNCERTAINTY_NS,
+            .timestampNs = static_cast<uint64_t>(::android::elapsedRealtimeNano()),
+            .timeUncertaintyNs = 1000000};
+    epoch.location.elapsedRealtime = elapsedRealtime;
+    epoch.measurement.elapsedRealtime = elapsedRealtime;
+    return epoch;
+}
+
+GnssTraceProvider::Stats GnssTraceProvider::getStats() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void GnssTraceProvider::dump(int fd) {
+    const Stats stats = getStats();
+    dprintf(fd, "Trace: %s (%s, speed %.2f)\n", mPath.c_str(),
+            mFormat == Format::NMEA ? "NMEA" : "RINEX", mSpeed);
+    dprintf(fd,
+            "  epochs: %" PRIu64 ", skipped epochs: %" PRIu64 ", loops: %" PRIu64
+            ", malformed lines: %" PRIu64 "\n",
+            stats.epochs, stats.skippedEpochs, stats.loops, stats.malformedLines);
+}
+
+bool GnssTraceProvider::nextLine(std::string_view* line) {
+    if (mOffset >= mSize) {
+        return false;
+    }
+    const char* start = mMapping + mOffset;
+    const void* newline = memchr(start, '\n', mSize - mOffset);
+    size_t length = newline ? static_cast<const char*>(newline) - start : mSize - mOffset;
+    mOffset += newline ? length + 1 : length;
+    if (length > 0 && start[length - 1] == '\r') {
+        length--;
+    }
+    *line = std::string_view(start, length);
+    return true;
+}
+
+bool GnssTraceProvider::parseRinexHeader() {
+    std::string_view line;
+    double version;
+    if (!nextLine(&line) || !parseDouble(columns(line, 0, 9), &version) ||
+        columns(line, 20, 1) != "O") {
+        return false;
+    }
+    if (version < 3 || version >= 4) {
+        // RINEX 2 has different epoch and observation records.
+        ALOGE("%s: unsupported RINEX version %.2f", __func__, version);
+        return false;
+    }
+    char system = '\0';
+    while (nextLine(&line)) {
+        const std::string_view label = trim(columns(line, 60, 20));
+        if (label == "END OF HEADER") {
+            mBodyOffset = mOffset;
+            return !mObservationTypes.empty();
+        }
+        if (label == "SYS / # / OBS TYPES") {
+            // Continuation lines have no system.
+            if (line[0] != ' ') {
+                system = line[0];
+            }
+            for (size_t column = 7; column < 59; column += 4) {
+                const std::string_view type = trim(columns(line, column, 3));
+                if (!type.empty()) {
+                    mObservationTypes[system].emplace_back(type);
+                }
+            }
+        } else if (label == "APPROX POSITION XYZ") {
+            mHasApproximatePosition = true;
+            for (size_t i = 0; i < 3; i++) {
+                mHasApproximatePosition &=
+                        parseDouble(columns(line, i * 14, 14), &mApproximatePosition[i]);
+            }
+        }
+    }
+    return false;
+}
+
+bool GnssTraceProvider::parseNmeaEpoch(GnssTraceEpoch* epoch, int64_t* timeNs) {
+    *epoch = GnssTraceEpoch();
+    std::vector<GnssSvInfo> svInfoList;
+    bool hasTime = false;
+    int64_t timeOfDayNs = 0;
+    int64_t dateDays = -1;
+    std::string_view line;
+    while (true) {
+        const size_t lineOffset = mOffset;
+        if (!nextLine(&line)) {
+            break;
+        }
+        line = trim(line);
+        std::string_view sentence;
+        if (!checkNmeaSentence(line, &sentence)) {
+            if (!line.empty()) {
+                mStats.malformedLines++;
+            }
+            continue;
+        }
+        std::string_view fields = sentence;
+        const std::string_view address = nextField(&fields, ',');
+        if (address.size() != 5) {
+            mStats.malformedLines++;
+            continue;
+        }
+        const std::string_view talker = address.substr(0, 2);
+        const std::string_view type = address.substr(2);
+        bool isWellFormed = true;
+        if (type == "GGA" || type == "RMC") {
+            int64_t sentenceTimeNs;
+            if (!parseNmeaTime(nextField(&fields, ','), &sentenceTimeNs)) {
+                mStats.malformedLines++;
+                continue;
+            }
+            if (hasTime && sentenceTimeNs != timeOfDayNs) {
+                // The first sentence of the next epoch.
+                mOffset = lineOffset;
+                break;
+            }
+            hasTime = true;
+            timeOfDayNs = sentenceTimeNs;
+            isWellFormed = type == "GGA" ? parseGga(fields, epoch)
+                                         : parseRmc(fields, epoch, &dateDays);
+        } else if (type == "GSV") {
+            // The satellites in view belong to the fix before them.
+            isWellFormed = parseGsv(talker, fields, &svInfoList);
+        }
+        if (!isWellFormed) {
+            mStats.malformedLines++;
+        }
+        epoch->nmeaSentences.push_back(line);
+    }
+    if (!hasTime) {
+        return false;
+    }
+
+    // The trace goes on to the next day when the time of day goes back. The dates are not used
+    // for the replay: traces may have epochs before their first RMC sentence, or RMC sentences
+    // at a lower rate than GGA ones.
+    *timeNs = mDayOffsetNs + timeOfDayNs;
+    if (mLastNmeaTimeNs != kUnknownTimeNs && *timeNs < mLastNmeaTimeNs) {
+        mDayOffsetNs += kNsPerDay;
+        *timeNs += kNsPerDay;
+    }
+    mLastNmeaTimeNs = *timeNs;
+    if (dateDays >= 0) {
+        mNmeaDateDays = dateDays;
+        mNmeaDateOffsetNs = mDayOffsetNs;
+    }
+
+    int64_t utcTimeMs;
+    if (mNmeaDateDays >= 0) {
+        // The days since the last date are counted by the replay.
+        utcTimeMs = (mNmeaDateDays * kNsPerDay + *timeNs - mNmeaDateOffsetNs) / kNsPerMs;
+    } else {
+        // Without date, the fixes are on the day of the mock location.
+        const int64_t mockDayMs = common::kMockTimestamp - common::kMockTimestamp % kMsPerDay;
+        utcTimeMs = mockDayMs + *timeNs / kNsPerMs;
+    }
+    epoch->location.v1_0.timestamp = utcTimeMs;
+    epoch->svInfoList = svInfoList;
+    return true;
+}
+
+bool GnssTraceProvider::parseRinexEpoch(GnssTraceEpoch* epoch, int64_t* timeNs) {
+    std::string_view line;
+    while (nextLine(&line)) {
+        if (trim(line).empty()) {
+            continue;
+        }
+        int64_t year;
+        int64_t month;
+        int64_t day;
+        int64_t hour;
+        int64_t minute;
+        double second;
+        int64_t flag;
+        int64_t count;
+        if (line[0] != '>' || !parseInt(columns(line, 2, 4), &year) ||
+            !parseInt(columns(line, 7, 2), &month) || !parseInt(columns(line, 10, 2), &day) ||
+            !parseInt(columns(line, 13, 2), &hour) || !parseInt(columns(line, 16, 2), &minute) ||
+            !parseDouble(columns(line, 18, 11), &second) ||
+            !parseInt(columns(line, 31, 1), &flag) || !parseInt(columns(line, 32, 3), &count) ||
+            flag < 0 || count < 0) {
+            mStats.malformedLines++;
+            continue;
+        }
+        if (flag > 1) {
+            // An event, followed by count special records.
+            for (int64_t i = 0; i < count && nextLine(&line); i++) {
+            }
+            continue;
+        }
+
+        const int64_t gpsTimeNs =
+                (daysFromCivil(year, month, day) - daysFromCivil(1980, 1, 6)) * kNsPerDay +
+                (hour * 3600 + minute * 60) * kNsPerSecond + std::llround(second * kNsPerSecond);
+        std::vector<V2_0::IGnssMeasurementCallback::GnssMeasurement> measurements;
+        std::vector<GnssSvInfo> svInfoList;
+        measurements.reserve(count);
+        svInfoList.reserve(count);
+        for (int64_t i = 0; i < count && nextLine(&line); i++) {
+            const auto types = mObservationTypes.find(line.empty() ? ' ' : line[0]);
+            V2_0::IGnssMeasurementCallback::GnssMeasurement measurement;
+            GnssSvInfo svInfo;
+            if (types == mObservationTypes.end() ||
+                !parseRinexObservations(line, types->second, gpsTimeNs, &measurement, &svInfo)) {
+                mStats.malformedLines++;
+                continue;
+            }
+            measurements.push_back(measurement);
+            svInfoList.push_back(svInfo);
+        }
+
+        *epoch = GnssTraceEpoch();
+        if (mHasApproximatePosition) {
+            V1_0::GnssLocation& location = epoch->location.v1_0;
+            ecefToGeodetic(mApproximatePosition, &location);
+            location.gnssLocationFlags = GnssLocationFlags::HAS_LAT_LONG |
+                                         GnssLocationFlags::HAS_ALTITUDE;
+            location.timestamp = gpsTimeNs / kNsPerMs +
+                                 (kGpsEpochUnixSeconds - kGpsLeapSeconds) * 1000;
+            epoch->hasLocation = true;
+        }
+        epoch->svInfoList = svInfoList;
+        epoch->hasMeasurement = true;
+        epoch->measurement.measurements = measurements;
+        *timeNs = gpsTimeNs;
+        return true;
+    }
+    return false;
+}
+
+void GnssTraceProvider::advanceLocked() {
+    int64_t timeNs;
+    auto parseEpoch = [this, &timeNs]() {
+        return mFormat == Format::NMEA ? parseNmeaEpoch(&mNext, &timeNs)
+                                       : parseRinexEpoch(&mNext, &timeNs);
+    };
+    if (!parseEpoch()) {
+        if (mFirstTimeNs == kUnknownTimeNs) {
+            mNextTimeNs = std::numeric_limits<int64_t>::max();
+            return;
+        }
+        // Starts over, a loop lasting from the first epoch to one interval after the latest. The
+        // loops always move forward, even if the epochs are out of order.
+        mOffset = mBodyOffset;
+        mNmeaDateDays = -1;
+        mNmeaDateOffsetNs = 0;
+        mDayOffsetNs = 0;
+        mLastNmeaTimeNs = kUnknownTimeNs;
+        mLoopOffsetNs += mLatestTimeNs - mFirstTimeNs +
+                         (mFirstIntervalNs > 0 ? mFirstIntervalNs : kDefaultIntervalNs);
+        mLoopCount++;
+        mStats.loops++;
+        if (!parseEpoch()) {
+            // The trace had an epoch at the first loop.
+            mNextTimeNs = std::numeric_limits<int64_t>::max();
+            return;
+        }
+    }
+    if (mFirstTimeNs == kUnknownTimeNs) {
+        mFirstTimeNs = timeNs;
+        mLatestTimeNs = timeNs;
+    } else if (mLoopCount == 0 && mFirstIntervalNs == 0) {
+        mFirstIntervalNs = timeNs - mFirstTimeNs;
+    }
+    mLatestTimeNs = std::max(mLatestTimeNs, timeNs);
+    mNextTimeNs = timeNs + mLoopOffsetNs;
+
+    if (mNext.hasMeasurement) {
+        // The receiver clock runs from the start of the trace, with a discontinuity per loop as
+        // the GNSS time goes back.
+        V1_0::IGnssMeasurementCallback::GnssClock& clock = mNext.measurement.clock;
+        clock = {};
+        clock.gnssClockFlags = GnssClockFlags::HAS_LEAP_SECOND | GnssClockFlags::HAS_FULL_BIAS;
+        clock.leapSecond = kGpsLeapSeconds;
+        clock.timeNs = mNextTimeNs - mFirstTimeNs;
+        clock.fullBiasNs = clock.timeNs - timeNs;
+        clock.hwClockDiscontinuityCount = mLoopCount;
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
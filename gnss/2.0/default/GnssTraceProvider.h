@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_GNSS_V2_0_GNSSTRACEPROVIDER_H
+#define ANDROID_HARDWARE_GNSS_V2_0_GNSSTRACEPROVIDER_H
+
+#include <android/hardware/gnss/2.0/IGnssCallback.h>
+#include <android/hardware/gnss/2.0/IGnssMeasurementCallback.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "GnssReportScheduler.h"
+
+namespace android {
+namespace hardware {
+namespace gnss {
+namespace V2_0 {
+namespace implementation {
+
+using ::android::hardware::hidl_vec;
+
+// What a trace reports at one epoch. NMEA traces have no measurements, RINEX observation files
+// only have the approximate position of the receiver.
+struct GnssTraceEpoch {
+    bool hasLocation = false;
+    V2_0::GnssLocation location = {};
+    hidl_vec<V2_0::IGnssCallback::GnssSvInfo> svInfoList;
+    bool hasMeasurement = false;
+    V2_0::IGnssMeasurementCallback::GnssData measurement = {};
+    // The sentences of NMEA traces, pointing into the trace: they are valid as long as the
+    // provider.
+    std::vector<std::string_view> nmeaSentences;
+};
+
+/**
+ * Replays a recorded GNSS trace in a loop, at the recorded rate or faster.
+ *
+ * Two formats are supported: NMEA 0183 logs (GGA, RMC and GSV sentences, epochs being delimited
+ * by the time of the fixes) and RINEX 3 observation files (pseudorange, carrier phase, doppler and
+ * C/N0 of each satellite). The trace is memory-mapped and parsed one epoch ahead of the replay,
+ * straight from the mapping, so traces of any duration use a constant amount of memory.
+ */
+class GnssTraceProvider {
+  public:
+    enum class Format { NMEA, RINEX };
+
+    struct Stats {
+        uint64_t epochs = 0;
+        // Epochs of the trace that were never reported, because the reports are less frequent.
+        uint64_t skippedEpochs = 0;
+        uint64_t loops = 0;
+        uint64_t malformedLines = 0;
+    };
+
+    /**
+     * Maps the trace, returns nullptr if it cannot be read or has no epoch. With a speed of 2, the
+     * trace is replayed twice as fast as it was recorded.
+     */
+    static std::shared_ptr<GnssTraceProvider> create(const std::string& path, float speed);
+    ~GnssTraceProvider();
+
+    Format getFormat() const { return mFormat; }
+    float getSpeed() const { return mSpeed; }
+
+    // The period of the reports for an interval of the trace, the reports are more frequent to
+    // replay the trace faster.
+    std::chrono::nanoseconds getReportPeriod(std::chrono::nanoseconds interval) const;
+
+    /**
+     * Returns the last epoch of the trace due at the time. The first call starts the replay with
+     * the first epoch. The elapsed realtime of the epoch is the time of the call.
+     */
+    GnssTraceEpoch getEpoch(GnssReportScheduler::Clock::time_point time);
+
+    Stats getStats();
+
+    // Writes the trace and the stats in human readable form.
+    void dump(int fd);
+
+  private:
+    // Observations of a RINEX system, by observation code ("C1C", "S1C"...).
+    using ObservationTypes = std::vector<std::string>;
+
+    GnssTraceProvider(const std::string& path, const char* mapping, size_t size, Format format,
+                      float speed);
+
+    // Returns the next line of the trace, or false at the end of the trace.
+    bool nextLine(std::string_view* line);
+    bool parseRinexHeader();
+    // Parse the epoch at the current offset, return false at the end of the trace. Times are in
+    // nanoseconds, on the time scale of the trace.
+    bool parseNmeaEpoch(GnssTraceEpoch* epoch, int64_t* timeNs);
+    bool parseRinexEpoch(GnssTraceEpoch* epoch, int64_t* timeNs);
+    // Parses the next epoch into mNext, going back to the start of the trace at its end. Must be
+    // called with mMutex held.
+    void advanceLocked();
+
+    const std::string mPath;
+    const char* const mMapping;
+    const size_t mSize;
+    const Format mFormat;
+    const float mSpeed;
+
+    // Offset of the first epoch, after the RINEX header.
+    size_t mBodyOffset;
+    std::map<char, ObservationTypes> mObservationTypes;
+    double mApproximatePosition[3];
+    bool mHasApproximatePosition;
+
+    std::mutex mMutex;
+    size_t mOffset;  // Protected by mMutex.
+    // The replay times of NMEA traces are times of day, offset by a day when they go past
+    // midnight, whether the trace has dates or not. The date of the last RMC sentence, in days
+    // since 1970 and -1 before, and the day offset at that sentence only date the locations.
+    int64_t mNmeaDateDays;      // Protected by mMutex.
+    int64_t mNmeaDateOffsetNs;  // Protected by mMutex.
+    int64_t mDayOffsetNs;       // Protected by mMutex.
+    int64_t mLastNmeaTimeNs;    // Protected by mMutex.
+    // Time of the first epoch, and interval between the first two epochs.
+    int64_t mFirstTimeNs;      // Protected by mMutex.
+    int64_t mFirstIntervalNs;  // Protected by mMutex.
+    // Added to the times of the trace, a loop duration per loop.
+    int64_t mLoopOffsetNs;  // Protected by mMutex.
+    // Time of the latest epoch of the trace, which is not the last one if they are out of order.
+    int64_t mLatestTimeNs;  // Protected by mMutex.
+    uint32_t mLoopCount;    // Protected by mMutex.
+    bool mIsReplaying;      // Protected by mMutex.
+    GnssReportScheduler::Clock::time_point mReplayStart;  // Protected by mMutex.
+    GnssTraceEpoch mCurrent;  // Protected by mMutex.
+    GnssTraceEpoch mNext;     // Protected by mMutex.
+    int64_t mNextTimeNs;      // Protected by mMutex.
+    Stats mStats;             // Protected by mMutex.
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace gnss
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_GNSS_V2_0_GNSSTRACEPROVIDER_H
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// GnssBatching instantiated in process, fed with numbered locations: checks what
+// is delivered and how many callbacks batching saves compared to delivering
+// every location as it is computed.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GnssBatching.h"
+
+using ::android::sp;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::hardware::gnss::V1_0::IGnssBatching;
+using ::android::hardware::gnss::V2_0::GnssLocation;
+using ::android::hardware::gnss::V2_0::IGnssBatchingCallback;
+using ::android::hardware::gnss::V2_0::implementation::GnssBatching;
+
+namespace {
+
+constexpr int64_t kPeriodNs = 10 * 1000 * 1000;  // 10 ms
+constexpr int64_t kFastPeriodNs = 1000 * 1000;   // 1 ms
+
+struct BatchingCallback : public IGnssBatchingCallback {
+    Return<void> gnssLocationBatchCb(const hidl_vec<GnssLocation>& locations) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBatches.push_back(locations);
+        return Void();
+    }
+
+    std::vector<hidl_vec<GnssLocation>> batches() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBatches;
+    }
+
+    std::mutex mMutex;
+    std::vector<hidl_vec<GnssLocation>> mBatches;
+};
+
+class GnssBatchingTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mGenerated = 0;
+        mBatching = new GnssBatching([this]() {
+            // The locations are numbered in their timestamp.
+            GnssLocation location = {};
+            location.elapsedRealtime.timestampNs = ++mGenerated;
+            return location;
+        });
+        mCallback = new BatchingCallback();
+        ASSERT_TRUE(mBatching->init_2_0(mCallback));
+    }
+
+    void TearDown() override { mBatching->cleanup(); }
+
+    bool start(int64_t periodNs, uint8_t flags) {
+        IGnssBatching::Options options = {.periodNanos = periodNs, .flags = flags};
+        return mBatching->start(options);
+    }
+
+    void waitUntilGenerated(uint64_t count) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (mGenerated < count && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        ASSERT_GE(mGenerated, count);
+    }
+
+    // Checks that the locations are numbered consecutively starting from first.
+    static void expectConsecutive(const std::vector<GnssLocation>& locations, uint64_t first) {
+        for (size_t i = 0; i < locations.size(); i++) {
+            ASSERT_EQ(first + i, locations[i].elapsedRealtime.timestampNs) << "at " << i;
+        }
+    }
+
+    std::atomic<uint64_t> mGenerated;
+    sp<GnssBatching> mBatching;
+    sp<BatchingCallback> mCallback;
+};
+
+}  // namespace
+
+TEST_F(GnssBatchingTest, ReportsItsBatchSize) {
+    EXPECT_EQ(GnssBatching::kBatchSize, mBatching->getBatchSize());
+}
+
+TEST_F(GnssBatchingTest, RejectsInvalidPeriod) {
+    EXPECT_FALSE(start(0 /* periodNs */, 0 /* flags */));
+}
+
+TEST_F(GnssBatchingTest, FlushDeliversTheWholeBatchInOneCallback) {
+    ASSERT_TRUE(start(kPeriodNs, 0 /* flags */));
+    waitUntilGenerated(50);
+    ASSERT_TRUE(mBatching->stop());
+    EXPECT_TRUE(mCallback->batches().empty());
+
+    mBatching->flush();
+    auto batches = mCallback->batches();
+    ASSERT_EQ(1u, batches.size());
+    const uint64_t generated = mGenerated;
+    ASSERT_EQ(generated, batches[0].size());
+    expectConsecutive(batches[0], 1);
+
+    // Delivering every location as it is computed would have taken one callback per location.
+    RecordProperty("locations", std::to_string(generated));
+    RecordProperty("callbacks", std::to_string(batches.size()));
+    RecordProperty("callback_reduction", std::to_string(generated / batches.size()));
+
+    // Delivered locations are cleared.
+    mBatching->flush();
+    batches = mCallback->batches();
+    ASSERT_EQ(2u, batches.size());
+    EXPECT_EQ(0u, batches[1].size());
+}
+
+TEST_F(GnssBatchingTest, WakeupOnFifoFullDeliversFullBatches) {
+    ASSERT_TRUE(start(kFastPeriodNs,
+                      static_cast<uint8_t>(IGnssBatching::Flag::WAKEUP_ON_FIFO_FULL)));
+    waitUntilGenerated(3 * GnssBatching::kBatchSize);
+    ASSERT_TRUE(mBatching->stop());
+
+    auto batches = mCallback->batches();
+    ASSERT_GE(batches.size(), 2u);
+    uint64_t next = 1;
+    for (const auto& batch : batches) {
+        ASSERT_EQ(GnssBatching::kBatchSize, batch.size());
+        expectConsecutive(batch, next);
+        next += batch.size();
+    }
+    RecordProperty("callback_reduction",
+                   std::to_string(static_cast<uint64_t>(mGenerated) / batches.size()));
+
+    // Nothing is lost between the full batches and the flush.
+    mBatching->flush();
+    batches = mCallback->batches();
+    expectConsecutive(batches.back(), next);
+    EXPECT_EQ(static_cast<uint64_t>(mGenerated), next + batches.back().size() - 1);
+}
+
+TEST_F(GnssBatchingTest, FullRingKeepsTheNewestLocationsWithoutWakeup) {
+    ASSERT_TRUE(start(kFastPeriodNs, 0 /* flags */));
+    waitUntilGenerated(GnssBatching::kBatchSize + 50);
+    ASSERT_TRUE(mBatching->stop());
+    EXPECT_TRUE(mCallback->batches().empty());
+
+    mBatching->flush();
+    auto batches = mCallback->batches();
+    ASSERT_EQ(1u, batches.size());
+    ASSERT_EQ(GnssBatching::kBatchSize, batches[0].size());
+    expectConsecutive(batches[0], mGenerated - GnssBatching::kBatchSize + 1);
+}
+
+TEST_F(GnssBatchingTest, ConcurrentStartsAndStopsAreSerialized) {
+    constexpr int kThreadCount = 4;
+    constexpr int kStartCount = 50;
+    std::atomic<int> started(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreadCount; i++) {
+        threads.emplace_back([this, &started]() {
+            for (int j = 0; j < kStartCount; j++) {
+                if (start(kFastPeriodNs, 0 /* flags */)) {
+                    started++;
+                }
+                if (j % 5 == 4) {
+                    mBatching->stop();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(kThreadCount * kStartCount, started);
+    EXPECT_TRUE(mBatching->stop());
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// GnssMeasurement instantiated in process with the mock source: checks that the
+// epochs of a report are all delivered on its tick, one callback per epoch, and
+// that they are timestamped one epoch period apart.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GnssMeasurement.h"
+
+using ::android::sp;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::hardware::gnss::V1_0::IGnssMeasurement;
+using ::android::hardware::gnss::V2_0::IGnssMeasurementCallback;
+using ::android::hardware::gnss::V2_0::implementation::GnssMeasurement;
+using ::android::hardware::gnss::V2_0::implementation::GnssMockMeasurementSource;
+using ::android::hardware::gnss::V2_0::implementation::GnssReportScheduler;
+
+namespace {
+
+using Clock = GnssReportScheduler::Clock;
+using GnssMeasurementStatus = IGnssMeasurement::GnssMeasurementStatus;
+using GnssData_1_0 = ::android::hardware::gnss::V1_0::IGnssMeasurementCallback::GnssData;
+using GnssData_1_1 = ::android::hardware::gnss::V1_1::IGnssMeasurementCallback::GnssData;
+
+constexpr size_t kSatelliteCount = 8;
+constexpr size_t kEpochsPerReport = 3;
+// The measurements are reported at 1 Hz.
+constexpr int64_t kEpochPeriodNs = 1000 * 1000 * 1000;
+// Time taken to fill and deliver the epochs of a report.
+constexpr int64_t kDeliveryToleranceNs = 50 * 1000 * 1000;
+
+struct MeasurementCallback : public IGnssMeasurementCallback {
+    struct Received {
+        size_t measurementCount;
+        int64_t timeNs;
+        uint64_t elapsedRealtimeNs;
+        Clock::time_point receivedAt;
+    };
+
+    Return<void> GnssMeasurementCb(const GnssData_1_0&) override {
+        ADD_FAILURE() << "Unexpected 1.0 measurement";
+        return Void();
+    }
+
+    Return<void> gnssMeasurementCb(const GnssData_1_1&) override {
+        ADD_FAILURE() << "Unexpected 1.1 measurement";
+        return Void();
+    }
+
+    Return<void> gnssMeasurementCb_2_0(const GnssData& data) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mReceived.push_back({data.measurements.size(), data.clock.timeNs,
+                             data.elapsedRealtime.timestampNs, Clock::now()});
+        return Void();
+    }
+
+    std::vector<Received> received() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mReceived;
+    }
+
+    std::mutex mMutex;
+    std::vector<Received> mReceived;
+};
+
+}  // namespace
+
+TEST(GnssMeasurementTest, DeliversTheEpochsOfAReportOnePeriodApart) {
+    auto scheduler = std::make_shared<GnssReportScheduler>();
+    sp<GnssMeasurement> measurement =
+            new GnssMeasurement(scheduler, nullptr /* traceProvider */,
+                                std::make_shared<GnssMockMeasurementSource>(kSatelliteCount),
+                                kEpochsPerReport);
+    sp<MeasurementCallback> callback = new MeasurementCallback();
+    ASSERT_EQ(GnssMeasurementStatus::SUCCESS,
+              static_cast<GnssMeasurementStatus>(
+                      measurement->setCallback_2_0(callback, false /* enableFullTracking */)));
+
+    // The first report is due within one report period.
+    const auto deadline = Clock::now() + std::chrono::nanoseconds(kEpochPeriodNs) *
+                                                 static_cast<int64_t>(kEpochsPerReport + 2);
+    while (callback->received().size() < kEpochsPerReport && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    measurement->close();
+
+    const auto received = callback->received();
+    ASSERT_GE(received.size(), kEpochsPerReport);
+    // Stopping waits for the report in progress, reports are never cut short.
+    EXPECT_EQ(0u, received.size() % kEpochsPerReport);
+
+    for (size_t report = 0; report < received.size() / kEpochsPerReport; report++) {
+        for (size_t i = report * kEpochsPerReport; i < (report + 1) * kEpochsPerReport; i++) {
+            EXPECT_EQ(kSatelliteCount, received[i].measurementCount) << "at " << i;
+            if (i == report * kEpochsPerReport) {
+                // The next report starts after the last epoch of the previous one.
+                if (i > 0) {
+                    EXPECT_GT(received[i].timeNs, received[i - 1].timeNs) << "at " << i;
+                }
+                continue;
+            }
+            const auto& previous = received[i - 1];
+            EXPECT_EQ(kEpochPeriodNs, received[i].timeNs - previous.timeNs) << "at " << i;
+            const int64_t elapsedRealtimeDeltaNs = static_cast<int64_t>(
+                    received[i].elapsedRealtimeNs - previous.elapsedRealtimeNs);
+            EXPECT_NEAR(kEpochPeriodNs, elapsedRealtimeDeltaNs, kDeliveryToleranceNs)
+                    << "at " << i;
+            // Delivered on the same tick.
+            EXPECT_LT(std::chrono::nanoseconds(received[i].receivedAt - previous.receivedAt)
+                              .count(),
+                      kDeliveryToleranceNs)
+                    << "at " << i;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the mock measurements at realistic sizes, and that filling an epoch
+// reuses the buffers of the previous one.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <set>
+#include <utility>
+
+#include "GnssMockMeasurementSource.h"
+
+using ::android::hardware::gnss::V2_0::GnssConstellationType;
+using ::android::hardware::gnss::V2_0::implementation::GnssMockMeasurementSource;
+
+namespace {
+
+using Clock = GnssMockMeasurementSource::Clock;
+using GnssData = GnssMockMeasurementSource::GnssData;
+
+constexpr size_t kSatelliteCount = 64;
+
+}  // namespace
+
+TEST(GnssMockMeasurementSourceTest, OneSatelliteIsGlonass) {
+    GnssMockMeasurementSource source(1);
+    GnssData data;
+    source.fill(Clock::now(), &data);
+    ASSERT_EQ(1u, data.measurements.size());
+    EXPECT_EQ(GnssConstellationType::GLONASS, data.measurements[0].constellation);
+    EXPECT_EQ(6, data.measurements[0].v1_1.v1_0.svid);
+    EXPECT_FLOAT_EQ(1.59975e+09f, data.measurements[0].v1_1.v1_0.carrierFrequencyHz);
+}
+
+TEST(GnssMockMeasurementSourceTest, SatelliteCountIsClamped) {
+    EXPECT_EQ(1u, GnssMockMeasurementSource(0).getSatelliteCount());
+    EXPECT_EQ(GnssMockMeasurementSource::kMaxSatelliteCount,
+              GnssMockMeasurementSource(GnssMockMeasurementSource::kMaxSatelliteCount + 1)
+                      .getSatelliteCount());
+}
+
+TEST(GnssMockMeasurementSourceTest, SatellitesSpanFourConstellations) {
+    GnssMockMeasurementSource source(kSatelliteCount);
+    GnssData data;
+    source.fill(Clock::now(), &data);
+    ASSERT_EQ(kSatelliteCount, data.measurements.size());
+
+    std::set<std::pair<GnssConstellationType, int16_t>> satellites;
+    std::set<GnssConstellationType> constellations;
+    for (const auto& measurement : data.measurements) {
+        satellites.emplace(measurement.constellation, measurement.v1_1.v1_0.svid);
+        constellations.insert(measurement.constellation);
+        EXPECT_GT(measurement.v1_1.v1_0.receivedSvTimeInNs, 0);
+    }
+    EXPECT_EQ(kSatelliteCount, satellites.size());
+    EXPECT_EQ(4u, constellations.size());
+}
+
+TEST(GnssMockMeasurementSourceTest, BuffersAreReused) {
+    GnssMockMeasurementSource source(kSatelliteCount);
+    const Clock::time_point epoch = Clock::now();
+    GnssData data;
+    source.fill(epoch, &data);
+    const auto* measurements = data.measurements.data();
+    const int64_t timeNs = data.clock.timeNs;
+    const int64_t receivedSvTimeNs = data.measurements[1].v1_1.v1_0.receivedSvTimeInNs;
+
+    source.fill(epoch + std::chrono::milliseconds(100), &data);
+    EXPECT_EQ(measurements, data.measurements.data());
+    EXPECT_EQ(timeNs + 100000000, data.clock.timeNs);
+    EXPECT_EQ(receivedSvTimeNs + 100000000, data.measurements[1].v1_1.v1_0.receivedSvTimeInNs);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the reports share their epochs, that slow reports do not make
+// the epochs drift, and that removing a report does not wait for the next epoch.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GnssReportScheduler.h"
+
+using ::android::hardware::gnss::V2_0::implementation::GnssReportScheduler;
+
+namespace {
+
+using Clock = GnssReportScheduler::Clock;
+
+constexpr auto kPeriod = std::chrono::milliseconds(20);
+
+class EpochRecorder {
+  public:
+    GnssReportScheduler::Report report(std::chrono::milliseconds delay = {}) {
+        return [this, delay](Clock::time_point epoch) {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mEpochs.push_back(epoch);
+            }
+            std::this_thread::sleep_for(delay);
+        };
+    }
+
+    std::vector<Clock::time_point> epochs() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEpochs;
+    }
+
+  private:
+    std::mutex mMutex;
+    std::vector<Clock::time_point> mEpochs;
+};
+
+}  // namespace
+
+TEST(GnssReportSchedulerTest, ReportsShareEpochs) {
+    GnssReportScheduler scheduler;
+    EpochRecorder location;
+    EpochRecorder measurement;
+    const int locationId = scheduler.addReport(kPeriod, location.report());
+    const int measurementId = scheduler.addReport(kPeriod, measurement.report());
+    std::this_thread::sleep_for(kPeriod * 10);
+    scheduler.removeReport(locationId);
+    scheduler.removeReport(measurementId);
+
+    const auto locationEpochs = location.epochs();
+    const auto measurementEpochs = measurement.epochs();
+    ASSERT_GE(locationEpochs.size(), 5u);
+    ASSERT_EQ(locationEpochs.size(), measurementEpochs.size());
+    for (size_t i = 0; i < locationEpochs.size(); i++) {
+        EXPECT_EQ(locationEpochs[i], measurementEpochs[i]);
+    }
+    EXPECT_EQ(scheduler.getStats().epochs, locationEpochs.size());
+}
+
+TEST(GnssReportSchedulerTest, SlowReportsDoNotDrift) {
+    GnssReportScheduler scheduler;
+    EpochRecorder recorder;
+    // Sleeping after each report would have stretched the interval by half.
+    const int id = scheduler.addReport(kPeriod, recorder.report(kPeriod / 2));
+    std::this_thread::sleep_for(kPeriod * 20);
+    scheduler.removeReport(id);
+
+    const auto epochs = recorder.epochs();
+    ASSERT_GE(epochs.size(), 10u);
+    for (size_t i = 1; i < epochs.size(); i++) {
+        EXPECT_EQ(kPeriod.count(), std::chrono::duration_cast<std::chrono::milliseconds>(
+                                           epochs[i] - epochs[i - 1])
+                                           .count())
+                << "epoch " << i;
+    }
+    const auto stats = scheduler.getStats();
+    EXPECT_GE(epochs.size() + stats.missedEpochs, 16u);
+    RecordProperty("mean_jitter_us", std::to_string(stats.totalJitterNs /
+                                                    static_cast<int64_t>(stats.epochs) / 1000));
+    RecordProperty("max_jitter_us", std::to_string(stats.maxJitterNs / 1000));
+}
+
+TEST(GnssReportSchedulerTest, RemoveDoesNotWaitForNextEpoch) {
+    GnssReportScheduler scheduler;
+    EpochRecorder recorder;
+    const int id = scheduler.addReport(std::chrono::seconds(10), recorder.report());
+    const auto start = Clock::now();
+    scheduler.removeReport(id);
+    EXPECT_LT(Clock::now() - start, std::chrono::seconds(1));
+    EXPECT_TRUE(recorder.epochs().empty());
+}
+
+TEST(GnssReportSchedulerTest, InvalidPeriodIsRejected) {
+    GnssReportScheduler scheduler;
+    EpochRecorder recorder;
+    EXPECT_LT(scheduler.addReport(std::chrono::milliseconds(0), recorder.report()), 0);
+}
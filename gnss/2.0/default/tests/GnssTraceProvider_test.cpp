@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays small NMEA and RINEX traces written to temporary files: checks what
+// is parsed out of them, and the timing of the replay at various speeds.
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+
+#include "GnssTraceProvider.h"
+
+using ::android::hardware::gnss::V2_0::GnssConstellationType;
+using ::android::hardware::gnss::V2_0::implementation::GnssReportScheduler;
+using ::android::hardware::gnss::V2_0::implementation::GnssTraceEpoch;
+using ::android::hardware::gnss::V2_0::implementation::GnssTraceProvider;
+
+namespace {
+
+using Clock = GnssReportScheduler::Clock;
+
+// Appends the checksum to the sentence.
+std::string nmea(const std::string& sentence) {
+    uint8_t checksum = 0;
+    for (char c : sentence) {
+        checksum ^= static_cast<uint8_t>(c);
+    }
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "*%02X\r\n", checksum);
+    return "$" + sentence + suffix;
+}
+
+// Three epochs, one second apart.
+std::string getNmeaTrace() {
+    std::string trace;
+    for (int second = 0; second < 3; second++) {
+        const std::string time = "1200" + std::to_string(10 + second) + ".00";
+        trace += nmea("GPRMC," + time + ",A,3725.3200,N,12205.0435,W,10.0,90.0,010419,,,A");
+        trace += nmea("GPGGA," + time + ",3725.3200,N,12205.0435,W,1,08,1.0,1.6,M,0.0,M,,");
+        trace += nmea("GPGSV,2,1,05,03,59,166,32,05,29,056,27,17,71,077,30,26,28,253,24");
+        trace += nmea("GPGSV,2,2,05,40,20,200,");
+        trace += nmea("GLGSV,1,1,01,70,11,116,20");
+    }
+    return trace;
+}
+
+std::string rinexHeader(const std::string& content, const std::string& label) {
+    char line[96];
+    snprintf(line, sizeof(line), "%-60s%-20s\n", content.c_str(), label.c_str());
+    return line;
+}
+
+std::string rinexEpoch(int second, int count) {
+    char line[64];
+    snprintf(line, sizeof(line), "> 2019 04 01 00 00%11.7f  0%3d\n", static_cast<double>(second),
+             count);
+    return line;
+}
+
+std::string rinexObservations(const char* satellite, double pseudorange, double phase,
+                              double doppler, double cn0) {
+    char line[96];
+    snprintf(line, sizeof(line), "%s%14.3f  %14.3f  %14.3f  %14.3f  \n", satellite, pseudorange,
+             phase, doppler, cn0);
+    return line;
+}
+
+std::string getRinexHeader() {
+    std::string header;
+    header += rinexHeader("     3.03           OBSERVATION DATA    M", "RINEX VERSION / TYPE");
+    header += rinexHeader(" -2693883.4027 -4297073.7224  3854693.4716", "APPROX POSITION XYZ");
+    header += rinexHeader("G    4 C1C L1C D1C S1C", "SYS / # / OBS TYPES");
+    header += rinexHeader("R    4 C1C L1C D1C S1C", "SYS / # / OBS TYPES");
+    header += rinexHeader("", "END OF HEADER");
+    return header;
+}
+
+// An epoch of one GPS and one GLONASS satellite.
+std::string getRinexEpoch(int second) {
+    return rinexEpoch(second, 2) +
+           rinexObservations("G01", 20000000.0, 105000000.0, -1000.0, 45.0) +
+           rinexObservations("R05", 21000000.0, 112000000.0, 500.0, 38.5);
+}
+
+// Two epochs, one second apart.
+std::string getRinexTrace() {
+    return getRinexHeader() + getRinexEpoch(0) + getRinexEpoch(1);
+}
+
+std::shared_ptr<GnssTraceProvider> createProvider(const TemporaryFile& file,
+                                                  const std::string& trace, float speed) {
+    if (!::android::base::WriteStringToFd(trace, file.fd)) {
+        return nullptr;
+    }
+    return GnssTraceProvider::create(file.path, speed);
+}
+
+}  // namespace
+
+TEST(GnssTraceProviderTest, NmeaEpochs) {
+    TemporaryFile file;
+    auto provider = createProvider(file, getNmeaTrace(), 1.0f);
+    ASSERT_NE(nullptr, provider);
+    EXPECT_EQ(GnssTraceProvider::Format::NMEA, provider->getFormat());
+
+    const Clock::time_point start = Clock::now();
+    const GnssTraceEpoch epoch = provider->getEpoch(start);
+    ASSERT_TRUE(epoch.hasLocation);
+    EXPECT_NEAR(37.4220, epoch.location.v1_0.latitudeDegrees, 1e-4);
+    EXPECT_NEAR(-122.0841, epoch.location.v1_0.longitudeDegrees, 1e-4);
+    EXPECT_NEAR(1.6, epoch.location.v1_0.altitudeMeters, 1e-6);
+    EXPECT_NEAR(5.14444, epoch.location.v1_0.speedMetersPerSec, 1e-4);
+    // 2019-04-01 12:00:10 UTC
+    EXPECT_EQ(1554120010000, epoch.location.v1_0.timestamp);
+    EXPECT_EQ(5u, epoch.nmeaSentences.size());
+
+    // The SBAS satellite without C/N0 is not used in the fix.
+    ASSERT_EQ(6u, epoch.svInfoList.size());
+    EXPECT_EQ(GnssConstellationType::SBAS, epoch.svInfoList[4].constellation);
+    EXPECT_EQ(127, epoch.svInfoList[4].v1_0.svid);
+    EXPECT_EQ(0, epoch.svInfoList[4].v1_0.svFlag);
+    EXPECT_EQ(GnssConstellationType::GLONASS, epoch.svInfoList[5].constellation);
+    EXPECT_EQ(6, epoch.svInfoList[5].v1_0.svid);
+    EXPECT_FLOAT_EQ(20.0f, epoch.svInfoList[5].v1_0.cN0Dbhz);
+
+    // The epoch is reported until the next one is due.
+    EXPECT_EQ(epoch.location.v1_0.timestamp,
+              provider->getEpoch(start + std::chrono::milliseconds(900)).location.v1_0.timestamp);
+    EXPECT_EQ(1554120011000,
+              provider->getEpoch(start + std::chrono::seconds(1)).location.v1_0.timestamp);
+    EXPECT_EQ(0u, provider->getStats().malformedLines);
+}
+
+TEST(GnssTraceProviderTest, NmeaReplayLoopsFaster) {
+    TemporaryFile file;
+    auto provider = createProvider(file, getNmeaTrace(), 4.0f);
+    ASSERT_NE(nullptr, provider);
+    EXPECT_EQ(std::chrono::milliseconds(250),
+              provider->getReportPeriod(std::chrono::milliseconds(1000)));
+
+    const Clock::time_point start = Clock::now();
+    const int64_t firstTimestamp = provider->getEpoch(start).location.v1_0.timestamp;
+    for (int i = 1; i < 5; i++) {
+        const GnssTraceEpoch epoch = provider->getEpoch(start + i * std::chrono::milliseconds(250));
+        // The trace lasts 3 seconds, the timestamps go back once it loops.
+        EXPECT_EQ(firstTimestamp + (i % 3) * 1000, epoch.location.v1_0.timestamp) << i;
+    }
+    const GnssTraceProvider::Stats stats = provider->getStats();
+    EXPECT_EQ(5u, stats.epochs);
+    EXPECT_EQ(0u, stats.skippedEpochs);
+    EXPECT_EQ(1u, stats.loops);
+}
+
+TEST(GnssTraceProviderTest, NmeaEpochsAreSkippedWhenReportsAreLessFrequent) {
+    TemporaryFile file;
+    auto provider = createProvider(file, getNmeaTrace(), 1.0f);
+    ASSERT_NE(nullptr, provider);
+
+    const Clock::time_point start = Clock::now();
+    const int64_t firstTimestamp = provider->getEpoch(start).location.v1_0.timestamp;
+    EXPECT_EQ(firstTimestamp + 2000,
+              provider->getEpoch(start + std::chrono::seconds(2)).location.v1_0.timestamp);
+    EXPECT_EQ(1u, provider->getStats().skippedEpochs);
+}
+
+TEST(GnssTraceProviderTest, NmeaEpochsBeforeTheFirstDateAreReplayedInOrder) {
+    // A GGA sentence without date, one second before the first RMC sentence.
+    const std::string trace =
+            nmea("GPGGA,120009.00,3725.3200,N,12205.0435,W,1,08,1.0,1.6,M,0.0,M,,") +
+            getNmeaTrace();
+    TemporaryFile file;
+    auto provider = createProvider(file, trace, 1.0f);
+    ASSERT_NE(nullptr, provider);
+
+    const Clock::time_point start = Clock::now();
+    EXPECT_TRUE(provider->getEpoch(start).hasLocation);
+    // Then the dated epochs, one per second.
+    EXPECT_EQ(1554120010000,
+              provider->getEpoch(start + std::chrono::seconds(1)).location.v1_0.timestamp);
+    EXPECT_EQ(1554120011000,
+              provider->getEpoch(start + std::chrono::seconds(2)).location.v1_0.timestamp);
+    EXPECT_EQ(0u, provider->getStats().skippedEpochs);
+    // The trace lasts 4 seconds, and loops over the undated epoch again.
+    EXPECT_EQ(1554120012000,
+              provider->getEpoch(start + std::chrono::seconds(3)).location.v1_0.timestamp);
+    const GnssTraceEpoch looped = provider->getEpoch(start + std::chrono::seconds(4));
+    EXPECT_TRUE(looped.hasLocation);
+    EXPECT_EQ(1u, provider->getStats().loops);
+    EXPECT_EQ(1554120010000,
+              provider->getEpoch(start + std::chrono::seconds(5)).location.v1_0.timestamp);
+}
+
+TEST(GnssTraceProviderTest, NmeaMalformedSentencesAreCounted) {
+    std::string trace = getNmeaTrace();
+    // Corrupts the checksum of the first sentence.
+    trace[trace.find('*') + 1] = trace[trace.find('*') + 1] == '0' ? '1' : '0';
+    TemporaryFile file;
+    auto provider = createProvider(file, trace, 1.0f);
+    ASSERT_NE(nullptr, provider);
+
+    const GnssTraceEpoch epoch = provider->getEpoch(Clock::now());
+    // The GGA sentence still has the location.
+    EXPECT_TRUE(epoch.hasLocation);
+    EXPECT_EQ(1u, provider->getStats().malformedLines);
+}
+
+TEST(GnssTraceProviderTest, RinexMeasurements) {
+    TemporaryFile file;
+    auto provider = createProvider(file, getRinexTrace(), 1.0f);
+    ASSERT_NE(nullptr, provider);
+    EXPECT_EQ(GnssTraceProvider::Format::RINEX, provider->getFormat());
+
+    const Clock::time_point start = Clock::now();
+    const GnssTraceEpoch epoch = provider->getEpoch(start);
+    ASSERT_TRUE(epoch.hasMeasurement);
+    ASSERT_EQ(2u, epoch.measurement.measurements.size());
+    ASSERT_EQ(2u, epoch.svInfoList.size());
+
+    const auto& gps = epoch.measurement.measurements[0];
+    EXPECT_EQ(GnssConstellationType::GPS, gps.constellation);
+    EXPECT_EQ(1, gps.v1_1.v1_0.svid);
+    EXPECT_EQ("C", std::string(gps.codeType));
+    EXPECT_DOUBLE_EQ(45.0, gps.v1_1.v1_0.cN0DbHz);
+    EXPECT_FLOAT_EQ(1575.42e6f, gps.v1_1.v1_0.carrierFrequencyHz);
+    // Receding satellite, the doppler is negative and the range rate positive.
+    EXPECT_NEAR(190.29, gps.v1_1.v1_0.pseudorangeRateMps, 0.01);
+    // 2019-04-01 00:00:00 GPS is one day into the week, minus 20000 km of travel.
+    EXPECT_NEAR(86400e9 - 20000000.0 / 299792458.0 * 1e9,
+                static_cast<double>(gps.v1_1.v1_0.receivedSvTimeInNs), 1);
+
+    const auto& glonass = epoch.measurement.measurements[1];
+    EXPECT_EQ(GnssConstellationType::GLONASS, glonass.constellation);
+    EXPECT_EQ(5, glonass.v1_1.v1_0.svid);
+    EXPECT_FLOAT_EQ(1602e6f, glonass.v1_1.v1_0.carrierFrequencyHz);
+
+    // The clock gives the GPS time of the epoch.
+    const auto& clock = epoch.measurement.clock;
+    EXPECT_EQ(0, clock.timeNs);
+    EXPECT_EQ(1238112000000000000, clock.timeNs - clock.fullBiasNs);
+
+    // The approximate position of the receiver.
+    ASSERT_TRUE(epoch.hasLocation);
+    EXPECT_NEAR(37.4219999, epoch.location.v1_0.latitudeDegrees, 1e-6);
+    EXPECT_NEAR(-122.0840575, epoch.location.v1_0.longitudeDegrees, 1e-6);
+    EXPECT_NEAR(1.6, epoch.location.v1_0.altitudeMeters, 1e-3);
+
+    const GnssTraceEpoch next = provider->getEpoch(start + std::chrono::seconds(1));
+    EXPECT_EQ(1000000000, next.measurement.clock.timeNs);
+    EXPECT_EQ(0u, provider->getStats().malformedLines);
+}
+
+TEST(GnssTraceProviderTest, RinexNegativeEpochCountIsMalformed) {
+    TemporaryFile file;
+    auto provider = createProvider(file, getRinexHeader() + rinexEpoch(0, -1) + getRinexEpoch(1),
+                                   1.0f);
+    ASSERT_NE(nullptr, provider);
+    // Before the replay loops over the trace.
+    EXPECT_EQ(1u, provider->getStats().malformedLines);
+
+    const GnssTraceEpoch epoch = provider->getEpoch(Clock::now());
+    ASSERT_TRUE(epoch.hasMeasurement);
+    EXPECT_EQ(2u, epoch.measurement.measurements.size());
+}
+
+TEST(GnssTraceProviderTest, RinexOutOfOrderEpochsLoopForward) {
+    TemporaryFile file;
+    // The second epoch is before the first one.
+    auto provider = createProvider(file, getRinexHeader() + getRinexEpoch(1) + getRinexEpoch(0),
+                                   1.0f);
+    ASSERT_NE(nullptr, provider);
+
+    const Clock::time_point start = Clock::now();
+    int64_t timeNs = provider->getEpoch(start).measurement.clock.timeNs;
+    for (int i = 1; i < 4; i++) {
+        const int64_t nextTimeNs =
+                provider->getEpoch(start + i * std::chrono::seconds(1)).measurement.clock.timeNs;
+        EXPECT_GT(nextTimeNs, timeNs) << i;
+        timeNs = nextTimeNs;
+    }
+    EXPECT_GE(provider->getStats().loops, 3u);
+}
+
+TEST(GnssTraceProviderTest, InvalidTracesAreRejected) {
+    EXPECT_EQ(nullptr, GnssTraceProvider::create("/nonexistent/trace.nmea", 1.0f));
+
+    TemporaryFile empty;
+    EXPECT_EQ(nullptr, GnssTraceProvider::create(empty.path, 1.0f));
+
+    TemporaryFile rinex2;
+    EXPECT_EQ(nullptr, createProvider(rinex2,
+                                      rinexHeader("     2.11           OBSERVATION DATA    G",
+                                                  "RINEX VERSION / TYPE") +
+                                              rinexHeader("", "END OF HEADER"),
+                                      1.0f));
+
+    TemporaryFile noEpoch;
+    EXPECT_EQ(nullptr, createProvider(noEpoch, nmea("GPGSV,1,1,01,03,59,166,32"), 1.0f));
+
+    TemporaryFile nmeaTrace;
+    EXPECT_EQ(nullptr, createProvider(nmeaTrace, getNmeaTrace(), 0.0f));
+}
@@ -21,6 +21,7 @@
 #include <android-base/macros.h>
 #include <android/hardware/sensors/1.0/ISensors.h>
 #include <hardware/sensors.h>
+#include <memory>
 #include <mutex>
 
 namespace android {
@@ -69,10 +70,11 @@ private:
     sensors_poll_device_1_t *mSensorDevice;
     std::mutex mPollLock;
 
-    int getHalDeviceVersion() const;
+    // Buffers of poll(), allocated once with kPollMaxBufferSize events.
+    std::unique_ptr<sensors_event_t[]> mPollBuffer;
+    hidl_vec<Event> mPollEvents;
 
-    static void convertFromSensorEvents(
-            size_t count, const sensors_event_t *src, hidl_vec<Event> *dst);
+    int getHalDeviceVersion() const;
 
     DISALLOW_COPY_AND_ASSIGN(Sensors);
 };
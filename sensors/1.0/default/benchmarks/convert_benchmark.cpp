@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Conversion of 1M mixed sensors_event_t to Event, event by event and in bulk.
+// The events come in runs of the same type, of the length given as argument:
+// 1 is what interleaved sensors look like, longer runs are typical of batches
+// flushed from hardware FIFOs.
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+
+#include <vector>
+
+#include "convert.h"
+
+using ::android::hardware::sensors::V1_0::Event;
+using ::android::hardware::sensors::V1_0::implementation::convertFromSensorEvent;
+using ::android::hardware::sensors::V1_0::implementation::convertFromSensorEvents;
+
+namespace {
+
+constexpr size_t kEventCount = 1000 * 1000;
+
+// Mostly motion sensors, with some environmental, step and heart rate events.
+const int32_t kTypes[] = {
+        SENSOR_TYPE_ACCELEROMETER,        SENSOR_TYPE_GYROSCOPE,
+        SENSOR_TYPE_ACCELEROMETER,        SENSOR_TYPE_GYROSCOPE,
+        SENSOR_TYPE_MAGNETIC_FIELD,       SENSOR_TYPE_GAME_ROTATION_VECTOR,
+        SENSOR_TYPE_ROTATION_VECTOR,      SENSOR_TYPE_GYROSCOPE_UNCALIBRATED,
+        SENSOR_TYPE_PRESSURE,             SENSOR_TYPE_LIGHT,
+        SENSOR_TYPE_STEP_COUNTER,         SENSOR_TYPE_HEART_RATE,
+};
+
+std::vector<sensors_event_t> makeEvents(size_t runLength) {
+    std::vector<sensors_event_t> events(kEventCount);
+    for (size_t i = 0; i < kEventCount; i++) {
+        sensors_event_t& event = events[i];
+        memset(&event, 0, sizeof(event));
+        event.version = sizeof(event);
+        event.type = kTypes[(i / runLength) % (sizeof(kTypes) / sizeof(kTypes[0]))];
+        event.sensor = event.type;
+        event.timestamp = i * 1000;
+        for (size_t j = 0; j < 16; j++) {
+            event.data[j] = i + j;
+        }
+        if (event.type == SENSOR_TYPE_STEP_COUNTER) {
+            event.u64.step_counter = i;
+        }
+    }
+    return events;
+}
+
+}  // namespace
+
+static void BM_ConvertFromSensorEvent(benchmark::State& state) {
+    std::vector<sensors_event_t> src = makeEvents(state.range(0));
+    std::vector<Event> dst(kEventCount);
+    for (auto _ : state) {
+        for (size_t i = 0; i < kEventCount; i++) {
+            convertFromSensorEvent(src[i], &dst[i]);
+        }
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kEventCount);
+}
+// Length of the runs of events of the same type.
+BENCHMARK(BM_ConvertFromSensorEvent)->Arg(1)->Arg(64)->Unit(benchmark::kMillisecond);
+
+static void BM_ConvertFromSensorEvents(benchmark::State& state) {
+    std::vector<sensors_event_t> src = makeEvents(state.range(0));
+    std::vector<Event> dst(kEventCount);
+
+    // Both conversions must give the same events.
+    std::vector<Event> expected(kEventCount);
+    for (size_t i = 0; i < kEventCount; i++) {
+        convertFromSensorEvent(src[i], &expected[i]);
+    }
+    convertFromSensorEvents(src.data(), kEventCount, dst.data());
+    if (memcmp(expected.data(), dst.data(), kEventCount * sizeof(Event)) != 0) {
+        state.SkipWithError("Bulk conversion differs from convertFromSensorEvent");
+        return;
+    }
+
+    for (auto _ : state) {
+        convertFromSensorEvents(src.data(), kEventCount, dst.data());
+        benchmark::DoNotOptimize(dst.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kEventCount);
+}
+BENCHMARK(BM_ConvertFromSensorEvents)->Arg(1)->Arg(64)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
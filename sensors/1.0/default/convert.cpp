@@ -18,6 +18,8 @@
 
 #include <android-base/logging.h>
 
+#include <stddef.h>
+
 namespace android {
 namespace hardware {
 namespace sensors {
@@ -198,6 +200,108 @@ void convertFromSensorEvent(const sensors_event_t &src, Event *dst) {
     }
 }
 
+// Number of leading bytes of the payload of an event of the given type which have the same layout
+// in sensors_event_t and in Event::u, the rest of Event::u being zero. 0 if the payload needs to be
+// converted by convertFromSensorEvent.
+static size_t getPayloadCopySize(int32_t type) {
+    typedef ::android::hardware::sensors::V1_0::SensorType SensorType;
+
+    switch ((SensorType)type) {
+        case SensorType::ACCELEROMETER:
+        case SensorType::MAGNETIC_FIELD:
+        case SensorType::ORIENTATION:
+        case SensorType::GYROSCOPE:
+        case SensorType::GRAVITY:
+        case SensorType::LINEAR_ACCELERATION:
+            return offsetof(Vec3, status) + sizeof(SensorStatus);
+
+        case SensorType::GAME_ROTATION_VECTOR:
+            return 4 * sizeof(float);
+
+        case SensorType::ROTATION_VECTOR:
+        case SensorType::GEOMAGNETIC_ROTATION_VECTOR:
+            return 5 * sizeof(float);
+
+        case SensorType::MAGNETIC_FIELD_UNCALIBRATED:
+        case SensorType::GYROSCOPE_UNCALIBRATED:
+        case SensorType::ACCELEROMETER_UNCALIBRATED:
+            return 6 * sizeof(float);
+
+        case SensorType::DEVICE_ORIENTATION:
+        case SensorType::LIGHT:
+        case SensorType::PRESSURE:
+        case SensorType::TEMPERATURE:
+        case SensorType::PROXIMITY:
+        case SensorType::RELATIVE_HUMIDITY:
+        case SensorType::AMBIENT_TEMPERATURE:
+        case SensorType::SIGNIFICANT_MOTION:
+        case SensorType::STEP_DETECTOR:
+        case SensorType::TILT_DETECTOR:
+        case SensorType::WAKE_GESTURE:
+        case SensorType::GLANCE_GESTURE:
+        case SensorType::PICK_UP_GESTURE:
+        case SensorType::WRIST_TILT_GESTURE:
+        case SensorType::STATIONARY_DETECT:
+        case SensorType::MOTION_DETECT:
+        case SensorType::HEART_BEAT:
+        case SensorType::LOW_LATENCY_OFFBODY_DETECT:
+            return sizeof(float);
+
+        case SensorType::STEP_COUNTER:
+            return sizeof(uint64_t);
+
+        case SensorType::HEART_RATE:
+            return offsetof(HeartRate, status) + sizeof(SensorStatus);
+
+        case SensorType::POSE_6DOF:
+            return 15 * sizeof(float);
+
+        case SensorType::META_DATA:
+        case SensorType::DYNAMIC_SENSOR_META:
+        case SensorType::ADDITIONAL_INFO:
+            return 0;
+
+        default:
+            return type >= (int32_t)SensorType::DEVICE_PRIVATE_BASE ? 16 * sizeof(float) : 0;
+    }
+}
+
+static_assert(sizeof(Event::u) == sizeof(sensors_event_t::data),
+              "sensors_event_t and Event payloads must have the same size");
+static_assert(offsetof(sensors_vec_t, status) == offsetof(Vec3, status),
+              "sensors_vec_t and Vec3 must have the same layout");
+static_assert(offsetof(uncalibrated_event_t, x_bias) == offsetof(Uncal, x_bias),
+              "uncalibrated_event_t and Uncal must have the same layout");
+static_assert(offsetof(heart_rate_event_t, status) == offsetof(HeartRate, status),
+              "heart_rate_event_t and HeartRate must have the same layout");
+
+void convertFromSensorEvents(const sensors_event_t *src, size_t count, Event *dst) {
+    size_t i = 0;
+    while (i < count) {
+        const int32_t type = src[i].type;
+        size_t end = i + 1;
+        while (end < count && src[end].type == type) {
+            ++end;
+        }
+
+        const size_t copySize = getPayloadCopySize(type);
+        if (copySize == 0) {
+            for (; i < end; ++i) {
+                convertFromSensorEvent(src[i], &dst[i]);
+            }
+            continue;
+        }
+        for (; i < end; ++i) {
+            dst[i].sensorHandle = src[i].sensor;
+            dst[i].sensorType = (SensorType)type;
+            dst[i].timestamp = src[i].timestamp;
+            uint8_t *payload = reinterpret_cast<uint8_t *>(&dst[i].u);
+            memcpy(payload, src[i].data, copySize);
+            memset(payload + copySize, 0, sizeof(dst[i].u) - copySize);
+        }
+    }
+}
+
 void convertToSensorEvent(const Event &src, sensors_event_t *dst) {
     *dst = {.version = sizeof(sensors_event_t),
             .sensor = src.sensorHandle,
@@ -31,6 +31,9 @@ void convertFromSensor(const sensor_t &src, SensorInfo *dst);
 void convertToSensor(const SensorInfo &src, sensor_t *dst);
 
 void convertFromSensorEvent(const sensors_event_t &src, Event *dst);
+// Same as convertFromSensorEvent for count events, but runs of events of the same type are
+// converted with plain copies, only looking at their type once.
+void convertFromSensorEvents(const sensors_event_t *src, size_t count, Event *dst);
 void convertToSensorEvent(const Event &src, sensors_event_t *dst);
 
 bool convertFromSharedMemInfo(const SharedMemInfo& memIn, sensors_direct_mem_t *memOut);
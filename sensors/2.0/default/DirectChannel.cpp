@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DirectChannel.h"
+
+#include <log/log.h>
+#include <sensors/convert.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::SensorsEventFormatOffset;
+using ::android::hardware::sensors::V1_0::SharedMemFormat;
+using ::android::hardware::sensors::V1_0::SharedMemType;
+using ::android::hardware::sensors::V1_0::implementation::convertToSensorEvent;
+
+constexpr size_t kRecordSize = static_cast<size_t>(SensorsEventFormatOffset::TOTAL_LENGTH);
+constexpr size_t kCounterOffset = static_cast<size_t>(SensorsEventFormatOffset::ATOMIC_COUNTER);
+constexpr size_t kTimestampOffset = static_cast<size_t>(SensorsEventFormatOffset::TIMESTAMP);
+
+static_assert(sizeof(sensors_event_t) == kRecordSize,
+              "sensors_event_t must match the direct channel format");
+static_assert(offsetof(sensors_event_t, reserved0) == kCounterOffset,
+              "the atomic counter must be stored in sensors_event_t::reserved0");
+
+std::unique_ptr<DirectChannel> DirectChannel::create(const SharedMemInfo& mem) {
+    // Gralloc buffers would require the mapper HAL, only fd backed memory is supported.
+    if (mem.type != SharedMemType::ASHMEM || mem.format != SharedMemFormat::SENSORS_EVENT ||
+        mem.size < kRecordSize || mem.memoryHandle.getNativeHandle() == nullptr ||
+        mem.memoryHandle->numFds < 1) {
+        return nullptr;
+    }
+
+    void* buffer = mmap(nullptr, mem.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        mem.memoryHandle->data[0], 0 /* offset */);
+    if (buffer == MAP_FAILED) {
+        ALOGE("Failed to map the direct channel memory: %s", strerror(errno));
+        return nullptr;
+    }
+    // The memory must be zeroed upon registration, see SharedMemFormat.
+    memset(buffer, 0, mem.size);
+    return std::unique_ptr<DirectChannel>(new DirectChannel(static_cast<uint8_t*>(buffer),
+                                                            mem.size));
+}
+
+DirectChannel::DirectChannel(uint8_t* buffer, size_t size)
+    : mBuffer(buffer), mSize(size), mNextOffset(0), mCounter(0) {}
+
+DirectChannel::~DirectChannel() {
+    munmap(mBuffer, mSize);
+}
+
+void DirectChannel::write(int32_t reportToken, const Event& event) {
+    sensors_event_t record;
+    convertToSensorEvent(event, &record);
+    record.version = kRecordSize;
+    record.sensor = reportToken;
+
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    if (++mCounter == 0) {
+        // 0 means that a record was never written.
+        mCounter = 1;
+    }
+    uint8_t* slot = mBuffer + mNextOffset;
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(&record);
+    // Everything but the counter first, so that the record is complete once the counter is seen.
+    memcpy(slot, source, kCounterOffset);
+    memcpy(slot + kTimestampOffset, source + kTimestampOffset, kRecordSize - kTimestampOffset);
+    __atomic_store_n(reinterpret_cast<uint32_t*>(slot + kCounterOffset), mCounter,
+                     __ATOMIC_RELEASE);
+
+    mNextOffset += kRecordSize;
+    if (mNextOffset + kRecordSize > mSize) {
+        mNextOffset = 0;
+    }
+}
+
+int64_t DirectChannel::getSamplingPeriodNs(RateLevel rate) {
+    switch (rate) {
+        case RateLevel::NORMAL:
+            return 1000 * 1000 * 1000 / 50;
+        case RateLevel::FAST:
+            return 1000 * 1000 * 1000 / 200;
+        case RateLevel::VERY_FAST:
+            return 1000 * 1000 * 1000 / 800;
+        case RateLevel::STOP:
+        default:
+            return 0;
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_0_DIRECTCHANNEL_H
+#define ANDROID_HARDWARE_SENSORS_V2_0_DIRECTCHANNEL_H
+
+#include <android/hardware/sensors/1.0/types.h>
+
+#include <memory>
+#include <mutex>
+
+using ::android::hardware::sensors::V1_0::Event;
+using ::android::hardware::sensors::V1_0::RateLevel;
+using ::android::hardware::sensors::V1_0::SharedMemInfo;
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * A direct channel backed by shared memory (ashmem or memfd), formatted as a ring of
+ * sensors_event_t records as described by SensorsEventFormatOffset.
+ *
+ * The atomic counter of a record is written last, with release semantics, so a reader that sees
+ * the counter it expects can read the rest of the record. Counters start at 1 and increase by one
+ * with every record written to the channel, whichever sensor it comes from.
+ */
+class DirectChannel {
+   public:
+    /**
+     * Maps the shared memory of the channel. Returns nullptr if the memory is not supported or
+     * can't be mapped.
+     */
+    static std::unique_ptr<DirectChannel> create(const SharedMemInfo& mem);
+
+    ~DirectChannel();
+
+    /**
+     * Appends an event to the channel, identified by reportToken instead of its sensor handle.
+     * Safe to call from several sensors at the same time.
+     */
+    void write(int32_t reportToken, const Event& event);
+
+    /**
+     * Nominal sampling period of a rate level, 0 for RateLevel::STOP.
+     */
+    static int64_t getSamplingPeriodNs(RateLevel rate);
+
+   private:
+    DirectChannel(uint8_t* buffer, size_t size);
+
+    uint8_t* const mBuffer;
+    const size_t mSize;
+
+    std::mutex mWriteLock;
+    size_t mNextOffset;  // Protected by mWriteLock.
+    uint32_t mCounter;   // Protected by mWriteLock.
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_0_DIRECTCHANNEL_H
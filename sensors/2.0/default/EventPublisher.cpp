@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EventPublisher.h"
+
+#include <log/log.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+// Events a thread can stage before waiting for the publisher.
+constexpr size_t kRingCapacity = 512;
+// Bits of mFlagWord.
+constexpr uint32_t kEventsStaged = 1 << 0;
+constexpr uint32_t kEventsDrained = 1 << 1;
+// Bounds the waits in case a wakeup is missed by one of several waiting threads.
+constexpr int64_t kDrainWaitTimeoutNs = 1000 * 1000;         // 1 ms
+constexpr int64_t kStageWaitTimeoutNs = 100 * 1000 * 1000;  // 100 ms
+
+// Identifies the publishers in the rings cached by the threads, since a new publisher may reuse
+// the address of a destroyed one.
+static std::atomic<uint64_t> sNextPublisherId(1);
+
+struct EventPublisher::StagingRing {
+    struct Entry {
+        Event event;
+        // Events posted together share the same sequence number.
+        uint64_t sequence;
+        bool wakeup;
+    };
+
+    StagingRing() : head(0), tail(0), entries(kRingCapacity) {}
+
+    // Called by the posting thread only. Appends as many events as fit, numbered with the next
+    // sequence number, and returns how many. The WAKE_UP flags are in wakeups if not null.
+    size_t push(const Event* events, size_t count, bool wakeup, const uint8_t* wakeups,
+                std::atomic<uint64_t>* sequence) {
+        const size_t writePos = tail.load(std::memory_order_relaxed);
+        const size_t free = kRingCapacity - (writePos - head.load(std::memory_order_acquire));
+        const size_t staged = std::min(count, free);
+        if (staged == 0) {
+            return 0;
+        }
+        // Only numbered once they are known to fit, the publisher waits for every number.
+        const uint64_t number = sequence->fetch_add(1);
+        for (size_t i = 0; i < staged; i++) {
+            Entry& entry = entries[(writePos + i) % kRingCapacity];
+            entry.event = events[i];
+            entry.sequence = number;
+            entry.wakeup = wakeups != nullptr ? wakeups[i] != 0 : wakeup;
+        }
+        tail.store(writePos + staged, std::memory_order_release);
+        return staged;
+    }
+
+    // Called by the publisher thread only. If the oldest staged events have the given sequence
+    // number, moves them to the end of events, adds the number of WAKE_UP events among them to
+    // wakeUpEvents and returns true.
+    bool pop(uint64_t number, std::vector<Event>* events, size_t* wakeUpEvents) {
+        size_t readPos = head.load(std::memory_order_relaxed);
+        const size_t writePos = tail.load(std::memory_order_acquire);
+        if (readPos == writePos || entries[readPos % kRingCapacity].sequence != number) {
+            return false;
+        }
+        for (; readPos != writePos; readPos++) {
+            const Entry& entry = entries[readPos % kRingCapacity];
+            if (entry.sequence != number) {
+                break;
+            }
+            events->push_back(entry.event);
+            *wakeUpEvents += entry.wakeup ? 1 : 0;
+        }
+        head.store(readPos, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the publisher thread only. Once its thread has exited, a ring which is empty
+    // stays empty.
+    bool isRetiredAndEmpty() const {
+        return retired.load(std::memory_order_acquire) &&
+               head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    // Free running positions, on separate cache lines since they have different writers.
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    std::vector<Entry> entries;
+    // Set once the thread posting to the ring has exited.
+    std::atomic_bool retired{false};
+    // Set once the publisher is destroyed, the thread may then forget the ring.
+    std::atomic_bool orphaned{false};
+};
+
+struct EventPublisher::ThreadRings {
+    ~ThreadRings() {
+        for (const auto& ring : rings) {
+            ring.second->retired.store(true, std::memory_order_release);
+        }
+    }
+
+    // The rings of the thread, by publisher id.
+    std::vector<std::pair<uint64_t, std::shared_ptr<StagingRing>>> rings;
+};
+
+EventPublisher::EventPublisher(WriteFunction write)
+    : mId(sNextPublisherId++),
+      mWrite(std::move(write)),
+      mFlagWord(0),
+      mFlag(nullptr),
+      mStopThread(false),
+      mRingsVersion(0),
+      mSequence(0),
+      mWrites(0),
+      mEvents(0),
+      mFullRingWaits(0),
+      mNextSequence(0),
+      mPublishedRingsVersion(0) {
+    LOG_ALWAYS_FATAL_IF(EventFlag::createEventFlag(&mFlagWord, &mFlag) != OK,
+                        "Failed to create the event publisher flag");
+    mThread = std::thread([this] { run(); });
+}
+
+EventPublisher::~EventPublisher() {
+    mStopThread = true;
+    mFlag->wake(kEventsStaged);
+    mThread.join();
+    EventFlag::deleteEventFlag(&mFlag);
+    std::lock_guard<std::mutex> lock(mRingsLock);
+    for (const auto& ring : mRings) {
+        ring->orphaned.store(true, std::memory_order_relaxed);
+    }
+}
+
+EventPublisher::StagingRing* EventPublisher::getThreadRing() {
+    static thread_local ThreadRings sThreadRings;
+    auto& rings = sThreadRings.rings;
+    for (const auto& threadRing : rings) {
+        if (threadRing.first == mId) {
+            return threadRing.second.get();
+        }
+    }
+    // Forgets the rings of the destroyed publishers.
+    rings.erase(std::remove_if(rings.begin(), rings.end(),
+                               [](const auto& threadRing) {
+                                   return threadRing.second->orphaned.load(
+                                           std::memory_order_relaxed);
+                               }),
+                rings.end());
+
+    std::lock_guard<std::mutex> lock(mRingsLock);
+    mRings.push_back(std::make_shared<StagingRing>());
+    rings.emplace_back(mId, mRings.back());
+    ++mRingsVersion;
+    return mRings.back().get();
+}
+
+void EventPublisher::post(const Event* events, size_t count, bool wakeup) {
+    post(events, count, wakeup, nullptr /* wakeups */);
+}
+
+void EventPublisher::post(const Event* events, size_t count, const uint8_t* wakeup) {
+    post(events, count, false /* wakeup */, wakeup);
+}
+
+void EventPublisher::post(const Event* events, size_t count, bool wakeup,
+                          const uint8_t* wakeups) {
+    if (count == 0) {
+        return;
+    }
+    StagingRing* ring = getThreadRing();
+    while (true) {
+        const size_t staged = ring->push(events, count, wakeup, wakeups, &mSequence);
+        events += staged;
+        count -= staged;
+        if (wakeups != nullptr) {
+            wakeups += staged;
+        }
+        // Only makes a system call if the publisher is not already woken up.
+        mFlag->wake(kEventsStaged);
+        if (count == 0) {
+            return;
+        }
+        ++mFullRingWaits;
+        uint32_t state;
+        mFlag->wait(kEventsDrained, &state, kDrainWaitTimeoutNs);
+    }
+}
+
+EventPublisher::Stats EventPublisher::getStats() {
+    Stats stats;
+    stats.writes = mWrites;
+    stats.events = mEvents;
+    stats.fullRingWaits = mFullRingWaits;
+    std::lock_guard<std::mutex> lock(mRingsLock);
+    stats.rings = mRings.size();
+    return stats;
+}
+
+size_t EventPublisher::drain() {
+    if (mRingsVersion.load(std::memory_order_acquire) != mPublishedRingsVersion) {
+        std::lock_guard<std::mutex> lock(mRingsLock);
+        mPublishedRingsVersion = mRingsVersion;
+        mPublishedRings.clear();
+        for (const auto& ring : mRings) {
+            mPublishedRings.push_back(ring.get());
+        }
+    }
+
+    // Events are published in the order they were posted, across all the threads, so that for
+    // instance a flush complete event never overtakes the events posted before the flush. A
+    // sequence number which is not staged yet is about to be, and stops the drain until then.
+    // The posts numbered after the start of the drain are left for the next one, so that busy
+    // producers cannot hold back the write.
+    const uint64_t endSequence = mSequence.load(std::memory_order_acquire);
+    mBuffer.clear();
+    size_t wakeUpEvents = 0;
+    bool progress = true;
+    while (progress && mNextSequence != endSequence) {
+        progress = false;
+        for (StagingRing* ring : mPublishedRings) {
+            if (ring->pop(mNextSequence, &mBuffer, &wakeUpEvents)) {
+                progress = true;
+                if (++mNextSequence == endSequence) {
+                    break;
+                }
+            }
+        }
+    }
+    removeRetiredRings();
+    return wakeUpEvents;
+}
+
+void EventPublisher::removeRetiredRings() {
+    if (std::none_of(mPublishedRings.begin(), mPublishedRings.end(),
+                     [](const StagingRing* ring) { return ring->isRetiredAndEmpty(); })) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mRingsLock);
+    mRings.erase(std::remove_if(mRings.begin(), mRings.end(),
+                                [](const auto& ring) { return ring->isRetiredAndEmpty(); }),
+                 mRings.end());
+    mPublishedRingsVersion = ++mRingsVersion;
+    mPublishedRings.clear();
+    for (const auto& ring : mRings) {
+        mPublishedRings.push_back(ring.get());
+    }
+}
+
+void EventPublisher::run() {
+    while (true) {
+        // Everything staged before the publisher is stopped is still written.
+        const bool stop = mStopThread;
+        const size_t wakeUpEvents = drain();
+        if (!mBuffer.empty()) {
+            mFlag->wake(kEventsDrained);
+            // All the events staged since the last write go to the writer at once.
+            mWrite(mBuffer.data(), mBuffer.size(), wakeUpEvents);
+            ++mWrites;
+            mEvents += mBuffer.size();
+            continue;
+        }
+        if (stop) {
+            break;
+        }
+        uint32_t state;
+        mFlag->wait(kEventsStaged, &state, kStageWaitTimeoutNs);
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
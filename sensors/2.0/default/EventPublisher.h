@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_0_EVENTPUBLISHER_H
+#define ANDROID_HARDWARE_SENSORS_V2_0_EVENTPUBLISHER_H
+
+#include <android/hardware/sensors/1.0/types.h>
+#include <fmq/EventFlag.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * Funnels the events posted by any number of threads into a single writer.
+ *
+ * Every posting thread appends its events to its own single producer, single consumer staging
+ * ring, without taking any lock, and the publisher thread moves the staged events of all the
+ * rings to the write function, in the order they were posted. A thread only waits for the
+ * publisher when its ring is full.
+ */
+class EventPublisher {
+   public:
+    using Event = ::android::hardware::sensors::V1_0::Event;
+    // Writes the events, wakeUpEvents of which are WAKE_UP events. Only called by the publisher
+    // thread.
+    using WriteFunction =
+            std::function<void(const Event* events, size_t count, size_t wakeUpEvents)>;
+
+    struct Stats {
+        uint64_t writes = 0;
+        uint64_t events = 0;
+        // Times a thread had to wait for the publisher because its ring was full.
+        uint64_t fullRingWaits = 0;
+        // Staging rings currently allocated, one per posting thread which is alive or has
+        // events left to write.
+        size_t rings = 0;
+    };
+
+    explicit EventPublisher(WriteFunction write);
+    // Writes the events which are still staged.
+    ~EventPublisher();
+
+    void post(const Event* events, size_t count, bool wakeup);
+    // Same as above, with a WAKE_UP flag per event: events[i] is a WAKE_UP event if wakeup[i] is
+    // not 0.
+    void post(const Event* events, size_t count, const uint8_t* wakeup);
+
+    Stats getStats();
+
+   private:
+    struct StagingRing;
+    // The rings of a thread, retired when the thread exits.
+    struct ThreadRings;
+
+    // The ring of the calling thread, created the first time the thread posts. Rings are
+    // removed once their thread has exited and they have been drained.
+    StagingRing* getThreadRing();
+    void post(const Event* events, size_t count, bool wakeup, const uint8_t* wakeups);
+    void run();
+    // Moves the events staged before the call to mBuffer, returns the number of WAKE_UP events.
+    // A post which is not fully staged yet stops the drain.
+    size_t drain();
+    // Removes the drained rings of the threads which have exited.
+    void removeRetiredRings();
+
+    const uint64_t mId;
+    const WriteFunction mWrite;
+
+    std::atomic<uint32_t> mFlagWord;
+    EventFlag* mFlag;
+    std::atomic_bool mStopThread;
+
+    std::mutex mRingsLock;
+    // Also referenced by the threads owning them, which may outlive the publisher.
+    std::vector<std::shared_ptr<StagingRing>> mRings;  // Protected by mRingsLock.
+    // Changes whenever a ring is added or removed.
+    std::atomic<uint64_t> mRingsVersion;
+    // Orders the posts of all the threads.
+    std::atomic<uint64_t> mSequence;
+
+    std::atomic<uint64_t> mWrites;
+    std::atomic<uint64_t> mEvents;
+    std::atomic<uint64_t> mFullRingWaits;
+
+    // Only used by the publisher thread.
+    uint64_t mNextSequence;
+    uint64_t mPublishedRingsVersion;
+    std::vector<StagingRing*> mPublishedRings;
+    std::vector<Event> mBuffer;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_0_EVENTPUBLISHER_H
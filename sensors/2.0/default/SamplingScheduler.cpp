@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SamplingScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+SamplingScheduler::SamplingScheduler(ISensorsEventCallback* callback)
+    : mCallback(callback), mStopThread(false) {
+    mThread = std::thread([this] { run(); });
+}
+
+SamplingScheduler::~SamplingScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopThread = true;
+        mWaitCV.notify_all();
+    }
+    mThread.join();
+}
+
+int64_t SamplingScheduler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+void SamplingScheduler::reschedule(Sensor* sensor) {
+    std::lock_guard<std::mutex> lock(mLock);
+    scheduleLocked(sensor);
+    // Wake up the sampling thread in case the sensor is now due before the next deadline
+    mWaitCV.notify_all();
+}
+
+void SamplingScheduler::scheduleLocked(Sensor* sensor) {
+    uint64_t generation = ++mGenerations[sensor];
+    int64_t nextSampleTime = sensor->getNextSampleTime();
+    if (nextSampleTime < 0) {
+        return;
+    }
+    // A sensor which must be sampled right away is due now, not in the past.
+    mHeap.push_back({std::max(nextSampleTime, now()), sensor, generation});
+    std::push_heap(mHeap.begin(), mHeap.end());
+}
+
+SamplingScheduler::Stats SamplingScheduler::getStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+void SamplingScheduler::resetStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStats = Stats();
+}
+
+void SamplingScheduler::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStopThread) {
+        if (mHeap.empty()) {
+            mWaitCV.wait(lock);
+            continue;
+        }
+        const Deadline next = mHeap.front();
+        if (next.generation != mGenerations[next.sensor]) {
+            std::pop_heap(mHeap.begin(), mHeap.end());
+            mHeap.pop_back();
+            continue;
+        }
+        int64_t currentTime = now();
+        if (currentTime < next.timeNs) {
+            mWaitCV.wait_for(lock, std::chrono::nanoseconds(next.timeNs - currentTime));
+            continue;
+        }
+
+        mDueSensors.clear();
+        while (!mHeap.empty() && mHeap.front().timeNs <= currentTime) {
+            const Deadline due = mHeap.front();
+            std::pop_heap(mHeap.begin(), mHeap.end());
+            mHeap.pop_back();
+            if (due.generation == mGenerations[due.sensor]) {
+                mDueSensors.push_back(due.sensor);
+            }
+        }
+        const int64_t jitterNs = currentTime - next.timeNs;
+        ++mStats.wakeups;
+        mStats.sensorSamples += mDueSensors.size();
+        mStats.totalJitterNs += jitterNs;
+        mStats.maxJitterNs = std::max(mStats.maxJitterNs, jitterNs);
+        lock.unlock();
+
+        // Sensors are sampled and events are posted without the lock, so that reconfiguring a
+        // sensor never waits for the Event FMQ.
+        mEvents.clear();
+        mWakeUpEvents.clear();
+        bool fifoReady = false;
+        for (Sensor* sensor : mDueSensors) {
+            fifoReady |= sensor->sample(currentTime,
+                                        sensor->isWakeUpSensor() ? &mWakeUpEvents : &mEvents);
+        }
+        if (fifoReady) {
+            mCallback->postBatchedEvents(mEvents, false /* wakeup */);
+        } else if (!mEvents.empty()) {
+            mCallback->postEvents(mEvents, false /* wakeup */);
+        }
+        if (!mWakeUpEvents.empty()) {
+            // Wake up events are accounted separately for the wake lock.
+            mCallback->postEvents(mWakeUpEvents, true /* wakeup */);
+        }
+
+        lock.lock();
+        for (Sensor* sensor : mDueSensors) {
+            scheduleLocked(sensor);
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
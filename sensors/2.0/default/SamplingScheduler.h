@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_0_SAMPLINGSCHEDULER_H
+#define ANDROID_HARDWARE_SENSORS_V2_0_SAMPLINGSCHEDULER_H
+
+#include "Sensor.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * Samples all the sensors from a single thread.
+ *
+ * The next sample time of every active sensor is kept in a min-heap. On each wakeup, all the
+ * sensors which are due are sampled and their events are posted together, with a single write
+ * to the Event FMQ. Sensors sample on multiples of their period, so the wakeups of sensors with
+ * harmonically related periods are shared.
+ */
+class SamplingScheduler {
+   public:
+    struct Stats {
+        uint64_t wakeups = 0;
+        uint64_t sensorSamples = 0;
+        // Lateness of the wakeups relative to the earliest due sample time.
+        int64_t totalJitterNs = 0;
+        int64_t maxJitterNs = 0;
+    };
+
+    explicit SamplingScheduler(ISensorsEventCallback* callback);
+    ~SamplingScheduler();
+
+    /**
+     * Must be called whenever the sampling configuration of the sensor changes. The sensor must
+     * outlive the scheduler.
+     */
+    void reschedule(Sensor* sensor);
+
+    Stats getStats();
+    void resetStats();
+
+    // The monotonic clock used for sample times.
+    static int64_t now();
+
+   private:
+    struct Deadline {
+        int64_t timeNs;
+        Sensor* sensor;
+        uint64_t generation;
+        // Makes std::*_heap a min-heap.
+        bool operator<(const Deadline& other) const { return timeNs > other.timeNs; }
+    };
+
+    void run();
+    // Pushes the next deadline of the sensor, if it has one. Must be called with mLock held.
+    void scheduleLocked(Sensor* sensor);
+
+    ISensorsEventCallback* const mCallback;
+
+    std::mutex mLock;
+    std::condition_variable mWaitCV;
+    bool mStopThread;                           // Protected by mLock.
+    std::vector<Deadline> mHeap;                // Protected by mLock.
+    // Deadlines pushed before the last reschedule of a sensor are stale and are skipped.
+    std::map<Sensor*, uint64_t> mGenerations;  // Protected by mLock.
+    Stats mStats;                               // Protected by mLock.
+
+    // Only used by the sampling thread, kept to avoid allocations.
+    std::vector<Sensor*> mDueSensors;
+    std::vector<Event> mEvents;
+    std::vector<Event> mWakeUpEvents;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_0_SAMPLINGSCHEDULER_H
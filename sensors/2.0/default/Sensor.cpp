@@ -18,6 +18,7 @@
 
 #include <utils/SystemClock.h>
 
+#include <algorithm>
 #include <cmath>
 
 namespace android {
@@ -28,54 +29,204 @@ namespace implementation {
 
 using ::android::hardware::sensors::V1_0::MetaDataEventType;
 using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V1_0::SensorFlagShift;
 using ::android::hardware::sensors::V1_0::SensorStatus;
 
 static constexpr float kDefaultMaxDelayUs = 10 * 1000 * 1000;
+// FIFO size of the sensors which support batching, 10 seconds at 300 Hz.
+static constexpr uint32_t kDefaultFifoMaxEventCount = 3000;
+
+// Flags of a sensor which supports ashmem direct channels up to the given rate.
+static uint32_t directReportFlags(RateLevel maxRate) {
+    return static_cast<uint32_t>(SensorFlagBits::DIRECT_CHANNEL_ASHMEM) |
+           (static_cast<uint32_t>(maxRate) << static_cast<uint32_t>(SensorFlagShift::DIRECT_REPORT));
+}
+
+// First multiple of the period after now, so that sensors with harmonically related periods are
+// sampled at the same times.
+static int64_t nextAlignedTime(int64_t now, int64_t periodNs) {
+    return (now / periodNs + 1) * periodNs;
+}
 
 Sensor::Sensor(ISensorsEventCallback* callback)
     : mIsEnabled(false),
       mSamplingPeriodNs(0),
-      mLastSampleTimeNs(0),
+      mMaxReportLatencyNs(0),
+      mNextSampleTimeNs(0),
+      mPlayback(false),
+      mFifoDeadlineNs(0),
       mCallback(callback),
-      mMode(OperationMode::NORMAL) {
-    mRunThread = std::thread(startThread, this);
-}
+      mMode(OperationMode::NORMAL) {}
 
-Sensor::~Sensor() {
-    std::unique_lock<std::mutex> lock(mRunMutex);
-    mStopThread = true;
-    mIsEnabled = false;
-    mWaitCV.notify_all();
-    lock.release();
-    mRunThread.join();
-}
+Sensor::~Sensor() {}
 
 const SensorInfo& Sensor::getSensorInfo() const {
     return mSensorInfo;
 }
 
-void Sensor::batch(int32_t samplingPeriodNs) {
-    if (samplingPeriodNs < mSensorInfo.minDelay * 1000) {
-        samplingPeriodNs = mSensorInfo.minDelay * 1000;
-    } else if (samplingPeriodNs > mSensorInfo.maxDelay * 1000) {
-        samplingPeriodNs = mSensorInfo.maxDelay * 1000;
+void Sensor::batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs) {
+    if (samplingPeriodNs < mSensorInfo.minDelay * 1000LL) {
+        samplingPeriodNs = mSensorInfo.minDelay * 1000LL;
+    } else if (samplingPeriodNs > mSensorInfo.maxDelay * 1000LL) {
+        samplingPeriodNs = mSensorInfo.maxDelay * 1000LL;
+    }
+    // Sensors without a FIFO report every event as soon as it is generated.
+    if (mSensorInfo.fifoMaxEventCount == 0 || maxReportLatencyNs < 0) {
+        maxReportLatencyNs = 0;
     }
 
+    std::lock_guard<std::mutex> lock(mLock);
+    mMaxReportLatencyNs = maxReportLatencyNs;
+    if (maxReportLatencyNs != 0) {
+        std::lock_guard<std::mutex> fifoLock(mFifoLock);
+        mFifo.reserve(mSensorInfo.fifoMaxEventCount);
+    }
     if (mSamplingPeriodNs != samplingPeriodNs) {
         mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+        // Check if a new event should be generated now
+        mNextSampleTimeNs = 0;
     }
 }
 
 void Sensor::activate(bool enable) {
+    std::lock_guard<std::mutex> lock(mLock);
     if (mIsEnabled != enable) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
         mIsEnabled = enable;
-        mWaitCV.notify_all();
+        mNextSampleTimeNs = 0;
+        if (!enable) {
+            // Batched events are not reported once the sensor is disabled.
+            std::lock_guard<std::mutex> fifoLock(mFifoLock);
+            mFifo.clear();
+        }
     }
 }
 
+size_t Sensor::drainFifo(std::vector<Event>* events) {
+    std::lock_guard<std::mutex> lock(mFifoLock);
+    size_t count = mFifo.size();
+    events->insert(events->end(), mFifo.begin(), mFifo.end());
+    mFifo.clear();
+    return count;
+}
+
+bool Sensor::isBatching() const {
+    return mMaxReportLatencyNs > 0 && mMode == OperationMode::NORMAL;
+}
+
+int64_t Sensor::getNextSampleTime() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!isSampling()) {
+        return -1;
+    }
+    int64_t nextSampleTime = mIsEnabled && !mPlayback ? mNextSampleTimeNs : INT64_MAX;
+    for (const auto& report : mDirectReports) {
+        nextSampleTime = std::min(nextSampleTime, report.nextReportTimeNs);
+    }
+    return nextSampleTime != INT64_MAX ? nextSampleTime : -1;
+}
+
+bool Sensor::sample(int64_t now, std::vector<Event>* events) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!isSampling()) {
+        return false;
+    }
+
+    // A single sample is shared by the Event FMQ and the direct channels which are due.
+    const bool eventsDue = mIsEnabled && !mPlayback && now >= mNextSampleTimeNs;
+    bool reportsDue = false;
+    for (const auto& report : mDirectReports) {
+        reportsDue |= now >= report.nextReportTimeNs;
+    }
+    if (!eventsDue && !reportsDue) {
+        return false;
+    }
+
+    std::vector<Event> sampled = readEvents();
+    for (auto& report : mDirectReports) {
+        if (now >= report.nextReportTimeNs) {
+            for (const auto& event : sampled) {
+                report.channel->write(mSensorInfo.sensorHandle, event);
+            }
+            report.nextReportTimeNs = nextAlignedTime(now, report.samplingPeriodNs);
+        }
+    }
+    if (!eventsDue) {
+        return false;
+    }
+    mNextSampleTimeNs = nextAlignedTime(now, mSamplingPeriodNs);
+    return batchEvents(sampled, now, events);
+}
+
+void Sensor::setPlayback(bool enable) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mPlayback = enable;
+    mNextSampleTimeNs = 0;
+}
+
+bool Sensor::playback(const Event& event, int64_t now, std::vector<Event>* events) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mIsEnabled || !mPlayback || mMode != OperationMode::NORMAL) {
+        return false;
+    }
+    std::vector<Event> played{event};
+    played[0].sensorHandle = mSensorInfo.sensorHandle;
+    return batchEvents(played, now, events);
+}
+
+bool Sensor::batchEvents(const std::vector<Event>& sampled, int64_t now,
+                         std::vector<Event>* events) {
+    if (sampled.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mFifoLock);
+    if (isBatching()) {
+        if (mFifo.empty()) {
+            mFifoDeadlineNs = now + mMaxReportLatencyNs;
+        }
+        mFifo.insert(mFifo.end(), sampled.begin(), sampled.end());
+        // Report when full, or if waiting for the next sample would exceed the latency.
+        return mFifo.size() >= mSensorInfo.fifoMaxEventCount ||
+               now + mSamplingPeriodNs > mFifoDeadlineNs;
+    }
+    if (!mFifo.empty()) {
+        // Batching was just disabled, the batched events must be reported first.
+        mFifo.insert(mFifo.end(), sampled.begin(), sampled.end());
+        return true;
+    }
+    events->insert(events->end(), sampled.begin(), sampled.end());
+    return false;
+}
+
+Result Sensor::configDirectReport(const std::shared_ptr<DirectChannel>& channel, RateLevel rate) {
+    if (rate > getMaxDirectRateLevel()) {
+        return Result::BAD_VALUE;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    auto report = std::find_if(mDirectReports.begin(), mDirectReports.end(),
+                               [&](const DirectReport& r) { return r.channel == channel; });
+    if (rate == RateLevel::STOP) {
+        if (report != mDirectReports.end()) {
+            mDirectReports.erase(report);
+        }
+        return Result::OK;
+    }
+
+    int64_t samplingPeriodNs = DirectChannel::getSamplingPeriodNs(rate);
+    if (report != mDirectReports.end()) {
+        report->samplingPeriodNs = samplingPeriodNs;
+    } else {
+        mDirectReports.push_back({channel, samplingPeriodNs, 0 /* nextReportTimeNs */});
+    }
+    return Result::OK;
+}
+
+RateLevel Sensor::getMaxDirectRateLevel() const {
+    return static_cast<RateLevel>(
+            (mSensorInfo.flags & static_cast<uint32_t>(SensorFlagBits::MASK_DIRECT_REPORT)) >>
+            static_cast<uint32_t>(SensorFlagShift::DIRECT_REPORT));
+}
+
 Result Sensor::flush() {
     // Only generate a flush complete event if the sensor is enabled and if the sensor is not a
     // one-shot sensor.
@@ -83,49 +234,23 @@ Result Sensor::flush() {
         return Result::BAD_VALUE;
     }
 
-    // Note: If a sensor supports batching, write all of the currently batched events for the sensor
-    // to the Event FMQ prior to writing the flush complete event.
+    // The batched events of the sensor, along with those of all the other sensors, are written to
+    // the Event FMQ prior to the flush complete event.
     Event ev;
     ev.sensorHandle = mSensorInfo.sensorHandle;
     ev.sensorType = SensorType::META_DATA;
     ev.u.meta.what = MetaDataEventType::META_DATA_FLUSH_COMPLETE;
     std::vector<Event> evs{ev};
-    mCallback->postEvents(evs, isWakeUpSensor());
+    mCallback->postBatchedEvents(evs, isWakeUpSensor());
 
     return Result::OK;
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
+bool Sensor::isSampling() const {
+    return mMode == OperationMode::NORMAL && (mIsEnabled || !mDirectReports.empty());
 }
 
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
-
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_REALTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            }
-
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
-        }
-    }
-}
-
-bool Sensor::isWakeUpSensor() {
+bool Sensor::isWakeUpSensor() const {
     return mSensorInfo.flags & static_cast<uint32_t>(SensorFlagBits::WAKE_UP);
 }
 
@@ -144,11 +269,8 @@ std::vector<Event> Sensor::readEvents() {
 }
 
 void Sensor::setOperationMode(OperationMode mode) {
-    if (mMode != mode) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mMode = mode;
-        mWaitCV.notify_all();
-    }
+    std::lock_guard<std::mutex> lock(mLock);
+    mMode = mode;
 }
 
 bool Sensor::supportsDataInjection() const {
@@ -205,12 +327,13 @@ AccelSensor::AccelSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
     mSensorInfo.maxRange = 78.4f;  // +/- 8g
     mSensorInfo.resolution = 1.52e-5;
     mSensorInfo.power = 0.001f;          // mA
-    mSensorInfo.minDelay = 20 * 1000;    // microseconds
+    mSensorInfo.minDelay = 5 * 1000;     // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
-    mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoReservedEventCount = kDefaultFifoMaxEventCount;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
-    mSensorInfo.flags = static_cast<uint32_t>(SensorFlagBits::DATA_INJECTION);
+    mSensorInfo.flags = static_cast<uint32_t>(SensorFlagBits::DATA_INJECTION) |
+                        directReportFlags(RateLevel::FAST);
 };
 
 PressureSensor::PressureSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
@@ -226,8 +349,8 @@ PressureSensor::PressureSensor(int32_t sensorHandle, ISensorsEventCallback* call
     mSensorInfo.power = 0.001f;       // mA
     mSensorInfo.minDelay = 100 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
-    mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoReservedEventCount = kDefaultFifoMaxEventCount;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
 };
@@ -245,10 +368,10 @@ MagnetometerSensor::MagnetometerSensor(int32_t sensorHandle, ISensorsEventCallba
     mSensorInfo.power = 0.001f;       // mA
     mSensorInfo.minDelay = 20 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
-    mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoReservedEventCount = kDefaultFifoMaxEventCount;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
-    mSensorInfo.flags = 0;
+    mSensorInfo.flags = directReportFlags(RateLevel::NORMAL);
 };
 
 LightSensor::LightSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
@@ -302,10 +425,10 @@ GyroSensor::GyroSensor(int32_t sensorHandle, ISensorsEventCallback* callback) :
     mSensorInfo.power = 0.001f;
     mSensorInfo.minDelay = 2.5f * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
-    mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoReservedEventCount = kDefaultFifoMaxEventCount;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
-    mSensorInfo.flags = 0;
+    mSensorInfo.flags = directReportFlags(RateLevel::FAST);
 };
 
 AmbientTempSensor::AmbientTempSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
@@ -17,16 +17,17 @@
 #ifndef ANDROID_HARDWARE_SENSORS_V2_0_SENSOR_H
 #define ANDROID_HARDWARE_SENSORS_V2_0_SENSOR_H
 
+#include "DirectChannel.h"
+
 #include <android/hardware/sensors/1.0/types.h>
 
-#include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 using ::android::hardware::sensors::V1_0::Event;
 using ::android::hardware::sensors::V1_0::OperationMode;
+using ::android::hardware::sensors::V1_0::RateLevel;
 using ::android::hardware::sensors::V1_0::Result;
 using ::android::hardware::sensors::V1_0::SensorInfo;
 using ::android::hardware::sensors::V1_0::SensorType;
@@ -41,38 +42,87 @@ class ISensorsEventCallback {
    public:
     virtual ~ISensorsEventCallback(){};
     virtual void postEvents(const std::vector<Event>& events, bool wakeup) = 0;
+    // Same as postEvents, but the events batched in the FIFOs of all the sensors are written
+    // first, in the same write.
+    virtual void postBatchedEvents(const std::vector<Event>& events, bool wakeup) = 0;
 };
 
+/**
+ * Generates the samples of a sensor. Sensors are sampled by the SamplingScheduler, which must be
+ * told with SamplingScheduler::reschedule whenever the sampling configuration of a sensor changes
+ * (activation, sampling period, direct reports, operation mode).
+ */
 class Sensor {
    public:
     Sensor(ISensorsEventCallback* callback);
     virtual ~Sensor();
 
     const SensorInfo& getSensorInfo() const;
-    void batch(int32_t samplingPeriodNs);
+    void batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs);
     virtual void activate(bool enable);
     Result flush();
 
+    // Moves the events batched in the FIFO to the end of events, returns how many were moved.
+    size_t drainFifo(std::vector<Event>* events);
+    bool isWakeUpSensor() const;
+
+    // Starts, changes the rate of, or with RateLevel::STOP stops, the reports of the sensor to a
+    // direct channel. The events are identified by the handle of the sensor in the channel.
+    Result configDirectReport(const std::shared_ptr<DirectChannel>& channel, RateLevel rate);
+    RateLevel getMaxDirectRateLevel() const;
+
     void setOperationMode(OperationMode mode);
     bool supportsDataInjection() const;
     Result injectEvent(const Event& event);
 
+    // Time at which the sensor must next be sampled, on the monotonic clock, or -1 if it is not
+    // sampled at all.
+    int64_t getNextSampleTime();
+
+    // Takes the samples which are due at now, writes them to the direct channels and either
+    // batches them or appends them to events, depending on the maximum report latency.
+    // Returns true if the batched events must be delivered.
+    bool sample(int64_t now, std::vector<Event>* events);
+
+    // While played back, the sensor no longer generates samples for the Event FMQ, its events
+    // come from a trace instead, see TracePlayer.
+    void setPlayback(bool enable);
+    // Batches the played back event, or appends it to events, if the sensor is enabled.
+    // Returns true if the batched events must be delivered.
+    bool playback(const Event& event, int64_t now, std::vector<Event>* events);
+
    protected:
-    void run();
     virtual std::vector<Event> readEvents();
-    static void startThread(Sensor* sensor);
 
-    bool isWakeUpSensor();
+    // Adds the events to the FIFO or to events, returns true if the FIFO must be delivered.
+    bool batchEvents(const std::vector<Event>& sampled, int64_t now, std::vector<Event>* events);
+    bool isBatching() const;
+    // Whether events must be generated, for the Event FMQ or for direct channels.
+    bool isSampling() const;
 
+    struct DirectReport {
+        std::shared_ptr<DirectChannel> channel;
+        int64_t samplingPeriodNs;
+        int64_t nextReportTimeNs;
+    };
+
+    // Protects the sampling configuration.
+    std::mutex mLock;
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
-    int64_t mLastSampleTimeNs;
+    int64_t mMaxReportLatencyNs;
+    int64_t mNextSampleTimeNs;
+    bool mPlayback;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
-    std::mutex mRunMutex;
-    std::thread mRunThread;
+    // Software equivalent of a hardware FIFO, holding up to fifoMaxEventCount events.
+    std::mutex mFifoLock;
+    std::vector<Event> mFifo;
+    // Time at which the oldest event of the FIFO must have been reported.
+    int64_t mFifoDeadlineNs;
+
+    // Protected by mLock.
+    std::vector<DirectReport> mDirectReports;
 
     ISensorsEventCallback* mCallback;
 
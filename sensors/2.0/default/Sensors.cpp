@@ -17,8 +17,12 @@
 #include "Sensors.h"
 
 #include <android/hardware/sensors/2.0/types.h>
+#include <cutils/properties.h>
 #include <log/log.h>
 
+#include <algorithm>
+#include <cstdlib>
+
 namespace android {
 namespace hardware {
 namespace sensors {
@@ -30,18 +34,32 @@ using ::android::hardware::sensors::V1_0::OperationMode;
 using ::android::hardware::sensors::V1_0::RateLevel;
 using ::android::hardware::sensors::V1_0::Result;
 using ::android::hardware::sensors::V1_0::SharedMemInfo;
+using ::android::hardware::sensors::V1_0::SharedMemType;
 using ::android::hardware::sensors::V2_0::SensorTimeout;
 using ::android::hardware::sensors::V2_0::WakeLockQueueFlagBits;
 
 constexpr const char* kWakeLockName = "SensorsHAL_WAKEUP";
+// How long to wait for the framework to read the Event FMQ when a batch does not fit in it.
+constexpr int64_t kWriteTimeoutNs = 100 * 1000 * 1000;  // 100 ms
+// How long the wake lock is kept once all the WAKE_UP events have been handled, so that it is not
+// acquired and released for every event of a stream.
+constexpr int64_t kWakeLockHysteresisMs = 50;
+// Sensor trace played back at startup instead of the generated samples, and its speed.
+constexpr const char* kTraceProperty = "vendor.sensors.mock.trace";
+constexpr const char* kTraceSpeedProperty = "vendor.sensors.mock.trace_speed";
 
 Sensors::Sensors()
     : mEventQueueFlag(nullptr),
       mNextHandle(1),
+      mNextDirectChannelHandle(1),
       mOutstandingWakeUpEvents(0),
       mReadWakeLockQueueRun(false),
       mAutoReleaseWakeLockTime(0),
       mHasWakeLock(false) {
+    mPublisher = std::make_unique<EventPublisher>(
+            [this](const Event* events, size_t count, size_t wakeUpEvents) {
+                writeEvents(events, count, wakeUpEvents);
+            });
     AddSensor<AccelSensor>();
     AddSensor<GyroSensor>();
     AddSensor<AmbientTempSensor>();
@@ -51,12 +69,30 @@ Sensors::Sensors()
     AddSensor<LightSensor>();
     AddSensor<ProximitySensor>();
     AddSensor<RelativeHumiditySensor>();
+    mScheduler = std::make_unique<SamplingScheduler>(this /* callback */);
+
+    char tracePath[PROPERTY_VALUE_MAX];
+    if (property_get(kTraceProperty, tracePath, nullptr) > 0) {
+        char speed[PROPERTY_VALUE_MAX];
+        property_get(kTraceSpeedProperty, speed, "1");
+        startTracePlayback(tracePath, strtof(speed, nullptr));
+    }
 }
 
 Sensors::~Sensors() {
+    // Stop sampling before anything used by the sampling threads goes away.
+    {
+        std::lock_guard<std::mutex> lock(mTracePlayerLock);
+        mTracePlayer.reset();
+    }
+    mScheduler.reset();
+    mPublisher.reset();
     deleteEventFlag();
     mReadWakeLockQueueRun = false;
-    mWakeLockThread.join();
+    // The thread is only started by initialize().
+    if (mWakeLockThread.joinable()) {
+        mWakeLockThread.join();
+    }
 }
 
 // Methods from ::android::hardware::sensors::V2_0::ISensors follow.
@@ -75,6 +111,7 @@ Return<void> Sensors::getSensorsList(getSensorsList_cb _hidl_cb) {
 Return<Result> Sensors::setOperationMode(OperationMode mode) {
     for (auto sensor : mSensors) {
         sensor.second->setOperationMode(mode);
+        mScheduler->reschedule(sensor.second.get());
     }
     return Result::OK;
 }
@@ -83,6 +120,7 @@ Return<Result> Sensors::activate(int32_t sensorHandle, bool enabled) {
     auto sensor = mSensors.find(sensorHandle);
     if (sensor != mSensors.end()) {
         sensor->second->activate(enabled);
+        mScheduler->reschedule(sensor->second.get());
         return Result::OK;
     }
     return Result::BAD_VALUE;
@@ -97,6 +135,7 @@ Return<Result> Sensors::initialize(
     // Ensure that all sensors are disabled
     for (auto sensor : mSensors) {
         sensor.second->activate(false /* enable */);
+        mScheduler->reschedule(sensor.second.get());
     }
 
     // Stop the Wake Lock thread if it is currently running
@@ -108,17 +147,22 @@ Return<Result> Sensors::initialize(
     // Save a reference to the callback
     mCallback = sensorsCallback;
 
-    // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
-    mEventQueue =
-        std::make_unique<EventMessageQueue>(eventQueueDescriptor, true /* resetPointers */);
+    {
+        // The publisher may still be writing events of the previous connection.
+        std::lock_guard<std::mutex> lock(mWriteLock);
 
-    // Ensure that any existing EventFlag is properly deleted
-    deleteEventFlag();
+        // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
+        mEventQueue =
+            std::make_unique<EventMessageQueue>(eventQueueDescriptor, true /* resetPointers */);
 
-    // Create the EventFlag that is used to signal to the framework that sensor events have been
-    // written to the Event FMQ
-    if (EventFlag::createEventFlag(mEventQueue->getEventFlagWord(), &mEventQueueFlag) != OK) {
-        result = Result::BAD_VALUE;
+        // Ensure that any existing EventFlag is properly deleted
+        deleteEventFlag();
+
+        // Create the EventFlag that is used to signal to the framework that sensor events have
+        // been written to the Event FMQ
+        if (EventFlag::createEventFlag(mEventQueue->getEventFlagWord(), &mEventQueueFlag) != OK) {
+            result = Result::BAD_VALUE;
+        }
     }
 
     // Create the Wake Lock FMQ that is used by the framework to communicate whenever WAKE_UP
@@ -138,10 +182,11 @@ Return<Result> Sensors::initialize(
 }
 
 Return<Result> Sensors::batch(int32_t sensorHandle, int64_t samplingPeriodNs,
-                              int64_t /* maxReportLatencyNs */) {
+                              int64_t maxReportLatencyNs) {
     auto sensor = mSensors.find(sensorHandle);
     if (sensor != mSensors.end()) {
-        sensor->second->batch(samplingPeriodNs);
+        sensor->second->batch(samplingPeriodNs, maxReportLatencyNs);
+        mScheduler->reschedule(sensor->second.get());
         return Result::OK;
     }
     return Result::BAD_VALUE;
@@ -164,80 +209,246 @@ Return<Result> Sensors::injectSensorData(const Event& event) {
     return Result::BAD_VALUE;
 }
 
-Return<void> Sensors::registerDirectChannel(const SharedMemInfo& /* mem */,
+Return<void> Sensors::registerDirectChannel(const SharedMemInfo& mem,
                                             registerDirectChannel_cb _hidl_cb) {
-    _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
+    if (mem.type != SharedMemType::ASHMEM) {
+        _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
+        return Return<void>();
+    }
+
+    std::shared_ptr<DirectChannel> channel = DirectChannel::create(mem);
+    if (channel == nullptr) {
+        _hidl_cb(Result::BAD_VALUE, -1 /* channelHandle */);
+        return Return<void>();
+    }
+
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    int32_t channelHandle = mNextDirectChannelHandle++;
+    mDirectChannels[channelHandle] = channel;
+    _hidl_cb(Result::OK, channelHandle);
     return Return<void>();
 }
 
-Return<Result> Sensors::unregisterDirectChannel(int32_t /* channelHandle */) {
-    return Result::INVALID_OPERATION;
+Return<Result> Sensors::unregisterDirectChannel(int32_t channelHandle) {
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    auto channel = mDirectChannels.find(channelHandle);
+    if (channel != mDirectChannels.end()) {
+        for (const auto& sensor : mSensors) {
+            sensor.second->configDirectReport(channel->second, RateLevel::STOP);
+            mScheduler->reschedule(sensor.second.get());
+        }
+        mDirectChannels.erase(channel);
+    }
+    return Result::OK;
 }
 
-Return<void> Sensors::configDirectReport(int32_t /* sensorHandle */, int32_t /* channelHandle */,
-                                         RateLevel /* rate */, configDirectReport_cb _hidl_cb) {
-    _hidl_cb(Result::INVALID_OPERATION, 0 /* reportToken */);
+Return<void> Sensors::configDirectReport(int32_t sensorHandle, int32_t channelHandle,
+                                         RateLevel rate, configDirectReport_cb _hidl_cb) {
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    auto channel = mDirectChannels.find(channelHandle);
+    if (channel == mDirectChannels.end()) {
+        _hidl_cb(Result::BAD_VALUE, 0 /* reportToken */);
+        return Return<void>();
+    }
+
+    if (sensorHandle == -1) {
+        // Only allowed to stop all the sensors of the channel.
+        Result result = rate == RateLevel::STOP ? Result::OK : Result::BAD_VALUE;
+        if (result == Result::OK) {
+            for (const auto& sensor : mSensors) {
+                sensor.second->configDirectReport(channel->second, RateLevel::STOP);
+                mScheduler->reschedule(sensor.second.get());
+            }
+        }
+        _hidl_cb(result, 0 /* reportToken */);
+        return Return<void>();
+    }
+
+    auto sensor = mSensors.find(sensorHandle);
+    if (sensor == mSensors.end()) {
+        _hidl_cb(Result::BAD_VALUE, 0 /* reportToken */);
+        return Return<void>();
+    }
+    // The sensor handle is used as report token, it is unique and positive.
+    Result result = sensor->second->configDirectReport(channel->second, rate);
+    mScheduler->reschedule(sensor->second.get());
+    _hidl_cb(result, result == Result::OK && rate != RateLevel::STOP ? sensorHandle : 0);
     return Return<void>();
 }
 
+bool Sensors::startTracePlayback(const std::string& path, float speed) {
+    stopTracePlayback();
+
+    std::unique_ptr<TracePlayer> player = TracePlayer::create(path, this /* callback */, speed);
+    if (player == nullptr) {
+        return false;
+    }
+    size_t playedSensors = 0;
+    for (const auto& sensor : mSensors) {
+        if (player->addSensor(sensor.second.get())) {
+            // The played back sensor no longer needs to be sampled.
+            mScheduler->reschedule(sensor.second.get());
+            playedSensors++;
+        }
+    }
+    ALOGI("Playing back %s at %.1fx through %zu sensors", path.c_str(), speed, playedSensors);
+    player->start();
+
+    std::lock_guard<std::mutex> lock(mTracePlayerLock);
+    mTracePlayer = std::move(player);
+    return true;
+}
+
+void Sensors::stopTracePlayback() {
+    std::lock_guard<std::mutex> lock(mTracePlayerLock);
+    if (mTracePlayer == nullptr) {
+        return;
+    }
+    mTracePlayer.reset();
+    for (const auto& sensor : mSensors) {
+        sensor.second->setPlayback(false);
+        mScheduler->reschedule(sensor.second.get());
+    }
+}
+
 void Sensors::postEvents(const std::vector<Event>& events, bool wakeup) {
+    if (wakeup && !events.empty()) {
+        onWakeUpEventsPosted(events.size());
+    }
+    mPublisher->post(events.data(), events.size(), wakeup);
+}
+
+void Sensors::postBatchedEvents(const std::vector<Event>& events, bool wakeup) {
+    // Like a hardware FIFO would when the AP wakes up, report the batches of all the sensors at
+    // once: they are posted together, so that the publisher writes them with a single wake.
+    std::lock_guard<std::mutex> lock(mBatchLock);
+    mBatchEvents.clear();
+    mBatchWakeUps.clear();
+    for (const auto& sensor : mSensors) {
+        sensor.second->drainFifo(&mBatchEvents);
+        mBatchWakeUps.resize(mBatchEvents.size(), sensor.second->isWakeUpSensor());
+    }
+    mBatchEvents.insert(mBatchEvents.end(), events.begin(), events.end());
+    mBatchWakeUps.resize(mBatchEvents.size(), wakeup);
+
+    const size_t wakeUpEvents = std::count(mBatchWakeUps.begin(), mBatchWakeUps.end(), 1);
+    if (wakeUpEvents > 0) {
+        onWakeUpEventsPosted(wakeUpEvents);
+    }
+    mPublisher->post(mBatchEvents.data(), mBatchEvents.size(), mBatchWakeUps.data());
+}
+
+void Sensors::writeEvents(const Event* events, size_t count, size_t wakeUpEvents) {
     std::lock_guard<std::mutex> lock(mWriteLock);
-    if (mEventQueue->write(events.data(), events.size())) {
+    if (mEventQueue == nullptr || mEventQueueFlag == nullptr) {
+        ALOGW("Dropped %zu events, the HAL is not initialized", count);
+        onWakeUpEventsHandled(static_cast<uint32_t>(wakeUpEvents));
+        return;
+    }
+
+    bool written = mEventQueue->write(events, count);
+    if (written) {
         mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+    } else {
+        // A batch may not fit in the free space of the Event FMQ, or even in the whole FMQ. Write
+        // it in chunks, waiting for the framework to read each of them.
+        const size_t chunkSize = mEventQueue->getQuantumCount();
+        size_t offset = 0;
+        for (; offset < count; offset += chunkSize) {
+            written = mEventQueue->writeBlocking(
+                    events + offset, std::min(chunkSize, count - offset),
+                    static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
+                    static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS), kWriteTimeoutNs,
+                    mEventQueueFlag);
+            if (!written) {
+                ALOGW("Dropped %zu events, the Event FMQ is full", count - offset);
+                break;
+            }
+        }
+        // The WAKE_UP events of a partially written batch stay counted, the wake lock is then
+        // released on timeout.
+        if (!written && offset == 0) {
+            onWakeUpEventsHandled(static_cast<uint32_t>(wakeUpEvents));
+        }
+    }
+}
 
-        if (wakeup) {
-            // Keep track of the number of outstanding WAKE_UP events in order to properly hold
-            // a wake lock until the framework has secured a wake lock
-            updateWakeLock(events.size(), 0 /* eventsHandled */);
+void Sensors::onWakeUpEventsPosted(size_t count) {
+    // Keep track of the number of outstanding WAKE_UP events in order to properly hold a wake
+    // lock until the framework has secured a wake lock
+    mOutstandingWakeUpEvents += static_cast<int32_t>(count);
+    // Update the time at which the last WAKE_UP event was sent
+    mAutoReleaseWakeLockTime = ::android::uptimeMillis() +
+                               static_cast<uint32_t>(SensorTimeout::WAKE_LOCK_SECONDS) * 1000;
+    // Thanks to the release hysteresis, the wake lock is usually still held.
+    if (!mHasWakeLock) {
+        std::lock_guard<std::mutex> lock(mWakeLockLock);
+        if (!mHasWakeLock && acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakeLockName) == 0) {
+            mHasWakeLock = true;
         }
     }
 }
 
-void Sensors::updateWakeLock(int32_t eventsWritten, int32_t eventsHandled) {
-    std::lock_guard<std::mutex> lock(mWakeLockLock);
-    int32_t newVal = mOutstandingWakeUpEvents + eventsWritten - eventsHandled;
-    if (newVal < 0) {
-        mOutstandingWakeUpEvents = 0;
-    } else {
-        mOutstandingWakeUpEvents = newVal;
+void Sensors::onWakeUpEventsHandled(uint32_t count) {
+    int32_t outstanding = mOutstandingWakeUpEvents;
+    int32_t remaining;
+    do {
+        remaining = std::max(outstanding - static_cast<int32_t>(count), 0);
+    } while (!mOutstandingWakeUpEvents.compare_exchange_weak(outstanding, remaining));
+}
+
+void Sensors::releaseWakeLockIfIdle(int64_t* idleSinceMs) {
+    if (!mHasWakeLock) {
+        *idleSinceMs = -1;
+        return;
     }
 
-    if (eventsWritten > 0) {
-        // Update the time at which the last WAKE_UP event was sent
-        mAutoReleaseWakeLockTime = ::android::uptimeMillis() +
-                                   static_cast<uint32_t>(SensorTimeout::WAKE_LOCK_SECONDS) * 1000;
+    const int64_t now = ::android::uptimeMillis();
+    // Check if the wake lock should be released automatically if
+    // SensorTimeout::WAKE_LOCK_SECONDS has elapsed since the last WAKE_UP event was written to
+    // the Wake Lock FMQ.
+    if (now > mAutoReleaseWakeLockTime) {
+        ALOGD("No events read from wake lock FMQ for %d seconds, auto releasing wake lock",
+              SensorTimeout::WAKE_LOCK_SECONDS);
+        mOutstandingWakeUpEvents = 0;
+    } else if (mOutstandingWakeUpEvents != 0) {
+        *idleSinceMs = -1;
+        return;
+    } else if (*idleSinceMs < 0) {
+        // Hold the wake lock a little longer, WAKE_UP events usually come in streams.
+        *idleSinceMs = now;
+        return;
+    } else if (now < *idleSinceMs + kWakeLockHysteresisMs) {
+        return;
     }
+    *idleSinceMs = -1;
 
-    if (!mHasWakeLock && mOutstandingWakeUpEvents > 0 &&
-        acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakeLockName) == 0) {
+    std::lock_guard<std::mutex> lock(mWakeLockLock);
+    // The publisher only acquires the wake lock if it sees it released after having counted its
+    // events, check them again once marked as released.
+    mHasWakeLock = false;
+    if (mOutstandingWakeUpEvents != 0 || release_wake_lock(kWakeLockName) != 0) {
         mHasWakeLock = true;
-    } else if (mHasWakeLock) {
-        // Check if the wake lock should be released automatically if
-        // SensorTimeout::WAKE_LOCK_SECONDS has elapsed since the last WAKE_UP event was written to
-        // the Wake Lock FMQ.
-        if (::android::uptimeMillis() > mAutoReleaseWakeLockTime) {
-            ALOGD("No events read from wake lock FMQ for %d seconds, auto releasing wake lock",
-                  SensorTimeout::WAKE_LOCK_SECONDS);
-            mOutstandingWakeUpEvents = 0;
-        }
-
-        if (mOutstandingWakeUpEvents == 0 && release_wake_lock(kWakeLockName) == 0) {
-            mHasWakeLock = false;
-        }
     }
 }
 
 void Sensors::readWakeLockFMQ() {
+    int64_t idleSinceMs = -1;
     while (mReadWakeLockQueueRun.load()) {
         constexpr int64_t kReadTimeoutNs = 500 * 1000 * 1000;  // 500 ms
         uint32_t eventsHandled = 0;
 
         // Read events from the Wake Lock FMQ. Timeout after a reasonable amount of time to ensure
-        // that any held wake lock is able to be released if it is held for too long.
-        mWakeLockQueue->readBlocking(&eventsHandled, 1 /* count */, 0 /* readNotification */,
-                                     static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN),
-                                     kReadTimeoutNs);
-        updateWakeLock(0 /* eventsWritten */, eventsHandled);
+        // that any held wake lock is able to be released if it is held for too long, or once the
+        // release hysteresis has elapsed.
+        const int64_t timeoutNs =
+                idleSinceMs < 0 ? kReadTimeoutNs : kWakeLockHysteresisMs * 1000 * 1000;
+        if (mWakeLockQueue->readBlocking(
+                    &eventsHandled, 1 /* count */, 0 /* readNotification */,
+                    static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN), timeoutNs)) {
+            onWakeUpEventsHandled(eventsHandled);
+        }
+        releaseWakeLockIfIdle(&idleSinceMs);
     }
 }
 
@@ -17,7 +17,11 @@
 #ifndef ANDROID_HARDWARE_SENSORS_V2_0_SENSORS_H
 #define ANDROID_HARDWARE_SENSORS_V2_0_SENSORS_H
 
+#include "DirectChannel.h"
+#include "EventPublisher.h"
+#include "SamplingScheduler.h"
 #include "Sensor.h"
+#include "TracePlayer.h"
 
 #include <android/hardware/sensors/2.0/ISensors.h>
 #include <fmq/MessageQueue.h>
@@ -27,6 +31,7 @@
 
 #include <atomic>
 #include <memory>
+#include <string>
 #include <thread>
 
 namespace android {
@@ -85,6 +90,17 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
 
     void postEvents(const std::vector<Event>& events, bool wakeup) override;
 
+    void postBatchedEvents(const std::vector<Event>& events, bool wakeup) override;
+
+    /**
+     * Replaces the samples of the sensors by the events of a recorded trace, played back in a
+     * loop at the given speed until stopTracePlayback() is called. Only the sensors whose type
+     * appears in the trace are played back. Returns false if the trace cannot be played.
+     */
+    bool startTracePlayback(const std::string& path, float speed);
+
+    void stopTracePlayback();
+
    private:
     /**
      * Add a new sensor
@@ -96,6 +112,13 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
         mSensors[sensor->getSensorInfo().sensorHandle] = sensor;
     }
 
+    /**
+     * Writes the events to the Event FMQ and wakes up the framework once. The WAKE_UP events
+     * were counted when posted, and are uncounted if the events are dropped. Only called by the
+     * publisher thread.
+     */
+    void writeEvents(const Event* events, size_t count, size_t wakeUpEvents);
+
     /**
      * Utility function to delete the Event Flag
      */
@@ -109,9 +132,22 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
     static void startReadWakeLockThread(Sensors* sensors);
 
     /**
-     * Responsible for acquiring and releasing a wake lock when there are unhandled WAKE_UP events
+     * Accounts for WAKE_UP events about to be posted, and acquires the wake lock if it is not
+     * held, so that the device cannot suspend while they are staged in the publisher.
+     */
+    void onWakeUpEventsPosted(size_t count);
+
+    /**
+     * Accounts for WAKE_UP events handled by the framework, or dropped before being written.
+     */
+    void onWakeUpEventsHandled(uint32_t count);
+
+    /**
+     * Releases the wake lock once there have been no outstanding WAKE_UP events for
+     * kWakeLockHysteresisMs, or automatically after SensorTimeout::WAKE_LOCK_SECONDS. Only called
+     * by the Wake Lock thread, which keeps idleSinceMs.
      */
-    void updateWakeLock(int32_t eventsWritten, int32_t eventsHandled);
+    void releaseWakeLockIfIdle(int64_t* idleSinceMs);
 
     using EventMessageQueue = MessageQueue<Event, kSynchronizedReadWrite>;
     using WakeLockMessageQueue = MessageQueue<uint32_t, kSynchronizedReadWrite>;
@@ -147,7 +183,32 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
     int32_t mNextHandle;
 
     /**
-     * Lock to protect writes to the FMQs
+     * Samples all the sensors, must be told about any change to their sampling configuration
+     */
+    std::unique_ptr<SamplingScheduler> mScheduler;
+
+    /**
+     * Plays back a recorded trace instead of sampling the sensors, if any. Protected by
+     * mTracePlayerLock.
+     */
+    std::unique_ptr<TracePlayer> mTracePlayer;
+    std::mutex mTracePlayerLock;
+
+    /**
+     * Stages the events posted by the sampling threads and writes them to the Event FMQ
+     */
+    std::unique_ptr<EventPublisher> mPublisher;
+
+    /**
+     * The events of the sensor FIFOs flushed by postBatchedEvents(), and their WAKE_UP flags,
+     * kept to avoid allocations. Protected by mBatchLock.
+     */
+    std::vector<Event> mBatchEvents;
+    std::vector<uint8_t> mBatchWakeUps;
+    std::mutex mBatchLock;
+
+    /**
+     * Lock to protect the Event FMQ against its replacement by initialize()
      */
     std::mutex mWriteLock;
 
@@ -156,10 +217,25 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
      */
     std::mutex mWakeLockLock;
 
+    /**
+     * The registered direct channels, by channel handle
+     */
+    std::map<int32_t, std::shared_ptr<DirectChannel>> mDirectChannels;
+
+    /**
+     * The next available direct channel handle
+     */
+    int32_t mNextDirectChannelHandle;
+
+    /**
+     * Lock to protect the direct channels
+     */
+    std::mutex mDirectChannelLock;
+
     /**
      * Track the number of WAKE_UP events that have not been handled by the framework
      */
-    uint32_t mOutstandingWakeUpEvents;
+    std::atomic<int32_t> mOutstandingWakeUpEvents;
 
     /**
      * A thread to read the Wake Lock FMQ
@@ -174,12 +250,12 @@ struct Sensors : public ISensors, public ISensorsEventCallback {
     /**
      * Track the time when the wake lock should automatically be released
      */
-    int64_t mAutoReleaseWakeLockTime;
+    std::atomic<int64_t> mAutoReleaseWakeLockTime;
 
     /**
-     * Flag to indicate if a wake lock has been acquired
+     * Flag to indicate if a wake lock has been acquired. Only changed with mWakeLockLock held.
      */
-    bool mHasWakeLock;
+    std::atomic_bool mHasWakeLock;
 };
 
 }  // namespace implementation
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TracePlayer.h"
+
+#include "SamplingScheduler.h"
+
+#include <log/log.h>
+#include <utils/SystemClock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::SensorStatus;
+using ::android::hardware::sensors::V1_0::SensorType;
+
+// Interval between the last record of a loop and the first record of the next one, when the
+// trace does not tell.
+constexpr int64_t kDefaultLoopGapNs = 1000 * 1000;  // 1 ms
+
+std::unique_ptr<TracePlayer> TracePlayer::create(const std::string& path,
+                                                 ISensorsEventCallback* callback, float speed) {
+    if (!(speed > 0)) {
+        ALOGE("Invalid trace playback speed %f", speed);
+        return nullptr;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Failed to open the sensor trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SensorTraceHeader)) {
+        ALOGE("Sensor trace %s is too short", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+    size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 /* offset */);
+    // The mapping holds its own reference to the file.
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        ALOGE("Failed to map the sensor trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    const SensorTraceHeader* header = static_cast<const SensorTraceHeader*>(mapping);
+    const size_t maxRecordCount = (size - sizeof(SensorTraceHeader)) / sizeof(SensorTraceRecord);
+    bool valid = header->magic == SensorTraceHeader::kMagic &&
+                 header->version == SensorTraceHeader::kVersion && header->recordCount > 0 &&
+                 header->recordCount <= maxRecordCount;
+    if (valid) {
+        const SensorTraceRecord* records = reinterpret_cast<const SensorTraceRecord*>(
+                static_cast<const uint8_t*>(mapping) + sizeof(SensorTraceHeader));
+        valid = std::is_sorted(records, records + header->recordCount,
+                               [](const SensorTraceRecord& a, const SensorTraceRecord& b) {
+                                   return a.timestampNs < b.timestampNs;
+                               });
+    }
+    if (!valid) {
+        ALOGE("Sensor trace %s is malformed", path.c_str());
+        munmap(mapping, size);
+        return nullptr;
+    }
+    return std::unique_ptr<TracePlayer>(
+            new TracePlayer(static_cast<const uint8_t*>(mapping), size, callback, speed));
+}
+
+TracePlayer::TracePlayer(const uint8_t* mapping, size_t size, ISensorsEventCallback* callback,
+                         float speed)
+    : mMapping(mapping),
+      mSize(size),
+      mRecords(reinterpret_cast<const SensorTraceRecord*>(mapping + sizeof(SensorTraceHeader))),
+      mRecordCount(reinterpret_cast<const SensorTraceHeader*>(mapping)->recordCount),
+      mCallback(callback),
+      mSpeed(speed),
+      mStopThread(false),
+      mLoopStartNs(0) {
+    int64_t durationNs = mRecords[mRecordCount - 1].timestampNs - mRecords[0].timestampNs;
+    // Keep the average interval between the records across loops.
+    int64_t gapNs = mRecordCount > 1 ? durationNs / static_cast<int64_t>(mRecordCount - 1) : 0;
+    if (gapNs == 0) {
+        gapNs = kDefaultLoopGapNs;
+    }
+    mLoopDurationNs = static_cast<int64_t>((durationNs + gapNs) / mSpeed);
+}
+
+TracePlayer::~TracePlayer() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopThread = true;
+        mWaitCV.notify_all();
+    }
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    munmap(const_cast<uint8_t*>(mMapping), mSize);
+}
+
+bool TracePlayer::addSensor(Sensor* sensor) {
+    const int32_t type = static_cast<int32_t>(sensor->getSensorInfo().type);
+    bool played = std::any_of(mRecords, mRecords + mRecordCount,
+                              [type](const SensorTraceRecord& r) { return r.sensorType == type; });
+    if (played) {
+        mSensors[type] = sensor;
+        sensor->setPlayback(true);
+    }
+    return played;
+}
+
+void TracePlayer::start() {
+    mThread = std::thread([this] { run(); });
+}
+
+TracePlayer::Stats TracePlayer::getStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+int64_t TracePlayer::getPlaybackTime(size_t index) const {
+    return mLoopStartNs +
+           static_cast<int64_t>((mRecords[index].timestampNs - mRecords[0].timestampNs) / mSpeed);
+}
+
+Event TracePlayer::toEvent(const SensorTraceRecord& record) const {
+    Event event;
+    event.sensorType = static_cast<SensorType>(record.sensorType);
+    for (size_t i = 0; i < sizeof(record.values) / sizeof(record.values[0]); i++) {
+        event.u.data[i] = record.values[i];
+    }
+    switch (event.sensorType) {
+        case SensorType::ACCELEROMETER:
+        case SensorType::GYROSCOPE:
+        case SensorType::MAGNETIC_FIELD:
+            event.u.vec3.status = SensorStatus::ACCURACY_HIGH;
+            break;
+        default:
+            break;
+    }
+    return event;
+}
+
+void TracePlayer::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    size_t next = 0;
+    mLoopStartNs = SamplingScheduler::now();
+    while (!mStopThread) {
+        int64_t currentTime = SamplingScheduler::now();
+        const int64_t dueTime = getPlaybackTime(next);
+        if (currentTime < dueTime) {
+            mWaitCV.wait_for(lock, std::chrono::nanoseconds(dueTime - currentTime));
+            continue;
+        }
+        lock.unlock();
+
+        // Played back events keep the intervals of the trace, whatever the lateness of the
+        // wakeup.
+        const int64_t realtime = ::android::elapsedRealtimeNano();
+        mEvents.clear();
+        mWakeUpEvents.clear();
+        bool fifoReady = false;
+        size_t count = 0;
+        for (; next < mRecordCount; next++, count++) {
+            const int64_t playbackTime = getPlaybackTime(next);
+            if (playbackTime > currentTime) {
+                break;
+            }
+            auto sensor = mSensors.find(mRecords[next].sensorType);
+            if (sensor == mSensors.end()) {
+                continue;
+            }
+            Event event = toEvent(mRecords[next]);
+            event.timestamp = realtime - (currentTime - playbackTime);
+            fifoReady |= sensor->second->playback(
+                    event, currentTime,
+                    sensor->second->isWakeUpSensor() ? &mWakeUpEvents : &mEvents);
+        }
+        if (fifoReady) {
+            mCallback->postBatchedEvents(mEvents, false /* wakeup */);
+        } else if (!mEvents.empty()) {
+            mCallback->postEvents(mEvents, false /* wakeup */);
+        }
+        if (!mWakeUpEvents.empty()) {
+            mCallback->postEvents(mWakeUpEvents, true /* wakeup */);
+        }
+        if (next == mRecordCount) {
+            next = 0;
+            mLoopStartNs += mLoopDurationNs;
+        }
+
+        lock.lock();
+        ++mStats.wakeups;
+        mStats.records += count;
+        mStats.maxLatenessNs = std::max(mStats.maxLatenessNs, currentTime - dueTime);
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
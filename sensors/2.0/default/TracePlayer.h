@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_0_TRACEPLAYER_H
+#define ANDROID_HARDWARE_SENSORS_V2_0_TRACEPLAYER_H
+
+#include "Sensor.h"
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+/**
+ * Binary format of the sensor traces: a header followed by the records of all the sensors,
+ * interleaved and sorted by timestamp. All the fields are little endian.
+ */
+struct SensorTraceHeader {
+    static constexpr uint32_t kMagic = 0x43525453;  // "STRC"
+    static constexpr uint32_t kVersion = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t recordCount;
+};
+
+struct SensorTraceRecord {
+    int64_t timestampNs;
+    // A SensorType, the sensor of that type plays the record back.
+    int32_t sensorType;
+    // Copied to the first values of Event::u::data. 3-axis sensors ignore the fourth value and
+    // report a high accuracy instead.
+    float values[5];
+};
+
+static_assert(sizeof(SensorTraceHeader) == 16, "unexpected trace header size");
+static_assert(sizeof(SensorTraceRecord) == 32, "unexpected trace record size");
+
+/**
+ * Replays a memory-mapped sensor trace in a loop, at the recorded rate or faster, through the
+ * sensors of the matching types. Played back sensors report the events of the trace instead of
+ * generated samples, with the usual activation and batching, and the events are posted with
+ * ISensorsEventCallback::postEvents like the sampled ones.
+ */
+class TracePlayer {
+   public:
+    struct Stats {
+        uint64_t wakeups = 0;
+        uint64_t records = 0;
+        // Lateness of the wakeups relative to the earliest due record.
+        int64_t maxLatenessNs = 0;
+    };
+
+    /**
+     * Maps the trace, returns nullptr if it cannot be read or is malformed. With a speed of 2,
+     * the trace is played twice as fast as it was recorded.
+     */
+    static std::unique_ptr<TracePlayer> create(const std::string& path,
+                                               ISensorsEventCallback* callback, float speed);
+    ~TracePlayer();
+
+    /**
+     * Plays the records of the type of the sensor through it, if the trace has any. Must be
+     * called before start(). Returns whether the sensor is played back.
+     */
+    bool addSensor(Sensor* sensor);
+
+    void start();
+
+    Stats getStats();
+
+   private:
+    TracePlayer(const uint8_t* mapping, size_t size, ISensorsEventCallback* callback,
+                float speed);
+
+    void run();
+    // Time at which the record must be played in the current loop, on the SamplingScheduler
+    // clock.
+    int64_t getPlaybackTime(size_t index) const;
+    Event toEvent(const SensorTraceRecord& record) const;
+
+    const uint8_t* const mMapping;
+    const size_t mSize;
+    const SensorTraceRecord* const mRecords;
+    const size_t mRecordCount;
+    ISensorsEventCallback* const mCallback;
+    const float mSpeed;
+
+    // The played back sensors, by SensorType.
+    std::map<int32_t, Sensor*> mSensors;
+
+    std::mutex mLock;
+    std::condition_variable mWaitCV;
+    bool mStopThread;  // Protected by mLock.
+    Stats mStats;      // Protected by mLock.
+    // Start of the current loop over the trace, and duration of a loop. Only used by the
+    // playback thread.
+    int64_t mLoopStartNs;
+    int64_t mLoopDurationNs;
+
+    // Only used by the playback thread, kept to avoid allocations.
+    std::vector<Event> mEvents;
+    std::vector<Event> mWakeUpEvents;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_0_TRACEPLAYER_H
@@ -0,0 +1,533 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Framework wakeups caused by the mock HAL when streaming the accelerometer and
+// the gyroscope at 200 Hz, for several maximum report latencies. The HAL is
+// instantiated in process and read like the framework does: wait for
+// READ_AND_PROCESS, read everything, signal EVENTS_READ.
+//
+// The same framework side figures are measured while playing back a recorded
+// accelerometer, gyroscope and magnetometer trace, at 1x and accelerated speed.
+//
+// The cost of posting events from 8 concurrent producers is compared between
+// the EventPublisher staging rings and a writer serialized by a mutex, like the
+// HAL used to be, and measured end to end through the HAL.
+//
+// Also compares the sampling wakeups and their jitter with all the sensors
+// streaming at their fastest rate, between the SamplingScheduler and the
+// previous model of one sampling thread per sensor.
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SamplingScheduler.h"
+#include "Sensors.h"
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::Return;
+using ::android::hardware::sensors::V1_0::Event;
+using ::android::hardware::sensors::V1_0::SensorInfo;
+using ::android::hardware::sensors::V1_0::SensorType;
+using ::android::hardware::sensors::V2_0::EventQueueFlagBits;
+using ::android::hardware::sensors::V2_0::ISensorsCallback;
+using ::android::hardware::sensors::V2_0::implementation::AccelSensor;
+using ::android::hardware::sensors::V2_0::implementation::AmbientTempSensor;
+using ::android::hardware::sensors::V2_0::implementation::DeviceTempSensor;
+using ::android::hardware::sensors::V2_0::implementation::EventPublisher;
+using ::android::hardware::sensors::V2_0::implementation::GyroSensor;
+using ::android::hardware::sensors::V2_0::implementation::ISensorsEventCallback;
+using ::android::hardware::sensors::V2_0::implementation::LightSensor;
+using ::android::hardware::sensors::V2_0::implementation::MagnetometerSensor;
+using ::android::hardware::sensors::V2_0::implementation::PressureSensor;
+using ::android::hardware::sensors::V2_0::implementation::ProximitySensor;
+using ::android::hardware::sensors::V2_0::implementation::RelativeHumiditySensor;
+using ::android::hardware::sensors::V2_0::implementation::SamplingScheduler;
+using ::android::hardware::sensors::V2_0::implementation::Sensor;
+using ::android::hardware::sensors::V2_0::implementation::Sensors;
+using ::android::hardware::sensors::V2_0::implementation::SensorTraceHeader;
+using ::android::hardware::sensors::V2_0::implementation::SensorTraceRecord;
+
+namespace {
+
+// Same size as the queue of the framework.
+constexpr size_t kEventQueueSize = 128;
+constexpr int64_t kSamplingPeriodNs = 5 * 1000 * 1000;  // 200 Hz
+constexpr auto kMeasurementDuration = std::chrono::seconds(2);
+
+struct SensorsCallback : ISensorsCallback {
+    Return<void> onDynamicSensorsConnected(const hidl_vec<SensorInfo>& /* sensorInfos */) {
+        return Return<void>();
+    }
+
+    Return<void> onDynamicSensorsDisconnected(const hidl_vec<int32_t>& /* sensorHandles */) {
+        return Return<void>();
+    }
+};
+
+// Plays the role of the framework.
+class EventReader {
+   public:
+    EventReader()
+        : mEventQueue(kEventQueueSize, true /* configureEventFlagWord */),
+          mWakeLockQueue(kEventQueueSize, true /* configureEventFlagWord */),
+          mEventQueueFlag(nullptr),
+          mRun(true),
+          mWakeups(0),
+          mEvents(0) {
+        EventFlag::createEventFlag(mEventQueue.getEventFlagWord(), &mEventQueueFlag);
+        mThread = std::thread([this] { readLoop(); });
+    }
+
+    ~EventReader() {
+        mRun = false;
+        mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+        mThread.join();
+        EventFlag::deleteEventFlag(&mEventQueueFlag);
+    }
+
+    bool initialize(const sp<Sensors>& sensors) {
+        return sensors->initialize(*mEventQueue.getDesc(), *mWakeLockQueue.getDesc(),
+                                   new SensorsCallback()) == Sensors::Result::OK;
+    }
+
+    void reset() {
+        mWakeups = 0;
+        mEvents = 0;
+    }
+    uint64_t wakeups() const { return mWakeups; }
+    uint64_t events() const { return mEvents; }
+
+   private:
+    void readLoop() {
+        Event buffer[kEventQueueSize];
+        while (mRun) {
+            uint32_t state;
+            mEventQueueFlag->wait(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
+                                  &state);
+            size_t available = mEventQueue.availableToRead();
+            if (available == 0) {
+                continue;
+            }
+            if (mEventQueue.read(buffer, available)) {
+                ++mWakeups;
+                mEvents += available;
+                mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ));
+            }
+        }
+    }
+
+    MessageQueue<Event, kSynchronizedReadWrite> mEventQueue;
+    MessageQueue<uint32_t, kSynchronizedReadWrite> mWakeLockQueue;
+    EventFlag* mEventQueueFlag;
+    std::atomic_bool mRun;
+    std::atomic<uint64_t> mWakeups;
+    std::atomic<uint64_t> mEvents;
+    std::thread mThread;
+};
+
+int32_t findSensor(const sp<Sensors>& sensors, SensorType type) {
+    int32_t handle = -1;
+    sensors->getSensorsList([&](const hidl_vec<SensorInfo>& list) {
+        for (const auto& info : list) {
+            if (info.type == type) handle = info.sensorHandle;
+        }
+    });
+    return handle;
+}
+
+// Counts the writes to the Event FMQ.
+class CountingCallback : public ISensorsEventCallback {
+   public:
+    void postEvents(const std::vector<Event>& /* events */, bool /* wakeup */) override {
+        ++mWrites;
+    }
+    void postBatchedEvents(const std::vector<Event>& /* events */, bool /* wakeup */) override {
+        ++mWrites;
+    }
+    uint64_t writes() const { return mWrites; }
+
+   private:
+    std::atomic<uint64_t> mWrites{0};
+};
+
+struct SamplingStats {
+    uint64_t wakeups = 0;
+    int64_t totalJitterNs = 0;
+    int64_t maxJitterNs = 0;
+};
+
+// The sampling model before SamplingScheduler: every sensor samples from its own thread.
+class SensorThread {
+   public:
+    SensorThread(Sensor* sensor, ISensorsEventCallback* callback)
+        : mSensor(sensor), mCallback(callback), mStop(false) {
+        mThread = std::thread([this] { run(); });
+    }
+
+    ~SensorThread() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStop = true;
+            mWaitCV.notify_all();
+        }
+        mThread.join();
+    }
+
+    SamplingStats getStats() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mStats;
+    }
+
+   private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mLock);
+        std::vector<Event> events;
+        bool firstSample = true;
+        while (!mStop) {
+            int64_t nextSampleTime = mSensor->getNextSampleTime();
+            int64_t now = SamplingScheduler::now();
+            if (nextSampleTime < 0) {
+                mWaitCV.wait(lock);
+            } else if (now < nextSampleTime) {
+                mWaitCV.wait_for(lock, std::chrono::nanoseconds(nextSampleTime - now));
+            } else {
+                if (!firstSample) {
+                    ++mStats.wakeups;
+                    mStats.totalJitterNs += now - nextSampleTime;
+                    mStats.maxJitterNs = std::max(mStats.maxJitterNs, now - nextSampleTime);
+                }
+                firstSample = false;
+                events.clear();
+                if (mSensor->sample(now, &events)) {
+                    mCallback->postBatchedEvents(events, mSensor->isWakeUpSensor());
+                } else if (!events.empty()) {
+                    mCallback->postEvents(events, mSensor->isWakeUpSensor());
+                }
+            }
+        }
+    }
+
+    Sensor* mSensor;
+    ISensorsEventCallback* mCallback;
+    std::mutex mLock;
+    std::condition_variable mWaitCV;
+    bool mStop;
+    SamplingStats mStats;
+    std::thread mThread;
+};
+
+// All the mock sensors, streaming at their fastest rate.
+std::vector<std::unique_ptr<Sensor>> createActiveSensors(ISensorsEventCallback* callback) {
+    std::vector<std::unique_ptr<Sensor>> sensors;
+    int32_t handle = 1;
+    sensors.emplace_back(new AccelSensor(handle++, callback));
+    sensors.emplace_back(new GyroSensor(handle++, callback));
+    sensors.emplace_back(new AmbientTempSensor(handle++, callback));
+    sensors.emplace_back(new DeviceTempSensor(handle++, callback));
+    sensors.emplace_back(new PressureSensor(handle++, callback));
+    sensors.emplace_back(new MagnetometerSensor(handle++, callback));
+    sensors.emplace_back(new LightSensor(handle++, callback));
+    sensors.emplace_back(new ProximitySensor(handle++, callback));
+    sensors.emplace_back(new RelativeHumiditySensor(handle++, callback));
+    for (const auto& sensor : sensors) {
+        sensor->batch(sensor->getSensorInfo().minDelay * 1000LL, 0 /* maxReportLatencyNs */);
+        sensor->activate(true);
+    }
+    return sensors;
+}
+
+void reportSamplingStats(benchmark::State& state, const SamplingStats& stats, uint64_t writes,
+                         double seconds) {
+    state.counters["wakeups_per_second"] = stats.wakeups / seconds;
+    state.counters["fmq_writes_per_second"] = writes / seconds;
+    state.counters["mean_jitter_us"] =
+            stats.wakeups != 0 ? stats.totalJitterNs / 1000.0 / stats.wakeups : 0;
+    state.counters["max_jitter_us"] = stats.maxJitterNs / 1000.0;
+}
+
+// Writes a trace of the accelerometer and the gyroscope at 400 Hz and of the magnetometer at
+// 100 Hz, interleaved.
+bool writeTrace(int fd, std::chrono::seconds duration) {
+    constexpr int64_t kPeriodNs = 2500 * 1000;  // 400 Hz
+    const int64_t sampleCount = std::chrono::nanoseconds(duration).count() / kPeriodNs;
+    std::vector<SensorTraceRecord> records;
+    for (int64_t i = 0; i < sampleCount; i++) {
+        const int64_t timestamp = i * kPeriodNs;
+        const float phase = static_cast<float>(i) / 400;
+        records.push_back({timestamp, static_cast<int32_t>(SensorType::ACCELEROMETER),
+                           {phase, 0.f, 9.81f, 0.f, 0.f}});
+        records.push_back({timestamp, static_cast<int32_t>(SensorType::GYROSCOPE),
+                           {0.f, phase, 0.f, 0.f, 0.f}});
+        if (i % 4 == 0) {
+            records.push_back({timestamp, static_cast<int32_t>(SensorType::MAGNETIC_FIELD),
+                               {20.f, -5.f, phase, 0.f, 0.f}});
+        }
+    }
+    SensorTraceHeader header = {SensorTraceHeader::kMagic, SensorTraceHeader::kVersion,
+                                records.size()};
+    return ::android::base::WriteFully(fd, &header, sizeof(header)) &&
+           ::android::base::WriteFully(fd, records.data(),
+                                       records.size() * sizeof(SensorTraceRecord));
+}
+
+}  // namespace
+
+static void BM_Sampling_ThreadPerSensor(benchmark::State& state) {
+    CountingCallback callback;
+    std::vector<std::unique_ptr<Sensor>> sensors = createActiveSensors(&callback);
+    double seconds = 0;
+    SamplingStats stats;
+    for (auto _ : state) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::vector<std::unique_ptr<SensorThread>> threads;
+            for (const auto& sensor : sensors) {
+                threads.emplace_back(new SensorThread(sensor.get(), &callback));
+            }
+            std::this_thread::sleep_for(kMeasurementDuration);
+            for (const auto& thread : threads) {
+                SamplingStats threadStats = thread->getStats();
+                stats.wakeups += threadStats.wakeups;
+                stats.totalJitterNs += threadStats.totalJitterNs;
+                stats.maxJitterNs = std::max(stats.maxJitterNs, threadStats.maxJitterNs);
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        seconds += std::chrono::duration<double>(elapsed).count();
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    reportSamplingStats(state, stats, callback.writes(), seconds);
+}
+BENCHMARK(BM_Sampling_ThreadPerSensor)->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_Sampling_Scheduler(benchmark::State& state) {
+    CountingCallback callback;
+    std::vector<std::unique_ptr<Sensor>> sensors = createActiveSensors(&callback);
+    double seconds = 0;
+    SamplingStats stats;
+    for (auto _ : state) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            SamplingScheduler scheduler(&callback);
+            for (const auto& sensor : sensors) {
+                scheduler.reschedule(sensor.get());
+            }
+            // Ignore the first samples, taken as soon as the sensors are scheduled.
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            scheduler.resetStats();
+            std::this_thread::sleep_for(kMeasurementDuration);
+            SamplingScheduler::Stats schedulerStats = scheduler.getStats();
+            stats.wakeups += schedulerStats.wakeups;
+            stats.totalJitterNs += schedulerStats.totalJitterNs;
+            stats.maxJitterNs = std::max(stats.maxJitterNs, schedulerStats.maxJitterNs);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        seconds += std::chrono::duration<double>(elapsed).count();
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    reportSamplingStats(state, stats, callback.writes(), seconds);
+}
+BENCHMARK(BM_Sampling_Scheduler)->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_Sensors_AccelGyro200Hz(benchmark::State& state) {
+    const int64_t maxReportLatencyNs = state.range(0) * 1000 * 1000;
+    sp<Sensors> sensors = new Sensors();
+    EventReader reader;
+    if (!reader.initialize(sensors)) {
+        state.SkipWithError("could not initialize the HAL");
+        return;
+    }
+    const int32_t handles[] = {findSensor(sensors, SensorType::ACCELEROMETER),
+                               findSensor(sensors, SensorType::GYROSCOPE)};
+    for (int32_t handle : handles) {
+        sensors->batch(handle, kSamplingPeriodNs, maxReportLatencyNs);
+        sensors->activate(handle, true);
+    }
+    // Let the first batch go through before measuring.
+    std::this_thread::sleep_for(std::chrono::nanoseconds(maxReportLatencyNs + kSamplingPeriodNs));
+
+    double seconds = 0;
+    uint64_t wakeups = 0;
+    uint64_t events = 0;
+    for (auto _ : state) {
+        reader.reset();
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(kMeasurementDuration);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        wakeups += reader.wakeups();
+        events += reader.events();
+        seconds += std::chrono::duration<double>(elapsed).count();
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    for (int32_t handle : handles) {
+        sensors->activate(handle, false);
+    }
+    state.counters["wakeups_per_second"] = wakeups / seconds;
+    state.counters["events_per_second"] = events / seconds;
+    state.counters["events_per_wakeup"] = wakeups != 0 ? double(events) / wakeups : 0;
+}
+// Maximum report latency in milliseconds.
+BENCHMARK(BM_Sensors_AccelGyro200Hz)
+    ->Arg(0)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Iterations(3)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_Sensors_TracePlayback(benchmark::State& state) {
+    const float speed = state.range(0);
+    TemporaryFile trace;
+    if (!writeTrace(trace.fd, std::chrono::seconds(1))) {
+        state.SkipWithError("Failed to write the trace");
+        return;
+    }
+    EventReader reader;
+    sp<Sensors> sensors = new Sensors();
+    if (!reader.initialize(sensors)) {
+        state.SkipWithError("Failed to initialize the HAL");
+        return;
+    }
+    if (!sensors->startTracePlayback(trace.path, speed)) {
+        state.SkipWithError("Failed to play the trace back");
+        return;
+    }
+    const int32_t handles[] = {findSensor(sensors, SensorType::ACCELEROMETER),
+                               findSensor(sensors, SensorType::GYROSCOPE),
+                               findSensor(sensors, SensorType::MAGNETIC_FIELD)};
+    for (int32_t handle : handles) {
+        sensors->batch(handle, 0 /* samplingPeriodNs */, 0 /* maxReportLatencyNs */);
+        sensors->activate(handle, true);
+    }
+
+    double seconds = 0;
+    uint64_t wakeups = 0;
+    uint64_t events = 0;
+    for (auto _ : state) {
+        reader.reset();
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(kMeasurementDuration);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        wakeups += reader.wakeups();
+        events += reader.events();
+        seconds += std::chrono::duration<double>(elapsed).count();
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    sensors->stopTracePlayback();
+    for (int32_t handle : handles) {
+        sensors->activate(handle, false);
+    }
+    state.counters["wakeups_per_second"] = wakeups / seconds;
+    state.counters["events_per_second"] = events / seconds;
+    state.counters["events_per_wakeup"] = wakeups != 0 ? double(events) / wakeups : 0;
+}
+// Playback speed.
+BENCHMARK(BM_Sensors_TracePlayback)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Iterations(3)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_EventPublisher_Post(benchmark::State& state) {
+    static EventPublisher* publisher;
+    static std::atomic<uint64_t> writtenEvents;
+    if (state.thread_index == 0) {
+        writtenEvents = 0;
+        publisher = new EventPublisher([](const Event* /* events */, size_t count,
+                                          size_t /* wakeUpEvents */) { writtenEvents += count; });
+    }
+    Event event;
+    event.sensorHandle = state.thread_index;
+    for (auto _ : state) {
+        publisher->post(&event, 1 /* count */, false /* wakeup */);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index == 0) {
+        EventPublisher::Stats stats = publisher->getStats();
+        state.counters["events_per_write"] =
+                stats.writes != 0 ? double(stats.events) / stats.writes : 0;
+        state.counters["full_ring_waits"] = stats.fullRingWaits;
+        delete publisher;
+    }
+}
+BENCHMARK(BM_EventPublisher_Post)->ThreadRange(1, 8)->UseRealTime();
+
+// How the HAL used to post: every producer takes the write lock to write to the Event FMQ.
+static void BM_LockedWriter_Post(benchmark::State& state) {
+    static std::mutex writeLock;
+    static std::vector<Event> written;
+    if (state.thread_index == 0) {
+        written.reserve(kEventQueueSize);
+    }
+    Event event;
+    event.sensorHandle = state.thread_index;
+    for (auto _ : state) {
+        std::lock_guard<std::mutex> lock(writeLock);
+        // Stands for the FMQ write.
+        if (written.size() == kEventQueueSize) {
+            written.clear();
+        }
+        written.push_back(event);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockedWriter_Post)->ThreadRange(1, 8)->UseRealTime();
+
+// 8 producers posting through the HAL to the framework, with or without WAKE_UP events.
+static void BM_Sensors_PostEvents(benchmark::State& state) {
+    static EventReader* reader;
+    static sp<Sensors> sensors;
+    if (state.thread_index == 0) {
+        reader = new EventReader();
+        sensors = new Sensors();
+        if (!reader->initialize(sensors)) {
+            state.SkipWithError("Failed to initialize the HAL");
+        }
+    }
+    const bool wakeup = state.range(0);
+    std::vector<Event> events(1);
+    events[0].sensorHandle = state.thread_index;
+    events[0].sensorType = SensorType::ACCELEROMETER;
+    for (auto _ : state) {
+        sensors->postEvents(events, wakeup);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index == 0) {
+        state.counters["events_per_wakeup"] =
+                reader->wakeups() != 0 ? double(reader->events()) / reader->wakeups() : 0;
+        sensors.clear();
+        delete reader;
+    }
+}
+// Whether the events are WAKE_UP events.
+BENCHMARK(BM_Sensors_PostEvents)->Arg(0)->Arg(1)->Threads(8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A direct channel client of the mock HAL, instantiated in process: it polls
+// the shared memory like an application would, validates the records and their
+// ordering, and measures the latency from sample to client.
+
+#include <gtest/gtest.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+#include <utils/SystemClock.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+
+#include "Sensors.h"
+
+using ::android::sp;
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::sensors::V1_0::SensorsEventFormatOffset;
+using ::android::hardware::sensors::V1_0::SharedMemFormat;
+using ::android::hardware::sensors::V1_0::SharedMemType;
+using ::android::hardware::sensors::V2_0::implementation::Sensors;
+
+namespace {
+
+constexpr size_t kRecordSize = static_cast<size_t>(SensorsEventFormatOffset::TOTAL_LENGTH);
+constexpr size_t kRecordCount = 1000;
+constexpr auto kMeasurementDuration = std::chrono::seconds(1);
+
+struct Record {
+    int32_t token;
+    int32_t type;
+    int64_t timestamp;
+};
+
+class DirectChannelClient {
+   public:
+    DirectChannelClient() : mSize(kRecordSize * kRecordCount), mNextOffset(0), mLastCounter(0) {
+        mFd = ashmem_create_region("DirectChannel_test", mSize);
+        mBuffer = static_cast<uint8_t*>(
+                mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0 /* offset */));
+        mNativeHandle = native_handle_create(1 /* numFds */, 0 /* numInts */);
+        mNativeHandle->data[0] = mFd;
+    }
+
+    ~DirectChannelClient() {
+        munmap(mBuffer, mSize);
+        native_handle_close(mNativeHandle);
+        native_handle_delete(mNativeHandle);
+    }
+
+    Sensors::SharedMemInfo getSharedMemInfo() const {
+        Sensors::SharedMemInfo mem;
+        mem.type = SharedMemType::ASHMEM;
+        mem.format = SharedMemFormat::SENSORS_EVENT;
+        mem.size = mSize;
+        mem.memoryHandle = hidl_handle(mNativeHandle);
+        return mem;
+    }
+
+    // Reads the records written since the last call. Fails if a record is malformed or
+    // out of order, or if records were overwritten before being read.
+    ::testing::AssertionResult read(std::vector<Record>* records) {
+        while (true) {
+            const uint8_t* slot = mBuffer + mNextOffset;
+            uint32_t counter = __atomic_load_n(
+                    reinterpret_cast<const uint32_t*>(
+                            slot + static_cast<size_t>(SensorsEventFormatOffset::ATOMIC_COUNTER)),
+                    __ATOMIC_ACQUIRE);
+            if (counter <= mLastCounter) {
+                // Not written yet, or written before the ring wrapped around.
+                return ::testing::AssertionSuccess();
+            }
+            if (counter != mLastCounter + 1) {
+                return ::testing::AssertionFailure()
+                       << "counter " << counter << " after " << mLastCounter;
+            }
+            int32_t size = *reinterpret_cast<const int32_t*>(
+                    slot + static_cast<size_t>(SensorsEventFormatOffset::SIZE_FIELD));
+            if (size != static_cast<int32_t>(kRecordSize)) {
+                return ::testing::AssertionFailure() << "record of size " << size;
+            }
+            Record record;
+            record.token = *reinterpret_cast<const int32_t*>(
+                    slot + static_cast<size_t>(SensorsEventFormatOffset::REPORT_TOKEN));
+            record.type = *reinterpret_cast<const int32_t*>(
+                    slot + static_cast<size_t>(SensorsEventFormatOffset::SENSOR_TYPE));
+            record.timestamp = *reinterpret_cast<const int64_t*>(
+                    slot + static_cast<size_t>(SensorsEventFormatOffset::TIMESTAMP));
+            records->push_back(record);
+
+            mLastCounter = counter;
+            mNextOffset += kRecordSize;
+            if (mNextOffset + kRecordSize > mSize) {
+                mNextOffset = 0;
+            }
+        }
+    }
+
+   private:
+    const size_t mSize;
+    int mFd;
+    uint8_t* mBuffer;
+    native_handle_t* mNativeHandle;
+    size_t mNextOffset;
+    uint32_t mLastCounter;
+};
+
+class DirectChannelTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        mSensors = new Sensors();
+        mSensors->getSensorsList([&](const hidl_vec<SensorInfo>& list) {
+            for (const auto& info : list) {
+                mHandles[info.type] = info.sensorHandle;
+            }
+        });
+        mSensors->registerDirectChannel(mClient.getSharedMemInfo(),
+                                        [&](Sensors::Result result, int32_t channelHandle) {
+                                            ASSERT_EQ(Sensors::Result::OK, result);
+                                            mChannelHandle = channelHandle;
+                                        });
+    }
+
+    void TearDown() override { mSensors->unregisterDirectChannel(mChannelHandle); }
+
+    int32_t configDirectReport(SensorType type, Sensors::RateLevel rate) {
+        int32_t token = -1;
+        mSensors->configDirectReport(mHandles[type], mChannelHandle, rate,
+                                     [&](Sensors::Result result, int32_t reportToken) {
+                                         EXPECT_EQ(Sensors::Result::OK, result);
+                                         token = reportToken;
+                                     });
+        return token;
+    }
+
+    // Polls the channel, validating the records, and returns the latencies from sample to
+    // client in nanoseconds.
+    std::vector<int64_t> readRecords(std::map<int32_t, size_t>* countPerToken) {
+        std::vector<int64_t> latencies;
+        std::map<int32_t, int64_t> lastTimestamps;
+        std::vector<Record> records;
+        auto end = std::chrono::steady_clock::now() + kMeasurementDuration;
+        while (std::chrono::steady_clock::now() < end) {
+            records.clear();
+            EXPECT_TRUE(mClient.read(&records));
+            int64_t now = ::android::elapsedRealtimeNano();
+            for (const auto& record : records) {
+                EXPECT_GT(record.timestamp, lastTimestamps[record.token])
+                        << "records of token " << record.token << " out of order";
+                lastTimestamps[record.token] = record.timestamp;
+                latencies.push_back(now - record.timestamp);
+                ++(*countPerToken)[record.token];
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return latencies;
+    }
+
+    sp<Sensors> mSensors;
+    DirectChannelClient mClient;
+    int32_t mChannelHandle = -1;
+    std::map<SensorType, int32_t> mHandles;
+};
+
+}  // namespace
+
+TEST_F(DirectChannelTest, GrallocIsNotSupported) {
+    Sensors::SharedMemInfo mem = mClient.getSharedMemInfo();
+    mem.type = SharedMemType::GRALLOC;
+    mSensors->registerDirectChannel(mem, [](Sensors::Result result, int32_t /* channelHandle */) {
+        EXPECT_EQ(Sensors::Result::INVALID_OPERATION, result);
+    });
+}
+
+TEST_F(DirectChannelTest, UnsupportedRateIsRejected) {
+    mSensors->configDirectReport(mHandles[SensorType::MAGNETIC_FIELD], mChannelHandle,
+                                 Sensors::RateLevel::VERY_FAST,
+                                 [](Sensors::Result result, int32_t /* reportToken */) {
+                                     EXPECT_EQ(Sensors::Result::BAD_VALUE, result);
+                                 });
+    mSensors->configDirectReport(mHandles[SensorType::LIGHT], mChannelHandle,
+                                 Sensors::RateLevel::NORMAL,
+                                 [](Sensors::Result result, int32_t /* reportToken */) {
+                                     EXPECT_EQ(Sensors::Result::BAD_VALUE, result);
+                                 });
+}
+
+TEST_F(DirectChannelTest, OrderingAndLatency) {
+    int32_t accelToken = configDirectReport(SensorType::ACCELEROMETER, Sensors::RateLevel::FAST);
+    int32_t gyroToken = configDirectReport(SensorType::GYROSCOPE, Sensors::RateLevel::NORMAL);
+    ASSERT_GT(accelToken, 0);
+    ASSERT_GT(gyroToken, 0);
+    ASSERT_NE(accelToken, gyroToken);
+
+    std::map<int32_t, size_t> countPerToken;
+    std::vector<int64_t> latencies = readRecords(&countPerToken);
+    ASSERT_FALSE(latencies.empty());
+
+    // Each rate level allows (55%, 220%] of its nominal rate.
+    const double seconds = std::chrono::duration<double>(kMeasurementDuration).count();
+    EXPECT_GT(countPerToken[accelToken], 200 * 0.55 * seconds);
+    EXPECT_LE(countPerToken[accelToken], 200 * 2.2 * seconds);
+    EXPECT_GT(countPerToken[gyroToken], 50 * 0.55 * seconds);
+    EXPECT_LE(countPerToken[gyroToken], 50 * 2.2 * seconds);
+
+    std::sort(latencies.begin(), latencies.end());
+    RecordProperty("latency_us_p50", std::to_string(latencies[latencies.size() / 2] / 1000));
+    RecordProperty("latency_us_p99", std::to_string(latencies[latencies.size() * 99 / 100] / 1000));
+    RecordProperty("latency_us_max", std::to_string(latencies.back() / 1000));
+}
+
+TEST_F(DirectChannelTest, StopEndsReports) {
+    configDirectReport(SensorType::ACCELEROMETER, Sensors::RateLevel::FAST);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // Stopping all the sensors of the channel.
+    mSensors->configDirectReport(-1 /* sensorHandle */, mChannelHandle,
+                                 Sensors::RateLevel::STOP,
+                                 [](Sensors::Result result, int32_t /* reportToken */) {
+                                     EXPECT_EQ(Sensors::Result::OK, result);
+                                 });
+
+    std::vector<Record> records;
+    ASSERT_TRUE(mClient.read(&records));
+    EXPECT_FALSE(records.empty());
+    records.clear();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(mClient.read(&records));
+    EXPECT_TRUE(records.empty());
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Concurrent producers posting through an EventPublisher: nothing must be lost,
+// duplicated or reordered, including posts larger than the staging rings.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "EventPublisher.h"
+
+using ::android::hardware::sensors::V1_0::Event;
+using ::android::hardware::sensors::V2_0::implementation::EventPublisher;
+
+namespace {
+
+constexpr int32_t kProducerCount = 8;
+constexpr int64_t kEventsPerProducer = 20000;
+
+// Records what the publisher writes. Only accessed by the publisher thread until the publisher
+// is destroyed.
+struct Writer {
+    std::vector<Event> events;
+    size_t wakeUpEvents = 0;
+    size_t writes = 0;
+
+    EventPublisher::WriteFunction function() {
+        return [this](const Event* written, size_t count, size_t wakeUp) {
+            events.insert(events.end(), written, written + count);
+            wakeUpEvents += wakeUp;
+            ++writes;
+        };
+    }
+};
+
+Event makeEvent(int32_t producer, int64_t index) {
+    Event event;
+    event.sensorHandle = producer;
+    event.timestamp = index;
+    return event;
+}
+
+}  // namespace
+
+TEST(EventPublisherTest, ConcurrentProducersKeepTheirOrder) {
+    Writer writer;
+    {
+        EventPublisher publisher(writer.function());
+        std::vector<std::thread> producers;
+        for (int32_t producer = 0; producer < kProducerCount; producer++) {
+            producers.emplace_back([&publisher, producer] {
+                std::vector<Event> events;
+                int64_t index = 0;
+                // Posts of 1 to 1000 events, some of which do not fit in a staging ring.
+                for (size_t size = 1; index < kEventsPerProducer; size = size * 7 % 1000 + 1) {
+                    events.clear();
+                    for (size_t i = 0; i < size && index < kEventsPerProducer; i++) {
+                        events.push_back(makeEvent(producer, index++));
+                    }
+                    publisher.post(events.data(), events.size(), producer % 2 == 0);
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+    }
+
+    ASSERT_EQ(static_cast<size_t>(kProducerCount * kEventsPerProducer), writer.events.size());
+    EXPECT_EQ(writer.events.size() / 2, writer.wakeUpEvents);
+    EXPECT_LT(writer.writes, writer.events.size());
+    std::map<int32_t, int64_t> nextIndex;
+    for (const auto& event : writer.events) {
+        ASSERT_EQ(nextIndex[event.sensorHandle]++, event.timestamp)
+                << "event of producer " << event.sensorHandle << " out of order";
+    }
+}
+
+TEST(EventPublisherTest, PostsAreWrittenInPostOrder) {
+    Writer writer;
+    {
+        EventPublisher publisher(writer.function());
+        for (int64_t index = 0; index < 100; index++) {
+            // Each post comes from another thread, after the previous one is staged.
+            std::async(std::launch::async, [&publisher, index] {
+                Event event = makeEvent(0 /* producer */, index);
+                publisher.post(&event, 1 /* count */, false /* wakeup */);
+            }).wait();
+        }
+    }
+
+    ASSERT_EQ(100u, writer.events.size());
+    for (int64_t index = 0; index < 100; index++) {
+        EXPECT_EQ(index, writer.events[index].timestamp);
+    }
+    EXPECT_EQ(0u, writer.wakeUpEvents);
+}
+
+TEST(EventPublisherTest, PerEventWakeUpFlags) {
+    Writer writer;
+    {
+        EventPublisher publisher(writer.function());
+        std::vector<Event> events;
+        std::vector<uint8_t> wakeup;
+        for (int64_t index = 0; index < 1000; index++) {
+            events.push_back(makeEvent(0 /* producer */, index));
+            wakeup.push_back(index % 3 == 0);
+        }
+        publisher.post(events.data(), events.size(), wakeup.data());
+    }
+
+    ASSERT_EQ(1000u, writer.events.size());
+    EXPECT_EQ(334u, writer.wakeUpEvents);
+}
+
+TEST(EventPublisherTest, RingsOfExitedThreadsAreRemoved) {
+    Writer writer;
+    {
+        EventPublisher publisher(writer.function());
+        for (int64_t index = 0; index < 100; index++) {
+            std::thread([&publisher, index] {
+                Event event = makeEvent(0 /* producer */, index);
+                publisher.post(&event, 1 /* count */, false /* wakeup */);
+            }).join();
+        }
+        // The rings are removed by the drain following the exit of their thread.
+        for (int attempt = 0; attempt < 100 && publisher.getStats().rings > 1; attempt++) {
+            Event event = makeEvent(1 /* producer */, attempt);
+            publisher.post(&event, 1 /* count */, false /* wakeup */);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_LE(publisher.getStats().rings, 1u);
+    }
+
+    for (int64_t index = 0; index < 100; index++) {
+        EXPECT_EQ(index, writer.events[index].timestamp);
+    }
+}
+
+TEST(EventPublisherTest, SteadyLoadDoesNotHoldBackWrites) {
+    std::atomic<size_t> writes(0);
+    std::atomic_bool stop(false);
+    {
+        EventPublisher publisher(
+                [&writes](const Event* /* events */, size_t /* count */, size_t) { ++writes; });
+        std::vector<std::thread> producers;
+        for (int32_t producer = 0; producer < kProducerCount; producer++) {
+            producers.emplace_back([&publisher, &stop, producer] {
+                Event event = makeEvent(producer, 0 /* index */);
+                while (!stop) {
+                    publisher.post(&event, 1 /* count */, false /* wakeup */);
+                }
+            });
+        }
+        // A drain only takes the posts numbered before it started, so writes keep coming while
+        // the producers never stop posting.
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const size_t writesBefore = writes;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_GT(writes, writesBefore + 1);
+        stop = true;
+        for (auto& producer : producers) {
+            producer.join();
+        }
+    }
+}